@@ -0,0 +1,895 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Bartleby benchmarks.
+///
+/// Generates synthetic archives and measures the time spent in each phase of
+/// Bartleby: collecting symbols, planning renames and emitting the final
+/// archive. The sizes of the final archive are measured for each rename
+/// style, and its ELF flavour can be linked into a shared object. Results are
+/// written as JSON.
+///
+/// \author thb-sb
+
+#include "Bartleby/Bartleby.h"
+#include "Bartleby/RenameMap.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/BinaryFormat/MachO.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Object/Binary.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/MachO.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace bartleby = saq::bartleby;
+
+namespace {
+
+llvm::cl::OptionCategory Cat("bartleby-benchmarks Options");
+
+/// \brief Object format of the synthetic archives.
+enum class Format { ELF, MachO, All };
+
+/// \brief Object format.
+llvm::cl::opt<Format> ObjFormat(
+    "format", llvm::cl::desc("Object format of the synthetic archives"),
+    llvm::cl::values(clEnumValN(Format::ELF, "elf", "ELF x86-64"),
+                     clEnumValN(Format::MachO, "macho", "Mach-O x86-64"),
+                     clEnumValN(Format::All, "all", "All formats")),
+    llvm::cl::init(Format::All), llvm::cl::cat(Cat));
+
+/// \brief Number of members.
+llvm::cl::opt<unsigned> Members("members",
+                                llvm::cl::desc("Number of archive members"),
+                                llvm::cl::init(256), llvm::cl::cat(Cat));
+
+/// \brief Number of symbols defined by each member.
+llvm::cl::opt<unsigned>
+    SymbolsPerMember("symbols",
+                     llvm::cl::desc("Number of symbols defined per member"),
+                     llvm::cl::init(64), llvm::cl::cat(Cat));
+
+/// \brief Length of symbol names.
+llvm::cl::opt<unsigned>
+    NameLength("name-length",
+               llvm::cl::desc("Minimum length of symbol names"),
+               llvm::cl::init(24), llvm::cl::cat(Cat));
+
+/// \brief Number of undefined references per member.
+llvm::cl::opt<unsigned> FanOut(
+    "fan-out",
+    llvm::cl::desc("Number of symbols of other members referenced per member"),
+    llvm::cl::init(16), llvm::cl::cat(Cat));
+
+/// \brief Number of iterations.
+llvm::cl::opt<unsigned> Iterations("iterations",
+                                   llvm::cl::desc("Number of iterations"),
+                                   llvm::cl::init(5), llvm::cl::cat(Cat));
+
+/// \brief Number of threads.
+llvm::cl::opt<unsigned>
+    Threads("threads",
+            llvm::cl::desc("Number of threads to use for reading and "
+                           "rewriting objects (0 uses all available threads)"),
+            llvm::cl::value_desc("N"), llvm::cl::init(1), llvm::cl::cat(Cat));
+
+/// \brief Uses the ELF fast rename path.
+llvm::cl::opt<bool> FastRename("fast-rename",
+                               llvm::cl::desc("Use the ELF fast rename path"),
+                               llvm::cl::cat(Cat));
+
+/// \brief Rename policy file.
+llvm::cl::opt<std::string> RenamePolicyFile(
+    "rename-policy",
+    llvm::cl::desc("Select the symbols to prefix using a policy file"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Renames symbols into short hashed names instead of prefixing them.
+llvm::cl::opt<bool>
+    HashNames("hash-names",
+              llvm::cl::desc("Rename symbols into short hashed names instead "
+                             "of prefixing them"),
+              llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Compiler driver linking the ELF final archives.
+llvm::cl::opt<std::string> Linker(
+    "linker",
+    llvm::cl::desc("Link the ELF final archive of each rename style into a "
+                   "shared object with this compiler driver, and time it"),
+    llvm::cl::value_desc("program"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Extra arguments given to the linker.
+llvm::cl::list<std::string>
+    LinkerArgs("linker-arg",
+               llvm::cl::desc("Extra argument given to --linker, such as "
+                              "-fuse-ld=gold"),
+               llvm::cl::value_desc("arg"), llvm::cl::cat(Cat));
+
+/// \brief Output file.
+llvm::cl::opt<std::string>
+    OutputFileName("o", llvm::cl::desc("JSON output (defaults to stdout)"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init("-"),
+                   llvm::cl::cat(Cat));
+
+/// \brief Tool name;
+constexpr llvm::StringRef ToolName = "bartleby-benchmarks";
+
+/// \brief Prefix applied to symbols.
+constexpr llvm::StringRef SymbolPrefix = "__bartleby_bench_";
+
+/// \brief Reports an error by displaying a message.
+///
+/// \param Message Message to display as an error string.
+[[noreturn]] void reportError(llvm::Twine Message) noexcept {
+  llvm::WithColor::error(llvm::errs(), ToolName) << Message << '\n';
+  llvm::errs().flush();
+  std::exit(EXIT_FAILURE);
+}
+
+/// \brief Reports an error.
+///
+/// \param E Error to report.
+[[noreturn]] void reportError(llvm::Error E) noexcept {
+  reportError(llvm::toString(std::move(E)));
+}
+
+/// \brief Returns the name of a synthetic symbol.
+///
+/// \param Member Index of the member that defines the symbol.
+/// \param Index Index of the symbol in the member.
+///
+/// \returns The name of the symbol, padded to \p NameLength.
+[[nodiscard]] std::string symbolName(const unsigned Member,
+                                     const unsigned Index) noexcept {
+  auto Name = ("sym_" + llvm::Twine(Member) + "_" + llvm::Twine(Index)).str();
+  if (Name.size() < NameLength) {
+    Name.resize(NameLength, 'x');
+  }
+  return Name;
+}
+
+/// \brief Symbols of a synthetic member.
+struct MemberSymbols {
+  /// \brief Symbols defined by the member.
+  std::vector<std::string> Defined;
+
+  /// \brief Symbols of other members referenced by the member.
+  std::vector<std::string> Undefined;
+};
+
+/// \brief Lists the symbols of a synthetic member.
+///
+/// Member \p M references the symbols defined by the next \p FanOut members,
+/// wrapping around.
+///
+/// \param M Index of the member.
+///
+/// \returns The symbols.
+[[nodiscard]] MemberSymbols memberSymbols(const unsigned M) noexcept {
+  MemberSymbols Syms;
+  Syms.Defined.reserve(SymbolsPerMember);
+  for (unsigned I = 0; I < SymbolsPerMember; ++I) {
+    Syms.Defined.push_back(symbolName(M, I));
+  }
+  if ((Members > 1) && (SymbolsPerMember > 0)) {
+    Syms.Undefined.reserve(FanOut);
+    for (unsigned I = 0; I < FanOut; ++I) {
+      const auto Target = (M + 1 + I % (Members - 1)) % Members;
+      Syms.Undefined.push_back(symbolName(Target, I % SymbolsPerMember));
+    }
+  }
+  return Syms;
+}
+
+/// \brief Writes zeros until the stream is aligned.
+///
+/// \param OS Output stream.
+/// \param Alignment Alignment.
+void align(llvm::raw_svector_ostream &OS, const uint64_t Alignment) noexcept {
+  OS.write_zeros(llvm::offsetToAlignment(OS.tell(), llvm::Align(Alignment)));
+}
+
+/// \brief Generates a synthetic ELF x86-64 relocatable object.
+///
+/// The object contains a \p .text section, a symbol table, a string table
+/// and a section header string table.
+///
+/// \param M Index of the member.
+///
+/// \returns The content of the object.
+[[nodiscard]] llvm::SmallVector<char, 0>
+generateELF(const unsigned M) noexcept {
+  namespace ELF = llvm::ELF;
+
+  const auto Syms = memberSymbols(M);
+  const uint64_t TextSize = std::max<uint64_t>(Syms.Defined.size(), 1);
+
+  llvm::SmallString<0> StrTab;
+  StrTab.push_back('\0');
+  llvm::SmallVector<uint32_t, 0> NameOffsets;
+  for (const auto *List : {&Syms.Defined, &Syms.Undefined}) {
+    for (const auto &Name : *List) {
+      NameOffsets.push_back(StrTab.size());
+      StrTab += Name;
+      StrTab.push_back('\0');
+    }
+  }
+  const llvm::StringRef ShStrTab("\0.text\0.symtab\0.strtab\0.shstrtab\0", 33);
+
+  llvm::SmallVector<char, 0> Content;
+  llvm::raw_svector_ostream OS(Content);
+  llvm::support::endian::Writer W(OS, llvm::endianness::little);
+
+  // Header, patched once the section header offset is known.
+  OS.write_zeros(sizeof(ELF::Elf64_Ehdr));
+
+  const uint64_t TextOff = OS.tell();
+  OS.write_zeros(TextSize);
+
+  align(OS, 8);
+  const uint64_t SymTabOff = OS.tell();
+  OS.write_zeros(sizeof(ELF::Elf64_Sym));
+  for (size_t I = 0; I < NameOffsets.size(); ++I) {
+    const bool Defined = I < Syms.Defined.size();
+    W.write<uint32_t>(NameOffsets[I]);
+    W.write<uint8_t>(Defined ? ((ELF::STB_GLOBAL << 4) | ELF::STT_FUNC)
+                             : ((ELF::STB_GLOBAL << 4) | ELF::STT_NOTYPE));
+    W.write<uint8_t>(ELF::STV_DEFAULT);
+    W.write<uint16_t>(Defined ? 1 : ELF::SHN_UNDEF);
+    W.write<uint64_t>(Defined ? I : 0);
+    W.write<uint64_t>(Defined ? 1 : 0);
+  }
+  const uint64_t SymTabSize = OS.tell() - SymTabOff;
+
+  const uint64_t StrTabOff = OS.tell();
+  OS << StrTab;
+  const uint64_t ShStrTabOff = OS.tell();
+  OS << ShStrTab;
+
+  align(OS, 8);
+  const uint64_t ShOff = OS.tell();
+  const auto WriteShdr = [&](uint32_t Name, uint32_t Type, uint64_t Flags,
+                             uint64_t Offset, uint64_t Size, uint32_t Link,
+                             uint32_t Info, uint64_t AddrAlign,
+                             uint64_t EntSize) {
+    W.write<uint32_t>(Name);
+    W.write<uint32_t>(Type);
+    W.write<uint64_t>(Flags);
+    W.write<uint64_t>(0);
+    W.write<uint64_t>(Offset);
+    W.write<uint64_t>(Size);
+    W.write<uint32_t>(Link);
+    W.write<uint32_t>(Info);
+    W.write<uint64_t>(AddrAlign);
+    W.write<uint64_t>(EntSize);
+  };
+  WriteShdr(0, ELF::SHT_NULL, 0, 0, 0, 0, 0, 0, 0);
+  WriteShdr(1, ELF::SHT_PROGBITS, ELF::SHF_ALLOC | ELF::SHF_EXECINSTR, TextOff,
+            TextSize, 0, 0, 16, 0);
+  WriteShdr(7, ELF::SHT_SYMTAB, 0, SymTabOff, SymTabSize, 3, 1, 8,
+            sizeof(ELF::Elf64_Sym));
+  WriteShdr(15, ELF::SHT_STRTAB, 0, StrTabOff, StrTab.size(), 0, 0, 1, 0);
+  WriteShdr(23, ELF::SHT_STRTAB, 0, ShStrTabOff, ShStrTab.size(), 0, 0, 1, 0);
+
+  llvm::SmallVector<char, sizeof(ELF::Elf64_Ehdr)> Header;
+  llvm::raw_svector_ostream HOS(Header);
+  llvm::support::endian::Writer HW(HOS, llvm::endianness::little);
+  HOS << ELF::ElfMagic;
+  HW.write<uint8_t>(ELF::ELFCLASS64);
+  HW.write<uint8_t>(ELF::ELFDATA2LSB);
+  HW.write<uint8_t>(ELF::EV_CURRENT);
+  HOS.write_zeros(ELF::EI_NIDENT - ELF::EI_OSABI);
+  HW.write<uint16_t>(ELF::ET_REL);
+  HW.write<uint16_t>(ELF::EM_X86_64);
+  HW.write<uint32_t>(ELF::EV_CURRENT);
+  HW.write<uint64_t>(0);
+  HW.write<uint64_t>(0);
+  HW.write<uint64_t>(ShOff);
+  HW.write<uint32_t>(0);
+  HW.write<uint16_t>(sizeof(ELF::Elf64_Ehdr));
+  HW.write<uint16_t>(0);
+  HW.write<uint16_t>(0);
+  HW.write<uint16_t>(sizeof(ELF::Elf64_Shdr));
+  HW.write<uint16_t>(5);
+  HW.write<uint16_t>(4);
+  std::copy(Header.begin(), Header.end(), Content.begin());
+
+  return Content;
+}
+
+/// \brief Generates a synthetic Mach-O x86-64 object.
+///
+/// The object contains a single \p __TEXT,__text section and a symbol table.
+///
+/// \param M Index of the member.
+///
+/// \returns The content of the object.
+[[nodiscard]] llvm::SmallVector<char, 0>
+generateMachO(const unsigned M) noexcept {
+  namespace MachO = llvm::MachO;
+
+  const auto Syms = memberSymbols(M);
+  const uint64_t TextSize = std::max<uint64_t>(Syms.Defined.size(), 1);
+  const uint32_t NumSyms = Syms.Defined.size() + Syms.Undefined.size();
+
+  llvm::SmallString<0> StrTab(" ");
+  StrTab.push_back('\0');
+  llvm::SmallVector<uint32_t, 0> NameOffsets;
+  for (const auto *List : {&Syms.Defined, &Syms.Undefined}) {
+    for (const auto &Name : *List) {
+      NameOffsets.push_back(StrTab.size());
+      StrTab.push_back('_');
+      StrTab += Name;
+      StrTab.push_back('\0');
+    }
+  }
+  StrTab.resize(llvm::alignTo(StrTab.size(), 8), '\0');
+
+  constexpr uint32_t SizeOfCmds = sizeof(MachO::segment_command_64) +
+                                  sizeof(MachO::section_64) +
+                                  sizeof(MachO::symtab_command);
+  constexpr uint64_t TextOff = sizeof(MachO::mach_header_64) + SizeOfCmds;
+  const uint64_t SymOff = llvm::alignTo(TextOff + TextSize, 8);
+  const uint64_t StrOff = SymOff + NumSyms * sizeof(MachO::nlist_64);
+
+  llvm::SmallVector<char, 0> Content;
+  llvm::raw_svector_ostream OS(Content);
+  llvm::support::endian::Writer W(OS, llvm::endianness::little);
+
+  const auto WriteName = [&OS](llvm::StringRef Name) {
+    OS << Name;
+    OS.write_zeros(16 - Name.size());
+  };
+
+  W.write<uint32_t>(MachO::MH_MAGIC_64);
+  W.write<uint32_t>(MachO::CPU_TYPE_X86_64);
+  W.write<uint32_t>(MachO::CPU_SUBTYPE_X86_64_ALL);
+  W.write<uint32_t>(MachO::MH_OBJECT);
+  W.write<uint32_t>(2);
+  W.write<uint32_t>(SizeOfCmds);
+  W.write<uint32_t>(MachO::MH_SUBSECTIONS_VIA_SYMBOLS);
+  W.write<uint32_t>(0);
+
+  W.write<uint32_t>(MachO::LC_SEGMENT_64);
+  W.write<uint32_t>(sizeof(MachO::segment_command_64) +
+                    sizeof(MachO::section_64));
+  WriteName("");
+  W.write<uint64_t>(0);
+  W.write<uint64_t>(TextSize);
+  W.write<uint64_t>(TextOff);
+  W.write<uint64_t>(TextSize);
+  W.write<uint32_t>(MachO::VM_PROT_READ | MachO::VM_PROT_WRITE |
+                    MachO::VM_PROT_EXECUTE);
+  W.write<uint32_t>(MachO::VM_PROT_READ | MachO::VM_PROT_WRITE |
+                    MachO::VM_PROT_EXECUTE);
+  W.write<uint32_t>(1);
+  W.write<uint32_t>(0);
+
+  WriteName("__text");
+  WriteName("__TEXT");
+  W.write<uint64_t>(0);
+  W.write<uint64_t>(TextSize);
+  W.write<uint32_t>(TextOff);
+  W.write<uint32_t>(0);
+  W.write<uint32_t>(0);
+  W.write<uint32_t>(0);
+  W.write<uint32_t>(MachO::S_ATTR_PURE_INSTRUCTIONS |
+                    MachO::S_ATTR_SOME_INSTRUCTIONS);
+  W.write<uint32_t>(0);
+  W.write<uint32_t>(0);
+  W.write<uint32_t>(0);
+
+  W.write<uint32_t>(MachO::LC_SYMTAB);
+  W.write<uint32_t>(sizeof(MachO::symtab_command));
+  W.write<uint32_t>(SymOff);
+  W.write<uint32_t>(NumSyms);
+  W.write<uint32_t>(StrOff);
+  W.write<uint32_t>(StrTab.size());
+
+  OS.write_zeros(TextSize);
+  align(OS, 8);
+
+  for (size_t I = 0; I < NameOffsets.size(); ++I) {
+    const bool Defined = I < Syms.Defined.size();
+    W.write<uint32_t>(NameOffsets[I]);
+    W.write<uint8_t>(Defined ? (MachO::N_SECT | MachO::N_EXT)
+                             : (MachO::N_UNDF | MachO::N_EXT));
+    W.write<uint8_t>(Defined ? 1 : MachO::NO_SECT);
+    W.write<uint16_t>(0);
+    W.write<uint64_t>(Defined ? I : 0);
+  }
+  OS << StrTab;
+
+  return Content;
+}
+
+/// \brief Generates a synthetic archive.
+///
+/// \param Fmt Object format.
+///
+/// \returns The content of the archive.
+[[nodiscard]] std::unique_ptr<llvm::MemoryBuffer>
+generateArchive(const Format Fmt) noexcept {
+  std::vector<std::string> Names;
+  std::vector<llvm::NewArchiveMember> ArMembers;
+  Names.reserve(Members);
+  ArMembers.reserve(Members);
+  for (unsigned M = 0; M < Members; ++M) {
+    auto Content = Fmt == Format::ELF ? generateELF(M) : generateMachO(M);
+    Names.push_back(("member_" + llvm::Twine(M) + ".o").str());
+    auto &ArMember = ArMembers.emplace_back();
+    ArMember.Buf = llvm::MemoryBuffer::getMemBufferCopy(
+        llvm::StringRef(Content.data(), Content.size()), Names.back());
+    ArMember.MemberName = Names.back();
+  }
+
+  auto ArOrErr = llvm::writeArchiveToBuffer(
+      ArMembers, llvm::SymtabWritingMode::NormalSymtab,
+      Fmt == Format::ELF ? llvm::object::Archive::K_GNU
+                         : llvm::object::Archive::K_DARWIN,
+      /*Deterministic=*/true, /*Thin=*/false);
+  if (!ArOrErr) {
+    reportError(ArOrErr.takeError());
+  }
+  return std::move(*ArOrErr);
+}
+
+/// \brief Returns the peak resident set size of the process.
+///
+/// \returns The peak RSS, in bytes.
+[[nodiscard]] uint64_t getPeakRSS() noexcept {
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return static_cast<uint64_t>(Usage.ru_maxrss);
+#else
+  return static_cast<uint64_t>(Usage.ru_maxrss) * 1024;
+#endif
+}
+
+/// \brief Measurements of a phase.
+struct Phase {
+  /// \brief Duration of each iteration, in seconds.
+  std::vector<double> Seconds;
+
+  /// \brief Peak RSS of the process at the end of the last iteration of the
+  /// phase, in bytes, including what earlier phases used.
+  uint64_t CumulativePeakRSS = 0;
+
+  /// \brief Largest increase of the peak RSS during one iteration of the
+  /// phase, in bytes.
+  ///
+  /// The peak RSS only grows, so a phase using less memory than an earlier
+  /// one does not raise it: this is a lower bound of the memory the phase
+  /// needed on top of what was already resident.
+  uint64_t PeakRSSGrowth = 0;
+
+  /// \brief Records the end of an iteration of the phase.
+  ///
+  /// \param Start Time at which the iteration started.
+  /// \param RSSAtStart Peak RSS when the iteration started, in bytes.
+  void record(const std::chrono::steady_clock::time_point Start,
+              const uint64_t RSSAtStart) noexcept {
+    Seconds.push_back(std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - Start)
+                          .count());
+    CumulativePeakRSS = getPeakRSS();
+    PeakRSSGrowth =
+        std::max(PeakRSSGrowth, CumulativePeakRSS - std::min(CumulativePeakRSS,
+                                                             RSSAtStart));
+  }
+
+  /// \brief Converts the measurements to JSON.
+  ///
+  /// \param Items Number of items processed per iteration.
+  /// \param Bytes Number of bytes processed per iteration, or 0 if not
+  /// relevant.
+  ///
+  /// \returns The JSON object.
+  [[nodiscard]] llvm::json::Object toJSON(const uint64_t Items,
+                                          const uint64_t Bytes) const noexcept {
+    auto Sorted = Seconds;
+    std::sort(Sorted.begin(), Sorted.end());
+    const auto Median = Sorted[Sorted.size() / 2];
+    llvm::json::Object Obj{
+        {"min_seconds", Sorted.front()},
+        {"median_seconds", Median},
+        {"max_seconds", Sorted.back()},
+        {"items_per_second", Median > 0 ? Items / Median : 0.},
+        {"cumulative_peak_rss_bytes",
+         static_cast<int64_t>(CumulativePeakRSS)},
+        {"peak_rss_growth_bytes", static_cast<int64_t>(PeakRSSGrowth)},
+    };
+    if (Bytes > 0) {
+      Obj["bytes_per_second"] = Median > 0 ? Bytes / Median : 0.;
+    }
+    return Obj;
+  }
+};
+
+/// \brief Returns the median of durations.
+///
+/// \param Seconds Durations, in seconds. Must not be empty.
+///
+/// \returns The median, in seconds.
+[[nodiscard]] double median(std::vector<double> Seconds) noexcept {
+  std::sort(Seconds.begin(), Seconds.end());
+  return Seconds[Seconds.size() / 2];
+}
+
+/// \brief Measures the sizes of a final archive.
+///
+/// \param Out The final archive.
+///
+/// \returns The size of the archive, of its own symbol table, and the total
+/// size of the string tables of the symbol tables of its members: the
+/// \p .strtab sections of ELF members and the string tables of Mach-O ones.
+[[nodiscard]] llvm::json::Object
+measureOutput(const llvm::MemoryBufferRef Out) noexcept {
+  auto ArOrErr = llvm::object::Archive::create(Out);
+  if (!ArOrErr) {
+    reportError(ArOrErr.takeError());
+  }
+
+  uint64_t StringTables = 0;
+  llvm::Error Err = llvm::Error::success();
+  for (const auto &Child : (*ArOrErr)->children(Err)) {
+    auto BinOrErr = Child.getAsBinary();
+    if (!BinOrErr) {
+      reportError(BinOrErr.takeError());
+    }
+    if (const auto *Obj =
+            llvm::dyn_cast<llvm::object::ELFObjectFileBase>(BinOrErr->get())) {
+      for (const auto &Sec : Obj->sections()) {
+        auto NameOrErr = Sec.getName();
+        if (!NameOrErr) {
+          reportError(NameOrErr.takeError());
+        }
+        if (*NameOrErr == ".strtab") {
+          StringTables += Sec.getSize();
+        }
+      }
+    } else if (const auto *Obj = llvm::dyn_cast<llvm::object::MachOObjectFile>(
+                   BinOrErr->get())) {
+      StringTables += Obj->getSymtabLoadCommand().strsize;
+    }
+  }
+  if (Err) {
+    reportError(std::move(Err));
+  }
+
+  return llvm::json::Object{
+      {"archive_bytes", static_cast<int64_t>(Out.getBufferSize())},
+      {"string_table_bytes", static_cast<int64_t>(StringTables)},
+      {"archive_symbol_table_bytes",
+       static_cast<int64_t>((*ArOrErr)->getSymbolTable().size())},
+  };
+}
+
+/// \brief Links a final archive into a shared object using \p Linker,
+/// \p Iterations times.
+///
+/// All the members are linked, as with \p --whole-archive.
+///
+/// \param Out The final archive.
+///
+/// \returns The link times and the size of the shared object.
+[[nodiscard]] llvm::json::Object
+linkOutput(const llvm::MemoryBufferRef Out) noexcept {
+  auto LinkerOrErr = llvm::sys::findProgramByName(Linker);
+  if (!LinkerOrErr) {
+    reportError(llvm::createFileError(Linker, LinkerOrErr.getError()));
+  }
+
+  llvm::SmallString<128> ArchivePath;
+  llvm::SmallString<128> SharedObjectPath;
+  if (const auto EC = llvm::sys::fs::createTemporaryFile("bartleby-bench", "a",
+                                                         ArchivePath)) {
+    reportError(llvm::errorCodeToError(EC));
+  }
+  if (const auto EC = llvm::sys::fs::createTemporaryFile(
+          "bartleby-bench", "so", SharedObjectPath)) {
+    reportError(llvm::errorCodeToError(EC));
+  }
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(ArchivePath, EC);
+    if (EC) {
+      reportError(llvm::createFileError(ArchivePath, EC));
+    }
+    OS << Out.getBuffer();
+  }
+
+  llvm::SmallVector<llvm::StringRef, 16> Args{*LinkerOrErr};
+  for (const auto &Arg : LinkerArgs) {
+    Args.push_back(Arg);
+  }
+  Args.append({"-shared", "-o", SharedObjectPath, "-Wl,--whole-archive",
+               ArchivePath, "-Wl,--no-whole-archive"});
+  // The standard output of the linker would mix with the results.
+  const std::optional<llvm::StringRef> Redirects[] = {
+      std::nullopt, llvm::StringRef(""), std::nullopt};
+
+  std::vector<double> Seconds;
+  for (unsigned It = 0; It < Iterations; ++It) {
+    std::string ErrMsg;
+    const auto Start = std::chrono::steady_clock::now();
+    const int RC = llvm::sys::ExecuteAndWait(*LinkerOrErr, Args,
+                                             /*Env=*/std::nullopt, Redirects,
+                                             /*SecondsToWait=*/0,
+                                             /*MemoryLimit=*/0, &ErrMsg);
+    Seconds.push_back(std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - Start)
+                          .count());
+    if (RC != 0) {
+      reportError("link failed" + (ErrMsg.empty() ? "" : ": " + ErrMsg));
+    }
+  }
+
+  uint64_t SharedObjectSize = 0;
+  if (const auto EC =
+          llvm::sys::fs::file_size(SharedObjectPath, SharedObjectSize)) {
+    reportError(llvm::createFileError(SharedObjectPath, EC));
+  }
+  llvm::sys::fs::remove(ArchivePath);
+  llvm::sys::fs::remove(SharedObjectPath);
+
+  return llvm::json::Object{
+      {"median_seconds", median(std::move(Seconds))},
+      {"shared_object_bytes", static_cast<int64_t>(SharedObjectSize)},
+  };
+}
+
+/// \brief Runs the benchmark on one object format.
+///
+/// \param Fmt Object format.
+///
+/// \returns The results.
+[[nodiscard]] llvm::json::Object run(const Format Fmt) noexcept {
+  using Clock = std::chrono::steady_clock;
+
+  const auto Input = generateArchive(Fmt);
+  std::optional<bartleby::RenamePolicy> Policy;
+  if (!RenamePolicyFile.empty()) {
+    auto PolicyOrErr = bartleby::RenamePolicy::load(RenamePolicyFile);
+    if (!PolicyOrErr) {
+      reportError(PolicyOrErr.takeError());
+    }
+    Policy.emplace(std::move(*PolicyOrErr));
+  }
+
+  // Returns a binary borrowing the synthetic archive.
+  const auto OpenInput = [&Input] {
+    auto Buf = llvm::MemoryBuffer::getMemBuffer(Input->getMemBufferRef(),
+                                                /*RequiresNullTerminator=*/
+                                                false);
+    auto BinOrErr = llvm::object::createBinary(Buf->getMemBufferRef());
+    if (!BinOrErr) {
+      reportError(BinOrErr.takeError());
+    }
+    return llvm::object::OwningBinary<llvm::object::Binary>(
+        std::move(*BinOrErr), std::move(Buf));
+  };
+
+  // Renames the symbols in a given style, and returns how many were renamed.
+  const auto Rename = [&Policy](bartleby::Bartleby &B,
+                                const bartleby::RenameStyle Style) {
+    if (Policy) {
+      return B.applyRenamePolicy(*Policy, SymbolPrefix, Threads, Style);
+    }
+    if (Style == bartleby::RenameStyle::Hash) {
+      return B.hashGlobalAndDefinedSymbols(SymbolPrefix);
+    }
+    return B.prefixGlobalAndDefinedSymbols(SymbolPrefix);
+  };
+
+  Phase Add, Prefix, Lookup, Build;
+  uint64_t NumSymbols = 0;
+  uint64_t NumPrefixed = 0;
+  uint64_t NameBytes = 0;
+  uint64_t OutputSize = 0;
+
+  for (unsigned It = 0; It < Iterations; ++It) {
+    auto Bin = OpenInput();
+
+    bartleby::Bartleby B;
+    auto RSS = getPeakRSS();
+    auto Start = Clock::now();
+    if (auto Err = B.addBinaries(Bin, Threads)) {
+      reportError(std::move(Err));
+    }
+    Add.record(Start, RSS);
+    NumSymbols = B.getSymbols().size();
+
+    RSS = getPeakRSS();
+    Start = Clock::now();
+    NumPrefixed = Rename(B, HashNames ? bartleby::RenameStyle::Hash
+                                      : bartleby::RenameStyle::Prefix);
+    Prefix.record(Start, RSS);
+
+    // Size of the names once renamed, which is what the string tables of the
+    // output hold.
+    NameBytes = 0;
+    llvm::SmallString<64> Storage;
+    for (const auto &Entry : B.getSymbols()) {
+      const auto Name = Entry.first();
+      NameBytes +=
+          Entry.getValue().getNewName(Name, Storage).value_or(Name).size();
+    }
+
+    // Looks every renamed symbol up in the binary rename map, as
+    // bartleby-symbolize does.
+    std::string MapContent;
+    llvm::raw_string_ostream MapOS(MapContent);
+    if (auto Err = B.writeBinaryRenameMap(MapOS)) {
+      reportError(std::move(Err));
+    }
+    MapOS.flush();
+    auto MapOrErr = bartleby::RenameMap::create(
+        llvm::MemoryBufferRef(MapContent, "rename-map"));
+    if (!MapOrErr) {
+      reportError(MapOrErr.takeError());
+    }
+    std::vector<std::string> NewNames;
+    for (const auto &Entry : B.getSymbols()) {
+      if (const auto NewName =
+              Entry.getValue().getNewName(Entry.first(), Storage)) {
+        NewNames.push_back(NewName->str());
+      }
+    }
+    RSS = getPeakRSS();
+    Start = Clock::now();
+    size_t Found = 0;
+    for (const auto &NewName : NewNames) {
+      Found += MapOrErr->lookup(NewName,
+                                bartleby::RenameMap::Direction::ToOriginal)
+                   .has_value();
+    }
+    Lookup.record(Start, RSS);
+    if (Found != MapOrErr->size()) {
+      reportError("rename map lookups failed");
+    }
+
+    bartleby::BuildOptions Options;
+    Options.Threads = Threads;
+    Options.FastRename = FastRename;
+    RSS = getPeakRSS();
+    Start = Clock::now();
+    auto OutOrErr =
+        bartleby::Bartleby::buildFinalArchive(std::move(B), Options);
+    if (!OutOrErr) {
+      reportError(OutOrErr.takeError());
+    }
+    Build.record(Start, RSS);
+    OutputSize = (*OutOrErr)->getBufferSize();
+  }
+
+  // The final archive of each rename style, out of the timed iterations.
+  llvm::json::Object Styles;
+  for (const auto Style :
+       {bartleby::RenameStyle::Prefix, bartleby::RenameStyle::Hash}) {
+    auto Bin = OpenInput();
+    bartleby::Bartleby B;
+    if (auto Err = B.addBinaries(Bin, Threads)) {
+      reportError(std::move(Err));
+    }
+    (void)Rename(B, Style);
+    bartleby::BuildOptions Options;
+    Options.Threads = Threads;
+    Options.FastRename = FastRename;
+    auto OutOrErr =
+        bartleby::Bartleby::buildFinalArchive(std::move(B), Options);
+    if (!OutOrErr) {
+      reportError(OutOrErr.takeError());
+    }
+
+    auto Sizes = measureOutput((*OutOrErr)->getMemBufferRef());
+    if (!Linker.empty() && (Fmt == Format::ELF)) {
+      Sizes["link"] = linkOutput((*OutOrErr)->getMemBufferRef());
+    }
+    Styles[Style == bartleby::RenameStyle::Hash ? "hash" : "prefix"] =
+        std::move(Sizes);
+  }
+
+  const uint64_t InputSize = Input->getBufferSize();
+  return llvm::json::Object{
+      {"format", Fmt == Format::ELF ? "elf" : "macho"},
+      {"input_bytes", static_cast<int64_t>(InputSize)},
+      {"output_bytes", static_cast<int64_t>(OutputSize)},
+      {"symbols", static_cast<int64_t>(NumSymbols)},
+      {"prefixed_symbols", static_cast<int64_t>(NumPrefixed)},
+      {"symbol_name_bytes", static_cast<int64_t>(NameBytes)},
+      {"rename_styles", std::move(Styles)},
+      {"phases",
+       llvm::json::Object{
+           {"add_binary", Add.toJSON(Members, InputSize)},
+           {"prefix_symbols", Prefix.toJSON(NumSymbols, 0)},
+           {"rename_map_lookup", Lookup.toJSON(NumPrefixed, 0)},
+           {"build_final_archive", Build.toJSON(Members, OutputSize)},
+       }},
+      {"peak_rss_bytes", static_cast<int64_t>(getPeakRSS())},
+  };
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  llvm::cl::HideUnrelatedOptions(Cat);
+  llvm::cl::ParseCommandLineOptions(
+      argc, argv, "Benchmark Bartleby on synthetic archives");
+
+  if ((Members == 0) || (Iterations == 0)) {
+    reportError("--members and --iterations must be greater than 0");
+  }
+
+  llvm::json::Array Results;
+  for (const auto Fmt : {Format::ELF, Format::MachO}) {
+    if ((ObjFormat == Format::All) || (ObjFormat == Fmt)) {
+      Results.push_back(run(Fmt));
+    }
+  }
+
+  llvm::json::Value Report = llvm::json::Object{
+      {"config",
+       llvm::json::Object{
+           {"members", static_cast<int64_t>(Members)},
+           {"symbols_per_member", static_cast<int64_t>(SymbolsPerMember)},
+           {"name_length", static_cast<int64_t>(NameLength)},
+           {"fan_out", static_cast<int64_t>(FanOut)},
+           {"iterations", static_cast<int64_t>(Iterations)},
+           {"threads", static_cast<int64_t>(Threads)},
+           {"fast_rename", FastRename.getValue()},
+           {"rename_policy", RenamePolicyFile.getValue()},
+           {"hash_names", HashNames.getValue()},
+           {"linker", Linker.getValue()},
+       }},
+      {"results", std::move(Results)},
+  };
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(OutputFileName, EC);
+  if (EC) {
+    reportError(llvm::createFileError(OutputFileName, EC));
+  }
+  OS << llvm::formatv("{0:2}", Report) << '\n';
+
+  return EXIT_SUCCESS;
+}
@@ -15,6 +15,7 @@
 #ifndef SAQ_BARTLEBY_H
 #define SAQ_BARTLEBY_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #if (defined(__clang__) || (_GNUC__ >= 4))
@@ -36,6 +37,9 @@ extern "C" {
 /** \brief A Bartleby handle. */
 struct BartlebyHandle;
 
+/** \brief Timings and counters about the phases of Bartleby. */
+struct BartlebyStatistics;
+
 /** \brief Allocates a new Bartleby handle.
  *
  * \returns A new Bartleby handle, or NULL if an error occurred. */
@@ -55,6 +59,80 @@ SAQ_BARTLEBY_API void saq_bartleby_free(struct BartlebyHandle *bh);
 SAQ_BARTLEBY_API int saq_bartleby_set_prefix(struct BartlebyHandle *bh,
                                              const char *prefix);
 
+/** \brief Applies a prefix to the symbols selected by a rename policy.
+ *
+ * The policy uses the format of the `--rename-policy` file of the
+ * `bartleby` tool.
+ *
+ * \param bh Bartleby handle.
+ * \param prefix Prefix to apply.
+ * \param policy Content of the policy.
+ * \param n Size of `policy`.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_set_prefix_with_policy(
+    struct BartlebyHandle *bh, const char *prefix, const char *policy,
+    size_t n);
+
+/** \brief Renames all global and defined symbols into short hashed names.
+ *
+ * Each symbol is renamed into `prefix` followed by a short hash of its name.
+ * See `--hash-names` of the `bartleby` tool.
+ *
+ * \param bh Bartleby handle.
+ * \param prefix Prefix to apply.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_set_hashed_names(struct BartlebyHandle *bh,
+                                                   const char *prefix);
+
+/** \brief Sets an approximate memory budget.
+ *
+ * Must be called before adding binaries. See `--max-memory` of the
+ * `bartleby` tool.
+ *
+ * \param bh Bartleby handle.
+ * \param bytes Budget in bytes, or 0 for no budget.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_set_memory_budget(struct BartlebyHandle *bh,
+                                                    uint64_t bytes);
+
+/** \brief How identical input members are handled. */
+enum BartlebyDuplicateMembers {
+  /** \brief Every member is processed and emitted. */
+  SAQ_BARTLEBY_DUPLICATES_KEEP = 0,
+
+  /** \brief Identical members are processed once, every copy is emitted. */
+  SAQ_BARTLEBY_DUPLICATES_SHARE = 1,
+
+  /** \brief Identical members are processed and emitted once. */
+  SAQ_BARTLEBY_DUPLICATES_COLLAPSE = 2,
+};
+
+/** \brief Sets how identical input members are handled.
+ *
+ * Must be called before adding binaries. See `--duplicate-members` of the
+ * `bartleby` tool.
+ *
+ * \param bh Bartleby handle.
+ * \param mode How identical members are handled, see
+ *             `BartlebyDuplicateMembers`.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int
+saq_bartleby_set_duplicate_members(struct BartlebyHandle *bh, int mode);
+
+/** \brief Returns the number of input members found identical to a member
+ * added before them.
+ *
+ * \param bh Bartleby handle.
+ * \param[out] n Number of duplicates.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_get_num_duplicates(struct BartlebyHandle *bh,
+                                                     size_t *n);
+
 /** \brief Adds a new binary to Bartleby.
  *
  * \param bh Bartleby handle.
@@ -67,6 +145,21 @@ SAQ_BARTLEBY_API int saq_bartleby_set_prefix(struct BartlebyHandle *bh,
 SAQ_BARTLEBY_API int saq_bartleby_add_binary(struct BartlebyHandle *bh,
                                              const void *s, const size_t n);
 
+/** \brief Adds a new binary to Bartleby without copying it.
+ *
+ * \param bh Bartleby handle.
+ * \param s Buffer containing the binary. It can be an object or an archive.
+ * \param n Size of `s`.
+ *
+ * Buffer `s` is borrowed, not copied. It must remain valid and unmodified
+ * until the handle is either freed using `saq_bartleby_free` or consumed by
+ * `saq_bartleby_build_archive`.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_add_binary_borrowed(struct BartlebyHandle *bh,
+                                                      const void *s,
+                                                      const size_t n);
+
 /** \brief Builds the final archive and writes its content to a buffer.
  *
  * \warning This function consumes the input Bartleby handle. Thus, users
@@ -81,6 +174,205 @@ SAQ_BARTLEBY_API int saq_bartleby_add_binary(struct BartlebyHandle *bh,
 SAQ_BARTLEBY_API int saq_bartleby_build_archive(struct BartlebyHandle *bh,
                                                 void **s, size_t *n);
 
+/** \brief Callback receiving the content of an archive.
+ *
+ * \param ctx User context, as given to `saq_bartleby_build_archive_to_writer`.
+ * \param s Bytes to write.
+ * \param n Number of bytes to write. All of them must be consumed.
+ *
+ * \returns 0 on success, else an error code. */
+typedef int (*saq_bartleby_write_fn)(void *ctx, const void *s, size_t n);
+
+/** \brief Builds the final archive and writes its content to a file
+ * descriptor.
+ *
+ * The archive is written as it is produced, without building it in memory
+ * first. The file descriptor is neither rewound nor closed.
+ *
+ * \warning This function consumes the input Bartleby handle. Thus, users
+ *          must not call `saq_bartleby_free` after calling
+ * `saq_bartleby_build_archive_to_fd`.
+ *
+ * \param bh Bartleby handle.
+ * \param fd Destination file descriptor, open for writing.
+ *
+ * \return 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_build_archive_to_fd(struct BartlebyHandle *bh,
+                                                      int fd);
+
+/** \brief Builds the final archive and passes its content to a callback.
+ *
+ * The archive is written as it is produced, without building it in memory
+ * first. `write` is called several times, with consecutive chunks of the
+ * archive. If `write` fails, it is not called anymore, and its error code is
+ * returned.
+ *
+ * \warning This function consumes the input Bartleby handle. Thus, users
+ *          must not call `saq_bartleby_free` after calling
+ * `saq_bartleby_build_archive_to_writer`.
+ *
+ * \param bh Bartleby handle.
+ * \param write Callback receiving the content of the archive.
+ * \param ctx User context given to `write`.
+ *
+ * \return 0 on success, else an error code. */
+SAQ_BARTLEBY_API int
+saq_bartleby_build_archive_to_writer(struct BartlebyHandle *bh,
+                                     saq_bartleby_write_fn write, void *ctx);
+
+/** \brief Binding of a symbol in an object. */
+enum BartlebyBinding {
+  /** \brief The symbol is local to the object. */
+  SAQ_BARTLEBY_BINDING_LOCAL = 0,
+
+  /** \brief The symbol is global. */
+  SAQ_BARTLEBY_BINDING_GLOBAL = 1,
+
+  /** \brief The symbol is weak. */
+  SAQ_BARTLEBY_BINDING_WEAK = 2,
+};
+
+/** \brief An occurrence of a symbol in an object. */
+struct BartlebyOccurrence {
+  /** \brief Index of the object, in the order the objects were added. */
+  uint32_t object;
+
+  /** \brief 1 if the object defines the symbol, 0 if it references it. */
+  uint8_t defined;
+
+  /** \brief Binding of the symbol in the object, see `BartlebyBinding`. */
+  uint8_t binding;
+};
+
+/** \brief Format of a dependency graph. */
+enum BartlebyGraphFormat {
+  /** \brief Compact binary format. */
+  SAQ_BARTLEBY_GRAPH_BINARY = 0,
+
+  /** \brief Graphviz DOT. */
+  SAQ_BARTLEBY_GRAPH_DOT = 1,
+
+  /** \brief JSON. */
+  SAQ_BARTLEBY_GRAPH_JSON = 2,
+};
+
+/** \brief Returns the number of objects in a Bartleby handle.
+ *
+ * \param bh Bartleby handle.
+ * \param[out] n Number of objects, archive members included.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_get_num_objects(struct BartlebyHandle *bh,
+                                                  size_t *n);
+
+/** \brief Returns the name of an object.
+ *
+ * \param bh Bartleby handle.
+ * \param object Index of the object.
+ * \param[out] s Name of the object. It is NUL-terminated, and must be freed
+ *                using `free`.
+ * \param[out] n Size of `s`, not including the NUL terminator.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_get_object_name(struct BartlebyHandle *bh,
+                                                  size_t object, char **s,
+                                                  size_t *n);
+
+/** \brief Returns the occurrences of a symbol in the objects.
+ *
+ * Occurrences are ordered by object. An unknown symbol has none.
+ *
+ * \param bh Bartleby handle.
+ * \param name Name of the symbol.
+ * \param[out] occurrences Occurrences. It must be freed using `free`. It is
+ *                          NULL if there is no occurrence.
+ * \param[out] n Number of occurrences.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int
+saq_bartleby_get_occurrences(struct BartlebyHandle *bh, const char *name,
+                             struct BartlebyOccurrence **occurrences,
+                             size_t *n);
+
+/** \brief Writes the dependency graph of the objects.
+ *
+ * An object depends on another one if it references a symbol that the other
+ * one defines with a global or weak binding.
+ *
+ * \param bh Bartleby handle.
+ * \param format Format of the graph, see `BartlebyGraphFormat`.
+ * \param write Callback receiving the graph.
+ * \param ctx User context given to `write`.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int
+saq_bartleby_write_dependency_graph(struct BartlebyHandle *bh, int format,
+                                    saq_bartleby_write_fn write, void *ctx);
+
+/** \brief Writes the map of the renamed symbols.
+ *
+ * Each renamed symbol is written on its own line, as its new name and its
+ * original name separated by a tab. Lines are sorted by new name.
+ *
+ * \param bh Bartleby handle.
+ * \param write Callback receiving the map.
+ * \param ctx User context given to `write`.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int saq_bartleby_write_rename_map(struct BartlebyHandle *bh,
+                                                   saq_bartleby_write_fn write,
+                                                   void *ctx);
+
+/** \brief Allocates new, empty statistics.
+ *
+ * \returns New statistics, or NULL if an error occurred. */
+SAQ_BARTLEBY_API struct BartlebyStatistics *saq_bartleby_statistics_new(void);
+
+/** \brief Frees statistics.
+ *
+ * \param stats Statistics to free. A NULL value here is allowed. */
+SAQ_BARTLEBY_API void
+saq_bartleby_statistics_free(struct BartlebyStatistics *stats);
+
+/** \brief Attaches statistics to a Bartleby handle.
+ *
+ * Timings and counters of the operations performed on the handle afterwards,
+ * including `saq_bartleby_build_archive`, are recorded into `stats`.
+ * `stats` must not be freed before the handle is either freed using
+ * `saq_bartleby_free` or consumed by `saq_bartleby_build_archive`.
+ *
+ * \param bh Bartleby handle.
+ * \param stats Statistics. A NULL value detaches the current ones.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int
+saq_bartleby_set_statistics(struct BartlebyHandle *bh,
+                            struct BartlebyStatistics *stats);
+
+/** \brief Serializes statistics to JSON.
+ *
+ * \param stats Statistics.
+ * \param[out] s Destination buffer. It is NUL-terminated, and must be freed
+ *                using `free`.
+ * \param[out] n Size of `s`, not including the NUL terminator.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int
+saq_bartleby_statistics_to_json(const struct BartlebyStatistics *stats,
+                                char **s, size_t *n);
+
+/** \brief Formats statistics as a human-readable report.
+ *
+ * \param stats Statistics.
+ * \param[out] s Destination buffer. It is NUL-terminated, and must be freed
+ *                using `free`.
+ * \param[out] n Size of `s`, not including the NUL terminator.
+ *
+ * \returns 0 on success, else an error code. */
+SAQ_BARTLEBY_API int
+saq_bartleby_statistics_report(const struct BartlebyStatistics *stats,
+                               char **s, size_t *n);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
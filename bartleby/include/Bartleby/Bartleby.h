@@ -20,15 +20,28 @@
 
 #pragma once
 
+#include "Bartleby/InputCache.h"
+#include "Bartleby/OccurrenceIndex.h"
+#include "Bartleby/RenameMap.h"
+#include "Bartleby/RenamePolicy.h"
+#include "Bartleby/Statistics.h"
 #include "Bartleby/Symbol.h"
+#include "Bartleby/SymbolMap.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
-#include "llvm/ADT/StringMap.h"
 #include "llvm/Object/Binary.h"
+#include "llvm/Support/MemoryBufferRef.h"
+#include "llvm/Support/ThreadPool.h"
 
+#include <optional>
+#include <string>
 #include <unordered_set>
+#include <utility>
 #include <variant>
+#include <vector>
 
 namespace saq::bartleby {
 
@@ -82,11 +95,133 @@ struct ObjectFormat {
   };
 };
 
+/// \brief How renamed symbols get their new name.
+enum class RenameStyle : uint8_t {
+  /// \brief The prefix is prepended to the name.
+  Prefix = 0,
+
+  /// \brief The name is replaced by the prefix followed by a short base-62
+  /// hash of the name. See \p Bartleby::hashGlobalAndDefinedSymbols.
+  Hash,
+};
+
+/// \brief How identical input members are handled. See
+/// \p Bartleby::setDuplicateMembers.
+enum class DuplicateMembers : uint8_t {
+  /// \brief Every member is processed and emitted.
+  Keep = 0,
+
+  /// \brief Identical members are processed once, and every copy is emitted.
+  Share,
+
+  /// \brief Identical members are processed and emitted once.
+  Collapse,
+};
+
+/// \brief A member found identical to a member added before it.
+struct DuplicateMember {
+  /// \brief Its name.
+  std::string Name;
+
+  /// \brief Name of the input binary it comes from.
+  std::string Input;
+
+  /// \brief Name of the member it is identical to.
+  std::string OriginalName;
+
+  /// \brief Name of the input binary that member comes from.
+  std::string OriginalInput;
+
+  /// \brief Size of its content, in bytes.
+  uint64_t Size;
+};
+
+/// \brief Options for building the final archive.
+struct BuildOptions {
+  /// \brief Number of threads to use for rewriting objects.
+  ///
+  /// A value of 1 rewrites the objects serially on the calling thread. A value
+  /// of 0 uses all the available hardware threads.
+  /// The output does not depend on this value.
+  unsigned Threads = 1;
+
+  /// \brief Renames symbols of ELF relocatable objects by rewriting their
+  /// string table only, instead of going through \p objcopy.
+  ///
+  /// Objects that are not supported by this fast path still go through
+  /// \p objcopy.
+  bool FastRename = false;
+
+  /// \brief Writes each rewritten object to a temporary file as soon as it is
+  /// produced, instead of keeping it in memory.
+  ///
+  /// Temporary files are removed right away and their content is mapped
+  /// back read-only, so that the archive is written from these mappings in a
+  /// final pass. Members found in the rewrite cache or reused from a
+  /// previous build are mapped from their file. Peak memory is then bounded
+  /// by the objects being rewritten, rather than by the whole archive.
+  bool StreamMembers = false;
+
+  /// \brief Directory where temporary files are created.
+  ///
+  /// If empty, the system temporary directory is used.
+  std::string TemporaryDirectory;
+
+  /// \brief Directory of the rewrite cache.
+  ///
+  /// Rewritten objects are stored there, keyed by a digest of their original
+  /// content and of the renames that apply to them, so that objects which
+  /// did not change since a previous build are not rewritten again.
+  /// If empty, no cache is used.
+  std::string CacheDirectory;
+
+  /// \brief Pruning policy of the rewrite cache.
+  ///
+  /// The format is the one accepted by \p llvm::parseCachePruningPolicy,
+  /// e.g. `prune_after=24h:cache_size_bytes=1g`. If empty, the default
+  /// policy is used.
+  std::string CachePolicy;
+
+  /// \brief Path to the manifest of an incremental build.
+  ///
+  /// If set, the manifest of the previous build is read from there, and the
+  /// members of the previous output archive whose original object and
+  /// applied renames did not change are copied from it instead of being
+  /// rewritten. The manifest is then replaced by the one of the new build.
+  /// A missing or outdated manifest results in a full build. Fat Mach-O
+  /// archives are always fully built, and no manifest is written for them.
+  /// If empty, the build is not incremental.
+  std::string ManifestPath;
+
+  /// \brief Path to the output archive of the previous build.
+  ///
+  /// Only used if \p ManifestPath is set. If empty, the output file is used
+  /// when building to a file, and no member is reused otherwise.
+  std::string PreviousArchivePath;
+
+  /// \brief Directory where the members of a thin archive are written.
+  ///
+  /// If set, each rewritten object is written to its own file in this
+  /// directory, and the output is a GNU thin archive referencing these files
+  /// instead of containing them. Files whose content did not change are left
+  /// untouched, so that they can be hard-linked or reused by later builds.
+  /// Members are referenced by a path relative to the archive when building
+  /// to a file, and by an absolute path otherwise. Thin archives cannot be
+  /// built out of Mach-O objects.
+  /// If empty, a regular archive is built.
+  std::string ThinMembersDirectory;
+
+  /// \brief Where to record statistics about the build, if not null.
+  ///
+  /// If null, the statistics attached to the handle, if any, are used.
+  Statistics *Stats = nullptr;
+};
+
 /// \brief Bartleby handle.
 class Bartleby {
 public:
   /// \brief Symbol map type.
-  using SymbolMap = llvm::StringMap<Symbol>;
+  using SymbolMap = saq::bartleby::SymbolMap;
 
   /// \brief Constructs an empty Bartleby handle.
   Bartleby() noexcept;
@@ -97,19 +232,178 @@ public:
   Bartleby &operator=(Bartleby &&) noexcept = default;
   ~Bartleby() noexcept = default;
 
+  /// \brief Opens a binary by mapping its file read-only into memory.
+  ///
+  /// The whole file is mapped, regardless of its size, and its content is
+  /// never copied afterwards, including for archive members.
+  ///
+  /// \param Path Path to the binary.
+  ///
+  /// \returns The binary, or an error.
+  [[nodiscard]] static llvm::Expected<
+      llvm::object::OwningBinary<llvm::object::Binary>>
+  openBinary(llvm::StringRef Path) noexcept;
+
   /// \brief Adds a new binary to Bartleby.
   ///
   /// \param[in] Binary Binary.
   ///
-  /// \returns An error.
+  /// \returns An error, which names the binary if it has a name, as a
+  /// \p llvm::FileError.
   [[nodiscard]] llvm::Error
   addBinary(llvm::object::OwningBinary<llvm::object::Binary> Binary) noexcept;
 
+  /// \brief Adds several binaries to Bartleby.
+  ///
+  /// This is equivalent to calling \p addBinary on each binary in order, but
+  /// archive members are parsed and their symbols are collected on several
+  /// threads. Each object gets its own symbol map, which is then merged into
+  /// the handle in the input order, so the result does not depend on
+  /// scheduling.
+  ///
+  /// Fat Mach-O binaries are added on the calling thread.
+  ///
+  /// \param[in] Binaries Binaries. They are moved into the handle.
+  /// \param Threads Number of threads to use. A value of 0 uses all the
+  /// available hardware threads.
+  ///
+  /// \returns An error, which names the faulty binary if it has a name,
+  /// as a \p llvm::FileError. If an error occurred, binaries preceding the
+  /// faulty one have been added.
+  [[nodiscard]] llvm::Error addBinaries(
+      llvm::MutableArrayRef<llvm::object::OwningBinary<llvm::object::Binary>>
+          Binaries,
+      unsigned Threads = 0) noexcept;
+
+  /// \brief Attaches statistics to the handle.
+  ///
+  /// Timings and counters of the following operations are recorded into
+  /// \p Stats, which must outlive the handle.
+  ///
+  /// \param Stats Statistics. A null value detaches the current ones.
+  void setStatistics(Statistics *Stats) noexcept { this->Stats = Stats; }
+
+  /// \brief Returns the statistics attached to the handle.
+  ///
+  /// \returns The statistics, or null.
+  [[nodiscard]] Statistics *getStatistics() const noexcept { return Stats; }
+
+  /// \brief Attaches an input cache to the handle.
+  ///
+  /// Symbols of binaries opened through \p Cache are only collected the
+  /// first time they are added to a handle using that cache. \p Cache must
+  /// outlive the handle.
+  ///
+  /// \param Cache Input cache. A null value detaches the current one.
+  void setInputCache(InputCache *Cache) noexcept { this->Cache = Cache; }
+
+  /// \brief Attaches a thread pool to the handle.
+  ///
+  /// Operations using more than one thread run their tasks on \p Pool
+  /// instead of creating a pool of their own. Since they wait for all the
+  /// tasks of the pool, it must not be used by anything else in the
+  /// meantime, e.g. by another handle. \p Pool must outlive the handle.
+  ///
+  /// \param Pool Thread pool. A null value detaches the current one.
+  void setThreadPool(llvm::ThreadPool *Pool) noexcept { this->Pool = Pool; }
+
+  /// \brief Sets a memory budget.
+  ///
+  /// Under a budget, archive members added by \p addBinaries are released
+  /// once their symbols are collected, and parsed again when they are
+  /// rewritten. Then, when building the final archive, final members are
+  /// kept off the heap as with \p BuildOptions::StreamMembers, whether they
+  /// are rewritten, found in the rewrite cache or reused from a previous
+  /// build, and objects are only rewritten concurrently as long as their
+  /// estimated footprint fits in the budget. An object that does not fit on
+  /// its own is rewritten alone. Members of fat Mach-O binaries are not
+  /// released.
+  ///
+  /// It must be set before binaries are added.
+  ///
+  /// \param Bytes Budget, in bytes. A value of 0 means no budget.
+  void setMemoryBudget(uint64_t Bytes) noexcept { MemoryBudget = Bytes; }
+
+  /// \brief Sets how identical input members are handled.
+  ///
+  /// Unless \p Mode is \p DuplicateMembers::Keep, the content of each object
+  /// added by \p addBinaries is hashed using xxHash64, and an object whose
+  /// content is identical to the one of an object added before it is
+  /// neither parsed nor scanned: its symbols are taken from that object.
+  /// With \p DuplicateMembers::Share, it is still emitted, sharing the final
+  /// object of the original one, which is rewritten once. With
+  /// \p DuplicateMembers::Collapse, it is dropped. Duplicates are reported
+  /// by \p getDuplicates. Members of fat Mach-O binaries are not
+  /// deduplicated.
+  ///
+  /// With an input cache attached, duplicates are still scanned the first
+  /// time their binary is added, so that the cache stays complete.
+  ///
+  /// It must be set before binaries are added.
+  ///
+  /// \param Mode How identical members are handled.
+  void setDuplicateMembers(DuplicateMembers Mode) noexcept {
+    DuplicatesMode = Mode;
+  }
+
+  /// \brief Returns the members found identical to a member added before
+  /// them.
+  ///
+  /// \returns The duplicates, in the order they were added.
+  [[nodiscard]] llvm::ArrayRef<DuplicateMember> getDuplicates() const noexcept {
+    return Duplicates;
+  }
+
   /// \brief Gets a const reference to the map of symbols.
   ///
   /// \returns The map of symbols.
   [[nodiscard]] const SymbolMap &getSymbols() const noexcept { return Symbols; }
 
+  /// \brief Returns the number of objects.
+  ///
+  /// \returns The number of objects, archive members included.
+  [[nodiscard]] size_t getNumObjects() const noexcept {
+    return Objects.size();
+  }
+
+  /// \brief Returns the name of an object.
+  ///
+  /// \param I Index of the object.
+  ///
+  /// \returns The name.
+  [[nodiscard]] llvm::StringRef getObjectName(size_t I) const noexcept {
+    return Objects[I].Name;
+  }
+
+  /// \brief Returns the occurrence index of the objects.
+  ///
+  /// The index is built on first use, and kept until objects are added or
+  /// removed.
+  ///
+  /// \returns The occurrence index.
+  [[nodiscard]] const OccurrenceIndex &getOccurrenceIndex() noexcept;
+
+  /// \brief Returns the occurrences of a symbol in the objects.
+  ///
+  /// \param Name Name of the symbol.
+  ///
+  /// \returns The occurrences, ordered by object. An unknown symbol has
+  /// none.
+  [[nodiscard]] llvm::ArrayRef<Occurrence>
+  getOccurrences(llvm::StringRef Name) noexcept;
+
+  /// \brief Builds the dependency graph of the objects.
+  ///
+  /// \returns The dependency graph.
+  [[nodiscard]] DependencyGraph getDependencyGraph() noexcept;
+
+  /// \brief Writes the dependency graph of the objects.
+  ///
+  /// \param OS Output stream.
+  /// \param Format Format.
+  void writeDependencyGraph(llvm::raw_ostream &OS,
+                            GraphFormat Format) noexcept;
+
   /// \brief Applies a prefix to all global and defined symbols.
   ///
   /// \param Prefix Prefix.
@@ -117,22 +411,107 @@ public:
   /// \returns The number of symbols that have been prefixed.
   size_t prefixGlobalAndDefinedSymbols(llvm::StringRef Prefix) noexcept;
 
+  /// \brief Applies a prefix to the symbols selected by a rename policy.
+  ///
+  /// The policy is evaluated over the whole symbol map at once, on several
+  /// threads, and the selected symbols are then renamed in order.
+  ///
+  /// \param Policy Rename policy.
+  /// \param Prefix Prefix.
+  /// \param Threads Number of threads to use. A value of 0 uses all the
+  /// available hardware threads.
+  /// \param Style How new names are built.
+  ///
+  /// \returns The number of symbols that have been renamed.
+  size_t applyRenamePolicy(const RenamePolicy &Policy, llvm::StringRef Prefix,
+                           unsigned Threads = 0,
+                           RenameStyle Style = RenameStyle::Prefix) noexcept;
+
+  /// \brief Renames all global and defined symbols into short hashed names.
+  ///
+  /// Each symbol is renamed into \p Prefix followed by 8 base-62 digits of
+  /// the xxHash64 of its name, keeping the leading underscore of Mach-O
+  /// symbols. A new name colliding with an existing symbol or with a
+  /// previously assigned new name is hashed again with a counter, symbols
+  /// being renamed in the order of their original names. New names thus
+  /// depend on the original name and on the set of names of the handle,
+  /// but not on the order in which inputs were added; without collision,
+  /// which is the common case, they only depend on the original name.
+  ///
+  /// \param Prefix Prefix.
+  ///
+  /// \returns The number of symbols that have been renamed.
+  size_t hashGlobalAndDefinedSymbols(llvm::StringRef Prefix) noexcept;
+
+  /// \brief Writes the map of the renamed symbols.
+  ///
+  /// Each renamed symbol is written on its own line, as its new name and
+  /// its original name separated by a tab. Lines are sorted by new name.
+  ///
+  /// \param OS Output stream.
+  void writeRenameMap(llvm::raw_ostream &OS) const noexcept;
+
+  /// \brief Writes the map of the renamed symbols in the binary format of
+  /// \p RenameMap, which can be mapped and looked up in both directions.
+  ///
+  /// \param OS Output stream.
+  ///
+  /// \returns An error if the map is too large for the format.
+  [[nodiscard]] llvm::Error
+  writeBinaryRenameMap(llvm::raw_ostream &OS) const noexcept;
+
+  /// \brief Removes the objects that are not reachable from a set of root
+  /// symbols.
+  ///
+  /// Objects are kept the way a linker extracts members from an archive: an
+  /// object is kept if it is the first one to define a root symbol, or a
+  /// symbol that a kept object references and that no kept object defines
+  /// yet. Only global and defined symbols are considered as definitions, as
+  /// in the symbol table of an archive. Objects from different slices of a
+  /// fat Mach-O are resolved separately.
+  ///
+  /// The symbol map is left untouched, so symbols only seen in removed
+  /// objects are still prefixed by \p prefixGlobalAndDefinedSymbols, without
+  /// any effect on the final archive.
+  ///
+  /// \param Roots Names of the root symbols, as they appear in the symbol
+  /// tables. Unknown names are ignored.
+  ///
+  /// \returns The number of objects that have been removed.
+  size_t
+  pruneUnreachableObjects(llvm::ArrayRef<llvm::StringRef> Roots) noexcept;
+
   /// \brief Builds the final archive and writes its content to a file.
   ///
   /// \param[in] B Bartleby handle.
   /// \param OutFilepath Path to out file.
+  /// \param Options Build options.
   ///
-  /// \returns An error.
+  /// \returns An error, also if the handle has no object.
   [[nodiscard]] static llvm::Error
-  buildFinalArchive(Bartleby &&B, llvm::StringRef OutFilepath) noexcept;
+  buildFinalArchive(Bartleby &&B, llvm::StringRef OutFilepath,
+                    const BuildOptions &Options = {}) noexcept;
+
+  /// \brief Builds the final archive and writes its content to a stream.
+  ///
+  /// \param[in] B Bartleby handle.
+  /// \param OS Output stream.
+  /// \param Options Build options.
+  ///
+  /// \returns An error, also if the handle has no object.
+  [[nodiscard]] static llvm::Error
+  buildFinalArchive(Bartleby &&B, llvm::raw_ostream &OS,
+                    const BuildOptions &Options = {}) noexcept;
 
   /// \brief Builds the final archive and returns its content.
   ///
   /// \param[in] B Bartleby handle.
+  /// \param Options Build options.
   ///
-  /// \returns The memory buffer containing the archive, or an error.
+  /// \returns The memory buffer containing the archive, or an error, also if
+  /// the handle has no object.
   [[nodiscard]] static llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
-  buildFinalArchive(Bartleby &&B) noexcept;
+  buildFinalArchive(Bartleby &&B, const BuildOptions &Options = {}) noexcept;
 
 private:
   /// \brief An object file.
@@ -149,6 +528,14 @@ private:
     /// We therefore have to keep a track of that binary.
     std::unique_ptr<llvm::object::Binary> Owner;
 
+    /// \brief Its content.
+    ///
+    /// If \p Handle is null, the object was released after its symbols were
+    /// collected, or is a duplicate, and is parsed again from its content
+    /// when needed. See \p setMemoryBudget and \p setDuplicateMembers.
+    /// Duplicates share the content of their original object.
+    llvm::MemoryBufferRef Buffer;
+
     /// \brief Its name.
     llvm::SmallString<32> Name;
 
@@ -156,6 +543,30 @@ private:
     ///
     /// This is used for writing fat Mach-O archives.
     uint32_t Alignment;
+
+    /// \brief Identifiers of the symbols it adds to the symbol table of an
+    /// archive, in the order of its symbol table.
+    ///
+    /// This is used for writing the symbol table of the final archive
+    /// without parsing the final objects again.
+    std::vector<SymbolID> ArchiveSymbols;
+
+    /// \brief Uses of all the symbols it defines or references, in the order
+    /// of its symbol table.
+    ///
+    /// This is used for copying the object verbatim into the final archive
+    /// when none of them is renamed, for finding the objects reachable from a
+    /// set of roots, and for building the occurrence index.
+    std::vector<SymbolUse> Uses;
+  };
+
+  /// \brief An object later objects may be identical to.
+  struct OriginalObject {
+    /// \brief Its index in \p Objects.
+    size_t Index;
+
+    /// \brief Name of the input binary it comes from.
+    llvm::StringRef Input;
   };
 
   /// \brief A set of object formats.
@@ -194,12 +605,61 @@ private:
   [[nodiscard]] llvm::Error addMachOUniversalBinary(
       llvm::object::OwningBinary<llvm::object::Binary> OwningBinary) noexcept;
 
+  /// \brief Records a duplicate, and adds it unless duplicates are
+  /// collapsed.
+  ///
+  /// \param Hash Hash of its content.
+  /// \param Original Index, in \p Objects, of the object it is identical
+  /// to.
+  /// \param Name Its name, if it is an archive member.
+  /// \param Input Name of the input binary it comes from.
+  void addDuplicate(uint64_t Hash, size_t Original,
+                    const std::optional<llvm::SmallString<32>> &Name,
+                    llvm::StringRef Input) noexcept;
+
+  /// \brief Collects the renamed symbols.
+  ///
+  /// \returns The new and original names of the renamed symbols.
+  [[nodiscard]] std::vector<std::pair<std::string, llvm::StringRef>>
+  collectRenames() const noexcept;
+
+  /// \brief Renames a set of symbols.
+  ///
+  /// \param Selected Whether each symbol, by identifier, is renamed.
+  /// \param Prefix Prefix.
+  /// \param Style How new names are built.
+  ///
+  /// \returns The number of symbols that have been renamed.
+  size_t renameSymbols(llvm::ArrayRef<uint8_t> Selected,
+                       llvm::StringRef Prefix, RenameStyle Style) noexcept;
+
+  /// \brief Returns the parsed representation of an object, parsing it
+  /// again if it was released.
+  ///
+  /// \param Obj The object.
+  /// \param[out] Storage Owner of the parsed object, if it had to be parsed
+  /// again.
+  ///
+  /// \returns The parsed object, or an error.
+  [[nodiscard]] static llvm::Expected<llvm::object::ObjectFile *>
+  parseObject(const ObjectFile &Obj,
+              std::unique_ptr<llvm::object::Binary> &Storage) noexcept;
+
+  /// \brief Returns the uses of symbols by each object.
+  ///
+  /// \returns The uses, indexed by object.
+  [[nodiscard]] std::vector<llvm::ArrayRef<SymbolUse>>
+  getObjectUses() const noexcept;
+
   /// \brief Map of symbols.
   SymbolMap Symbols;
 
   /// \brief Objects.
   llvm::SmallVector<ObjectFile, 128> Objects;
 
+  /// \brief Occurrence index of \p Objects, once built.
+  std::optional<OccurrenceIndex> Occurrences;
+
   /// \brief Vector of owning binaries.
   llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 128>
       OwnedBinaries;
@@ -210,6 +670,27 @@ private:
   /// Bartleby handle.
   ObjectFormatVariant ObjFormat;
 
+  /// \brief Statistics, if attached.
+  Statistics *Stats = nullptr;
+
+  /// \brief Input cache, if attached.
+  InputCache *Cache = nullptr;
+
+  /// \brief Thread pool, if attached.
+  llvm::ThreadPool *Pool = nullptr;
+
+  /// \brief Memory budget, in bytes, or 0.
+  uint64_t MemoryBudget = 0;
+
+  /// \brief How identical input members are handled.
+  DuplicateMembers DuplicatesMode = DuplicateMembers::Keep;
+
+  /// \brief Objects duplicates are looked for, by hash of their content.
+  llvm::DenseMap<uint64_t, llvm::SmallVector<OriginalObject, 1>> Originals;
+
+  /// \brief Members found identical to a member added before them.
+  std::vector<DuplicateMember> Duplicates;
+
   // Forward declaration.
   class ArchiveWriter;
 };
@@ -0,0 +1,236 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Input cache specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "Bartleby/SymbolMap.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Object/Binary.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace saq::bartleby {
+
+/// \brief In-memory cache of input binaries, shared by several Bartleby
+/// handles.
+///
+/// Binaries are identified by a digest of their content, given or computed.
+/// A computed digest is kept along with the status of the file, and the file
+/// is hashed again only once that status changes. Along with a
+/// binary, the cache keeps its mapping and the symbols collected from each
+/// of its objects, so that a handle using the cache through
+/// \p Bartleby::setInputCache does not collect them again.
+///
+/// The cache can be bounded with \p setMaxSize, in which case \p prune
+/// evicts the least recently used binaries.
+///
+/// This is meant for long-running processes, such as a Bazel persistent
+/// worker, that build several archives out of the same inputs.
+/// The cache is not thread-safe.
+class InputCache {
+public:
+  /// \brief Constructs an empty cache.
+  InputCache() noexcept = default;
+
+  InputCache(const InputCache &) noexcept = delete;
+  InputCache &operator=(const InputCache &) noexcept = delete;
+  ~InputCache() noexcept;
+
+  /// \brief Opens a binary through the cache.
+  ///
+  /// If a binary with the same digest is already in the cache, its mapping
+  /// and its symbols are reused. Otherwise, the file is mapped using
+  /// \p Bartleby::openBinary. If the digest of a path changes, the entry of
+  /// its previous content is evicted, unless another path still refers to
+  /// it.
+  ///
+  /// The returned binary borrows its content from the cache: it must not
+  /// outlive the cache, nor be used after the same path is opened again
+  /// with another digest.
+  ///
+  /// \param Path Path to the binary.
+  /// \param Digest Digest of the content of the binary. If empty, the file
+  /// is identified by its size, modification time, device and inode. It is
+  /// only mapped and hashed with BLAKE3 when these change, or when they
+  /// cannot tell a file rewritten in place from its previous content: when
+  /// the modification time is a whole second, a sign of a coarse resolution,
+  /// or is less than a second old.
+  ///
+  /// \returns The binary, or an error.
+  [[nodiscard]] llvm::Expected<
+      llvm::object::OwningBinary<llvm::object::Binary>>
+  openBinary(llvm::StringRef Path, llvm::StringRef Digest = {}) noexcept;
+
+  /// \brief Returns the symbols of the objects of a binary.
+  ///
+  /// \param Binary A binary opened through the cache.
+  ///
+  /// \returns The symbols of each object of the binary, in order, or a null
+  /// pointer if they are not known yet.
+  [[nodiscard]] const std::vector<ObjectSymbols> *
+  getSummaries(const llvm::object::Binary &Binary) const noexcept;
+
+  /// \brief Records the symbols of the objects of a binary.
+  ///
+  /// Nothing is recorded if the binary was not opened through the cache.
+  ///
+  /// \param Binary A binary opened through the cache.
+  /// \param Summaries The symbols of each object of the binary, in order.
+  void setSummaries(const llvm::object::Binary &Binary,
+                    std::vector<ObjectSymbols> Summaries) noexcept;
+
+  /// \brief Bounds the size of the cache.
+  ///
+  /// The bound is enforced by \p prune.
+  ///
+  /// \param Bytes Maximum total size of the binaries kept by the cache, in
+  /// bytes, or 0 for no bound.
+  void setMaxSize(const uint64_t Bytes) noexcept { MaxSize = Bytes; }
+
+  /// \brief Evicts the least recently used binaries, until the total size of
+  /// the binaries kept by the cache is within the bound given to
+  /// \p setMaxSize.
+  ///
+  /// Binaries opened through the cache before must no longer be used, which
+  /// is why the cache is only pruned on request, e.g. between two builds.
+  ///
+  /// \returns The number of evicted binaries.
+  size_t prune() noexcept;
+
+  /// \brief Returns the total size of the binaries kept by the cache.
+  ///
+  /// \returns The size, in bytes.
+  [[nodiscard]] uint64_t getSize() const noexcept { return Size; }
+
+  /// \brief Returns the number of binaries in the cache.
+  ///
+  /// \returns The number of binaries.
+  [[nodiscard]] size_t size() const noexcept { return Entries.size(); }
+
+  /// \brief Returns the number of binaries opened from the cache.
+  ///
+  /// \returns The number of hits.
+  [[nodiscard]] size_t getHits() const noexcept { return Hits; }
+
+  /// \brief Returns the number of binaries that had to be mapped.
+  ///
+  /// \returns The number of misses.
+  [[nodiscard]] size_t getMisses() const noexcept { return Misses; }
+
+  /// \brief Returns the number of files hashed for lack of a digest.
+  ///
+  /// \returns The number of hashed files.
+  [[nodiscard]] size_t getHashedFiles() const noexcept { return HashedFiles; }
+
+private:
+  /// \brief An entry.
+  struct Entry {
+    /// \brief The mapped binary.
+    llvm::object::OwningBinary<llvm::object::Binary> Binary;
+
+    /// \brief Symbols of its objects, once collected.
+    std::optional<std::vector<ObjectSymbols>> Summaries;
+
+    /// \brief Number of paths referring to this entry.
+    size_t Paths = 0;
+
+    /// \brief Value of \p Clock when the entry was last opened.
+    uint64_t LastUse = 0;
+  };
+
+  /// \brief Status of a file, which stands for its content as long as it
+  /// does not change.
+  struct FileStamp {
+    /// \brief Size, in bytes.
+    uint64_t Size;
+
+    /// \brief Modification time.
+    llvm::sys::TimePoint<> ModificationTime;
+
+    /// \brief Device and inode.
+    llvm::sys::fs::UniqueID ID;
+
+    bool operator==(const FileStamp &Other) const noexcept {
+      return (Size == Other.Size) &&
+             (ModificationTime == Other.ModificationTime) && (ID == Other.ID);
+    }
+  };
+
+  /// \brief What is known about a path.
+  struct PathInfo {
+    /// \brief Key of the entry of its content.
+    std::string Key;
+
+    /// \brief Status of the file when its content was hashed, if it can
+    /// stand for that content.
+    std::optional<FileStamp> Stamp;
+  };
+
+  /// \brief Drops a reference from a path to an entry, and evicts the entry
+  /// if it was the last one.
+  ///
+  /// \param Key Key of the entry.
+  void release(llvm::StringRef Key) noexcept;
+
+  /// \brief Evicts an entry, whatever the number of paths referring to it.
+  ///
+  /// \param Key Key of the entry.
+  void evict(llvm::StringRef Key) noexcept;
+
+  /// \brief Entries, by key.
+  llvm::StringMap<std::unique_ptr<Entry>> Entries;
+
+  /// \brief Keys and file status, by path.
+  llvm::StringMap<PathInfo> ByPath;
+
+  /// \brief Entries, by the address of their content.
+  llvm::DenseMap<const char *, Entry *> ByData;
+
+  /// \brief Total size of the binaries of \p Entries, in bytes.
+  uint64_t Size = 0;
+
+  /// \brief Bound of \p Size enforced by \p prune, or 0.
+  uint64_t MaxSize = 0;
+
+  /// \brief Number of binaries opened so far, used to order entries by
+  /// recency.
+  uint64_t Clock = 0;
+
+  /// \brief Number of hits.
+  size_t Hits = 0;
+
+  /// \brief Number of misses.
+  size_t Misses = 0;
+
+  /// \brief Number of files hashed for lack of a digest.
+  size_t HashedFiles = 0;
+};
+
+} // end namespace saq::bartleby
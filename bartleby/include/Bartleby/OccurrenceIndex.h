@@ -0,0 +1,201 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Occurrence index and dependency graph specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "Bartleby/SymbolMap.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace saq::bartleby {
+
+/// \brief An occurrence of a symbol in an object.
+struct Occurrence {
+  /// \brief Index of the object, in the order of the Bartleby handle.
+  uint32_t Object;
+
+  /// \brief Whether the object defines the symbol, rather than references it.
+  bool Defined;
+
+  /// \brief Binding of the symbol in the object.
+  Binding Bind;
+};
+
+/// \brief Index of the occurrences of each symbol in a set of objects.
+///
+/// All the occurrences are stored in a single flat array, grouped by symbol,
+/// and ordered by object within a group. The group of a symbol is found
+/// through a second array of offsets, indexed by \p SymbolID.
+class OccurrenceIndex {
+public:
+  /// \brief Constructs an empty index.
+  OccurrenceIndex() noexcept = default;
+
+  /// \brief Constructs the index of a set of objects.
+  ///
+  /// \param NumSymbols Number of symbols in the symbol map.
+  /// \param Uses Uses of symbols by each object.
+  OccurrenceIndex(size_t NumSymbols,
+                  llvm::ArrayRef<llvm::ArrayRef<SymbolUse>> Uses) noexcept;
+
+  OccurrenceIndex(const OccurrenceIndex &) noexcept = delete;
+  OccurrenceIndex(OccurrenceIndex &&) noexcept = default;
+  OccurrenceIndex &operator=(const OccurrenceIndex &) noexcept = delete;
+  OccurrenceIndex &operator=(OccurrenceIndex &&) noexcept = default;
+  ~OccurrenceIndex() noexcept = default;
+
+  /// \brief Returns the occurrences of a symbol.
+  ///
+  /// \param ID Identifier of the symbol.
+  ///
+  /// \returns The occurrences, ordered by object. An unknown identifier has
+  /// none.
+  [[nodiscard]] llvm::ArrayRef<Occurrence> lookup(SymbolID ID) const noexcept;
+
+  /// \brief Returns the number of indexed symbols.
+  ///
+  /// \returns The number of symbols.
+  [[nodiscard]] size_t getNumSymbols() const noexcept {
+    return Offsets.empty() ? 0 : (Offsets.size() - 1);
+  }
+
+  /// \brief Returns the total number of occurrences.
+  ///
+  /// \returns The number of occurrences.
+  [[nodiscard]] size_t size() const noexcept { return Occurrences.size(); }
+
+private:
+  /// \brief Offset of the occurrences of each symbol in \p Occurrences,
+  /// followed by the total number of occurrences.
+  std::vector<uint32_t> Offsets;
+
+  /// \brief Occurrences, grouped by symbol.
+  std::vector<Occurrence> Occurrences;
+};
+
+/// \brief Format of an exported dependency graph.
+enum class GraphFormat : uint8_t {
+  /// \brief Compact binary format, see \p DependencyGraph::writeBinary.
+  Binary = 0,
+
+  /// \brief Graphviz DOT.
+  DOT,
+
+  /// \brief JSON.
+  JSON,
+};
+
+/// \brief Graph of the dependencies between objects.
+///
+/// An object depends on another one if it references a symbol that the other
+/// one defines with a global or weak binding. Each edge carries the number
+/// of symbols resolved through it. Edges are stored in a single flat array,
+/// grouped by source object, and sorted by target object within a group.
+class DependencyGraph {
+public:
+  /// \brief An edge of the graph.
+  struct Edge {
+    /// \brief Index of the object depended on.
+    uint32_t To;
+
+    /// \brief Number of symbols resolved through the edge.
+    uint32_t Symbols;
+  };
+
+  /// \brief Constructs the graph of a set of objects.
+  ///
+  /// \param Index Occurrence index of the objects.
+  /// \param Uses Uses of symbols by each object.
+  DependencyGraph(const OccurrenceIndex &Index,
+                  llvm::ArrayRef<llvm::ArrayRef<SymbolUse>> Uses) noexcept;
+
+  /// \brief Returns the dependencies of an object.
+  ///
+  /// \param Object Index of the object.
+  ///
+  /// \returns Its outgoing edges, sorted by target.
+  [[nodiscard]] llvm::ArrayRef<Edge>
+  getDependencies(uint32_t Object) const noexcept;
+
+  /// \brief Returns the number of objects.
+  ///
+  /// \returns The number of objects.
+  [[nodiscard]] size_t getNumObjects() const noexcept {
+    return Offsets.size() - 1;
+  }
+
+  /// \brief Returns the number of edges.
+  ///
+  /// \returns The number of edges.
+  [[nodiscard]] size_t getNumEdges() const noexcept { return Edges.size(); }
+
+  /// \brief Writes the graph in a given format.
+  ///
+  /// \param OS Output stream.
+  /// \param Format Format.
+  /// \param Names Name of each object.
+  void write(llvm::raw_ostream &OS, GraphFormat Format,
+             llvm::ArrayRef<llvm::StringRef> Names) const noexcept;
+
+  /// \brief Writes the graph in the compact binary format.
+  ///
+  /// All integers are 32-bit little-endian:
+  ///  - the magic \p BTLYDEPG, then the version, 1;
+  ///  - the number of objects N, then the number of edges E;
+  ///  - N names, each as its size followed by its bytes;
+  ///  - N + 1 offsets of the edges of each object in the edge array;
+  ///  - E edges, each as its target followed by its number of symbols.
+  ///
+  /// \param OS Output stream.
+  /// \param Names Name of each object.
+  void writeBinary(llvm::raw_ostream &OS,
+                   llvm::ArrayRef<llvm::StringRef> Names) const noexcept;
+
+  /// \brief Writes the graph in the Graphviz DOT format.
+  ///
+  /// \param OS Output stream.
+  /// \param Names Name of each object.
+  void writeDOT(llvm::raw_ostream &OS,
+                llvm::ArrayRef<llvm::StringRef> Names) const noexcept;
+
+  /// \brief Writes the graph in JSON, as an object holding an array of
+  /// object names, \p objects, and an array of edges, \p edges, each with
+  /// \p from, \p to and \p symbols.
+  ///
+  /// \param OS Output stream.
+  /// \param Names Name of each object.
+  void writeJSON(llvm::raw_ostream &OS,
+                 llvm::ArrayRef<llvm::StringRef> Names) const noexcept;
+
+private:
+  /// \brief Offset of the edges of each object in \p Edges, followed by the
+  /// total number of edges.
+  std::vector<uint32_t> Offsets;
+
+  /// \brief Edges, grouped by source object.
+  std::vector<Edge> Edges;
+};
+
+} // end namespace saq::bartleby
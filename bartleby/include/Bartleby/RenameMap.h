@@ -0,0 +1,194 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Binary rename map specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/MemoryBufferRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace saq::bartleby {
+
+/// \brief Map between the new and the original names of renamed symbols,
+/// read in place from its binary form.
+///
+/// The binary form is made of, with all integers being 32-bit little-endian:
+///
+///  - the magic \p BTLYRMAP, the version, the number of entries, the number
+///    of buckets of the hash tables and the size of the string table.
+///  - the entries, sorted by new name. An entry is the offset and size of
+///    the new name, then the offset and size of the original name, in the
+///    string table.
+///  - the hash table of the new names, then the one of the original names.
+///    Each bucket holds the index of an entry, or \p 0xffffffff if it is
+///    empty. Names are hashed using xxHash64, and collisions are resolved by
+///    linear probing. Tables are at most half full.
+///  - the string table.
+///
+/// Once the map has been validated, which is done once when it is opened,
+/// looking a name up in either direction costs a hash and, most of the
+/// time, a single string comparison, without any allocation.
+class RenameMap {
+public:
+  /// \brief Direction of a lookup.
+  enum class Direction : uint8_t {
+    /// \brief From the new name to the original name.
+    ToOriginal = 0,
+
+    /// \brief From the original name to the new name.
+    ToRenamed,
+  };
+
+  /// \brief Writes the binary form of a map.
+  ///
+  /// \param OS Output stream.
+  /// \param Renames New and original names of the renamed symbols. New
+  /// names must be unique, as well as original names.
+  ///
+  /// \returns An error if the names do not fit in the format.
+  [[nodiscard]] static llvm::Error
+  write(llvm::raw_ostream &OS,
+        llvm::ArrayRef<std::pair<llvm::StringRef, llvm::StringRef>>
+            Renames) noexcept;
+
+  /// \brief Opens a map from a buffer, which must outlive the map.
+  ///
+  /// \param Buffer Binary form of the map.
+  ///
+  /// \returns The map, or an error if the buffer is malformed.
+  [[nodiscard]] static llvm::Expected<RenameMap>
+  create(llvm::MemoryBufferRef Buffer) noexcept;
+
+  /// \brief Maps a file and opens the map it contains.
+  ///
+  /// \param Path Path to the file.
+  ///
+  /// \returns The map, or an error.
+  [[nodiscard]] static llvm::Expected<RenameMap>
+  load(llvm::StringRef Path) noexcept;
+
+  RenameMap(const RenameMap &) noexcept = delete;
+  RenameMap(RenameMap &&) noexcept = default;
+  RenameMap &operator=(const RenameMap &) noexcept = delete;
+  RenameMap &operator=(RenameMap &&) noexcept = default;
+  ~RenameMap() noexcept = default;
+
+  /// \brief Returns the number of renamed symbols.
+  ///
+  /// \returns The number of renamed symbols.
+  [[nodiscard]] size_t size() const noexcept { return Entries.size(); }
+
+  /// \brief Looks a name up.
+  ///
+  /// This is thread-safe.
+  ///
+  /// \param Name The name.
+  /// \param D Direction of the lookup.
+  ///
+  /// \returns The name it maps to, or nullopt if it is not in the map.
+  [[nodiscard]] std::optional<llvm::StringRef>
+  lookup(llvm::StringRef Name, Direction D) const noexcept;
+
+  /// \brief Rewrites the names found in a text, such as a stack trace.
+  ///
+  /// Every run of characters that may appear in a symbol name (letters,
+  /// digits, \p _, \p $ and \p .) is looked up, and replaced if it is in
+  /// the map. The rest of the text is copied as is.
+  ///
+  /// \param Text The text.
+  /// \param D Direction of the lookups.
+  /// \param OS Output stream.
+  ///
+  /// \returns The number of names that have been replaced.
+  size_t symbolize(llvm::StringRef Text, Direction D,
+                   llvm::raw_ostream &OS) const noexcept;
+
+private:
+  /// \brief An entry of the map.
+  struct Entry {
+    /// \brief Offset of the new name in the string table.
+    llvm::support::ulittle32_t NewOffset;
+
+    /// \brief Size of the new name.
+    llvm::support::ulittle32_t NewSize;
+
+    /// \brief Offset of the original name in the string table.
+    llvm::support::ulittle32_t NameOffset;
+
+    /// \brief Size of the original name.
+    llvm::support::ulittle32_t NameSize;
+  };
+
+  /// \brief Constructs an empty map.
+  RenameMap() noexcept = default;
+
+  /// \brief Returns the new name of an entry.
+  ///
+  /// \param E The entry.
+  ///
+  /// \returns The new name.
+  [[nodiscard]] llvm::StringRef getNewName(const Entry &E) const noexcept {
+    return Strings.substr(E.NewOffset, E.NewSize);
+  }
+
+  /// \brief Returns the original name of an entry.
+  ///
+  /// \param E The entry.
+  ///
+  /// \returns The original name.
+  [[nodiscard]] llvm::StringRef getName(const Entry &E) const noexcept {
+    return Strings.substr(E.NameOffset, E.NameSize);
+  }
+
+  /// \brief Finds the entry of a name.
+  ///
+  /// \param Name The name.
+  /// \param D Direction of the lookup, which tells which hash table to use.
+  ///
+  /// \returns The entry, or null if the name is not in the map.
+  [[nodiscard]] const Entry *find(llvm::StringRef Name,
+                                  Direction D) const noexcept;
+
+  /// \brief Owner of the mapped file, if the map was loaded from a file.
+  std::unique_ptr<llvm::MemoryBuffer> Owner;
+
+  /// \brief Entries, sorted by new name.
+  llvm::ArrayRef<Entry> Entries;
+
+  /// \brief Hash table of the new names.
+  llvm::ArrayRef<llvm::support::ulittle32_t> NewBuckets;
+
+  /// \brief Hash table of the original names.
+  llvm::ArrayRef<llvm::support::ulittle32_t> NameBuckets;
+
+  /// \brief String table.
+  llvm::StringRef Strings;
+};
+
+} // end namespace saq::bartleby
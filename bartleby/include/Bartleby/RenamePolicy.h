@@ -0,0 +1,225 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Rename policy specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "Bartleby/Symbol.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Regex.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace saq::bartleby {
+
+/// \brief Policy deciding which symbols are renamed.
+///
+/// A policy is made of rules, one per line:
+///
+///     keep <kind>:<pattern>
+///     rename <kind>:<pattern>
+///     default keep|rename
+///
+/// where \p kind is one of \p literal, \p prefix, \p glob or \p regex.
+/// Globs follow \p llvm::GlobPattern. Regular expressions are POSIX extended
+/// ones, without back references, and must match the whole name. Empty
+/// lines and lines starting with \p # are ignored.
+///
+/// Rules only choose among global and defined symbols: as with
+/// \p Bartleby::prefixGlobalAndDefinedSymbols, other symbols are never
+/// renamed, whatever the rules. Among them, a symbol matched by a \p keep
+/// rule is not renamed. Otherwise, a symbol matched by a \p rename rule is
+/// renamed. Otherwise, the default applies: the symbol is renamed with
+/// \p default \p rename, which is the default, and kept with \p default
+/// \p keep.
+///
+/// Rules do not depend on each other's order, so that they can be compiled
+/// into a single matcher: literals go to a hash table, prefixes and globs
+/// that are prefixes go to a trie, and the other globs are translated into
+/// regular expressions, joined with the regular expressions of the same
+/// action into a single one.
+class RenamePolicy {
+public:
+  /// \brief What a policy does with a symbol.
+  enum class Action : uint8_t {
+    /// \brief No rule matches, the default applies.
+    Default = 0,
+
+    /// \brief The symbol is kept.
+    Keep,
+
+    /// \brief The symbol is renamed.
+    Rename,
+  };
+
+  /// \brief Parses a policy.
+  ///
+  /// \param Text Content of the policy.
+  ///
+  /// \returns The policy, or an error pointing at the faulty line.
+  [[nodiscard]] static llvm::Expected<RenamePolicy>
+  parse(llvm::StringRef Text) noexcept;
+
+  /// \brief Reads and parses a policy file.
+  ///
+  /// \param Path Path to the policy file.
+  ///
+  /// \returns The policy, or an error.
+  [[nodiscard]] static llvm::Expected<RenamePolicy>
+  load(llvm::StringRef Path) noexcept;
+
+  /// \brief Constructs a policy without rules, which renames global and
+  /// defined symbols.
+  RenamePolicy() noexcept = default;
+
+  RenamePolicy(const RenamePolicy &) noexcept = delete;
+  RenamePolicy(RenamePolicy &&) noexcept = default;
+  RenamePolicy &operator=(const RenamePolicy &) noexcept = delete;
+  RenamePolicy &operator=(RenamePolicy &&) noexcept = default;
+  ~RenamePolicy() noexcept = default;
+
+  /// \brief Matches a name against the rules.
+  ///
+  /// This is thread-safe.
+  ///
+  /// \param Name Name of the symbol.
+  ///
+  /// \returns What the rules do with the symbol.
+  [[nodiscard]] Action match(llvm::StringRef Name) const noexcept;
+
+  /// \brief Decides whether a symbol is renamed.
+  ///
+  /// Symbols that are not global and defined are never renamed.
+  ///
+  /// This is thread-safe.
+  ///
+  /// \param Name Name of the symbol.
+  /// \param Sym The symbol.
+  ///
+  /// \returns True if the symbol is renamed.
+  [[nodiscard]] bool shouldRename(llvm::StringRef Name,
+                                  const Symbol &Sym) const noexcept;
+
+private:
+  /// \brief Set of actions, as a bit mask.
+  using ActionMask = uint8_t;
+
+  /// \brief Returns the bit of an action.
+  ///
+  /// \param A Action.
+  ///
+  /// \returns The bit.
+  [[nodiscard]] static constexpr ActionMask bit(Action A) noexcept {
+    return static_cast<ActionMask>(1U << static_cast<unsigned>(A));
+  }
+
+  /// \brief Trie of prefixes.
+  ///
+  /// Nodes, and the edges of each node sorted by label, are stored in flat
+  /// arrays.
+  class PrefixTrie {
+  public:
+    /// \brief Builds the trie.
+    ///
+    /// \param Prefixes Prefixes, with the actions of their rules.
+    void
+    build(std::vector<std::pair<std::string, ActionMask>> Prefixes) noexcept;
+
+    /// \brief Matches a name.
+    ///
+    /// \param Name The name.
+    ///
+    /// \returns The actions of all the prefixes of \p Name.
+    [[nodiscard]] ActionMask match(llvm::StringRef Name) const noexcept;
+
+  private:
+    /// \brief A node.
+    struct Node {
+      /// \brief Index of its first edge.
+      uint32_t FirstEdge = 0;
+
+      /// \brief Number of edges.
+      uint32_t NumEdges = 0;
+
+      /// \brief Actions of the prefix ending at this node.
+      ActionMask Mask = 0;
+    };
+
+    /// \brief Builds the node of a set of prefixes sharing their first
+    /// characters.
+    ///
+    /// \param Prefixes Sorted prefixes.
+    /// \param Depth Number of characters they share.
+    ///
+    /// \returns Index of the node.
+    uint32_t
+    buildNode(llvm::ArrayRef<std::pair<std::string, ActionMask>> Prefixes,
+              size_t Depth) noexcept;
+
+    /// \brief Nodes. The first one is the root.
+    std::vector<Node> Nodes;
+
+    /// \brief Label of each edge.
+    std::vector<uint8_t> Labels;
+
+    /// \brief Target node of each edge.
+    std::vector<uint32_t> Targets;
+  };
+
+  /// \brief Adds a rule.
+  ///
+  /// \param A Action of the rule.
+  /// \param Kind Kind of the pattern.
+  /// \param Pattern The pattern.
+  /// \param[out] Prefixes Where to add prefixes.
+  /// \param[out] Regex Where to join the regular expression.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error
+  addRule(Action A, llvm::StringRef Kind, llvm::StringRef Pattern,
+          std::vector<std::pair<std::string, ActionMask>> &Prefixes,
+          std::string &Regex) noexcept;
+
+  /// \brief Actions of literal names.
+  llvm::StringMap<ActionMask> Literals;
+
+  /// \brief Prefixes.
+  PrefixTrie Prefixes;
+
+  /// \brief Joined regular expression of the \p keep rules, and of their
+  /// globs which are neither literals nor prefixes, if any.
+  std::optional<llvm::Regex> KeepRegex;
+
+  /// \brief Joined regular expression of the \p rename rules, and of their
+  /// globs which are neither literals nor prefixes, if any.
+  std::optional<llvm::Regex> RenameRegex;
+
+  /// \brief Whether global and defined symbols are renamed by default.
+  bool RenameByDefault = true;
+};
+
+} // end namespace saq::bartleby
@@ -0,0 +1,267 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Bartleby statistics specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+namespace saq::bartleby {
+
+/// \brief Timings and counters about the phases of Bartleby.
+///
+/// Statistics are collected when a \p Statistics object is attached to a
+/// Bartleby handle using \p Bartleby::setStatistics, or passed to
+/// \p Bartleby::buildFinalArchive through \p BuildOptions::Stats.
+/// Recording is thread-safe.
+///
+/// Phases may nest: \p ProcessObjectFile is part of \p AddBinary. Phases
+/// that run on several threads accumulate the time spent by each call, and,
+/// as for \p llvm::Timer, CPU times are those of the whole process.
+class Statistics {
+public:
+  /// \brief A phase.
+  enum class Phase : unsigned {
+    /// \brief \p Bartleby::addBinary and \p Bartleby::addBinaries.
+    AddBinary = 0,
+
+    /// \brief Collection of the symbols of one object.
+    ProcessObjectFile,
+
+    /// \brief \p Bartleby::prefixGlobalAndDefinedSymbols and
+    /// \p Bartleby::applyRenamePolicy.
+    PrefixSymbols,
+
+    /// \brief Rewriting of one object.
+    ObjCopy,
+
+    /// \brief Writing of the final archive.
+    WriteArchive,
+  };
+
+  /// \brief Number of phases.
+  static constexpr size_t NumPhases =
+      static_cast<size_t>(Phase::WriteArchive) + 1;
+
+  /// \brief Measurements of a phase.
+  struct PhaseRecord {
+    /// \brief Wall time, CPU times and memory used.
+    llvm::TimeRecord Time;
+
+    /// \brief Number of times the phase ran.
+    uint64_t Calls = 0;
+
+    /// \brief Number of bytes read.
+    uint64_t BytesIn = 0;
+
+    /// \brief Number of bytes written.
+    uint64_t BytesOut = 0;
+
+    /// \brief Number of objects processed.
+    uint64_t Objects = 0;
+
+    /// \brief Number of symbols processed.
+    uint64_t Symbols = 0;
+  };
+
+  /// \brief Measures a phase for the lifetime of the scope.
+  ///
+  /// Nothing is measured if no \p Statistics object is given.
+  class Scope {
+  public:
+    /// \brief Starts measuring a phase.
+    ///
+    /// \param Stats Where to record the measurements. Can be null.
+    /// \param P The phase.
+    Scope(Statistics *Stats, Phase P) noexcept;
+
+    Scope(const Scope &) noexcept = delete;
+    Scope &operator=(const Scope &) noexcept = delete;
+
+    /// \brief Stops measuring the phase, and records it.
+    ~Scope() noexcept;
+
+    /// \brief Number of bytes read.
+    uint64_t BytesIn = 0;
+
+    /// \brief Number of bytes written.
+    uint64_t BytesOut = 0;
+
+    /// \brief Number of objects processed.
+    uint64_t Objects = 0;
+
+    /// \brief Number of symbols processed.
+    uint64_t Symbols = 0;
+
+  private:
+    /// \brief Where to record the measurements.
+    Statistics *Stats;
+
+    /// \brief The phase.
+    Phase P;
+
+    /// \brief Time at which the phase started.
+    llvm::TimeRecord Start;
+  };
+
+  /// \brief Constructs empty statistics.
+  Statistics() noexcept = default;
+
+  Statistics(const Statistics &) noexcept = delete;
+  Statistics &operator=(const Statistics &) noexcept = delete;
+
+  /// \brief Records a run of a phase.
+  ///
+  /// \param P The phase.
+  /// \param Record Its measurements.
+  void record(Phase P, const PhaseRecord &Record) noexcept;
+
+  /// \brief Samples the \p malloc usage and the peak RSS of the process.
+  ///
+  /// Scopes of \p AddBinary, \p PrefixSymbols and \p WriteArchive do so
+  /// when they end. Scopes of the phases that run once per object do not.
+  void sampleMemoryUsage() noexcept;
+
+  /// \brief Records lookups in the rewrite cache.
+  ///
+  /// \param Hits Number of lookups that found an entry.
+  /// \param Misses Number of lookups that did not find an entry.
+  void recordCacheLookups(uint64_t Hits, uint64_t Misses) noexcept;
+
+  /// \brief Records members reused from a previous build.
+  ///
+  /// \param N Number of members.
+  void recordReusedMembers(uint64_t N) noexcept;
+
+  /// \brief Records members copied verbatim, because none of their symbols
+  /// is renamed.
+  ///
+  /// \param N Number of members.
+  void recordPassthroughMembers(uint64_t N) noexcept;
+
+  /// \brief Records input members found identical to a member added before
+  /// them.
+  ///
+  /// \param N Number of members.
+  void recordDuplicateMembers(uint64_t N) noexcept;
+
+  /// \brief Returns the measurements of a phase.
+  ///
+  /// \param P The phase.
+  ///
+  /// \returns The measurements.
+  [[nodiscard]] PhaseRecord getPhase(Phase P) const noexcept;
+
+  /// \brief Returns the number of lookups that found an entry in the rewrite
+  /// cache.
+  ///
+  /// \returns The number of hits.
+  [[nodiscard]] uint64_t getCacheHits() const noexcept;
+
+  /// \brief Returns the number of lookups that did not find an entry in the
+  /// rewrite cache.
+  ///
+  /// \returns The number of misses.
+  [[nodiscard]] uint64_t getCacheMisses() const noexcept;
+
+  /// \brief Returns the number of members reused from a previous build,
+  /// instead of being rewritten.
+  ///
+  /// \returns The number of members.
+  [[nodiscard]] uint64_t getReusedMembers() const noexcept;
+
+  /// \brief Returns the number of members copied verbatim, because none of
+  /// their symbols is renamed.
+  ///
+  /// \returns The number of members.
+  [[nodiscard]] uint64_t getPassthroughMembers() const noexcept;
+
+  /// \brief Returns the number of input members found identical to a member
+  /// added before them.
+  ///
+  /// \returns The number of members.
+  [[nodiscard]] uint64_t getDuplicateMembers() const noexcept;
+
+  /// \brief Returns the highest amount of memory allocated through
+  /// \p malloc, observed by \p sampleMemoryUsage.
+  ///
+  /// \returns The amount of memory, in bytes, or 0 if not supported.
+  [[nodiscard]] uint64_t getPeakMallocUsage() const noexcept;
+
+  /// \brief Returns the peak resident set size of the process, observed by
+  /// \p sampleMemoryUsage.
+  ///
+  /// \returns The peak RSS, in bytes, or 0 if not supported.
+  [[nodiscard]] uint64_t getPeakRSS() const noexcept;
+
+  /// \brief Returns the name of a phase.
+  ///
+  /// \param P The phase.
+  ///
+  /// \returns The name.
+  [[nodiscard]] static llvm::StringRef getPhaseName(Phase P) noexcept;
+
+  /// \brief Prints a report, in the format of \p llvm::TimerGroup, followed
+  /// by the counters.
+  ///
+  /// \param OS Output stream.
+  void printReport(llvm::raw_ostream &OS) const noexcept;
+
+  /// \brief Converts the statistics to JSON.
+  ///
+  /// \returns The JSON value.
+  [[nodiscard]] llvm::json::Value toJSON() const noexcept;
+
+private:
+  /// \brief Mutex protecting the statistics.
+  mutable std::mutex Mutex;
+
+  /// \brief Measurements of each phase.
+  std::array<PhaseRecord, NumPhases> Phases;
+
+  /// \brief Number of hits in the rewrite cache.
+  uint64_t CacheHits = 0;
+
+  /// \brief Number of misses in the rewrite cache.
+  uint64_t CacheMisses = 0;
+
+  /// \brief Number of members reused from a previous build.
+  uint64_t ReusedMembers = 0;
+
+  /// \brief Number of members copied verbatim.
+  uint64_t PassthroughMembers = 0;
+
+  /// \brief Number of duplicate input members.
+  uint64_t DuplicateMembers = 0;
+
+  /// \brief Peak \p malloc usage.
+  uint64_t PeakMallocUsage = 0;
+
+  /// \brief Peak RSS.
+  uint64_t PeakRSS = 0;
+};
+
+} // end namespace saq::bartleby
@@ -20,8 +20,11 @@
 
 #pragma once
 
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Object/ObjectFile.h"
 
+#include <cstdint>
 #include <optional>
 
 namespace saq::bartleby {
@@ -63,14 +66,29 @@ public:
 
   /// \brief Counts how many times this symbol is referenced.
   ///
+  /// Each object in which the symbol is undefined counts as one reference.
+  ///
   /// \returns Number of references.
   [[nodiscard]] size_t getReferences() const noexcept;
 
-  /// \brief Returns the overwrite name.
+  /// \brief Returns true if the symbol is going to be renamed.
+  ///
+  /// \returns True if the symbol has a new name, else false.
+  [[nodiscard]] bool isRenamed() const noexcept;
+
+  /// \brief Returns the new name of the symbol.
+  ///
+  /// If the symbol was renamed by prefixing it, the new name is built into
+  /// \p Storage. For Mach-O symbols, the prefix is inserted after the leading
+  /// underscore.
+  ///
+  /// \param Name Current name of the symbol.
+  /// \param[out] Storage Storage for the new name, if it has to be built.
   ///
-  /// \returns The overwrite name.
+  /// \returns The new name, or nothing if the symbol is not renamed.
   [[nodiscard]] std::optional<llvm::StringRef>
-  getOverwriteName() const noexcept;
+  getNewName(llvm::StringRef Name,
+             llvm::SmallVectorImpl<char> &Storage) const noexcept;
 
   /// \brief Returns true if the symbol contains references to some mach-o
   /// symbols.
@@ -79,16 +97,20 @@ public:
   /// false.
   [[nodiscard]] bool isMachO() const noexcept;
 
-  /// \brief Sets the name of the symbol.
-  ///
-  /// \param name Name to set.
-  void setName(std::string Name) noexcept;
-
   /// \brief Updates the symbol with new symbol information.
   ///
   /// \param syminfo Symbol information.
   void updateWithNewSymbolInfo(const SymbolInfo &Syminfo) noexcept;
 
+  /// \brief Merges another view of the same symbol into this one.
+  ///
+  /// The symbol becomes defined (resp. global) if \p Other is defined (resp.
+  /// global), as \p updateWithNewSymbolInfo does for a single occurrence.
+  /// References are summed.
+  ///
+  /// \param Other Symbol to merge.
+  void merge(const Symbol &Other) noexcept;
+
   /// \brief Constructs a new symbol.
   Symbol() noexcept;
 
@@ -99,18 +121,49 @@ public:
   ~Symbol() noexcept = default;
 
 private:
-  /// \brief New name to set, if any.
-  std::optional<std::string> OverwriteName;
+  /// \brief How the symbol is renamed.
+  enum class RenameKind : uint8_t {
+    /// \brief The symbol is not renamed.
+    None,
+
+    /// \brief The symbol is renamed into \p NewName.
+    Replace,
+
+    /// \brief The symbol is renamed by prefixing it with \p NewName.
+    Prefix,
+  };
+
+  /// \brief Sets the new name of the symbol.
+  ///
+  /// \param Name New name. It must outlive the symbol.
+  void setNewName(llvm::StringRef Name) noexcept;
+
+  /// \brief Sets the prefix of the symbol.
+  ///
+  /// \param Prefix Prefix. It must outlive the symbol.
+  void setPrefix(llvm::StringRef Prefix) noexcept;
+
+  /// \brief New name or prefix, depending on \p Rename. It is owned by the
+  /// \p SymbolMap the symbol belongs to.
+  llvm::StringRef NewName;
 
   /// \brief Type of the object it belongs to.
   llvm::Triple::ObjectFormatType Type =
       llvm::Triple::ObjectFormatType::UnknownObjectFormat;
 
+  /// \brief Number of objects in which the symbol is undefined.
+  uint32_t References = 0;
+
+  /// \brief How the symbol is renamed.
+  RenameKind Rename = RenameKind::None;
+
   /// \brief Is global.
   bool Global = false;
 
   /// \brief Is defined.
   bool Defined = false;
+
+  friend class SymbolMap;
 };
 
 } // end namespace saq::bartleby
@@ -0,0 +1,259 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Symbol map specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "Bartleby/Symbol.h"
+
+#include "llvm/ADT/CachedHashString.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace saq::bartleby {
+
+/// \brief Identifier of a symbol in a \p SymbolMap.
+///
+/// Identifiers are assigned in insertion order, starting from 0.
+using SymbolID = uint32_t;
+
+/// \brief Map of symbols, indexed by name.
+///
+/// Names are interned in a bump-allocated arena owned by the map, and each
+/// symbol gets a compact \p SymbolID. Lookups take a \p llvm::StringRef and
+/// never allocate. Iteration follows insertion order.
+///
+/// Inserting a symbol invalidates references and iterators to entries, but
+/// not the names, nor the identifiers.
+class SymbolMap {
+public:
+  /// \brief An entry of the map.
+  class Entry {
+  public:
+    /// \brief Returns the name of the symbol.
+    ///
+    /// \returns The name.
+    [[nodiscard]] llvm::StringRef first() const noexcept { return Name; }
+
+    /// \brief Returns the symbol.
+    ///
+    /// \returns The symbol.
+    [[nodiscard]] Symbol &getValue() noexcept { return Value; }
+
+    /// \brief Returns the symbol.
+    ///
+    /// \returns The symbol.
+    [[nodiscard]] const Symbol &getValue() const noexcept { return Value; }
+
+  private:
+    /// \brief Constructs an entry.
+    ///
+    /// \param Name Name of the symbol, owned by the map.
+    Entry(llvm::StringRef Name) noexcept : Name(Name) {}
+
+    /// \brief Name of the symbol.
+    llvm::StringRef Name;
+
+    /// \brief The symbol.
+    Symbol Value;
+
+    friend class SymbolMap;
+  };
+
+  /// \brief Iterator type.
+  using iterator = std::vector<Entry>::iterator;
+
+  /// \brief Constant iterator type.
+  using const_iterator = std::vector<Entry>::const_iterator;
+
+  /// \brief Constructs an empty map.
+  SymbolMap() noexcept = default;
+
+  SymbolMap(const SymbolMap &) noexcept = delete;
+  SymbolMap(SymbolMap &&) noexcept = default;
+  SymbolMap &operator=(const SymbolMap &) noexcept = delete;
+  SymbolMap &operator=(SymbolMap &&) noexcept = default;
+  ~SymbolMap() noexcept = default;
+
+  /// \brief Inserts a symbol if it does not exist yet.
+  ///
+  /// \param Name Name of the symbol. It is copied into the map.
+  ///
+  /// \returns The identifier of the symbol, and true if it was inserted.
+  std::pair<SymbolID, bool> insert(llvm::StringRef Name) noexcept;
+
+  /// \brief Returns a symbol, inserting it if it does not exist yet.
+  ///
+  /// \param Name Name of the symbol.
+  ///
+  /// \returns The symbol.
+  Symbol &operator[](llvm::StringRef Name) noexcept {
+    return Entries[insert(Name).first].Value;
+  }
+
+  /// \brief Looks up the identifier of a symbol.
+  ///
+  /// \param Name Name of the symbol.
+  ///
+  /// \returns The identifier, or nothing if the symbol does not exist.
+  [[nodiscard]] std::optional<SymbolID>
+  getID(llvm::StringRef Name) const noexcept;
+
+  /// \brief Returns the entry of a symbol.
+  ///
+  /// \param ID Identifier of the symbol.
+  ///
+  /// \returns The entry.
+  [[nodiscard]] Entry &getEntry(SymbolID ID) noexcept { return Entries[ID]; }
+
+  /// \brief Returns the entry of a symbol.
+  ///
+  /// \param ID Identifier of the symbol.
+  ///
+  /// \returns The entry.
+  [[nodiscard]] const Entry &getEntry(SymbolID ID) const noexcept {
+    return Entries[ID];
+  }
+
+  /// \brief Finds a symbol.
+  ///
+  /// \param Name Name of the symbol.
+  ///
+  /// \returns An iterator to its entry, or \p end() if it does not exist.
+  [[nodiscard]] iterator find(llvm::StringRef Name) noexcept;
+
+  /// \brief Finds a symbol.
+  ///
+  /// \param Name Name of the symbol.
+  ///
+  /// \returns An iterator to its entry, or \p end() if it does not exist.
+  [[nodiscard]] const_iterator find(llvm::StringRef Name) const noexcept;
+
+  /// \brief Renames a symbol.
+  ///
+  /// \param ID Identifier of the symbol.
+  /// \param NewName New name. It is copied into the map.
+  void setNewName(SymbolID ID, llvm::StringRef NewName) noexcept;
+
+  /// \brief Renames a symbol by prefixing its name.
+  ///
+  /// The new name is not built: only the prefix is stored, once for all the
+  /// symbols it is applied to. See \p Symbol::getNewName.
+  ///
+  /// \param ID Identifier of the symbol.
+  /// \param Prefix Prefix. It is copied into the map if it is not there yet.
+  void setPrefix(SymbolID ID, llvm::StringRef Prefix) noexcept;
+
+  /// \brief Returns the number of symbols.
+  ///
+  /// \returns The number of symbols.
+  [[nodiscard]] size_t size() const noexcept { return Entries.size(); }
+
+  /// \brief Returns true if the map is empty.
+  ///
+  /// \returns True if the map is empty.
+  [[nodiscard]] bool empty() const noexcept { return Entries.empty(); }
+
+  /// \brief Reserves space for a number of symbols.
+  ///
+  /// \param N Number of symbols.
+  void reserve(size_t N) noexcept;
+
+  [[nodiscard]] iterator begin() noexcept { return Entries.begin(); }
+  [[nodiscard]] iterator end() noexcept { return Entries.end(); }
+  [[nodiscard]] const_iterator begin() const noexcept {
+    return Entries.begin();
+  }
+  [[nodiscard]] const_iterator end() const noexcept { return Entries.end(); }
+
+private:
+  /// \brief Copies a string into the arena.
+  ///
+  /// \param Str String to copy.
+  ///
+  /// \returns The copy.
+  [[nodiscard]] llvm::StringRef save(llvm::StringRef Str) noexcept;
+
+  /// \brief Copies a string into the arena, unless an equal string was
+  /// already interned using this method.
+  ///
+  /// \param Str String to intern.
+  ///
+  /// \returns The interned string.
+  [[nodiscard]] llvm::StringRef intern(llvm::StringRef Str) noexcept;
+
+  /// \brief Arena holding names, new names and prefixes.
+  llvm::BumpPtrAllocator Arena;
+
+  /// \brief Entries, indexed by \p SymbolID.
+  std::vector<Entry> Entries;
+
+  /// \brief Index from names to identifiers.
+  llvm::DenseMap<llvm::CachedHashStringRef, SymbolID> Index;
+
+  /// \brief Strings interned using \p intern.
+  llvm::DenseSet<llvm::CachedHashStringRef> Interned;
+};
+
+/// \brief Binding of a symbol in an object.
+enum class Binding : uint8_t {
+  /// \brief The symbol is local to the object.
+  Local = 0,
+
+  /// \brief The symbol is global.
+  Global,
+
+  /// \brief The symbol is weak.
+  Weak,
+};
+
+/// \brief Use of a symbol by an object.
+struct SymbolUse {
+  /// \brief Identifier of the symbol.
+  SymbolID ID;
+
+  /// \brief Whether the object defines the symbol, rather than references it.
+  bool Defined;
+
+  /// \brief Binding of the symbol in the object.
+  Binding Bind;
+};
+
+/// \brief Symbols collected from a single object.
+struct ObjectSymbols {
+  /// \brief Its symbols.
+  SymbolMap Symbols;
+
+  /// \brief Identifiers, in \p Symbols, of the symbols which belong to the
+  /// symbol table of an archive, i.e. global symbols that are defined, in
+  /// the order of the symbol table of the object.
+  std::vector<SymbolID> ArchiveSymbols;
+
+  /// \brief Uses of the symbols, with identifiers in \p Symbols, in the
+  /// order of the symbol table of the object.
+  std::vector<SymbolUse> Uses;
+};
+
+} // end namespace saq::bartleby
@@ -0,0 +1,380 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Archive index implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/ArchiveIndex.h"
+
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+
+#include <algorithm>
+#include <cassert>
+
+#define DEBUG_TYPE "Bartleby"
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief Size of the header of an archive member.
+constexpr uint64_t MemberHeaderSize = 60;
+
+/// \brief Size of the magic of an archive.
+constexpr uint64_t MagicSize = 8;
+
+/// \brief Returns whether an archive format uses BSD member headers.
+///
+/// \param Kind Archive format.
+///
+/// \returns True for the BSD and Darwin formats.
+[[nodiscard]] bool isBSDLike(llvm::object::Archive::Kind Kind) noexcept {
+  return (Kind == llvm::object::Archive::K_BSD) ||
+         (Kind == llvm::object::Archive::K_DARWIN) ||
+         (Kind == llvm::object::Archive::K_DARWIN64);
+}
+
+/// \brief Returns whether an archive format is a Darwin one.
+///
+/// \param Kind Archive format.
+///
+/// \returns True for the Darwin formats.
+[[nodiscard]] bool isDarwin(llvm::object::Archive::Kind Kind) noexcept {
+  return (Kind == llvm::object::Archive::K_DARWIN) ||
+         (Kind == llvm::object::Archive::K_DARWIN64);
+}
+
+/// \brief Returns whether an archive format uses 64-bit offsets.
+///
+/// \param Kind Archive format.
+///
+/// \returns True for the GNU64 and Darwin64 formats.
+[[nodiscard]] bool is64Bit(llvm::object::Archive::Kind Kind) noexcept {
+  return (Kind == llvm::object::Archive::K_GNU64) ||
+         (Kind == llvm::object::Archive::K_DARWIN64);
+}
+
+/// \brief Returns the name of the symbol table member of a BSD archive.
+///
+/// \param Kind Archive format.
+///
+/// \returns The name.
+[[nodiscard]] llvm::StringRef
+getBSDSymbolTableName(llvm::object::Archive::Kind Kind) noexcept {
+  return is64Bit(Kind) ? "__.SYMDEF_64" : "__.SYMDEF";
+}
+
+/// \brief Returns the number of null bytes following the name of a BSD member,
+/// so that its content is aligned on 8 bytes.
+///
+/// \param Offset Offset of the member header.
+/// \param Name Name of the member.
+///
+/// \returns The number of null bytes.
+[[nodiscard]] uint64_t getBSDNamePadding(uint64_t Offset,
+                                         llvm::StringRef Name) noexcept {
+  return llvm::offsetToAlignment(Offset + MemberHeaderSize + Name.size(),
+                                 llvm::Align(8));
+}
+
+/// \brief Writes a field of a member header, padded with spaces.
+///
+/// \param OS Output stream.
+/// \param Value Value of the field.
+/// \param Width Width of the field.
+void writeField(llvm::raw_ostream &OS, const llvm::Twine &Value,
+                size_t Width) noexcept {
+  llvm::SmallString<16> Str;
+  Value.toVector(Str);
+  assert(Str.size() <= Width);
+  OS << Str;
+  OS.indent(Width - Str.size());
+}
+
+/// \brief Writes the fields of a member header which follow its name, for a
+/// deterministic archive.
+///
+/// \param OS Output stream.
+/// \param Size Size of the member.
+void writeHeaderFields(llvm::raw_ostream &OS, uint64_t Size) noexcept {
+  writeField(OS, "0", 12);
+  writeField(OS, "0", 6);
+  writeField(OS, "0", 6);
+  writeField(OS, "0", 8);
+  writeField(OS, llvm::Twine(Size), 10);
+  OS << "`\n";
+}
+
+/// \brief Writes an integer of the symbol table.
+///
+/// \param OS Output stream.
+/// \param Kind Archive format, which defines the size and the byte order.
+/// \param Value The integer.
+void writeInteger(llvm::raw_ostream &OS, llvm::object::Archive::Kind Kind,
+                  uint64_t Value) noexcept {
+  const unsigned Size = is64Bit(Kind) ? 8 : 4;
+  const bool LittleEndian = isBSDLike(Kind);
+  for (unsigned I = 0; I < Size; ++I) {
+    const unsigned Shift = 8 * (LittleEndian ? I : (Size - 1 - I));
+    OS << static_cast<char>((Value >> Shift) & 0xff);
+  }
+}
+
+/// \brief Output stream forwarding its content to another stream, except for
+/// a number of leading bytes.
+class SkipOStream final : public llvm::raw_ostream {
+public:
+  /// \brief Constructs a stream.
+  ///
+  /// \param OS Stream to forward the content to.
+  /// \param Skip Number of leading bytes to drop.
+  SkipOStream(llvm::raw_ostream &OS, uint64_t Skip) noexcept
+      : llvm::raw_ostream(/*unbuffered=*/true), OS(OS), Skip(Skip) {}
+
+private:
+  void write_impl(const char *Ptr, size_t Size) override {
+    Pos += Size;
+    const auto Skipped = std::min<uint64_t>(Skip, Size);
+    Skip -= Skipped;
+    OS.write(Ptr + Skipped, Size - Skipped);
+  }
+
+  uint64_t current_pos() const override { return Pos; }
+
+  /// \brief Stream to forward the content to.
+  llvm::raw_ostream &OS;
+
+  /// \brief Number of bytes still to drop.
+  uint64_t Skip;
+
+  /// \brief Number of bytes written.
+  uint64_t Pos = 0;
+};
+
+} // end anonymous namespace
+
+bool ArchiveIndex::supports(llvm::object::Archive::Kind Kind) noexcept {
+  switch (Kind) {
+  case llvm::object::Archive::K_GNU:
+  case llvm::object::Archive::K_GNU64:
+  case llvm::object::Archive::K_BSD:
+  case llvm::object::Archive::K_DARWIN:
+  case llvm::object::Archive::K_DARWIN64: {
+    return true;
+  }
+  default: {
+    return false;
+  }
+  }
+}
+
+ArchiveIndex::ArchiveIndex(llvm::object::Archive::Kind Kind,
+                           bool Thin) noexcept
+    : Kind(Kind), Thin(Thin) {
+  assert(supports(Kind));
+}
+
+void ArchiveIndex::addMember(const llvm::NewArchiveMember &Member) noexcept {
+  const auto Name = Member.MemberName;
+  MemberOffsets.push_back(End);
+
+  uint64_t HeaderSize = MemberHeaderSize;
+  if (isBSDLike(Kind)) {
+    HeaderSize += Name.size() + getBSDNamePadding(End, Name);
+  } else if (Thin || (Name.size() >= 16) || Name.contains('/')) {
+    if (Thin || LongNames.insert(Name).second) {
+      LongNamesSize += Name.size() + 2;
+    }
+  }
+
+  const uint64_t DataSize = Thin ? 0 : Member.Buf->getBufferSize();
+  const uint64_t MemberPadding =
+      isDarwin(Kind) ? llvm::offsetToAlignment(DataSize, llvm::Align(8)) : 0;
+  const uint64_t TailPadding =
+      llvm::offsetToAlignment(DataSize + MemberPadding, llvm::Align(2));
+  End += HeaderSize + DataSize + MemberPadding + TailPadding;
+}
+
+void ArchiveIndex::addSymbol(llvm::StringRef Name) noexcept {
+  assert(!MemberOffsets.empty());
+  Symbols.push_back(Symbol{
+      .NameOffset = Names.size(),
+      .Member = MemberOffsets.size() - 1,
+  });
+  Names += Name;
+  Names.push_back('\0');
+}
+
+ArchiveIndex::Layout
+ArchiveIndex::computeLayout(llvm::object::Archive::Kind Kind) const noexcept {
+  Layout L{.Kind = Kind,
+           .SymbolTableSize = 0,
+           .MembersOffset = MagicSize,
+           .NamesSize = Names.size()};
+
+  // As with llvm::writeArchive, an empty symbol table is only written for
+  // Darwin, whose linker requires one.
+  const bool BSD = isBSDLike(Kind);
+  if (!Names.empty() || isDarwin(Kind)) {
+    const uint64_t OffsetSize = is64Bit(Kind) ? 8 : 4;
+    // As cctools does, llvm::writeArchive pads the names of a BSD symbol
+    // table to 4 bytes.
+    if (BSD) {
+      L.NamesSize = llvm::alignTo(L.NamesSize, 4);
+    }
+    uint64_t Size = OffsetSize + (Symbols.size() * OffsetSize * (BSD ? 2 : 1)) +
+                    (BSD ? OffsetSize : 0) + L.NamesSize;
+    Size = llvm::alignTo(Size, BSD ? 8 : 2);
+    L.SymbolTableSize = MemberHeaderSize + Size;
+    if (BSD) {
+      const auto Name = getBSDSymbolTableName(Kind);
+      L.SymbolTableSize += Name.size() + getBSDNamePadding(MagicSize, Name);
+    }
+  }
+  L.MembersOffset += L.SymbolTableSize;
+
+  if (!BSD && (LongNamesSize > 0)) {
+    L.MembersOffset += MemberHeaderSize + llvm::alignTo(LongNamesSize, 2);
+  }
+  return L;
+}
+
+llvm::Expected<ArchiveIndex::Layout>
+ArchiveIndex::computeLayout() const noexcept {
+  auto L = computeLayout(Kind);
+  if (is64Bit(Kind) || MemberOffsets.empty() ||
+      (L.MembersOffset + MemberOffsets.back() < (uint64_t{1} << 32))) {
+    return L;
+  }
+
+  // The last member starts beyond what 32-bit offsets can hold.
+  switch (Kind) {
+  case llvm::object::Archive::K_GNU: {
+    return computeLayout(llvm::object::Archive::K_GNU64);
+  }
+  case llvm::object::Archive::K_DARWIN: {
+    return computeLayout(llvm::object::Archive::K_DARWIN64);
+  }
+  default: {
+    return llvm::createStringError(
+        std::errc::file_too_large,
+        "archive too large for the BSD archive format");
+  }
+  }
+}
+
+void ArchiveIndex::writeSymbolTable(llvm::raw_ostream &OS,
+                                    const Layout &L) const noexcept {
+  if (L.SymbolTableSize == 0) {
+    return;
+  }
+
+  const bool BSD = isBSDLike(L.Kind);
+  const uint64_t OffsetSize = is64Bit(L.Kind) ? 8 : 4;
+  if (BSD) {
+    const auto Name = getBSDSymbolTableName(L.Kind);
+    const auto Padding = getBSDNamePadding(MagicSize, Name);
+    writeField(OS, "#1/" + llvm::Twine(Name.size() + Padding), 16);
+    writeHeaderFields(OS, L.SymbolTableSize - MemberHeaderSize);
+    OS << Name;
+    OS.write_zeros(Padding);
+    writeInteger(OS, L.Kind, Symbols.size() * 2 * OffsetSize);
+  } else {
+    writeField(OS, llvm::Twine(is64Bit(L.Kind) ? "/SYM64" : "") + "/", 16);
+    writeHeaderFields(OS, L.SymbolTableSize - MemberHeaderSize);
+    writeInteger(OS, L.Kind, Symbols.size());
+  }
+
+  for (const auto &Sym : Symbols) {
+    if (BSD) {
+      writeInteger(OS, L.Kind, Sym.NameOffset);
+    }
+    writeInteger(OS, L.Kind, L.MembersOffset + MemberOffsets[Sym.Member]);
+  }
+  if (BSD) {
+    writeInteger(OS, L.Kind, L.NamesSize);
+  }
+  OS << Names;
+  OS.write_zeros(L.NamesSize - Names.size());
+
+  const uint64_t Size = OffsetSize +
+                        (Symbols.size() * OffsetSize * (BSD ? 2 : 1)) +
+                        (BSD ? OffsetSize : 0) + L.NamesSize;
+  OS.write_zeros(llvm::alignTo(Size, BSD ? 8 : 2) - Size);
+}
+
+llvm::Error
+ArchiveIndex::verify(llvm::ArrayRef<llvm::NewArchiveMember> Members,
+                     const Layout &L) const noexcept {
+  if (L.Kind != Kind) {
+    return llvm::Error::success();
+  }
+
+  auto BufferOrErr =
+      llvm::writeArchiveToBuffer(Members, llvm::SymtabWritingMode::NormalSymtab,
+                                 Kind, /*Deterministic=*/true, Thin);
+  if (!BufferOrErr) {
+    return BufferOrErr.takeError();
+  }
+
+  llvm::SmallString<0> Content;
+  llvm::raw_svector_ostream OS(Content);
+  OS << (Thin ? "!<thin>\n" : "!<arch>\n");
+  writeSymbolTable(OS, L);
+
+  const auto Expected = (*BufferOrErr)->getBuffer().take_front(Content.size());
+  if (Expected == Content) {
+    return llvm::Error::success();
+  }
+  const auto Mismatch =
+      std::mismatch(Expected.begin(), Expected.end(), Content.begin());
+  return llvm::createStringError(
+      llvm::inconvertibleErrorCode(),
+      "archive index mismatch at offset %zu of the symbol table",
+      static_cast<size_t>(Mismatch.first - Expected.begin()));
+}
+
+llvm::Error ArchiveIndex::writeArchive(
+    llvm::raw_ostream &OS,
+    llvm::ArrayRef<llvm::NewArchiveMember> Members) const noexcept {
+  assert(Members.size() == MemberOffsets.size());
+
+  auto LayoutOrErr = computeLayout();
+  if (!LayoutOrErr) {
+    return LayoutOrErr.takeError();
+  }
+#ifndef NDEBUG
+  if (auto Err = verify(Members, *LayoutOrErr)) {
+    return Err;
+  }
+#endif
+  LLVM_DEBUG(llvm::dbgs() << "writing an archive index of " << Symbols.size()
+                          << " symbol(s) for " << Members.size()
+                          << " member(s)\n");
+
+  OS << (Thin ? "!<thin>\n" : "!<arch>\n");
+  writeSymbolTable(OS, *LayoutOrErr);
+
+  // Members are written by LLVM, without a symbol table, after its own magic.
+  SkipOStream MembersOS(OS, MagicSize);
+  return llvm::writeArchiveToStream(MembersOS, Members,
+                                    llvm::SymtabWritingMode::NoSymtab, Kind,
+                                    /*Deterministic=*/true, Thin);
+}
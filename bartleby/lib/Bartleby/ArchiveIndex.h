@@ -0,0 +1,173 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Archive index specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace saq::bartleby {
+
+/// \brief Symbol table of an archive, built from symbols that are already
+/// known.
+///
+/// \p llvm::writeArchive parses every member again to compute the symbol
+/// table of an archive. Instead, members and the symbols they define are
+/// declared to the index, in the order of the archive. The index lays out
+/// the members the way \p llvm::writeArchive does, writes the magic and the
+/// symbol table, and lets \p llvm::writeArchiveToStream write the members
+/// without a symbol table.
+///
+/// The GNU, GNU64, BSD and Darwin formats are supported. As with
+/// \p llvm::writeArchive, GNU and Darwin archives switch to their 64-bit
+/// variant when a member starts beyond 4GiB.
+class ArchiveIndex {
+public:
+  /// \brief Returns whether an archive format is supported.
+  ///
+  /// \param Kind Archive format.
+  ///
+  /// \returns True if the format is supported.
+  [[nodiscard]] static bool
+  supports(llvm::object::Archive::Kind Kind) noexcept;
+
+  /// \brief Constructs an empty index.
+  ///
+  /// \param Kind Archive format. It must be supported.
+  /// \param Thin Whether the archive is thin.
+  ArchiveIndex(llvm::object::Archive::Kind Kind, bool Thin) noexcept;
+
+  /// \brief Declares the next member of the archive.
+  ///
+  /// \param Member The member.
+  void addMember(const llvm::NewArchiveMember &Member) noexcept;
+
+  /// \brief Declares a symbol defined by the last declared member.
+  ///
+  /// \param Name Name of the symbol, as it appears in the final member.
+  void addSymbol(llvm::StringRef Name) noexcept;
+
+  /// \brief Writes the archive.
+  ///
+  /// In builds with assertions, the symbol table is also checked, byte for
+  /// byte, against the one written by \p llvm::writeArchiveToBuffer.
+  ///
+  /// \param OS Output stream.
+  /// \param Members Members of the archive, as declared.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error
+  writeArchive(llvm::raw_ostream &OS,
+               llvm::ArrayRef<llvm::NewArchiveMember> Members) const noexcept;
+
+private:
+  /// \brief A symbol.
+  struct Symbol {
+    /// \brief Offset of its name in \p Names.
+    uint64_t NameOffset;
+
+    /// \brief Index of the member which defines it.
+    size_t Member;
+  };
+
+  /// \brief Layout of the beginning of the archive.
+  struct Layout {
+    /// \brief Final archive format.
+    llvm::object::Archive::Kind Kind;
+
+    /// \brief Size of the symbol table member, header included, or 0 if
+    /// there is no symbol table.
+    uint64_t SymbolTableSize;
+
+    /// \brief Offset of the first member, after the magic, the symbol table
+    /// and the string table.
+    uint64_t MembersOffset;
+
+    /// \brief Size of the names of the symbol table, padding included.
+    uint64_t NamesSize;
+  };
+
+  /// \brief Computes the layout of the beginning of the archive.
+  ///
+  /// \returns The layout, or an error if the archive is too large for its
+  /// format.
+  [[nodiscard]] llvm::Expected<Layout> computeLayout() const noexcept;
+
+  /// \brief Computes the layout of the beginning of the archive, for a given
+  /// format.
+  ///
+  /// \param Kind Archive format.
+  ///
+  /// \returns The layout.
+  [[nodiscard]] Layout
+  computeLayout(llvm::object::Archive::Kind Kind) const noexcept;
+
+  /// \brief Writes the symbol table.
+  ///
+  /// \param OS Output stream.
+  /// \param L Layout of the archive.
+  void writeSymbolTable(llvm::raw_ostream &OS, const Layout &L) const noexcept;
+
+  /// \brief Checks the symbol table, byte for byte, against the one written
+  /// by \p llvm::writeArchiveToBuffer.
+  ///
+  /// \param Members Members of the archive.
+  /// \param L Layout of the archive.
+  ///
+  /// \returns An error if they differ.
+  [[nodiscard]] llvm::Error
+  verify(llvm::ArrayRef<llvm::NewArchiveMember> Members,
+         const Layout &L) const noexcept;
+
+  /// \brief Archive format, as requested.
+  llvm::object::Archive::Kind Kind;
+
+  /// \brief Whether the archive is thin.
+  bool Thin;
+
+  /// \brief Offset of each member, relative to the first member.
+  std::vector<uint64_t> MemberOffsets;
+
+  /// \brief Offset of the end of the last member, relative to the first
+  /// member.
+  uint64_t End = 0;
+
+  /// \brief Symbols.
+  std::vector<Symbol> Symbols;
+
+  /// \brief Names of the symbols, each followed by a null character.
+  llvm::SmallString<0> Names;
+
+  /// \brief Size of the GNU string table of long member names.
+  uint64_t LongNamesSize = 0;
+
+  /// \brief Long member names already in the GNU string table.
+  llvm::StringSet<> LongNames;
+};
+
+} // end namespace saq::bartleby
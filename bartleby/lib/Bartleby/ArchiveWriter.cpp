@@ -4,9 +4,14 @@
 ///
 /// \author thb-sb
 
+#include "Bartleby/ArchiveIndex.h"
 #include "Bartleby/Bartleby.h"
+#include "Bartleby/ELFRenamer.h"
 #include "Bartleby/Error.h"
 #include "Bartleby/Export.h"
+#include "Bartleby/IncrementalManifest.h"
+#include "Bartleby/MappedMember.h"
+#include "Bartleby/ObjectCache.h"
 
 #include "llvm/ObjCopy/COFF/COFFConfig.h"
 #include "llvm/ObjCopy/CommonConfig.h"
@@ -16,12 +21,30 @@
 #include "llvm/ObjCopy/ObjCopy.h"
 #include "llvm/ObjCopy/XCOFF/XCOFFConfig.h"
 #include "llvm/ObjCopy/wasm/WasmConfig.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/BinaryFormat/MachO.h"
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/ArchiveWriter.h"
-#include "llvm/Object/MachOUniversalWriter.h"
+#include "llvm/Support/BLAKE3.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/SwapByteOrder.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <unordered_map>
+#include <vector>
 
 #define DEBUG_TYPE "Bartleby"
 
@@ -29,30 +52,84 @@ using namespace saq::bartleby;
 
 namespace {
 
-/// \brief An archive to build.
-struct Archive {
-  /// \brief Archive members.
-  llvm::SmallVector<llvm::NewArchiveMember, 128> Members;
+/// \brief A slice of a fat Mach-O to build.
+struct FatSlice {
+  /// \brief Slice triple.
+  llvm::Triple Triple;
 
-  /// \brief The buffer which will contain the archive.
-  std::unique_ptr<llvm::MemoryBuffer> OutBuffer;
+  /// \brief Name of the members of the slice.
+  std::string Name;
 
-  /// \brief The final archive properties.
-  std::unique_ptr<llvm::object::Archive> OutArchive;
+  /// \brief Alignment, as a power of two.
+  uint32_t Alignment = 0;
 
-  /// \brief Archive triple.
-  llvm::Triple Triple;
+  /// \brief CPU type.
+  uint32_t CPUType = 0;
+
+  /// \brief CPU subtype.
+  uint32_t CPUSubType = 0;
 
-  /// \brief Name.
-  std::unique_ptr<std::string> Name;
+  /// \brief Indices of the objects of the slice, in the Bartleby handle.
+  std::vector<size_t> Objects;
 
-  /// \brief Alignment.
-  uint32_t Alignment;
+  /// \brief The archive of the slice, once built.
+  std::unique_ptr<llvm::MemoryBuffer> OutBuffer;
 };
 
-/// \brief A map that links an ObjectFormat with an Archive.
-using ArchiveMap =
-    std::unordered_map<ObjectFormat, Archive, ObjectFormat::Hash>;
+/// \brief Estimated peak memory of rewriting an object, as a multiple of its
+/// size: the parsed object, the model built by \p objcopy, and the output.
+constexpr uint64_t RewriteFootprintFactor = 3;
+
+/// \brief Bounds the memory used by concurrent tasks.
+///
+/// Each task reserves an estimate of its footprint before running, and waits
+/// until the reservations of the running tasks leave room for it. A task
+/// whose estimate exceeds the budget waits for all the others, then runs
+/// alone.
+class MemoryGate {
+public:
+  /// \brief Constructs a gate.
+  ///
+  /// \param Budget Budget, in bytes.
+  MemoryGate(const uint64_t Budget) noexcept : Budget(Budget) {}
+
+  /// \brief Reserves memory, waiting for enough of it to be available.
+  ///
+  /// \param Bytes Estimated footprint of the task.
+  ///
+  /// \returns The reserved amount, to give back to \p release.
+  [[nodiscard]] uint64_t acquire(uint64_t Bytes) noexcept {
+    Bytes = std::min(Bytes, Budget);
+    std::unique_lock<std::mutex> Lock(Mutex);
+    Available.wait(Lock, [&] { return InUse + Bytes <= Budget; });
+    InUse += Bytes;
+    return Bytes;
+  }
+
+  /// \brief Gives back reserved memory.
+  ///
+  /// \param Bytes Amount returned by \p acquire.
+  void release(const uint64_t Bytes) noexcept {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      InUse -= Bytes;
+    }
+    Available.notify_all();
+  }
+
+private:
+  /// \brief Budget, in bytes.
+  const uint64_t Budget;
+
+  /// \brief Reserved memory, in bytes.
+  uint64_t InUse = 0;
+
+  /// \brief Protects \p InUse.
+  std::mutex Mutex;
+
+  /// \brief Notified when memory is given back.
+  std::condition_variable Available;
+};
 
 } // end anonymous namespace
 
@@ -64,30 +141,46 @@ public:
   /// \brief Constructs an \p ArchiveWriter using a Bartleby handle.
   ///
   /// \param[in] B Bartleby handle.
-  ArchiveWriter(Bartleby &&B) noexcept : Handle(std::move(B)) {
-    const auto End = Handle.Symbols.end();
-    for (auto Entry = Handle.Symbols.begin(); Entry != End; ++Entry) {
-      const auto &Name = Entry->first();
-      const auto &Sym = Entry->getValue();
-      if (const auto OName = Sym.getOverwriteName(); OName) {
+  /// \param Options Build options.
+  ArchiveWriter(Bartleby &&B, const BuildOptions &Options) noexcept
+      : Options(Options), Handle(std::move(B)) {
+    if (this->Options.Stats == nullptr) {
+      this->Options.Stats = Handle.Stats;
+    }
+    if (Handle.MemoryBudget != 0) {
+      this->Options.StreamMembers = true;
+    }
+    llvm::SmallString<128> Storage;
+    for (const auto &Entry : Handle.Symbols) {
+      const auto Name = Entry.first();
+      if (const auto NewName = Entry.getValue().getNewName(Name, Storage)) {
         LLVM_DEBUG(llvm::dbgs() << "bartleby is going to rename '" << Name
-                                << "' into '" << *OName << "'\n");
-        CommonConfig.SymbolsToRename[Name] = *OName;
+                                << "' into '" << *NewName << "'\n");
+        CommonConfig.SymbolsToRename[Name] = NameSaver.save(*NewName);
       }
     }
   }
 
   /// \brief Constructs the slices needed for a fat Mach-O.
   ///
+  /// Objects are rewritten, then the archive of each slice is written, both
+  /// on a thread pool if more than one thread was requested. Slices are
+  /// ordered by first appearance of their object format in the Bartleby
+  /// handle.
+  ///
   /// \param[out] Slices Vector where to store slices.
-  /// \param[out] Archives Vector where to write archives.
   ///
   /// \returns An error.
-  [[nodiscard]] llvm::Error buildMachOUniversalBinarySlices(
-      llvm::SmallVectorImpl<llvm::object::Slice> &Slices,
-      ArchiveMap &Archives) noexcept {
+  [[nodiscard]] llvm::Error
+  buildMachOUniversalBinarySlices(std::vector<FatSlice> &Slices) noexcept {
     assert(Handle.isMachOUniversalBinary());
 
+    if (isThin()) {
+      return llvm::createStringError(
+          std::errc::not_supported,
+          "thin archives cannot be built out of fat Mach-O binaries");
+    }
+
     const auto &ObjFmtSet = std::get<ObjectFormatSet>(Handle.ObjFormat);
 
     LLVM_DEBUG(for (const auto &Fmt
@@ -95,58 +188,134 @@ public:
       llvm::dbgs() << "object format in fat Mach-O: " << Fmt << '\n';
     });
 
-    Archives.reserve(ObjFmtSet.size());
     Slices.reserve(ObjFmtSet.size());
-
-    for (const auto &Obj : Handle.Objects) {
+    std::unordered_map<ObjectFormat, size_t, ObjectFormat::Hash> SliceIndices;
+    for (size_t I = 0; I < Handle.Objects.size(); ++I) {
+      const auto &Obj = Handle.Objects[I];
       const auto Triple = Obj.Handle->makeTriple();
       LLVM_DEBUG(llvm::dbgs()
                  << "got object, triple is " << Triple.str()
                  << ", object format is " << ObjectFormat{Triple} << '\n');
       assert(ObjFmtSet.count(Triple) == 1);
-      auto FinalObjOrErr = executeObjCopyOnObject(Obj);
-      if (!FinalObjOrErr) {
-        return FinalObjOrErr.takeError();
-      }
-      auto &Ar = Archives[ObjectFormat{Triple}];
-      Ar.Triple = Triple;
-      Ar.Alignment = Obj.Alignment;
-      auto &ArMember = Ar.Members.emplace_back();
-      ArMember.Buf = std::move(*FinalObjOrErr);
-      Ar.Name = std::make_unique<std::string>(Triple.str());
-      ArMember.MemberName = *Ar.Name;
-    }
-
-    for (auto &[Fmt, Ar] : Archives) {
-      if (auto BufferOrErr = llvm::writeArchiveToBuffer(
-              Ar.Members, llvm::SymtabWritingMode::NormalSymtab,
-              Ar.Members[0].detectKindFromObject(),
-              /* Deterministic=*/true, /*Thin=*/false)) {
-        Ar.OutBuffer = std::move(*BufferOrErr);
-      } else {
-        return BufferOrErr.takeError();
+      const auto [It, Inserted] =
+          SliceIndices.try_emplace(ObjectFormat{Triple}, Slices.size());
+      if (Inserted) {
+        auto &Slice = Slices.emplace_back();
+        Slice.Triple = Triple;
+        Slice.Name = Triple.str();
+        auto CPUTypeOrErr = llvm::MachO::getCPUType(Triple);
+        if (!CPUTypeOrErr) {
+          return CPUTypeOrErr.takeError();
+        }
+        auto CPUSubTypeOrErr = llvm::MachO::getCPUSubType(Triple);
+        if (!CPUSubTypeOrErr) {
+          return CPUSubTypeOrErr.takeError();
+        }
+        Slice.CPUType = *CPUTypeOrErr;
+        Slice.CPUSubType = *CPUSubTypeOrErr;
       }
+      auto &Slice = Slices[It->second];
+      Slice.Alignment = Obj.Alignment;
+      Slice.Objects.push_back(I);
+    }
 
-      auto NewArOrErr = llvm::object::Archive::create(*Ar.OutBuffer);
-      if (!NewArOrErr) {
-        return NewArOrErr.takeError();
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> Buffers;
+    if (auto Err = rewriteObjects(Buffers)) {
+      return Err;
+    }
+
+    return forEachIndex(Slices.size(), [&](const size_t I) -> llvm::Error {
+      auto &Slice = Slices[I];
+      llvm::SmallVector<llvm::NewArchiveMember, 128> Members;
+      Members.reserve(Slice.Objects.size());
+      for (const auto Index : Slice.Objects) {
+        auto &Member = Members.emplace_back();
+        Member.Buf = std::move(Buffers[Index]);
+        Member.MemberName = Slice.Name;
       }
 
-      auto CPUTypeOrErr = llvm::MachO::getCPUType(Ar.Triple);
-      if (!CPUTypeOrErr) {
-        return CPUTypeOrErr.takeError();
+      Statistics::Scope S(Options.Stats, Statistics::Phase::WriteArchive);
+      S.Objects = Members.size();
+      S.BytesIn = getMembersSize(Members);
+      llvm::SmallVector<char, 0> Content;
+      llvm::raw_svector_ostream OS(Content);
+      if (auto Err =
+              writeArchive(OS, Members, Slice.Objects, /*Thin=*/false)) {
+        return Err;
       }
+      S.BytesOut = Content.size();
+      Slice.OutBuffer = std::make_unique<llvm::SmallVectorMemoryBuffer>(
+          std::move(Content), false);
+      return llvm::Error::success();
+    });
+  }
 
-      auto CPUSubTypeOrErr = llvm::MachO::getCPUSubType(Ar.Triple);
-      if (!CPUSubTypeOrErr) {
-        return CPUSubTypeOrErr.takeError();
+  /// \brief Computes the architecture table of a fat Mach-O.
+  ///
+  /// Each slice is placed right after the previous one, aligned on its
+  /// alignment, as \p llvm::object::writeUniversalBinary does.
+  ///
+  /// \param Slices Slices, with their archive built.
+  ///
+  /// \returns The architecture table, in host byte order, or an error.
+  [[nodiscard]] static llvm::Expected<
+      llvm::SmallVector<llvm::MachO::fat_arch, 3>>
+  layoutMachOUniversalBinary(llvm::ArrayRef<FatSlice> Slices) noexcept {
+    llvm::SmallVector<llvm::MachO::fat_arch, 3> Archs;
+    uint64_t Offset = sizeof(llvm::MachO::fat_header) +
+                      (Slices.size() * sizeof(llvm::MachO::fat_arch));
+    for (const auto &Slice : Slices) {
+      Offset = llvm::alignTo(Offset, uint64_t{1} << Slice.Alignment);
+      const auto Size = Slice.OutBuffer->getBufferSize();
+      if (Offset + Size > UINT32_MAX) {
+        return llvm::createStringError(
+            std::errc::file_too_large,
+            "fat Mach-O too large: slice %s does not fit in 32-bit offsets",
+            Slice.Name.c_str());
       }
-      Ar.OutArchive = std::move(*NewArOrErr);
-      Slices.emplace_back(*Ar.OutArchive, *CPUTypeOrErr, *CPUSubTypeOrErr,
-                          Ar.Triple.str(), Ar.Alignment);
+      auto &Arch = Archs.emplace_back();
+      Arch.cputype = Slice.CPUType;
+      Arch.cpusubtype = Slice.CPUSubType;
+      Arch.offset = static_cast<uint32_t>(Offset);
+      Arch.size = static_cast<uint32_t>(Size);
+      Arch.align = Slice.Alignment;
+      Offset += Size;
     }
+    return Archs;
+  }
 
-    return llvm::Error::success();
+  /// \brief Writes a fat Mach-O to a stream.
+  ///
+  /// The archive of each slice is written as is, without being parsed again.
+  ///
+  /// \param Slices Slices, with their archive built.
+  /// \param Archs Architecture table, from \p layoutMachOUniversalBinary.
+  /// \param OS Output stream.
+  static void
+  writeMachOUniversalBinary(llvm::ArrayRef<FatSlice> Slices,
+                            llvm::ArrayRef<llvm::MachO::fat_arch> Archs,
+                            llvm::raw_ostream &OS) noexcept {
+    llvm::MachO::fat_header Header;
+    Header.magic = llvm::MachO::FAT_MAGIC;
+    Header.nfat_arch = static_cast<uint32_t>(Archs.size());
+    if (llvm::sys::IsLittleEndianHost) {
+      llvm::MachO::swapStruct(Header);
+    }
+    OS.write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+    for (auto Arch : Archs) {
+      if (llvm::sys::IsLittleEndianHost) {
+        llvm::MachO::swapStruct(Arch);
+      }
+      OS.write(reinterpret_cast<const char *>(&Arch), sizeof(Arch));
+    }
+
+    uint64_t Offset = sizeof(llvm::MachO::fat_header) +
+                      (Archs.size() * sizeof(llvm::MachO::fat_arch));
+    for (size_t I = 0; I < Slices.size(); ++I) {
+      OS.write_zeros(Archs[I].offset - Offset);
+      OS << Slices[I].OutBuffer->getBuffer();
+      Offset = Archs[I].offset + Archs[I].size;
+    }
   }
 
   /// \brief Builds a fat Mach-O file and writes the output to a file.
@@ -156,14 +325,57 @@ public:
   /// \returns An error.
   [[nodiscard]] llvm::Error
   buildMachOUniversalBinary(llvm::StringRef OutFilepath) noexcept {
-    llvm::SmallVector<llvm::object::Slice, 3> Slices;
-    ArchiveMap Archives;
+    std::vector<FatSlice> Slices;
+    if (auto Err = buildMachOUniversalBinarySlices(Slices)) {
+      return Err;
+    }
+    auto ArchsOrErr = layoutMachOUniversalBinary(Slices);
+    if (!ArchsOrErr) {
+      return ArchsOrErr.takeError();
+    }
+
+    Statistics::Scope S(Options.Stats, Statistics::Phase::WriteArchive);
+    llvm::SmallString<128> Model(OutFilepath);
+    Model += ".temp-%%%%%%%%";
+    auto TmpOrErr = llvm::sys::fs::TempFile::create(Model);
+    if (!TmpOrErr) {
+      return TmpOrErr.takeError();
+    }
+    {
+      llvm::raw_fd_ostream OS(TmpOrErr->FD, /*shouldClose=*/false);
+      writeMachOUniversalBinary(Slices, *ArchsOrErr, OS);
+      OS.flush();
+      if (const auto EC = OS.error()) {
+        OS.clear_error();
+        llvm::consumeError(TmpOrErr->discard());
+        return llvm::createFileError(TmpOrErr->TmpName, EC);
+      }
+      S.BytesOut = OS.tell();
+    }
+    return TmpOrErr->keep(OutFilepath);
+  }
 
-    if (auto Err = buildMachOUniversalBinarySlices(Slices, Archives)) {
+  /// \brief Builds a fat Mach-O file and writes its content to a stream.
+  ///
+  /// \param OS Output stream.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error
+  buildMachOUniversalBinary(llvm::raw_ostream &OS) noexcept {
+    std::vector<FatSlice> Slices;
+    if (auto Err = buildMachOUniversalBinarySlices(Slices)) {
       return Err;
     }
+    auto ArchsOrErr = layoutMachOUniversalBinary(Slices);
+    if (!ArchsOrErr) {
+      return ArchsOrErr.takeError();
+    }
 
-    return llvm::object::writeUniversalBinary(Slices, OutFilepath);
+    Statistics::Scope S(Options.Stats, Statistics::Phase::WriteArchive);
+    const auto Start = OS.tell();
+    writeMachOUniversalBinary(Slices, *ArchsOrErr, OS);
+    S.BytesOut = OS.tell() - Start;
+    return llvm::Error::success();
   }
 
   /// \brief Builds a fat Mach-O file and returns its content.
@@ -171,43 +383,114 @@ public:
   /// \returns A memory buffer, or an error.
   [[nodiscard]] llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
   buildMachOUniversalBinary() noexcept {
-    llvm::SmallVector<llvm::object::Slice, 3> Slices;
-    ArchiveMap Archives;
-
-    if (auto Err = buildMachOUniversalBinarySlices(Slices, Archives)) {
+    std::vector<FatSlice> Slices;
+    if (auto Err = buildMachOUniversalBinarySlices(Slices)) {
       return Err;
     }
-
-    llvm::SmallVector<char, 8192> Content;
-    llvm::raw_svector_ostream OS(Content);
-
-    if (auto Err = llvm::object::writeUniversalBinaryToStream(Slices, OS)) {
-      return Err;
+    auto ArchsOrErr = layoutMachOUniversalBinary(Slices);
+    if (!ArchsOrErr) {
+      return ArchsOrErr.takeError();
     }
 
+    Statistics::Scope S(Options.Stats, Statistics::Phase::WriteArchive);
+    llvm::SmallVector<char, 0> Content;
+    if (!ArchsOrErr->empty()) {
+      Content.reserve(ArchsOrErr->back().offset + ArchsOrErr->back().size);
+    }
+    llvm::raw_svector_ostream OS(Content);
+    writeMachOUniversalBinary(Slices, *ArchsOrErr, OS);
+    S.BytesOut = Content.size();
     return std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(Content),
                                                            false);
   }
 
+  /// \brief Checks that the handle has objects to write.
+  ///
+  /// An archive must have at least one member, from which its format is
+  /// detected. The handle may have none if no binary was added, or if
+  /// \p Bartleby::pruneUnreachableObjects removed all of them.
+  ///
+  /// \returns An error if the handle has no object.
+  [[nodiscard]] llvm::Error checkHasObjects() const noexcept {
+    if (Handle.Objects.empty()) {
+      return llvm::createStringError(std::errc::invalid_argument,
+                                     "no object to write in the archive");
+    }
+    return llvm::Error::success();
+  }
+
   /// \brief Builds the final archive and writes the content to a file.
   ///
   /// \param OutFilepath Path to out file.
   ///
   /// \returns An error.
   [[nodiscard]] llvm::Error build(llvm::StringRef OutFilepath) noexcept {
+    if (auto Err = checkHasObjects()) {
+      return Err;
+    }
     if (Handle.isMachOUniversalBinary()) {
       return buildMachOUniversalBinary(OutFilepath);
     }
 
+    openIncremental(Options.PreviousArchivePath.empty()
+                        ? OutFilepath
+                        : llvm::StringRef(Options.PreviousArchivePath));
     if (auto Err = executeObjCopyOnObjects()) {
       return Err;
     }
 
-    return llvm::writeArchive(OutFilepath, ArMembers,
-                              llvm::SymtabWritingMode::NormalSymtab,
-                              ArMembers[0].detectKindFromObject(),
-                              /* Deterministic= */ true,
-                              /* Thin= */ false);
+    {
+      Statistics::Scope S(Options.Stats, Statistics::Phase::WriteArchive);
+      S.Objects = ArMembers.size();
+      S.BytesIn = getMembersSize(ArMembers);
+      if (auto Err = writeThinMembers(OutFilepath)) {
+        return Err;
+      }
+      if (auto Err = llvm::writeToOutput(
+              OutFilepath, [&](llvm::raw_ostream &OS) -> llvm::Error {
+                return writeArchive(OS, ArMembers, getObjectIndices(),
+                                    isThin());
+              })) {
+        return Err;
+      }
+      S.BytesOut = getFileSize(OutFilepath);
+    }
+    return closeIncremental();
+  }
+
+  /// \brief Builds the final archive and writes its content to a stream.
+  ///
+  /// \param OS Output stream.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error build(llvm::raw_ostream &OS) noexcept {
+    if (auto Err = checkHasObjects()) {
+      return Err;
+    }
+    if (Handle.isMachOUniversalBinary()) {
+      return buildMachOUniversalBinary(OS);
+    }
+
+    openIncremental(Options.PreviousArchivePath);
+    if (auto Err = executeObjCopyOnObjects()) {
+      return Err;
+    }
+
+    {
+      Statistics::Scope S(Options.Stats, Statistics::Phase::WriteArchive);
+      S.Objects = ArMembers.size();
+      S.BytesIn = getMembersSize(ArMembers);
+      if (auto Err = writeThinMembers(/*ArchivePath=*/{})) {
+        return Err;
+      }
+      const auto Start = OS.tell();
+      if (auto Err =
+              writeArchive(OS, ArMembers, getObjectIndices(), isThin())) {
+        return Err;
+      }
+      S.BytesOut = OS.tell() - Start;
+    }
+    return closeIncremental();
   }
 
   /// \brief Builds the final archive and returns its content.
@@ -215,19 +498,35 @@ public:
   /// \returns A memory buffer or an error.
   [[nodiscard]] llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
   build() noexcept {
+    if (auto Err = checkHasObjects()) {
+      return Err;
+    }
     if (Handle.isMachOUniversalBinary()) {
       return buildMachOUniversalBinary();
     }
 
+    openIncremental(Options.PreviousArchivePath);
     if (auto Err = executeObjCopyOnObjects()) {
       return Err;
     }
 
-    return llvm::writeArchiveToBuffer(ArMembers,
-                                      llvm::SymtabWritingMode::NormalSymtab,
-                                      ArMembers[0].detectKindFromObject(),
-                                      /* Deterministic= */ true,
-                                      /* Thin= */ false);
+    Statistics::Scope S(Options.Stats, Statistics::Phase::WriteArchive);
+    S.Objects = ArMembers.size();
+    S.BytesIn = getMembersSize(ArMembers);
+    if (auto Err = writeThinMembers(/*ArchivePath=*/{})) {
+      return Err;
+    }
+    llvm::SmallVector<char, 0> Content;
+    llvm::raw_svector_ostream OS(Content);
+    if (auto Err = writeArchive(OS, ArMembers, getObjectIndices(), isThin())) {
+      return Err;
+    }
+    S.BytesOut = Content.size();
+    if (auto Err = closeIncremental()) {
+      return Err;
+    }
+    return std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(Content),
+                                                           false);
   }
 
   ~ArchiveWriter() noexcept override = default;
@@ -262,42 +561,769 @@ public:
   }
 
 private:
+  /// \brief Returns the total size of archive members.
+  ///
+  /// \param Members Archive members.
+  ///
+  /// \returns The size, in bytes.
+  [[nodiscard]] static uint64_t
+  getMembersSize(llvm::ArrayRef<llvm::NewArchiveMember> Members) noexcept {
+    uint64_t Size = 0;
+    for (const auto &Member : Members) {
+      Size += Member.Buf->getBufferSize();
+    }
+    return Size;
+  }
+
+  /// \brief Returns the size of a file.
+  ///
+  /// \param Path Path to the file.
+  ///
+  /// \returns The size, in bytes, or 0 if it cannot be retrieved.
+  [[nodiscard]] static uint64_t getFileSize(llvm::StringRef Path) noexcept {
+    uint64_t Size = 0;
+    if (llvm::sys::fs::file_size(Path, Size)) {
+      return 0;
+    }
+    return Size;
+  }
+
   /// \brief Executes \p objcopy on an object.
   ///
-  /// \param Obj The object.
+  /// If \p BuildOptions::FastRename is set, the ELF fast path is tried
+  /// first.
+  ///
+  /// \param Obj The parsed object.
   ///
   /// \returns The content of the final object, or an error.
   [[nodiscard]] llvm::Expected<std::unique_ptr<llvm::SmallVectorMemoryBuffer>>
-  executeObjCopyOnObject(const ObjectFile &Obj) noexcept {
+  executeObjCopyOnObject(llvm::object::ObjectFile &Obj) noexcept {
+    Statistics::Scope S(Options.Stats, Statistics::Phase::ObjCopy);
+    S.Objects = 1;
+    S.BytesIn = Obj.getData().size();
+
+    if (Options.FastRename) {
+      auto FinalObjOrErr = renameELFSymbols(Obj, CommonConfig.SymbolsToRename);
+      if (!FinalObjOrErr) {
+        return FinalObjOrErr;
+      }
+      if (*FinalObjOrErr != nullptr) {
+        S.BytesOut = (*FinalObjOrErr)->getBufferSize();
+        return FinalObjOrErr;
+      }
+    }
+
     llvm::SmallVector<char, 8192> Content;
     llvm::raw_svector_ostream OS(Content);
     if (auto Err =
-            llvm::objcopy::executeObjcopyOnBinary(*this, *Obj.Handle, OS)) {
+            llvm::objcopy::executeObjcopyOnBinary(*this, Obj, OS)) {
       return Err;
     }
+    S.BytesOut = Content.size();
     return std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(Content),
                                                            false);
   }
 
-  /// \brief Executes \p objcopy on objects belonging to the Bartleby handle.
+  /// \brief Returns whether an object defines or references a renamed
+  /// symbol.
+  ///
+  /// Objects which do not are copied verbatim into the final archive,
+  /// instead of being rewritten.
+  ///
+  /// \param Obj The object.
+  ///
+  /// \returns True if at least one of its symbols is renamed.
+  [[nodiscard]] bool
+  touchesRenamedSymbol(const ObjectFile &Obj) const noexcept {
+    return llvm::any_of(Obj.Uses, [this](const SymbolUse &Use) {
+      return Handle.Symbols.getEntry(Use.ID).getValue().isRenamed();
+    });
+  }
+
+  /// \brief Returns the index of each object of the handle, in order.
+  ///
+  /// \returns The indices, i.e. the object of each member of \p ArMembers.
+  [[nodiscard]] std::vector<size_t> getObjectIndices() const noexcept {
+    std::vector<size_t> Indices(Handle.Objects.size());
+    std::iota(Indices.begin(), Indices.end(), size_t{0});
+    return Indices;
+  }
+
+  /// \brief Writes an archive.
+  ///
+  /// The symbol table is built from the symbols collected from the objects,
+  /// under their new name, instead of parsing the rewritten members again.
+  /// Formats not supported by \p ArchiveIndex are written by
+  /// \p llvm::writeArchiveToStream.
+  ///
+  /// \param OS Output stream.
+  /// \param Members Members of the archive.
+  /// \param Objects Index, in the handle, of the object of each member.
+  /// \param Thin Whether the archive is thin.
   ///
   /// \returns An error.
-  [[nodiscard]] llvm::Error executeObjCopyOnObjects() noexcept {
-    LLVM_DEBUG(llvm::dbgs()
-               << "processing " << Handle.Objects.size() << " object(s)\n");
-    for (auto &Obj : Handle.Objects) {
-      if (auto FinalObjOrErr = executeObjCopyOnObject(Obj)) {
-        auto &ArMember = ArMembers.emplace_back();
-        ArMember.Buf = std::move(*FinalObjOrErr);
-        ArMember.MemberName = Obj.Name;
+  [[nodiscard]] llvm::Error
+  writeArchive(llvm::raw_ostream &OS,
+               llvm::ArrayRef<llvm::NewArchiveMember> Members,
+               llvm::ArrayRef<size_t> Objects, bool Thin) const noexcept {
+    assert(Members.size() == Objects.size());
+    assert(!Members.empty());
+    const auto Kind = Members[0].detectKindFromObject();
+    if (!ArchiveIndex::supports(Kind)) {
+      return llvm::writeArchiveToStream(OS, Members,
+                                        llvm::SymtabWritingMode::NormalSymtab,
+                                        Kind, /* Deterministic= */ true, Thin);
+    }
+
+    ArchiveIndex Index(Kind, Thin);
+    llvm::SmallString<128> Storage;
+    for (size_t I = 0; I < Members.size(); ++I) {
+      Index.addMember(Members[I]);
+      for (const auto ID : Handle.Objects[Objects[I]].ArchiveSymbols) {
+        const auto &Entry = Handle.Symbols.getEntry(ID);
+        const auto Name = Entry.first();
+        Index.addSymbol(
+            Entry.getValue().getNewName(Name, Storage).value_or(Name));
+      }
+    }
+    return Index.writeArchive(OS, Members);
+  }
+
+  /// \brief Returns whether the output is a thin archive.
+  ///
+  /// \returns True if \p BuildOptions::ThinMembersDirectory is set.
+  [[nodiscard]] bool isThin() const noexcept {
+    return !Options.ThinMembersDirectory.empty();
+  }
+
+  /// \brief Writes a file, unless it already has the expected content.
+  ///
+  /// The file is replaced atomically, so that a mapping of its previous
+  /// content is not affected.
+  ///
+  /// \param Path Path to the file.
+  /// \param Content Expected content.
+  ///
+  /// \returns An error.
+  [[nodiscard]] static llvm::Error
+  writeFileIfChanged(llvm::StringRef Path, llvm::StringRef Content) noexcept {
+    if (auto BufOrErr =
+            llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+        BufOrErr && ((*BufOrErr)->getBuffer() == Content)) {
+      return llvm::Error::success();
+    }
+
+    llvm::SmallString<128> Model(Path);
+    Model += ".tmp-%%%%%%%%";
+    auto TmpOrErr = llvm::sys::fs::TempFile::create(Model);
+    if (!TmpOrErr) {
+      return TmpOrErr.takeError();
+    }
+    {
+      llvm::raw_fd_ostream OS(TmpOrErr->FD, /*shouldClose=*/false);
+      OS << Content;
+      OS.flush();
+      if (const auto EC = OS.error()) {
+        OS.clear_error();
+        llvm::consumeError(TmpOrErr->discard());
+        return llvm::createFileError(TmpOrErr->TmpName, EC);
+      }
+    }
+    return TmpOrErr->keep(Path);
+  }
+
+  /// \brief Writes the archive members to their own file, if the output is a
+  /// thin archive.
+  ///
+  /// Members are written to \p BuildOptions::ThinMembersDirectory, under
+  /// their name. Names used by several members are prefixed with the index
+  /// of the member. Their name in the archive is then replaced by the path
+  /// of their file.
+  ///
+  /// \param ArchivePath Path to the archive, to which member paths are made
+  /// relative. If empty, member paths are absolute.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error
+  writeThinMembers(llvm::StringRef ArchivePath) noexcept {
+    if (!isThin()) {
+      return llvm::Error::success();
+    }
+    assert(!ArMembers.empty());
+    const auto Kind = ArMembers[0].detectKindFromObject();
+    if ((Kind != llvm::object::Archive::K_GNU) &&
+        (Kind != llvm::object::Archive::K_GNU64)) {
+      return llvm::createStringError(
+          std::errc::not_supported,
+          "thin archives are only supported for the GNU archive format");
+    }
+
+    llvm::SmallString<128> Directory(Options.ThinMembersDirectory);
+    if (const auto EC = llvm::sys::fs::make_absolute(Directory)) {
+      return llvm::createFileError(Directory, EC);
+    }
+    if (const auto EC = llvm::sys::fs::create_directories(Directory)) {
+      return llvm::createFileError(Directory, EC);
+    }
+
+    llvm::StringSet<> FileNames;
+    std::vector<llvm::SmallString<128>> Paths(ArMembers.size());
+    for (size_t I = 0; I < ArMembers.size(); ++I) {
+      std::string FileName =
+          llvm::sys::path::filename(ArMembers[I].MemberName).str();
+      while (FileName.empty() || !FileNames.insert(FileName).second) {
+        FileName = llvm::utostr(I) + "-" + FileName;
+      }
+      Paths[I] = Directory;
+      llvm::sys::path::append(Paths[I], FileName);
+    }
+
+    if (auto Err =
+            forEachIndex(ArMembers.size(), [&](const size_t I) -> llvm::Error {
+              return writeFileIfChanged(Paths[I],
+                                        ArMembers[I].Buf->getBuffer());
+            })) {
+      return Err;
+    }
+
+    for (size_t I = 0; I < ArMembers.size(); ++I) {
+      if (ArchivePath.empty()) {
+        ArMembers[I].MemberName = NameSaver.save(Paths[I].str());
+        continue;
+      }
+      auto PathOrErr = llvm::computeArchiveRelativePath(ArchivePath, Paths[I]);
+      if (!PathOrErr) {
+        return PathOrErr.takeError();
+      }
+      ArMembers[I].MemberName = NameSaver.save(*PathOrErr);
+    }
+    return llvm::Error::success();
+  }
+
+  /// \brief Opens the rewrite cache, if \p BuildOptions::CacheDirectory is
+  /// set.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error openCache() noexcept {
+    if (Options.CacheDirectory.empty()) {
+      return llvm::Error::success();
+    }
+    auto CacheOrErr =
+        ObjectCache::open(Options.CacheDirectory, Options.CachePolicy);
+    if (!CacheOrErr) {
+      return CacheOrErr.takeError();
+    }
+    Cache = std::move(*CacheOrErr);
+    return llvm::Error::success();
+  }
+
+  /// \brief Prunes the rewrite cache and reports its statistics.
+  void closeCache() noexcept {
+    if (!Cache) {
+      return;
+    }
+    Cache->prune();
+    LLVM_DEBUG(llvm::dbgs() << "rewrite cache: " << Cache->getHits()
+                            << " hit(s), " << Cache->getMisses()
+                            << " miss(es)\n");
+    if (Options.Stats != nullptr) {
+      Options.Stats->recordCacheLookups(Cache->getHits(), Cache->getMisses());
+    }
+    Cache.reset();
+  }
+
+  /// \brief Computes the key of an object in the rewrite cache.
+  ///
+  /// The key is a digest of the content of the object and of the renames
+  /// that apply to its symbols, in the order of its symbol table. Renames
+  /// which do not concern the object do not change its key.
+  ///
+  /// \param Obj The parsed object.
+  ///
+  /// \returns The key.
+  [[nodiscard]] std::string
+  getCacheKey(const llvm::object::ObjectFile &Obj) const noexcept {
+    llvm::BLAKE3 Hasher;
+    Hasher.update("bartleby-rewrite-cache-v1");
+    Hasher.update(getRewriteMode());
+    const auto Content = Obj.getData();
+    Hasher.update(llvm::utohexstr(Content.size()));
+    Hasher.update(Content);
+
+    const auto &Renames = CommonConfig.SymbolsToRename;
+    for (const auto &Sym : Obj.symbols()) {
+      auto NameOrErr = Sym.getName();
+      if (!NameOrErr) {
+        llvm::consumeError(NameOrErr.takeError());
+        continue;
+      }
+      if (const auto It = Renames.find(*NameOrErr); It != Renames.end()) {
+        Hasher.update(It->first());
+        Hasher.update(llvm::StringRef("\0", 1));
+        Hasher.update(It->second);
+        Hasher.update(llvm::StringRef("\0", 1));
+      }
+    }
+    const auto Digest = Hasher.final();
+    return llvm::toHex(Digest, /*LowerCase=*/true);
+  }
+
+  /// \brief Returns how objects are rewritten.
+  ///
+  /// \returns The rewrite mode.
+  [[nodiscard]] llvm::StringRef getRewriteMode() const noexcept {
+    return Options.FastRename ? "fast" : "objcopy";
+  }
+
+  /// \brief Computes the digest of some content.
+  ///
+  /// \param Content The content.
+  ///
+  /// \returns The digest, as an hexadecimal string.
+  [[nodiscard]] static std::string getDigest(llvm::StringRef Content) noexcept {
+    llvm::BLAKE3 Hasher;
+    Hasher.update(Content);
+    const auto Digest = Hasher.final();
+    return llvm::toHex(Digest, /*LowerCase=*/true);
+  }
+
+  /// \brief Prepares an incremental build, if \p BuildOptions::ManifestPath
+  /// is set.
+  ///
+  /// The manifest of the previous build and the previous output archive are
+  /// loaded, if they exist and match each other. Otherwise, no member is
+  /// reused.
+  ///
+  /// \param PreviousArchivePath Path to the previous output archive.
+  void openIncremental(llvm::StringRef PreviousArchivePath) noexcept {
+    if (Options.ManifestPath.empty()) {
+      return;
+    }
+    NextManifest.emplace(getRewriteMode());
+    NextManifest->getMembers().resize(Handle.Objects.size());
+
+    auto ManifestOrErr = IncrementalManifest::read(Options.ManifestPath);
+    if (!ManifestOrErr) {
+      auto Err = ManifestOrErr.takeError();
+      LLVM_DEBUG(llvm::dbgs() << "not reusing any member: " << Err << '\n');
+      llvm::consumeError(std::move(Err));
+      return;
+    }
+    if (ManifestOrErr->getRewriteMode() != getRewriteMode()) {
+      LLVM_DEBUG(llvm::dbgs() << "not reusing any member: rewrite mode "
+                              << "changed\n");
+      return;
+    }
+    if (PreviousArchivePath.empty()) {
+      return;
+    }
+
+    // The archive is mapped, whatever its size, so that reused members do
+    // not stay on the heap until the new archive is written.
+    auto BufOrErr = mapFile(PreviousArchivePath);
+    if (!BufOrErr) {
+      LLVM_DEBUG(llvm::dbgs() << "not reusing any member: cannot open "
+                              << PreviousArchivePath << '\n');
+      llvm::consumeError(BufOrErr.takeError());
+      return;
+    }
+    auto ArOrErr = llvm::object::Archive::create(**BufOrErr);
+    if (!ArOrErr) {
+      auto Err = ArOrErr.takeError();
+      LLVM_DEBUG(llvm::dbgs() << "not reusing any member: " << Err << '\n');
+      llvm::consumeError(std::move(Err));
+      return;
+    }
+
+    std::vector<llvm::StringRef> Members;
+    Members.reserve(ManifestOrErr->getMembers().size());
+    llvm::Error Err = llvm::Error::success();
+    for (const auto &Child : (*ArOrErr)->children(Err)) {
+      auto DataOrErr = Child.getBuffer();
+      if (!DataOrErr) {
+        llvm::consumeError(DataOrErr.takeError());
+        llvm::consumeError(std::move(Err));
+        return;
+      }
+      Members.push_back(*DataOrErr);
+    }
+    if (Err) {
+      LLVM_DEBUG(llvm::dbgs() << "not reusing any member: " << Err << '\n');
+      llvm::consumeError(std::move(Err));
+      return;
+    }
+    if (Members.size() != ManifestOrErr->getMembers().size()) {
+      LLVM_DEBUG(llvm::dbgs() << "not reusing any member: the manifest does "
+                              << "not match " << PreviousArchivePath << '\n');
+      return;
+    }
+
+    PreviousManifest.emplace(std::move(*ManifestOrErr));
+    PreviousMembers = std::move(Members);
+    PreviousArchiveReader = std::move(*ArOrErr);
+    PreviousArchive = std::move(*BufOrErr);
+  }
+
+  /// \brief Writes the manifest of an incremental build, and reports the
+  /// number of reused members.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error closeIncremental() noexcept {
+    if (!NextManifest) {
+      return llvm::Error::success();
+    }
+    LLVM_DEBUG(llvm::dbgs() << "reused " << ReusedMembers << " of "
+                            << Handle.Objects.size() << " member(s)\n");
+    if (Options.Stats != nullptr) {
+      Options.Stats->recordReusedMembers(ReusedMembers);
+    }
+    return NextManifest->write(Options.ManifestPath);
+  }
+
+  /// \brief Describes an object for the manifest of an incremental build.
+  ///
+  /// \param Obj The object.
+  /// \param Parsed The parsed object.
+  /// \param[out] Record Where to store the description. Its output digest is
+  /// left untouched.
+  void describeObject(const ObjectFile &Obj,
+                      const llvm::object::ObjectFile &Parsed,
+                      IncrementalManifest::Member &Record) const noexcept {
+    Record.Name = Obj.Name.str();
+    Record.InputDigest = getDigest(Parsed.getData());
+
+    const auto &Renames = CommonConfig.SymbolsToRename;
+    for (const auto &Sym : Parsed.symbols()) {
+      auto NameOrErr = Sym.getName();
+      if (!NameOrErr) {
+        llvm::consumeError(NameOrErr.takeError());
+        continue;
+      }
+      auto FlagsOrErr = Sym.getFlags();
+      if (!FlagsOrErr) {
+        llvm::consumeError(FlagsOrErr.takeError());
+        continue;
+      }
+      if (NameOrErr->empty()) {
+        continue;
+      }
+      if (*FlagsOrErr & llvm::object::BasicSymbolRef::Flags::SF_Undefined) {
+        Record.References.push_back(NameOrErr->str());
       } else {
-        return FinalObjOrErr.takeError();
+        Record.Defines.push_back(NameOrErr->str());
+      }
+      if (const auto It = Renames.find(*NameOrErr); It != Renames.end()) {
+        Record.Renames.emplace_back(It->first().str(), It->second.str());
       }
     }
+    llvm::sort(Record.Renames);
+    Record.Renames.erase(
+        std::unique(Record.Renames.begin(), Record.Renames.end()),
+        Record.Renames.end());
+  }
+
+  /// \brief Looks up an object in the previous build of an incremental
+  /// build.
+  ///
+  /// A member is reused if its original object and the renames applied to
+  /// it did not change, and if the previous output archive still contains
+  /// it as it was written.
+  ///
+  /// \param[in,out] Record Description of the object. Its output digest is
+  /// set if the previous member is reused.
+  ///
+  /// \returns The previous member, or a null pointer if it cannot be reused.
+  [[nodiscard]] std::unique_ptr<llvm::MemoryBuffer>
+  reusePreviousMember(IncrementalManifest::Member &Record) noexcept {
+    if (!PreviousManifest) {
+      return nullptr;
+    }
+    const auto *Previous =
+        PreviousManifest->findByInputDigest(Record.InputDigest);
+    if ((Previous == nullptr) || (Previous->Renames != Record.Renames)) {
+      return nullptr;
+    }
+    const auto Data =
+        PreviousMembers[Previous - PreviousManifest->getMembers().data()];
+    if (getDigest(Data) != Previous->OutputDigest) {
+      return nullptr;
+    }
+    ++ReusedMembers;
+    Record.OutputDigest = Previous->OutputDigest;
+    return viewMember(*PreviousArchive, Data, Record.Name);
+  }
+
+  /// \brief Prepares a final member to be kept until the archive is
+  /// written.
+  ///
+  /// Final members are rewritten, found in the rewrite cache, or reused from
+  /// the previous build of an incremental build, and all of them go through
+  /// here. With \p BuildOptions::StreamMembers, which a memory budget
+  /// implies, they must not stay on the heap: members that are not mapped
+  /// from a file are spilled to one.
+  ///
+  /// \param Member The final member.
+  ///
+  /// \returns The member to keep, or an error.
+  [[nodiscard]] llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+  keepMember(std::unique_ptr<llvm::MemoryBuffer> Member) noexcept {
+    if (!Options.StreamMembers ||
+        (Member->getBufferKind() == llvm::MemoryBuffer::MemoryBuffer_MMap)) {
+      return std::move(Member);
+    }
+    return spillMember(Member->getBuffer(), Options.TemporaryDirectory);
+  }
+
+  /// \brief Rewrites an object, and spills it to disk if
+  /// \p BuildOptions::StreamMembers is set. See \p keepMember.
+  ///
+  /// If a rewrite cache is opened, the object is looked up first, and
+  /// stored after being rewritten. Failing to store an object in the cache
+  /// is not an error.
+  ///
+  /// If \p Record is given, the object is described there for the manifest of
+  /// an incremental build, and the member of the previous build is reused
+  /// if possible.
+  ///
+  /// \param Obj The object.
+  /// \param[out] Record Where to describe the object, or a null pointer.
+  ///
+  /// \returns The content of the final object, or an error.
+  [[nodiscard]] llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+  rewriteObject(const ObjectFile &Obj,
+                IncrementalManifest::Member *Record = nullptr) noexcept {
+    const bool Passthrough = !touchesRenamedSymbol(Obj);
+    if (Passthrough && (Record == nullptr)) {
+      ++PassthroughMembers;
+      return llvm::MemoryBuffer::getMemBuffer(Obj.Buffer,
+                                              /*RequiresNullTerminator=*/false);
+    }
+
+    // The object may have been released under a memory budget, in which case
+    // it is parsed again for the duration of the rewrite.
+    std::unique_ptr<llvm::object::Binary> Storage;
+    auto ParsedOrErr = parseObject(Obj, Storage);
+    if (!ParsedOrErr) {
+      return ParsedOrErr.takeError();
+    }
+    auto &Parsed = **ParsedOrErr;
+
+    if (Record != nullptr) {
+      describeObject(Obj, Parsed, *Record);
+    }
+    if (Passthrough) {
+      ++PassthroughMembers;
+      Record->OutputDigest = Record->InputDigest;
+      return llvm::MemoryBuffer::getMemBuffer(Obj.Buffer,
+                                              /*RequiresNullTerminator=*/false);
+    }
+    if (Record != nullptr) {
+      if (auto Previous = reusePreviousMember(*Record)) {
+        return keepMember(std::move(Previous));
+      }
+    }
+
+    std::string Key;
+    if (Cache) {
+      Key = getCacheKey(Parsed);
+      if (auto Cached = Cache->lookup(Key)) {
+        if (Record != nullptr) {
+          Record->OutputDigest = getDigest(Cached->getBuffer());
+        }
+        return keepMember(std::move(Cached));
+      }
+    }
+
+    auto FinalObjOrErr = executeObjCopyOnObject(Parsed);
+    if (!FinalObjOrErr) {
+      return FinalObjOrErr.takeError();
+    }
+    if (Cache) {
+      if (auto Err = Cache->store(Key, (*FinalObjOrErr)->getBuffer())) {
+        LLVM_DEBUG(llvm::dbgs() << "failed to store " << Obj.Name
+                                << " in the rewrite cache: " << Err << '\n');
+        llvm::consumeError(std::move(Err));
+      }
+    }
+    if (Record != nullptr) {
+      Record->OutputDigest = getDigest((*FinalObjOrErr)->getBuffer());
+    }
+    return keepMember(std::move(*FinalObjOrErr));
+  }
+
+  /// \brief Runs a task for each index in [0, N), on a thread pool if more
+  /// than one thread was requested.
+  ///
+  /// If several tasks fail, the error of the one with the lowest index is
+  /// returned, so that the result does not depend on scheduling.
+  ///
+  /// \param N Number of tasks.
+  /// \param Task Task to run, taking an index and returning an error.
+  ///
+  /// \returns An error.
+  template <typename Fn>
+  [[nodiscard]] llvm::Error forEachIndex(const size_t N, Fn &&Task) noexcept {
+    size_t ErrIndex = N;
+    llvm::Error Err = llvm::Error::success();
+    std::mutex ErrMutex;
+
+    const auto Run = [&](const size_t I) {
+      auto TaskErr = Task(I);
+      if (!TaskErr) {
+        return;
+      }
+      std::lock_guard<std::mutex> Lock(ErrMutex);
+      if (I < ErrIndex) {
+        llvm::consumeError(std::move(Err));
+        Err = std::move(TaskErr);
+        ErrIndex = I;
+      } else {
+        llvm::consumeError(std::move(TaskErr));
+      }
+    };
+
+    if ((Options.Threads == 1) || (N < 2)) {
+      for (size_t I = 0; (I < N) && (ErrIndex == N); ++I) {
+        Run(I);
+      }
+    } else {
+      std::optional<llvm::ThreadPool> OwnPool;
+      auto &Pool =
+          (Handle.Pool != nullptr)
+              ? *Handle.Pool
+              : OwnPool.emplace(llvm::hardware_concurrency(Options.Threads));
+      for (size_t I = 0; I < N; ++I) {
+        Pool.async(Run, I);
+      }
+      Pool.wait();
+    }
+
+    return Err;
+  }
+
+  /// \brief Rewrites the objects belonging to the Bartleby handle.
+  ///
+  /// Objects are rewritten on a thread pool if more than one thread was
+  /// requested, as long as their estimated footprint fits in the memory
+  /// budget of the handle, if any. If several objects fail, the error of the
+  /// first one is returned. Shared duplicates are not rewritten: they reuse
+  /// the final object of their original object.
+  ///
+  /// \param[out] Buffers Where to store the final objects, in the order of
+  /// \p Handle.Objects.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error rewriteObjects(
+      std::vector<std::unique_ptr<llvm::MemoryBuffer>> &Buffers) noexcept {
+    const auto &Objects = Handle.Objects;
+    LLVM_DEBUG(llvm::dbgs() << "processing " << Objects.size()
+                            << " object(s) using " << Options.Threads
+                            << " thread(s)\n");
+
+    if (auto Err = openCache()) {
+      return Err;
+    }
+
+    std::optional<MemoryGate> Gate;
+    if (Handle.MemoryBudget != 0) {
+      Gate.emplace(Handle.MemoryBudget);
+    }
+
+    // Duplicates share the content of their original object, and so the
+    // final object it is rewritten into. See Bartleby::setDuplicateMembers.
+    std::vector<size_t> Originals(Objects.size());
+    std::iota(Originals.begin(), Originals.end(), size_t{0});
+    std::vector<size_t> Rewritten;
+    if (Handle.DuplicatesMode == DuplicateMembers::Share) {
+      llvm::DenseMap<const char *, size_t> ByContent;
+      for (size_t I = 0; I < Objects.size(); ++I) {
+        Originals[I] =
+            ByContent.try_emplace(Objects[I].Buffer.getBufferStart(), I)
+                .first->second;
+        if (Originals[I] == I) {
+          Rewritten.push_back(I);
+        }
+      }
+    } else {
+      Rewritten = Originals;
+    }
+
+    Buffers.resize(Objects.size());
+    if (auto Err = forEachIndex(
+            Rewritten.size(), [&](const size_t J) -> llvm::Error {
+              const auto I = Rewritten[J];
+              const auto Reserved =
+                  Gate ? Gate->acquire(RewriteFootprintFactor *
+                                       Objects[I].Buffer.getBufferSize())
+                       : 0;
+              auto FinalObjOrErr = rewriteObject(
+                  Objects[I],
+                  NextManifest ? &NextManifest->getMembers()[I] : nullptr);
+              if (Gate) {
+                Gate->release(Reserved);
+              }
+              if (!FinalObjOrErr) {
+                return FinalObjOrErr.takeError();
+              }
+              Buffers[I] = std::move(*FinalObjOrErr);
+              return llvm::Error::success();
+            })) {
+      return Err;
+    }
+    closeCache();
+
+    for (size_t I = 0; I < Objects.size(); ++I) {
+      const auto Original = Originals[I];
+      if (Original == I) {
+        continue;
+      }
+      Buffers[I] = llvm::MemoryBuffer::getMemBuffer(
+          Buffers[Original]->getMemBufferRef(),
+          /*RequiresNullTerminator=*/false);
+      if (NextManifest) {
+        auto &Members = NextManifest->getMembers();
+        Members[I] = Members[Original];
+        Members[I].Name = Objects[I].Name.str();
+      }
+    }
+
+    LLVM_DEBUG(llvm::dbgs() << "copied " << PassthroughMembers << " of "
+                            << Objects.size() << " object(s) verbatim\n");
+    if (Options.Stats != nullptr) {
+      Options.Stats->recordPassthroughMembers(PassthroughMembers);
+    }
+
+    return llvm::Error::success();
+  }
+
+  /// \brief Executes \p objcopy on objects belonging to the Bartleby handle.
+  ///
+  /// Archive members are always appended in the order of \p Handle.Objects.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error executeObjCopyOnObjects() noexcept {
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> Buffers;
+    if (auto Err = rewriteObjects(Buffers)) {
+      return Err;
+    }
+
+    const auto &Objects = Handle.Objects;
+    for (size_t I = 0; I < Objects.size(); ++I) {
+      auto &ArMember = ArMembers.emplace_back();
+      ArMember.Buf = std::move(Buffers[I]);
+      ArMember.MemberName = Objects[I].Name;
+    }
 
     return llvm::Error::success();
   }
 
+  /// \brief Arena holding the new names of symbols.
+  llvm::BumpPtrAllocator NameArena;
+
+  /// \brief Saver of the new names of symbols, into \p NameArena.
+  llvm::StringSaver NameSaver{NameArena};
+
   /// \brief Common config.
   llvm::objcopy::CommonConfig CommonConfig;
 
@@ -319,19 +1345,56 @@ private:
   /// \brief Archive members.
   llvm::SmallVector<llvm::NewArchiveMember, 128> ArMembers;
 
+  /// \brief Build options.
+  BuildOptions Options;
+
+  /// \brief Rewrite cache, opened for the duration of the rewrite.
+  std::unique_ptr<ObjectCache> Cache;
+
+  /// \brief Manifest of the previous build, if it can be reused.
+  std::optional<IncrementalManifest> PreviousManifest;
+
+  /// \brief Output archive of the previous build.
+  std::unique_ptr<llvm::MemoryBuffer> PreviousArchive;
+
+  /// \brief Reader of \p PreviousArchive, which owns the members of a thin
+  /// archive.
+  std::unique_ptr<llvm::object::Archive> PreviousArchiveReader;
+
+  /// \brief Members of \p PreviousArchive, in the order of
+  /// \p PreviousManifest.
+  std::vector<llvm::StringRef> PreviousMembers;
+
+  /// \brief Manifest of the current build, if incremental.
+  std::optional<IncrementalManifest> NextManifest;
+
+  /// \brief Number of members reused from the previous build.
+  std::atomic<size_t> ReusedMembers = 0;
+
+  /// \brief Number of members copied verbatim.
+  std::atomic<size_t> PassthroughMembers = 0;
+
   /// \brief Bartleby handle.
   Bartleby Handle;
 };
 
 BARTLEBY_API llvm::Error
-Bartleby::buildFinalArchive(Bartleby &&B,
-                            llvm::StringRef OutFilepath) noexcept {
-  ArchiveWriter Builder(std::move(B));
+Bartleby::buildFinalArchive(Bartleby &&B, llvm::StringRef OutFilepath,
+                            const BuildOptions &Options) noexcept {
+  ArchiveWriter Builder(std::move(B), Options);
   return Builder.build(OutFilepath);
 }
 
+BARTLEBY_API llvm::Error
+Bartleby::buildFinalArchive(Bartleby &&B, llvm::raw_ostream &OS,
+                            const BuildOptions &Options) noexcept {
+  ArchiveWriter Builder(std::move(B), Options);
+  return Builder.build(OS);
+}
+
 BARTLEBY_API llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
-Bartleby::buildFinalArchive(Bartleby &&B) noexcept {
-  ArchiveWriter Builder(std::move(B));
+Bartleby::buildFinalArchive(Bartleby &&B,
+                            const BuildOptions &Options) noexcept {
+  ArchiveWriter Builder(std::move(B), Options);
   return Builder.build();
 }
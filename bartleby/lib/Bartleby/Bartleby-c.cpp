@@ -22,8 +22,10 @@
 #include "Bartleby/Bartleby.h"
 
 #include "llvm/Object/Binary.h"
+#include "llvm/Support/FormatVariadic.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include <memory>
 
@@ -42,6 +44,78 @@ struct BartlebyHandle {
   bartleby::Bartleby B;
 };
 
+/// \brief Definition of the statistics.
+struct BartlebyStatistics {
+  /// Statistics object.
+  bartleby::Statistics Stats;
+};
+
+namespace {
+
+/// \brief Copies a string to a NUL-terminated buffer allocated using
+/// \p malloc.
+///
+/// \param Str String to copy.
+/// \param[out] s Destination buffer.
+/// \param[out] n Size of `s`, not including the NUL terminator.
+///
+/// \returns 0 on success, else an error code.
+[[nodiscard]] int copyString(llvm::StringRef Str, char **s,
+                             size_t *n) noexcept {
+  *s = static_cast<char *>(::malloc(Str.size() + 1));
+  if (*s == nullptr) {
+    return ENOMEM;
+  }
+  ::memcpy(*s, Str.data(), Str.size());
+  (*s)[Str.size()] = '\0';
+  *n = Str.size();
+  return 0;
+}
+
+/// \brief Output stream passing its content to a user callback.
+class WriterOStream final : public llvm::raw_ostream {
+public:
+  /// \brief Constructs a stream.
+  ///
+  /// \param Write Callback receiving the content.
+  /// \param Ctx User context given to \p Write.
+  WriterOStream(saq_bartleby_write_fn Write, void *Ctx) noexcept
+      : Write(Write), Ctx(Ctx) {
+    SetBufferSize(1 << 16);
+  }
+
+  ~WriterOStream() override { flush(); }
+
+  /// \brief Returns the error code returned by the callback.
+  ///
+  /// \returns 0 if the callback never failed, else its error code.
+  [[nodiscard]] int getError() const noexcept { return Err; }
+
+private:
+  void write_impl(const char *Ptr, size_t Size) override {
+    if ((Err == 0) && (Size > 0)) {
+      Err = Write(Ctx, Ptr, Size);
+    }
+    Pos += Size;
+  }
+
+  uint64_t current_pos() const override { return Pos; }
+
+  /// \brief Callback receiving the content.
+  saq_bartleby_write_fn Write;
+
+  /// \brief User context.
+  void *Ctx;
+
+  /// \brief Number of bytes written.
+  uint64_t Pos = 0;
+
+  /// \brief Error code returned by the callback.
+  int Err = 0;
+};
+
+} // end anonymous namespace
+
 extern "C" {
 
 struct BartlebyHandle *saq_bartleby_new(void) { return new BartlebyHandle{}; }
@@ -62,6 +136,92 @@ int saq_bartleby_set_prefix(struct BartlebyHandle *bh, const char *prefix) {
   return 0;
 }
 
+int saq_bartleby_set_prefix_with_policy(struct BartlebyHandle *bh,
+                                        const char *prefix,
+                                        const char *policy, size_t n) {
+  if (bh == nullptr) {
+    return EINVAL;
+  }
+
+  if ((prefix == nullptr) || (policy == nullptr)) {
+    return EINVAL;
+  }
+
+  auto PolicyOrErr =
+      bartleby::RenamePolicy::parse(llvm::StringRef(policy, n));
+  if (!PolicyOrErr) {
+    llvm::consumeError(PolicyOrErr.takeError());
+    return EINVAL;
+  }
+  bh->B.applyRenamePolicy(*PolicyOrErr, prefix);
+
+  return 0;
+}
+
+int saq_bartleby_set_hashed_names(struct BartlebyHandle *bh,
+                                  const char *prefix) {
+  if (bh == nullptr) {
+    return EINVAL;
+  }
+
+  if (prefix == nullptr) {
+    return EINVAL;
+  }
+
+  bh->B.hashGlobalAndDefinedSymbols(prefix);
+
+  return 0;
+}
+
+int saq_bartleby_set_memory_budget(struct BartlebyHandle *bh,
+                                   const uint64_t bytes) {
+  if (bh == nullptr) {
+    return EINVAL;
+  }
+
+  bh->B.setMemoryBudget(bytes);
+
+  return 0;
+}
+
+int saq_bartleby_set_duplicate_members(struct BartlebyHandle *bh,
+                                       const int mode) {
+  if (bh == nullptr) {
+    return EINVAL;
+  }
+
+  bartleby::DuplicateMembers Mode;
+  switch (mode) {
+  case SAQ_BARTLEBY_DUPLICATES_KEEP: {
+    Mode = bartleby::DuplicateMembers::Keep;
+    break;
+  }
+  case SAQ_BARTLEBY_DUPLICATES_SHARE: {
+    Mode = bartleby::DuplicateMembers::Share;
+    break;
+  }
+  case SAQ_BARTLEBY_DUPLICATES_COLLAPSE: {
+    Mode = bartleby::DuplicateMembers::Collapse;
+    break;
+  }
+  default: {
+    return EINVAL;
+  }
+  }
+  bh->B.setDuplicateMembers(Mode);
+
+  return 0;
+}
+
+int saq_bartleby_get_num_duplicates(struct BartlebyHandle *bh, size_t *n) {
+  if ((bh == nullptr) || (n == nullptr)) {
+    return EINVAL;
+  }
+
+  *n = bh->B.getDuplicates().size();
+  return 0;
+}
+
 int saq_bartleby_add_binary(struct BartlebyHandle *bh, const void *s,
                             const size_t n) {
   if (bh == nullptr) {
@@ -92,6 +252,36 @@ int saq_bartleby_add_binary(struct BartlebyHandle *bh, const void *s,
   return 0;
 }
 
+int saq_bartleby_add_binary_borrowed(struct BartlebyHandle *bh,
+                                     const void *s, const size_t n) {
+  if (bh == nullptr) {
+    return EINVAL;
+  }
+
+  if (s == nullptr) {
+    return EINVAL;
+  }
+
+  if (n == 0) {
+    return EINVAL;
+  }
+  auto Buffer = llvm::MemoryBuffer::getMemBuffer(
+      llvm::StringRef(static_cast<const char *>(s), n), "",
+      /*RequiresNullTerminator=*/false);
+
+  if (auto BinOrErr = llvm::object::createBinary(*Buffer)) {
+    if (auto Err = bh->B.addBinary({std::move(*BinOrErr), std::move(Buffer)})) {
+      llvm::consumeError(std::move(Err));
+      return EINVAL;
+    }
+  } else {
+    llvm::consumeError(BinOrErr.takeError());
+    return EINVAL;
+  }
+
+  return 0;
+}
+
 int saq_bartleby_build_archive(struct BartlebyHandle *bh, void **s, size_t *n) {
   std::unique_ptr<struct BartlebyHandle> handle(bh);
 
@@ -123,4 +313,218 @@ int saq_bartleby_build_archive(struct BartlebyHandle *bh, void **s, size_t *n) {
   return EINVAL;
 }
 
+int saq_bartleby_build_archive_to_fd(struct BartlebyHandle *bh, int fd) {
+  std::unique_ptr<struct BartlebyHandle> handle(bh);
+
+  if (handle == nullptr) {
+    return EINVAL;
+  }
+
+  if (fd < 0) {
+    return EBADF;
+  }
+
+  llvm::raw_fd_ostream OS(fd, /*shouldClose=*/false);
+  auto Err = bartleby::Bartleby::buildFinalArchive(std::move(handle->B), OS);
+  OS.flush();
+  if (const auto EC = OS.error()) {
+    OS.clear_error();
+    llvm::consumeError(std::move(Err));
+    return EC.value();
+  }
+  if (Err) {
+    llvm::consumeError(std::move(Err));
+    return EINVAL;
+  }
+  return 0;
+}
+
+int saq_bartleby_build_archive_to_writer(struct BartlebyHandle *bh,
+                                         saq_bartleby_write_fn write,
+                                         void *ctx) {
+  std::unique_ptr<struct BartlebyHandle> handle(bh);
+
+  if (handle == nullptr) {
+    return EINVAL;
+  }
+
+  if (write == nullptr) {
+    return EINVAL;
+  }
+
+  WriterOStream OS(write, ctx);
+  auto Err = bartleby::Bartleby::buildFinalArchive(std::move(handle->B), OS);
+  OS.flush();
+  if (OS.getError() != 0) {
+    llvm::consumeError(std::move(Err));
+    return OS.getError();
+  }
+  if (Err) {
+    llvm::consumeError(std::move(Err));
+    return EINVAL;
+  }
+  return 0;
+}
+
+int saq_bartleby_get_num_objects(struct BartlebyHandle *bh, size_t *n) {
+  if ((bh == nullptr) || (n == nullptr)) {
+    return EINVAL;
+  }
+
+  *n = bh->B.getNumObjects();
+  return 0;
+}
+
+int saq_bartleby_get_object_name(struct BartlebyHandle *bh, size_t object,
+                                 char **s, size_t *n) {
+  if (bh == nullptr) {
+    return EINVAL;
+  }
+
+  if ((s == nullptr) || (n == nullptr)) {
+    return EINVAL;
+  }
+  *s = nullptr;
+  *n = 0;
+
+  if (object >= bh->B.getNumObjects()) {
+    return ERANGE;
+  }
+  return copyString(bh->B.getObjectName(object), s, n);
+}
+
+int saq_bartleby_get_occurrences(struct BartlebyHandle *bh, const char *name,
+                                 struct BartlebyOccurrence **occurrences,
+                                 size_t *n) {
+  if ((bh == nullptr) || (name == nullptr)) {
+    return EINVAL;
+  }
+
+  if ((occurrences == nullptr) || (n == nullptr)) {
+    return EINVAL;
+  }
+  *occurrences = nullptr;
+  *n = 0;
+
+  const auto Occurrences = bh->B.getOccurrences(name);
+  if (Occurrences.empty()) {
+    return 0;
+  }
+  *occurrences = static_cast<struct BartlebyOccurrence *>(
+      ::malloc(Occurrences.size() * sizeof(struct BartlebyOccurrence)));
+  if (*occurrences == nullptr) {
+    return ENOMEM;
+  }
+  for (size_t I = 0; I < Occurrences.size(); ++I) {
+    (*occurrences)[I] = BartlebyOccurrence{
+        .object = Occurrences[I].Object,
+        .defined = Occurrences[I].Defined,
+        .binding = static_cast<uint8_t>(Occurrences[I].Bind),
+    };
+  }
+  *n = Occurrences.size();
+  return 0;
+}
+
+int saq_bartleby_write_dependency_graph(struct BartlebyHandle *bh, int format,
+                                        saq_bartleby_write_fn write,
+                                        void *ctx) {
+  if ((bh == nullptr) || (write == nullptr)) {
+    return EINVAL;
+  }
+
+  bartleby::GraphFormat Format;
+  switch (format) {
+  case SAQ_BARTLEBY_GRAPH_BINARY: {
+    Format = bartleby::GraphFormat::Binary;
+    break;
+  }
+  case SAQ_BARTLEBY_GRAPH_DOT: {
+    Format = bartleby::GraphFormat::DOT;
+    break;
+  }
+  case SAQ_BARTLEBY_GRAPH_JSON: {
+    Format = bartleby::GraphFormat::JSON;
+    break;
+  }
+  default: {
+    return EINVAL;
+  }
+  }
+
+  WriterOStream OS(write, ctx);
+  bh->B.writeDependencyGraph(OS, Format);
+  OS.flush();
+  return OS.getError();
+}
+
+int saq_bartleby_write_rename_map(struct BartlebyHandle *bh,
+                                  saq_bartleby_write_fn write, void *ctx) {
+  if ((bh == nullptr) || (write == nullptr)) {
+    return EINVAL;
+  }
+
+  WriterOStream OS(write, ctx);
+  bh->B.writeRenameMap(OS);
+  OS.flush();
+  return OS.getError();
+}
+
+struct BartlebyStatistics *saq_bartleby_statistics_new(void) {
+  return new BartlebyStatistics{};
+}
+
+void saq_bartleby_statistics_free(struct BartlebyStatistics *stats) {
+  delete stats;
+}
+
+int saq_bartleby_set_statistics(struct BartlebyHandle *bh,
+                                struct BartlebyStatistics *stats) {
+  if (bh == nullptr) {
+    return EINVAL;
+  }
+
+  bh->B.setStatistics(stats != nullptr ? &stats->Stats : nullptr);
+
+  return 0;
+}
+
+int saq_bartleby_statistics_to_json(const struct BartlebyStatistics *stats,
+                                    char **s, size_t *n) {
+  if (stats == nullptr) {
+    return EINVAL;
+  }
+
+  if ((s == nullptr) || (n == nullptr)) {
+    return EINVAL;
+  }
+  *s = nullptr;
+  *n = 0;
+
+  std::string JSON;
+  llvm::raw_string_ostream OS(JSON);
+  OS << llvm::formatv("{0}", stats->Stats.toJSON());
+  OS.flush();
+  return copyString(JSON, s, n);
+}
+
+int saq_bartleby_statistics_report(const struct BartlebyStatistics *stats,
+                                   char **s, size_t *n) {
+  if (stats == nullptr) {
+    return EINVAL;
+  }
+
+  if ((s == nullptr) || (n == nullptr)) {
+    return EINVAL;
+  }
+  *s = nullptr;
+  *n = 0;
+
+  std::string Report;
+  llvm::raw_string_ostream OS(Report);
+  stats->Stats.printReport(OS);
+  OS.flush();
+  return copyString(Report, s, n);
+}
+
 } // end extern "C"
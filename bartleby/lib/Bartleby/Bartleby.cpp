@@ -23,10 +23,23 @@
 #include "Bartleby/Error.h"
 #include "Bartleby/Export.h"
 #include "Bartleby/Symbol.h"
+#include "Bartleby/SymbolScanner.h"
 
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/MachOUniversal.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 #define DEBUG_TYPE "bartleby"
 
@@ -60,18 +73,6 @@ getSymbolInfo(const llvm::object::SymbolRef &Sym) noexcept {
   return Info;
 }
 
-/// \brief Collects all the information of all symbols from an object.
-///
-/// \param Obj Object.
-/// \param[out] SymInfos Container where to store the symbol infos.
-void collectSymbolInfos(const llvm::object::ObjectFile *Obj,
-                        llvm::SmallVectorImpl<SymbolInfo> &SymInfos) noexcept {
-  for (const auto &Sym : Obj->symbols()) {
-    auto &Info = SymInfos.emplace_back(getSymbolInfo(Sym));
-    Info.ObjectType = Obj->getTripleObjectFormat();
-  }
-}
-
 /// \brief Determines if we should skip a symbol based on its information.
 ///
 /// \param SymInfo Symbol information.
@@ -98,29 +99,249 @@ void collectSymbolInfos(const llvm::object::ObjectFile *Obj,
   return false;
 }
 
+/// \brief Determines if a symbol belongs to the symbol table of an archive.
+///
+/// This follows what \p llvm::writeArchive does.
+///
+/// \param SymInfo Symbol information.
+///
+/// \returns True if the symbol is global, defined, and not format specific.
+[[nodiscard]] bool isArchiveSymbol(const SymbolInfo &SymInfo) noexcept {
+  const auto Flags = *SymInfo.Flags;
+  return ((Flags & llvm::object::BasicSymbolRef::Flags::SF_Global) != 0) &&
+         ((Flags & llvm::object::BasicSymbolRef::Flags::SF_Undefined) == 0) &&
+         ((Flags & llvm::object::BasicSymbolRef::Flags::SF_FormatSpecific) ==
+          0);
+}
+
+/// \brief Describes the use of a symbol by an object.
+///
+/// \param ID Identifier of the symbol.
+/// \param SymInfo Symbol information.
+///
+/// \returns The use.
+[[nodiscard]] SymbolUse getSymbolUse(const SymbolID ID,
+                                     const SymbolInfo &SymInfo) noexcept {
+  const auto Flags = *SymInfo.Flags;
+  auto Bind = Binding::Local;
+  if ((Flags & llvm::object::BasicSymbolRef::Flags::SF_Weak) != 0) {
+    Bind = Binding::Weak;
+  } else if ((Flags & llvm::object::BasicSymbolRef::Flags::SF_Global) != 0) {
+    Bind = Binding::Global;
+  }
+  return SymbolUse{
+      .ID = ID,
+      .Defined =
+          (Flags & llvm::object::BasicSymbolRef::Flags::SF_Undefined) == 0,
+      .Bind = Bind,
+  };
+}
+
+/// \brief Returns the flags of a symbol from its use in an object.
+///
+/// This is the reverse of \p getSymbolUse, restricted to the flags
+/// \p Symbol::updateWithNewSymbolInfo relies on.
+///
+/// \param Use The use of the symbol.
+///
+/// \returns The flags.
+[[nodiscard]] uint32_t getSymbolFlags(const SymbolUse &Use) noexcept {
+  uint32_t Flags = llvm::object::BasicSymbolRef::Flags::SF_None;
+  if (!Use.Defined) {
+    Flags |= llvm::object::BasicSymbolRef::Flags::SF_Undefined;
+  }
+  if (Use.Bind == Binding::Weak) {
+    Flags |= llvm::object::BasicSymbolRef::Flags::SF_Weak |
+             llvm::object::BasicSymbolRef::Flags::SF_Global;
+  } else if (Use.Bind == Binding::Global) {
+    Flags |= llvm::object::BasicSymbolRef::Flags::SF_Global;
+  }
+  return Flags;
+}
+
+/// \brief Attaches the name of the input binary an error comes from.
+///
+/// \param Input Name of the input binary. If empty, the error is returned
+/// as is.
+/// \param Err The error.
+///
+/// \returns The error.
+[[nodiscard]] llvm::Error makeInputError(llvm::StringRef Input,
+                                         llvm::Error Err) noexcept {
+  if (Input.empty()) {
+    return Err;
+  }
+  return llvm::createFileError(Input, std::move(Err));
+}
+
+/// \brief Records a symbol of an object.
+///
+/// \param SymInfo Symbol information.
+/// \param[out] Symbols Symbol map to update.
+/// \param[out] ArchiveSymbols Where to append the identifier of the symbol if
+/// it belongs to the symbol table of an archive. Can be null.
+/// \param[out] Uses Where to append the use of the symbol. Can be null.
+void processSymbol(const SymbolInfo &SymInfo, Bartleby::SymbolMap &Symbols,
+                   std::vector<SymbolID> *ArchiveSymbols,
+                   std::vector<SymbolUse> *Uses) noexcept {
+  const auto ID = Symbols.insert(*SymInfo.Name).first;
+  Symbols.getEntry(ID).getValue().updateWithNewSymbolInfo(SymInfo);
+  if ((ArchiveSymbols != nullptr) && isArchiveSymbol(SymInfo)) {
+    ArchiveSymbols->push_back(ID);
+  }
+  if (Uses != nullptr) {
+    Uses->push_back(getSymbolUse(ID, SymInfo));
+  }
+}
+
 /// \brief Processes an object file.
 ///
+/// ELF and Mach-O objects go through a scanner specialized for their format,
+/// other ones through the generic \p llvm::object::SymbolRef interface.
+///
 /// \param Object The object file.
 /// \param[out] Symbols Symbol map to update.
+/// \param Stats Where to record statistics. Can be null.
+/// \param[out] ArchiveSymbols Where to append the identifiers of the symbols
+/// that belong to the symbol table of an archive. Can be null.
+/// \param[out] Uses Where to append the uses of all the symbols of the
+/// object. Can be null.
 void ProcessObjectFile(const llvm::object::ObjectFile *Object,
-                       Bartleby::SymbolMap &Symbols) {
-  llvm::SmallVector<SymbolInfo, 128> SymInfos;
-  collectSymbolInfos(Object, SymInfos);
-  for (const auto &SymInfo : SymInfos) {
+                       Bartleby::SymbolMap &Symbols, Statistics *Stats,
+                       std::vector<SymbolID> *ArchiveSymbols = nullptr,
+                       std::vector<SymbolUse> *Uses = nullptr) {
+  Statistics::Scope S(Stats, Statistics::Phase::ProcessObjectFile);
+  S.Objects = 1;
+  S.BytesIn = Object->getData().size();
+  const auto ObjectType = Object->getTripleObjectFormat();
+
+  const auto NumSymbols = scanSymbols(
+      *Object, [&](llvm::StringRef Name, const uint32_t Flags) {
+        SymbolInfo SymInfo;
+        SymInfo.Name = Name;
+        SymInfo.Flags = Flags;
+        SymInfo.ObjectType = ObjectType;
+        processSymbol(SymInfo, Symbols, ArchiveSymbols, Uses);
+      });
+  if (NumSymbols) {
+    S.Symbols = *NumSymbols;
+    return;
+  }
+
+  for (const auto &Sym : Object->symbols()) {
+    auto SymInfo = getSymbolInfo(Sym);
+    SymInfo.ObjectType = ObjectType;
+    ++S.Symbols;
     if (shouldSkipSymbol(SymInfo)) {
       continue;
     }
 
-    std::string Name(*SymInfo.Name);
-
     LLVM_DEBUG(llvm::dbgs()
-               << "Found symbol '" << Name << "', type: " << *SymInfo.Type
-               << ", flags: " << *SymInfo.Flags << '\n');
-    auto &Sym = Symbols[Name];
-    Sym.updateWithNewSymbolInfo(SymInfo);
+               << "Found symbol '" << *SymInfo.Name << "', type: "
+               << *SymInfo.Type << ", flags: " << *SymInfo.Flags << '\n');
+    processSymbol(SymInfo, Symbols, ArchiveSymbols, Uses);
   }
 }
 
+/// \brief A read-only memory mapping of a whole file.
+class MappedFile final : public llvm::MemoryBuffer {
+public:
+  /// \brief Maps a file.
+  ///
+  /// \param Path Path to the file.
+  ///
+  /// \returns The mapped file, or an error.
+  [[nodiscard]] static llvm::Expected<std::unique_ptr<MappedFile>>
+  create(llvm::StringRef Path) noexcept {
+    auto FDOrErr = llvm::sys::fs::openNativeFileForRead(Path);
+    if (!FDOrErr) {
+      return FDOrErr.takeError();
+    }
+    auto FD = *FDOrErr;
+
+    std::unique_ptr<MappedFile> File(new MappedFile(Path));
+    llvm::sys::fs::file_status Status;
+    std::error_code EC = llvm::sys::fs::status(FD, Status);
+    if (!EC && (Status.getSize() > 0)) {
+      File->Region = llvm::sys::fs::mapped_file_region(
+          FD, llvm::sys::fs::mapped_file_region::readonly, Status.getSize(),
+          0, EC);
+    }
+    llvm::sys::fs::closeFile(FD);
+    if (EC) {
+      return llvm::errorCodeToError(EC);
+    }
+
+    if (File->Region) {
+      File->init(File->Region.const_data(),
+                 File->Region.const_data() + File->Region.size(),
+                 /*RequiresNullTerminator=*/false);
+    } else {
+      File->init("", "", /*RequiresNullTerminator=*/false);
+    }
+    return File;
+  }
+
+  llvm::StringRef getBufferIdentifier() const override { return Path; }
+
+  BufferKind getBufferKind() const override { return MemoryBuffer_MMap; }
+
+private:
+  /// \brief Constructs an empty mapping.
+  ///
+  /// \param Path Path to the file.
+  MappedFile(llvm::StringRef Path) noexcept : Path(Path) {}
+
+  /// \brief Path to the file.
+  std::string Path;
+
+  /// \brief The mapping.
+  llvm::sys::fs::mapped_file_region Region;
+};
+
+/// \brief Number of base-62 digits of a hashed name.
+constexpr size_t HashedNameDigits = 8;
+
+/// \brief Builds the hashed name of a symbol.
+///
+/// \param Name Name of the symbol.
+/// \param Prefix Prefix.
+/// \param MachO Whether the symbol is a Mach-O one, in which case its
+/// leading underscore is kept.
+/// \param Attempt Number of previous attempts that led to a collision.
+/// \param[out] Storage Storage for the new name.
+///
+/// \returns The new name.
+[[nodiscard]] llvm::StringRef
+buildHashedName(llvm::StringRef Name, llvm::StringRef Prefix, const bool MachO,
+                const uint32_t Attempt,
+                llvm::SmallVectorImpl<char> &Storage) noexcept {
+  static constexpr llvm::StringLiteral Digits =
+      "0123456789"
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+      "abcdefghijklmnopqrstuvwxyz";
+
+  Storage.clear();
+  uint64_t Hash;
+  if (Attempt == 0) {
+    Hash = llvm::xxHash64(Name);
+  } else {
+    llvm::raw_svector_ostream(Storage) << Name << '\0' << Attempt;
+    Hash = llvm::xxHash64(llvm::StringRef(Storage.data(), Storage.size()));
+    Storage.clear();
+  }
+
+  if (MachO) {
+    Storage.push_back('_');
+  }
+  Storage.append(Prefix.begin(), Prefix.end());
+  for (size_t I = 0; I < HashedNameDigits; ++I) {
+    Storage.push_back(Digits[Hash % Digits.size()]);
+    Hash /= Digits.size();
+  }
+  return llvm::StringRef(Storage.data(), Storage.size());
+}
+
 } // end anonymous namespace
 
 ObjectFormat::ObjectFormat(const llvm::Triple &Triple) noexcept
@@ -149,96 +370,761 @@ saq::bartleby::operator<<(llvm::raw_ostream &OS,
             << ", file format=" << ObjFormat.FormatType << ')';
 }
 
+BARTLEBY_API llvm::Expected<llvm::object::OwningBinary<llvm::object::Binary>>
+Bartleby::openBinary(llvm::StringRef Path) noexcept {
+  auto FileOrErr = MappedFile::create(Path);
+  if (!FileOrErr) {
+    return FileOrErr.takeError();
+  }
+  auto BinOrErr = llvm::object::createBinary((*FileOrErr)->getMemBufferRef());
+  if (!BinOrErr) {
+    return BinOrErr.takeError();
+  }
+  return llvm::object::OwningBinary<llvm::object::Binary>(
+      std::move(*BinOrErr), std::move(*FileOrErr));
+}
+
 BARTLEBY_API llvm::Error Bartleby::addBinary(
     llvm::object::OwningBinary<llvm::object::Binary> OwningBinary) noexcept {
-  auto *Binary = OwningBinary.getBinary();
-  llvm::Error E = llvm::Error::success();
-
-  if (auto *Obj = llvm::dyn_cast<llvm::object::ObjectFile>(Binary)) {
-    const auto Triple = Obj->makeTriple();
-    if (!objectFormatMatches(Triple)) {
-      return llvm::make_error<Error>(Error::ObjectFormatTypeMismatchReason{
-          .Constraint = std::get<ObjectFormat>(ObjFormat), .Found = {Triple}});
-    }
-    ObjFormat = Triple;
-    ProcessObjectFile(Obj, Symbols);
-    auto &Entry = Objects.emplace_back(ObjectFile{.Handle = Obj});
-    (llvm::Twine(llvm::utostr(Objects.size())) + ".o")
-        .toNullTerminatedStringRef(Entry.Name);
-  } else if (auto *Archive = llvm::dyn_cast<llvm::object::Archive>(Binary)) {
-    llvm::Error E = llvm::Error::success();
-    for (const auto &Ch : Archive->children(E)) {
-      auto BinOrErr = Ch.getAsBinary();
+  return addBinaries(
+      llvm::MutableArrayRef<llvm::object::OwningBinary<llvm::object::Binary>>(
+          OwningBinary),
+      1);
+}
+
+namespace {
+
+/// \brief An object waiting to be added to a Bartleby handle.
+struct PendingObject {
+  /// \brief Index of the input binary it comes from.
+  size_t BinaryIndex;
+
+  /// \brief Content of the object, if it is an archive member.
+  std::optional<llvm::MemoryBufferRef> Buffer;
+
+  /// \brief Name of the object, if it is an archive member.
+  std::optional<llvm::SmallString<32>> Name;
+
+  /// \brief Handle to \p llvm::object::ObjectFile, once parsed.
+  llvm::object::ObjectFile *Handle = nullptr;
+
+  /// \brief Owner of \p Handle, if the object is an archive member.
+  std::unique_ptr<llvm::object::Binary> Owner;
+
+  /// \brief Triple of the object, once parsed.
+  llvm::Triple Triple;
+
+  /// \brief Whether the object was parsed, even if it was released since.
+  bool Parsed = false;
+
+  /// \brief Symbols collected from the object, if this was done ahead of
+  /// time.
+  std::optional<ObjectSymbols> Symbols;
+
+  /// \brief Symbols of the object found in the input cache, if any.
+  const ObjectSymbols *Summary = nullptr;
+
+  /// \brief Hash of its content, if duplicates are looked for.
+  std::optional<uint64_t> ContentHash;
+
+  /// \brief Index, in the objects of the handle, of the object it is
+  /// identical to, if any.
+  std::optional<size_t> OriginalObject;
+
+  /// \brief Index, in the pending objects, of the object it is identical
+  /// to, if any.
+  std::optional<size_t> OriginalPending;
+
+  /// \brief Index of the object in the handle, once added.
+  size_t ObjectIndex = 0;
+
+  /// \brief Returns the content of the object.
+  ///
+  /// \returns The content.
+  [[nodiscard]] llvm::MemoryBufferRef getContent() const noexcept {
+    return Buffer ? *Buffer : Handle->getMemoryBufferRef();
+  }
+
+  /// \brief Tells whether the object is identical to a previous one.
+  ///
+  /// \returns True if it is a duplicate.
+  [[nodiscard]] bool isDuplicate() const noexcept {
+    return OriginalObject || OriginalPending;
+  }
+
+  /// \brief Tells whether the object has to be parsed.
+  ///
+  /// Duplicates are only parsed if their symbols have to be stored in the
+  /// input cache.
+  ///
+  /// \param Cache Input cache of the handle. Can be null.
+  ///
+  /// \returns True if the object has to be parsed.
+  [[nodiscard]] bool needsParsing(const InputCache *Cache) const noexcept {
+    return !isDuplicate() || ((Cache != nullptr) && (Summary == nullptr));
+  }
+
+  /// \brief Collects the symbols of the object ahead of time.
+  ///
+  /// \param Stats Where to record statistics. Can be null.
+  void collectSymbols(Statistics *Stats) noexcept {
+    auto &Collected = Symbols.emplace();
+    ProcessObjectFile(Handle, Collected.Symbols, Stats,
+                      &Collected.ArchiveSymbols, &Collected.Uses);
+  }
+
+  /// \brief Error that occurred while locating or parsing the object, if
+  /// any.
+  std::optional<llvm::Error> Err;
+
+  PendingObject(const size_t BinaryIndex) noexcept : BinaryIndex(BinaryIndex) {}
+  PendingObject(PendingObject &&) noexcept = default;
+  PendingObject &operator=(PendingObject &&) noexcept = default;
+  ~PendingObject() noexcept {
+    if (Err) {
+      llvm::consumeError(std::move(*Err));
+    }
+  }
+
+  /// \brief Parses the object if it is an archive member.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error parse() noexcept {
+    if (Parsed) {
+      return llvm::Error::success();
+    }
+    if (Buffer) {
+      auto BinOrErr = llvm::object::createBinary(*Buffer);
       if (!BinOrErr) {
         return BinOrErr.takeError();
       }
-      if (auto *Obj =
-              llvm::dyn_cast<llvm::object::ObjectFile>(BinOrErr.get().get())) {
-        const auto Triple = Obj->makeTriple();
+      Owner = std::move(*BinOrErr);
+      Handle = llvm::dyn_cast<llvm::object::ObjectFile>(Owner.get());
+      if (Handle == nullptr) {
+        Error::UnsupportedBinaryReason Reason;
+        llvm::raw_svector_ostream OS(Reason.Msg);
+        OS << "unsupported binary '" << Owner->getType()
+           << "' (triple: " << Owner->getTripleObjectFormat() << ')';
+        return llvm::make_error<Error>(std::move(Reason));
+      }
+    }
+    Triple = Handle->makeTriple();
+    Parsed = true;
+    return llvm::Error::success();
+  }
+
+  /// \brief Drops the parsed object if it is an archive member. It is parsed
+  /// again from \p Buffer when needed.
+  void release() noexcept {
+    if (Buffer) {
+      Handle = nullptr;
+      Owner.reset();
+    }
+  }
+};
+
+} // end anonymous namespace
+
+BARTLEBY_API llvm::Error Bartleby::addBinaries(
+    llvm::MutableArrayRef<llvm::object::OwningBinary<llvm::object::Binary>>
+        Binaries,
+    const unsigned Threads) noexcept {
+  Statistics::Scope S(Stats, Statistics::Phase::AddBinary);
+  Occurrences.reset();
+  for (const auto &Binary : Binaries) {
+    S.BytesIn += Binary.getBinary()->getData().size();
+  }
+
+  // First, list the objects to add. Archive members are only located here,
+  // they are parsed later.
+  std::vector<PendingObject> Pending;
+  for (size_t I = 0; I < Binaries.size(); ++I) {
+    auto *Binary = Binaries[I].getBinary();
+    const auto First = Pending.size();
+    if (auto *Obj = llvm::dyn_cast<llvm::object::ObjectFile>(Binary)) {
+      Pending.emplace_back(I).Handle = Obj;
+    } else if (auto *Archive = llvm::dyn_cast<llvm::object::Archive>(Binary)) {
+      llvm::Error E = llvm::Error::success();
+      for (const auto &Ch : Archive->children(E)) {
+        auto &P = Pending.emplace_back(I);
+        if (auto BufOrErr = Ch.getMemoryBufferRef()) {
+          P.Buffer = *BufOrErr;
+        } else {
+          P.Err.emplace(BufOrErr.takeError());
+        }
+        if (auto NameOrErr = Ch.getName()) {
+          P.Name = *NameOrErr;
+        } else {
+          llvm::consumeError(NameOrErr.takeError());
+        }
+      }
+      if (E) {
+        Pending.emplace_back(I).Err.emplace(std::move(E));
+      }
+    }
+
+    // Reuse the symbols collected the last time this binary was added.
+    const auto *Summaries =
+        (Cache != nullptr) ? Cache->getSummaries(*Binary) : nullptr;
+    if ((Summaries != nullptr) &&
+        (Summaries->size() == Pending.size() - First)) {
+      for (size_t J = 0; J < Summaries->size(); ++J) {
+        Pending[First + J].Summary = &(*Summaries)[J];
+      }
+    }
+  }
+  S.Objects = Pending.size();
+
+  // Duplicates are looked for before anything is parsed, so that they are
+  // neither parsed nor scanned.
+  if (DuplicatesMode != DuplicateMembers::Keep) {
+    llvm::DenseMap<uint64_t, llvm::SmallVector<size_t, 1>> PendingOriginals;
+    for (size_t I = 0; I < Pending.size(); ++I) {
+      auto &P = Pending[I];
+      if (P.Err) {
+        continue;
+      }
+      const auto Content = P.getContent().getBuffer();
+      const auto Hash = llvm::xxHash64(Content);
+      P.ContentHash = Hash;
+      if (const auto It = Originals.find(Hash); It != Originals.end()) {
+        for (const auto &Original : It->second) {
+          if (Objects[Original.Index].Buffer.getBuffer() == Content) {
+            P.OriginalObject = Original.Index;
+            break;
+          }
+        }
+      }
+      if (P.OriginalObject) {
+        continue;
+      }
+      auto &Candidates = PendingOriginals[Hash];
+      for (const auto J : Candidates) {
+        if (Pending[J].getContent().getBuffer() == Content) {
+          P.OriginalPending = J;
+          break;
+        }
+      }
+      if (!P.OriginalPending) {
+        Candidates.push_back(I);
+      }
+    }
+  }
+
+  // Then, parse archive members and collect their symbols ahead of time if
+  // we are allowed to use several threads. Each object gets its own symbol
+  // map, which is merged into the handle in the input order.
+  if (Threads != 1) {
+    std::optional<llvm::ThreadPool> OwnPool;
+    auto &Pool = (this->Pool != nullptr)
+                     ? *this->Pool
+                     : OwnPool.emplace(llvm::hardware_concurrency(Threads));
+    for (auto &P : Pending) {
+      if (P.Err || !P.needsParsing(Cache)) {
+        continue;
+      }
+      Pool.async([&P, this] {
+        if (auto Err = P.parse()) {
+          P.Err.emplace(std::move(Err));
+          return;
+        }
+        if (P.Summary == nullptr) {
+          P.collectSymbols(Stats);
+        }
+        if (MemoryBudget != 0) {
+          P.release();
+        }
+      });
+    }
+    Pool.wait();
+  }
+
+  auto Next = Pending.begin();
+  for (size_t I = 0; I < Binaries.size(); ++I) {
+    auto *Binary = Binaries[I].getBinary();
+
+    if (Binary->isMachOUniversalBinary()) {
+      const auto Input = Binary->getFileName().str();
+      if (auto Err = addMachOUniversalBinary(std::move(Binaries[I]))) {
+        return makeInputError(Input, std::move(Err));
+      }
+      continue;
+    }
+
+    if (!llvm::isa<llvm::object::ObjectFile>(Binary) &&
+        !llvm::isa<llvm::object::Archive>(Binary)) {
+      Error::UnsupportedBinaryReason Reason;
+      llvm::raw_svector_ostream OS(Reason.Msg);
+      OS << "unsupported binary '" << Binary->getType()
+         << "' (triple: " << Binary->getTripleObjectFormat() << ')';
+      return makeInputError(Binary->getFileName(),
+                            llvm::make_error<Error>(std::move(Reason)));
+    }
+
+    const auto First = Next;
+    for (; (Next != Pending.end()) && (Next->BinaryIndex == I); ++Next) {
+      auto &P = *Next;
+      if (P.Err) {
+        auto Err = std::move(*P.Err);
+        P.Err.reset();
+        return makeInputError(Binary->getFileName(), std::move(Err));
+      }
+      if (P.needsParsing(Cache)) {
+        if (auto Err = P.parse()) {
+          return makeInputError(Binary->getFileName(), std::move(Err));
+        }
+
+        const auto &Triple = P.Triple;
         if (!objectFormatMatches(Triple)) {
-          return llvm::make_error<Error>(Error::ObjectFormatTypeMismatchReason{
-              .Constraint = std::get<ObjectFormat>(ObjFormat),
-              .Found = {Triple}});
+          return makeInputError(
+              Binary->getFileName(),
+              llvm::make_error<Error>(Error::ObjectFormatTypeMismatchReason{
+                  .Constraint = std::get<ObjectFormat>(ObjFormat),
+                  .Found = {Triple}}));
         }
         ObjFormat = Triple;
 
-        ProcessObjectFile(Obj, Symbols);
-        auto &Entry = Objects.emplace_back(ObjectFile{
-            .Owner = std::move(BinOrErr.get()),
-        });
-        Entry.Handle = Obj;
-        if (auto NameOrErr = Ch.getName()) {
-          Entry.Name = *NameOrErr;
-        } else {
-          (llvm::Twine(llvm::utostr(Objects.size())) + ".o")
-              .toNullTerminatedStringRef(Entry.Name);
+        if ((P.Summary == nullptr) && !P.Symbols && (Cache != nullptr)) {
+          P.collectSymbols(Stats);
+        }
+      }
+      if (P.isDuplicate()) {
+        addDuplicate(*P.ContentHash,
+                     P.OriginalObject ? *P.OriginalObject
+                                      : Pending[*P.OriginalPending].ObjectIndex,
+                     P.Name, Binary->getFileName());
+        P.release();
+        continue;
+      }
+      const auto *ObjSymbols = P.Summary;
+      if ((ObjSymbols == nullptr) && P.Symbols) {
+        ObjSymbols = &*P.Symbols;
+      }
+      std::vector<SymbolID> ArchiveSymbols;
+      std::vector<SymbolUse> Uses;
+      if (ObjSymbols != nullptr) {
+        std::vector<SymbolID> IDs;
+        IDs.reserve(ObjSymbols->Symbols.size());
+        for (const auto &ObjEntry : ObjSymbols->Symbols) {
+          const auto ID = Symbols.insert(ObjEntry.first()).first;
+          Symbols.getEntry(ID).getValue().merge(ObjEntry.getValue());
+          IDs.push_back(ID);
+        }
+        ArchiveSymbols.reserve(ObjSymbols->ArchiveSymbols.size());
+        for (const auto ID : ObjSymbols->ArchiveSymbols) {
+          ArchiveSymbols.push_back(IDs[ID]);
+        }
+        Uses.reserve(ObjSymbols->Uses.size());
+        for (auto Use : ObjSymbols->Uses) {
+          Use.ID = IDs[Use.ID];
+          Uses.push_back(Use);
         }
       } else {
-        Error::UnsupportedBinaryReason Reason;
-        llvm::raw_svector_ostream OS(Reason.Msg);
-        OS << "unsupported binary '" << Binary->getType()
-           << "' (triple: " << Binary->getTripleObjectFormat() << ')';
-        return llvm::make_error<Error>(std::move(Reason));
+        ProcessObjectFile(P.Handle, Symbols, Stats, &ArchiveSymbols, &Uses);
+      }
+
+      // Under a memory budget, archive members are parsed again when they
+      // are rewritten, rather than kept parsed until then.
+      if (MemoryBudget != 0) {
+        P.release();
+      }
+      auto &Entry = Objects.emplace_back(ObjectFile{
+          .Handle = P.Handle,
+          .Owner = std::move(P.Owner),
+          .Buffer = P.Buffer ? *P.Buffer : P.Handle->getMemoryBufferRef(),
+          .ArchiveSymbols = std::move(ArchiveSymbols),
+          .Uses = std::move(Uses),
+      });
+      if (P.Name) {
+        Entry.Name = *P.Name;
+      } else {
+        (llvm::Twine(llvm::utostr(Objects.size())) + ".o")
+            .toNullTerminatedStringRef(Entry.Name);
+      }
+      P.ObjectIndex = Objects.size() - 1;
+      if (P.ContentHash) {
+        Originals[*P.ContentHash].push_back(OriginalObject{
+            .Index = P.ObjectIndex,
+            .Input = Binary->getFileName(),
+        });
       }
     }
-  } else if (Binary->isMachOUniversalBinary()) {
-    return addMachOUniversalBinary(std::move(OwningBinary));
+
+    if ((Cache != nullptr) && (First != Next) && (First->Summary == nullptr)) {
+      std::vector<ObjectSymbols> Summaries;
+      Summaries.reserve(Next - First);
+      for (auto It = First; It != Next; ++It) {
+        Summaries.push_back(std::move(*It->Symbols));
+      }
+      Cache->setSummaries(*Binary, std::move(Summaries));
+    }
+    OwnedBinaries.push_back(std::move(Binaries[I]));
+  }
+  return llvm::Error::success();
+}
+
+void Bartleby::addDuplicate(
+    const uint64_t Hash, const size_t Original,
+    const std::optional<llvm::SmallString<32>> &Name,
+    llvm::StringRef Input) noexcept {
+  auto &Dup = Duplicates.emplace_back();
+  if (Name) {
+    Dup.Name = Name->str();
   } else {
+    Dup.Name = llvm::utostr(Objects.size() + 1) + ".o";
+  }
+  Dup.Input = Input.str();
+  Dup.OriginalName = Objects[Original].Name.str();
+  for (const auto &Candidate : Originals[Hash]) {
+    if (Candidate.Index == Original) {
+      Dup.OriginalInput = Candidate.Input.str();
+      break;
+    }
+  }
+  Dup.Size = Objects[Original].Buffer.getBufferSize();
+  LLVM_DEBUG(llvm::dbgs() << "'" << Dup.Name << "' from '" << Dup.Input
+                          << "' is identical to '" << Dup.OriginalName
+                          << "' from '" << Dup.OriginalInput << "'\n");
+  if (Stats != nullptr) {
+    Stats->recordDuplicateMembers(1);
+  }
+  if (DuplicatesMode == DuplicateMembers::Collapse) {
+    return;
+  }
+
+  // The symbols of the original object are recorded again, as scanning the
+  // duplicate would.
+  auto ArchiveSymbols = Objects[Original].ArchiveSymbols;
+  auto Uses = Objects[Original].Uses;
+  const auto Buffer = Objects[Original].Buffer;
+  const auto ObjectType = std::get<ObjectFormat>(ObjFormat).FormatType;
+  for (const auto &Use : Uses) {
+    SymbolInfo SymInfo;
+    SymInfo.Flags = getSymbolFlags(Use);
+    SymInfo.ObjectType = ObjectType;
+    Symbols.getEntry(Use.ID).getValue().updateWithNewSymbolInfo(SymInfo);
+  }
+  Objects.emplace_back(ObjectFile{
+      .Handle = nullptr,
+      .Buffer = Buffer,
+      .Name = llvm::StringRef(Dup.Name),
+      .ArchiveSymbols = std::move(ArchiveSymbols),
+      .Uses = std::move(Uses),
+  });
+}
+
+llvm::Expected<llvm::object::ObjectFile *> Bartleby::parseObject(
+    const ObjectFile &Obj,
+    std::unique_ptr<llvm::object::Binary> &Storage) noexcept {
+  if (Obj.Handle != nullptr) {
+    return Obj.Handle;
+  }
+  auto BinOrErr = llvm::object::createBinary(Obj.Buffer);
+  if (!BinOrErr) {
+    return BinOrErr.takeError();
+  }
+  Storage = std::move(*BinOrErr);
+  auto *Handle = llvm::dyn_cast<llvm::object::ObjectFile>(Storage.get());
+  if (Handle == nullptr) {
     Error::UnsupportedBinaryReason Reason;
     llvm::raw_svector_ostream OS(Reason.Msg);
-    OS << "unsupported binary '" << Binary->getType()
-       << "' (triple: " << Binary->getTripleObjectFormat() << ')';
+    OS << "unsupported binary '" << Storage->getType()
+       << "' (triple: " << Storage->getTripleObjectFormat() << ')';
     return llvm::make_error<Error>(std::move(Reason));
   }
-  OwnedBinaries.push_back(std::move(OwningBinary));
-  return llvm::Error::success();
+  return Handle;
 }
 
 BARTLEBY_API size_t
 Bartleby::prefixGlobalAndDefinedSymbols(llvm::StringRef Prefix) noexcept {
+  Statistics::Scope S(Stats, Statistics::Phase::PrefixSymbols);
   size_t N = 0;
-  const auto End = Symbols.end();
-  for (auto Entry = Symbols.begin(); Entry != End; ++Entry) {
-    const auto &Name = Entry->first();
-    auto &Sym = Entry->getValue();
+  for (SymbolID ID = 0; ID < Symbols.size(); ++ID) {
+    const auto &Sym = Symbols.getEntry(ID).getValue();
     if (Sym.isGlobal() && Sym.isDefined()) {
-      std::string NewName;
-      if (Sym.isMachO()) {
-        NewName += '_';
+      Symbols.setPrefix(ID, Prefix);
+      ++N;
+    }
+  }
+  S.Symbols = N;
+
+  return N;
+}
+
+BARTLEBY_API size_t
+Bartleby::applyRenamePolicy(const RenamePolicy &Policy, llvm::StringRef Prefix,
+                            const unsigned Threads,
+                            const RenameStyle Style) noexcept {
+  Statistics::Scope S(Stats, Statistics::Phase::PrefixSymbols);
+
+  // Symbols are matched in parallel, by chunks, but renamed in order since
+  // this writes to the arena of the symbol map.
+  constexpr size_t ChunkSize = 4096;
+  const auto &Map = Symbols;
+  std::vector<uint8_t> Selected(Map.size(), 0);
+  const auto Match = [&Map, &Policy, &Selected](const size_t Begin,
+                                                const size_t End) {
+    for (size_t ID = Begin; ID < End; ++ID) {
+      const auto &Entry = Map.getEntry(ID);
+      Selected[ID] = Policy.shouldRename(Entry.first(), Entry.getValue());
+    }
+  };
+  if ((Threads == 1) || (Map.size() <= ChunkSize)) {
+    Match(0, Map.size());
+  } else {
+    std::optional<llvm::ThreadPool> OwnPool;
+    auto &Pool = (this->Pool != nullptr)
+                     ? *this->Pool
+                     : OwnPool.emplace(llvm::hardware_concurrency(Threads));
+    for (size_t Begin = 0; Begin < Map.size(); Begin += ChunkSize) {
+      Pool.async(Match, Begin, std::min(Begin + ChunkSize, Map.size()));
+    }
+    Pool.wait();
+  }
+
+  const auto N = renameSymbols(Selected, Prefix, Style);
+  S.Symbols = N;
+
+  return N;
+}
+
+BARTLEBY_API size_t
+Bartleby::hashGlobalAndDefinedSymbols(llvm::StringRef Prefix) noexcept {
+  Statistics::Scope S(Stats, Statistics::Phase::PrefixSymbols);
+  std::vector<uint8_t> Selected(Symbols.size(), 0);
+  for (SymbolID ID = 0; ID < Symbols.size(); ++ID) {
+    const auto &Sym = Symbols.getEntry(ID).getValue();
+    Selected[ID] = Sym.isGlobal() && Sym.isDefined();
+  }
+
+  const auto N = renameSymbols(Selected, Prefix, RenameStyle::Hash);
+  S.Symbols = N;
+
+  return N;
+}
+
+size_t Bartleby::renameSymbols(llvm::ArrayRef<uint8_t> Selected,
+                               llvm::StringRef Prefix,
+                               const RenameStyle Style) noexcept {
+  size_t N = 0;
+  if (Style == RenameStyle::Prefix) {
+    for (SymbolID ID = 0; ID < Selected.size(); ++ID) {
+      if (Selected[ID] != 0) {
+        Symbols.setPrefix(ID, Prefix);
+        ++N;
       }
-      NewName += Prefix;
+    }
+    return N;
+  }
 
-      if (Sym.isMachO()) {
-        NewName += Name.substr(1);
-      } else {
-        NewName += Name;
+  // New names must neither shadow an existing symbol nor be shared by two
+  // symbols, otherwise the rename would merge them. Which of two colliding
+  // symbols is hashed again must not depend on the order the inputs were
+  // added in, so symbols are renamed in the order of their names.
+  std::vector<SymbolID> Order;
+  for (SymbolID ID = 0; ID < Selected.size(); ++ID) {
+    if (Selected[ID] != 0) {
+      Order.push_back(ID);
+    }
+  }
+  std::sort(Order.begin(), Order.end(),
+            [this](const SymbolID LHS, const SymbolID RHS) {
+              return Symbols.getEntry(LHS).first() <
+                     Symbols.getEntry(RHS).first();
+            });
+
+  llvm::DenseSet<llvm::CachedHashStringRef> Assigned;
+  llvm::SmallString<64> Storage;
+  for (const auto ID : Order) {
+    const auto &Entry = Symbols.getEntry(ID);
+    const auto Name = Entry.first();
+    const auto MachO = Entry.getValue().isMachO();
+    llvm::StringRef NewName;
+    for (uint32_t Attempt = 0;; ++Attempt) {
+      NewName = buildHashedName(Name, Prefix, MachO, Attempt, Storage);
+      if (!Symbols.getID(NewName) &&
+          !Assigned.contains(llvm::CachedHashStringRef(NewName))) {
+        break;
+      }
+    }
+    Symbols.setNewName(ID, NewName);
+
+    // The new name is now owned by the symbol map.
+    Assigned.insert(llvm::CachedHashStringRef(
+        *Entry.getValue().getNewName(Name, Storage)));
+    ++N;
+  }
+  return N;
+}
+
+BARTLEBY_API void
+Bartleby::writeRenameMap(llvm::raw_ostream &OS) const noexcept {
+  auto Renames = collectRenames();
+  std::sort(Renames.begin(), Renames.end());
+  for (const auto &[NewName, Name] : Renames) {
+    OS << NewName << '\t' << Name << '\n';
+  }
+}
+
+BARTLEBY_API llvm::Error
+Bartleby::writeBinaryRenameMap(llvm::raw_ostream &OS) const noexcept {
+  const auto Renames = collectRenames();
+  std::vector<std::pair<llvm::StringRef, llvm::StringRef>> Refs;
+  Refs.reserve(Renames.size());
+  for (const auto &[NewName, Name] : Renames) {
+    Refs.emplace_back(NewName, Name);
+  }
+  return RenameMap::write(OS, Refs);
+}
+
+std::vector<std::pair<std::string, llvm::StringRef>>
+Bartleby::collectRenames() const noexcept {
+  std::vector<std::pair<std::string, llvm::StringRef>> Renames;
+  llvm::SmallString<64> Storage;
+  for (const auto &Entry : Symbols) {
+    if (const auto NewName = Entry.getValue().getNewName(Entry.first(),
+                                                         Storage)) {
+      Renames.emplace_back(NewName->str(), Entry.first());
+    }
+  }
+  return Renames;
+}
+
+BARTLEBY_API size_t Bartleby::pruneUnreachableObjects(
+    llvm::ArrayRef<llvm::StringRef> Roots) noexcept {
+  // Objects of different slices of a fat Mach-O never resolve each other's
+  // references.
+  std::vector<size_t> Groups(Objects.size(), 0);
+  size_t NumGroups = 1;
+  if (isMachOUniversalBinary()) {
+    std::unordered_map<ObjectFormat, size_t, ObjectFormat::Hash> Indices;
+    for (size_t I = 0; I < Objects.size(); ++I) {
+      const auto [It, Inserted] = Indices.try_emplace(
+          ObjectFormat{Objects[I].Handle->makeTriple()}, Indices.size());
+      Groups[I] = It->second;
+    }
+    NumGroups = std::max<size_t>(Indices.size(), 1);
+  }
+
+  // Slots are indexed by group, then by symbol.
+  const size_t NumSymbols = Symbols.size();
+  const auto Slot = [&](const size_t I, const SymbolID ID) {
+    return (Groups[I] * NumSymbols) + ID;
+  };
+  constexpr size_t NoObject = std::numeric_limits<size_t>::max();
+  std::vector<size_t> Definers(NumGroups * NumSymbols, NoObject);
+  for (size_t I = 0; I < Objects.size(); ++I) {
+    for (const auto ID : Objects[I].ArchiveSymbols) {
+      auto &Definer = Definers[Slot(I, ID)];
+      if (Definer == NoObject) {
+        Definer = I;
+      }
+    }
+  }
+
+  std::vector<bool> Defined(NumGroups * NumSymbols, false);
+  std::vector<bool> Kept(Objects.size(), false);
+  std::vector<size_t> Worklist;
+  const auto Keep = [&](const size_t I) {
+    if ((I == NoObject) || Kept[I]) {
+      return;
+    }
+    Kept[I] = true;
+    Worklist.push_back(I);
+    for (const auto ID : Objects[I].ArchiveSymbols) {
+      Defined[Slot(I, ID)] = true;
+    }
+  };
+
+  for (const auto Root : Roots) {
+    const auto ID = Symbols.getID(Root);
+    if (!ID) {
+      continue;
+    }
+    for (size_t Group = 0; Group < NumGroups; ++Group) {
+      Keep(Definers[(Group * NumSymbols) + *ID]);
+    }
+  }
+  while (!Worklist.empty()) {
+    const auto I = Worklist.back();
+    Worklist.pop_back();
+    for (const auto &Use : Objects[I].Uses) {
+      if (!Use.Defined && !Defined[Slot(I, Use.ID)]) {
+        Keep(Definers[Slot(I, Use.ID)]);
+      }
+    }
+  }
+
+  constexpr size_t Removed = NoObject;
+  std::vector<size_t> NewIndices(Objects.size(), Removed);
+  size_t N = 0;
+  for (size_t I = 0; I < Objects.size(); ++I) {
+    if (Kept[I]) {
+      if (N != I) {
+        Objects[N] = std::move(Objects[I]);
       }
-      Sym.setName(std::move(NewName));
+      NewIndices[I] = N;
       ++N;
+    } else {
+      LLVM_DEBUG(llvm::dbgs() << "pruning unreachable object '"
+                              << Objects[I].Name << "'\n");
     }
   }
+  const size_t NumRemoved = Objects.size() - N;
+  Objects.erase(Objects.begin() + N, Objects.end());
+  Occurrences.reset();
 
-  return N;
+  // Later duplicates of removed objects are added as originals.
+  for (auto &Entry : Originals) {
+    auto &Candidates = Entry.second;
+    llvm::erase_if(Candidates, [&](const OriginalObject &Original) {
+      return NewIndices[Original.Index] == Removed;
+    });
+    for (auto &Original : Candidates) {
+      Original.Index = NewIndices[Original.Index];
+    }
+  }
+  return NumRemoved;
+}
+
+std::vector<llvm::ArrayRef<SymbolUse>>
+Bartleby::getObjectUses() const noexcept {
+  std::vector<llvm::ArrayRef<SymbolUse>> Uses;
+  Uses.reserve(Objects.size());
+  for (const auto &Obj : Objects) {
+    Uses.push_back(Obj.Uses);
+  }
+  return Uses;
+}
+
+BARTLEBY_API const OccurrenceIndex &Bartleby::getOccurrenceIndex() noexcept {
+  if (!Occurrences) {
+    Occurrences.emplace(Symbols.size(), getObjectUses());
+  }
+  return *Occurrences;
+}
+
+BARTLEBY_API llvm::ArrayRef<Occurrence>
+Bartleby::getOccurrences(llvm::StringRef Name) noexcept {
+  const auto ID = Symbols.getID(Name);
+  if (!ID) {
+    return {};
+  }
+  return getOccurrenceIndex().lookup(*ID);
+}
+
+BARTLEBY_API DependencyGraph Bartleby::getDependencyGraph() noexcept {
+  return DependencyGraph(getOccurrenceIndex(), getObjectUses());
+}
+
+BARTLEBY_API void Bartleby::writeDependencyGraph(llvm::raw_ostream &OS,
+                                                 GraphFormat Format) noexcept {
+  std::vector<llvm::StringRef> Names;
+  Names.reserve(Objects.size());
+  for (const auto &Obj : Objects) {
+    Names.push_back(Obj.Name);
+  }
+  getDependencyGraph().write(OS, Format, Names);
 }
 
 bool Bartleby::objectFormatMatches(const ObjectFormat &ObjFmt) const noexcept {
@@ -293,11 +1179,17 @@ llvm::Error Bartleby::addMachOUniversalBinary(
 
     if (auto ObjOrErr = Ofa.getAsObjectFile()) {
       auto Obj = std::move(*ObjOrErr);
-      ProcessObjectFile(&*Obj, Symbols);
+      std::vector<SymbolID> ArchiveSymbols;
+      std::vector<SymbolUse> Uses;
+      ProcessObjectFile(&*Obj, Symbols, Stats, &ArchiveSymbols, &Uses);
+      const auto Buffer = Obj->getMemoryBufferRef();
       auto &Entry = Objects.emplace_back(ObjectFile{
           .Handle = &*Obj,
           .Owner = std::move(Obj),
+          .Buffer = Buffer,
           .Alignment = Ofa.getAlign(),
+          .ArchiveSymbols = std::move(ArchiveSymbols),
+          .Uses = std::move(Uses),
       });
       (llvm::Twine(llvm::utostr(Objects.size())) + ".o")
           .toNullTerminatedStringRef(Entry.Name);
@@ -315,11 +1207,16 @@ llvm::Error Bartleby::addMachOUniversalBinary(
         auto Bin = std::move(*BinOrErr);
 
         if (auto *Obj = llvm::dyn_cast<llvm::object::MachOObjectFile>(&*Bin)) {
-          ProcessObjectFile(Obj, Symbols);
+          std::vector<SymbolID> ArchiveSymbols;
+          std::vector<SymbolUse> Uses;
+          ProcessObjectFile(Obj, Symbols, Stats, &ArchiveSymbols, &Uses);
           auto &Entry = Objects.emplace_back(ObjectFile{
               .Handle = &*Obj,
               .Owner = std::move(Bin),
+              .Buffer = Obj->getMemoryBufferRef(),
               .Alignment = 0,
+              .ArchiveSymbols = std::move(ArchiveSymbols),
+              .Uses = std::move(Uses),
           });
           if (auto NameOrErr = Ch.getName()) {
             Entry.Name = *NameOrErr;
@@ -0,0 +1,190 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief ELF symbol renamer implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/ELFRenamer.h"
+
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/Debug.h"
+
+#include <cstring>
+
+#define DEBUG_TYPE "Bartleby"
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief Renames the symbols of an ELF relocatable object.
+///
+/// \param Obj The object.
+/// \param SymbolsToRename Map of symbols to rename.
+///
+/// \returns The content of the final object, a null pointer if the object
+/// is not supported, or an error.
+template <typename ELFT>
+[[nodiscard]] llvm::Expected<std::unique_ptr<llvm::SmallVectorMemoryBuffer>>
+renameSymbols(
+    const llvm::object::ELFObjectFile<ELFT> &Obj,
+    const llvm::StringMap<llvm::StringRef> &SymbolsToRename) noexcept {
+  using Shdr = typename ELFT::Shdr;
+  using Sym = typename ELFT::Sym;
+
+  const auto &File = Obj.getELFFile();
+  const auto &Header = File.getHeader();
+  if ((Header.e_type != llvm::ELF::ET_REL) ||
+      (Header.e_shentsize != sizeof(Shdr)) ||
+      (Header.e_shstrndx == llvm::ELF::SHN_XINDEX)) {
+    LLVM_DEBUG(llvm::dbgs() << "unsupported ELF header, falling back\n");
+    return nullptr;
+  }
+
+  auto SectionsOrErr = File.sections();
+  if (!SectionsOrErr) {
+    return SectionsOrErr.takeError();
+  }
+  const auto Sections = *SectionsOrErr;
+
+  const Shdr *SymTab = nullptr;
+  for (const auto &Sec : Sections) {
+    if (Sec.sh_type != llvm::ELF::SHT_SYMTAB) {
+      continue;
+    }
+    if (SymTab != nullptr) {
+      LLVM_DEBUG(llvm::dbgs() << "several symbol tables, falling back\n");
+      return nullptr;
+    }
+    SymTab = &Sec;
+  }
+  if (SymTab == nullptr) {
+    LLVM_DEBUG(llvm::dbgs() << "no symbol table, falling back\n");
+    return nullptr;
+  }
+
+  const size_t StrTabIndex = SymTab->sh_link;
+  if ((StrTabIndex == 0) || (StrTabIndex >= Sections.size()) ||
+      (StrTabIndex == Header.e_shstrndx) ||
+      (Sections[StrTabIndex].sh_type != llvm::ELF::SHT_STRTAB)) {
+    LLVM_DEBUG(llvm::dbgs() << "unsupported string table, falling back\n");
+    return nullptr;
+  }
+  for (const auto &Sec : Sections) {
+    if ((&Sec != SymTab) && (Sec.sh_link == StrTabIndex)) {
+      LLVM_DEBUG(llvm::dbgs() << "string table is shared, falling back\n");
+      return nullptr;
+    }
+  }
+  const auto &StrTab = Sections[StrTabIndex];
+
+  auto SymsOrErr = File.symbols(SymTab);
+  if (!SymsOrErr) {
+    return SymsOrErr.takeError();
+  }
+  const auto Syms = *SymsOrErr;
+
+  auto StrTabDataOrErr = File.getStringTableForSymtab(*SymTab);
+  if (!StrTabDataOrErr) {
+    return StrTabDataOrErr.takeError();
+  }
+
+  // Builds the new string table. Names are deduplicated, but suffixes are
+  // not merged.
+  llvm::SmallVector<char, 0> NewStrTab;
+  NewStrTab.push_back('\0');
+  llvm::StringMap<uint32_t> Offsets;
+  llvm::SmallVector<uint32_t, 0> NameOffsets;
+  NameOffsets.reserve(Syms.size());
+  bool Renamed = false;
+  for (const auto &S : Syms) {
+    auto NameOrErr = S.getName(*StrTabDataOrErr);
+    if (!NameOrErr) {
+      return NameOrErr.takeError();
+    }
+    auto Name = *NameOrErr;
+    if (Name.empty()) {
+      NameOffsets.push_back(0);
+      continue;
+    }
+    if (const auto It = SymbolsToRename.find(Name);
+        It != SymbolsToRename.end()) {
+      Name = It->getValue();
+      Renamed = true;
+    }
+    const auto [Entry, Inserted] =
+        Offsets.try_emplace(Name, static_cast<uint32_t>(NewStrTab.size()));
+    if (Inserted) {
+      NewStrTab.append(Name.begin(), Name.end());
+      NewStrTab.push_back('\0');
+    }
+    NameOffsets.push_back(Entry->getValue());
+  }
+
+  const auto Data = Obj.getData();
+  llvm::SmallVector<char, 0> Content(Data.begin(), Data.end());
+  if (!Renamed) {
+    return std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(Content),
+                                                           false);
+  }
+
+  Shdr NewStrTabHeader = StrTab;
+  if (NewStrTab.size() <= StrTab.sh_size) {
+    auto *Dest = Content.data() + StrTab.sh_offset;
+    std::memcpy(Dest, NewStrTab.data(), NewStrTab.size());
+    std::memset(Dest + NewStrTab.size(), 0,
+                StrTab.sh_size - NewStrTab.size());
+  } else {
+    NewStrTabHeader.sh_offset = Content.size();
+    Content.append(NewStrTab.begin(), NewStrTab.end());
+  }
+  NewStrTabHeader.sh_size = NewStrTab.size();
+  std::memcpy(Content.data() + Header.e_shoff + StrTabIndex * sizeof(Shdr),
+              &NewStrTabHeader, sizeof(Shdr));
+
+  for (size_t I = 0; I < Syms.size(); ++I) {
+    Sym NewSym = Syms[I];
+    NewSym.st_name = NameOffsets[I];
+    std::memcpy(Content.data() + SymTab->sh_offset + I * sizeof(Sym), &NewSym,
+                sizeof(Sym));
+  }
+
+  return std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(Content),
+                                                         false);
+}
+
+} // end anonymous namespace
+
+llvm::Expected<std::unique_ptr<llvm::SmallVectorMemoryBuffer>>
+saq::bartleby::renameELFSymbols(
+    const llvm::object::ObjectFile &Obj,
+    const llvm::StringMap<llvm::StringRef> &SymbolsToRename) noexcept {
+  if (const auto *O = llvm::dyn_cast<llvm::object::ELF32LEObjectFile>(&Obj)) {
+    return renameSymbols(*O, SymbolsToRename);
+  }
+  if (const auto *O = llvm::dyn_cast<llvm::object::ELF32BEObjectFile>(&Obj)) {
+    return renameSymbols(*O, SymbolsToRename);
+  }
+  if (const auto *O = llvm::dyn_cast<llvm::object::ELF64LEObjectFile>(&Obj)) {
+    return renameSymbols(*O, SymbolsToRename);
+  }
+  if (const auto *O = llvm::dyn_cast<llvm::object::ELF64BEObjectFile>(&Obj)) {
+    return renameSymbols(*O, SymbolsToRename);
+  }
+  return nullptr;
+}
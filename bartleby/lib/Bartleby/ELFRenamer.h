@@ -0,0 +1,56 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief ELF symbol renamer specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
+
+#include <memory>
+
+namespace saq::bartleby {
+
+/// \brief Renames the symbols of an ELF relocatable object without going
+/// through \p objcopy.
+///
+/// Only the string table of the symbol table and the \p st_name field of the
+/// symbols are rewritten. Everything else, including section data,
+/// relocations and debug information, is copied verbatim. The new string
+/// table replaces the old one if it fits, otherwise it is appended at the
+/// end of the object and its section header is updated accordingly.
+///
+/// Objects that are not ELF relocatable objects, that have more than one
+/// symbol table or that share the symbol string table with another section
+/// are not supported.
+///
+/// \param Obj The object.
+/// \param SymbolsToRename Map of symbols to rename, as in
+/// \p llvm::objcopy::CommonConfig.
+///
+/// \returns The content of the final object, a null pointer if the object
+/// is not supported, or an error.
+[[nodiscard]] llvm::Expected<std::unique_ptr<llvm::SmallVectorMemoryBuffer>>
+renameELFSymbols(
+    const llvm::object::ObjectFile &Obj,
+    const llvm::StringMap<llvm::StringRef> &SymbolsToRename) noexcept;
+
+} // end namespace saq::bartleby
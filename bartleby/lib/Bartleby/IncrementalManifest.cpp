@@ -0,0 +1,205 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Incremental manifest implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/IncrementalManifest.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief Creates an error about a malformed manifest.
+///
+/// \param Path Path to the manifest.
+/// \param Message What is wrong.
+///
+/// \returns The error.
+[[nodiscard]] llvm::Error makeMalformedError(llvm::StringRef Path,
+                                             llvm::StringRef Message) noexcept {
+  return llvm::createFileError(
+      Path, llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                    "malformed manifest: " + Message));
+}
+
+/// \brief Reads an array of strings.
+///
+/// \param Array The JSON array.
+/// \param[out] Strings Where to store the strings.
+///
+/// \returns False if an element is not a string.
+[[nodiscard]] bool readStrings(const llvm::json::Array &Array,
+                               std::vector<std::string> &Strings) noexcept {
+  Strings.reserve(Array.size());
+  for (const auto &Value : Array) {
+    const auto Str = Value.getAsString();
+    if (!Str) {
+      return false;
+    }
+    Strings.emplace_back(*Str);
+  }
+  return true;
+}
+
+/// \brief Converts strings to a JSON array.
+///
+/// \param Strings The strings.
+///
+/// \returns The JSON array.
+[[nodiscard]] llvm::json::Array
+toJSONArray(const std::vector<std::string> &Strings) noexcept {
+  llvm::json::Array Array;
+  Array.reserve(Strings.size());
+  for (const auto &Str : Strings) {
+    Array.emplace_back(Str);
+  }
+  return Array;
+}
+
+} // end anonymous namespace
+
+llvm::Expected<IncrementalManifest>
+IncrementalManifest::read(llvm::StringRef Path) noexcept {
+  auto BufOrErr = llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    return llvm::createFileError(Path, BufOrErr.getError());
+  }
+
+  auto JSONOrErr = llvm::json::parse((*BufOrErr)->getBuffer());
+  if (!JSONOrErr) {
+    return llvm::createFileError(Path, JSONOrErr.takeError());
+  }
+  const auto *Root = JSONOrErr->getAsObject();
+  if (Root == nullptr) {
+    return makeMalformedError(Path, "expected an object");
+  }
+  if (Root->getInteger("version") != Version) {
+    return makeMalformedError(Path, "unsupported version");
+  }
+  const auto RewriteMode = Root->getString("rewrite_mode");
+  const auto *Members = Root->getArray("members");
+  if (!RewriteMode || (Members == nullptr)) {
+    return makeMalformedError(Path, "missing rewrite mode or members");
+  }
+
+  IncrementalManifest Manifest(*RewriteMode);
+  Manifest.Members.reserve(Members->size());
+  for (const auto &Value : *Members) {
+    const auto *Obj = Value.getAsObject();
+    if (Obj == nullptr) {
+      return makeMalformedError(Path, "expected a member");
+    }
+    const auto Name = Obj->getString("name");
+    const auto InputDigest = Obj->getString("input");
+    const auto OutputDigest = Obj->getString("output");
+    const auto *Defines = Obj->getArray("defines");
+    const auto *References = Obj->getArray("references");
+    const auto *Renames = Obj->getObject("renames");
+    if (!Name || !InputDigest || !OutputDigest || (Defines == nullptr) ||
+        (References == nullptr) || (Renames == nullptr)) {
+      return makeMalformedError(Path, "incomplete member");
+    }
+
+    auto &M = Manifest.Members.emplace_back();
+    M.Name = Name->str();
+    M.InputDigest = InputDigest->str();
+    M.OutputDigest = OutputDigest->str();
+    if (!readStrings(*Defines, M.Defines) ||
+        !readStrings(*References, M.References)) {
+      return makeMalformedError(Path, "expected a symbol name");
+    }
+    M.Renames.reserve(Renames->size());
+    for (const auto &[From, To] : *Renames) {
+      const auto NewName = To.getAsString();
+      if (!NewName) {
+        return makeMalformedError(Path, "expected a symbol name");
+      }
+      M.Renames.emplace_back(From.str(), NewName->str());
+    }
+    llvm::sort(M.Renames);
+
+    Manifest.ByInputDigest.try_emplace(M.InputDigest,
+                                       Manifest.Members.size() - 1);
+  }
+
+  return std::move(Manifest);
+}
+
+llvm::Error IncrementalManifest::write(llvm::StringRef Path) const noexcept {
+  llvm::SmallString<128> Model(Path);
+  Model += ".tmp-%%%%%%%%";
+
+  auto TmpOrErr = llvm::sys::fs::TempFile::create(Model);
+  if (!TmpOrErr) {
+    return TmpOrErr.takeError();
+  }
+  {
+    llvm::raw_fd_ostream OS(TmpOrErr->FD, /*shouldClose=*/false);
+    OS << llvm::formatv("{0:2}", toJSON()) << '\n';
+    OS.flush();
+    if (const auto EC = OS.error()) {
+      OS.clear_error();
+      llvm::consumeError(TmpOrErr->discard());
+      return llvm::createFileError(TmpOrErr->TmpName, EC);
+    }
+  }
+  return TmpOrErr->keep(Path);
+}
+
+const IncrementalManifest::Member *IncrementalManifest::findByInputDigest(
+    llvm::StringRef InputDigest) const noexcept {
+  if (const auto It = ByInputDigest.find(InputDigest);
+      It != ByInputDigest.end()) {
+    return &Members[It->second];
+  }
+  return nullptr;
+}
+
+llvm::json::Value IncrementalManifest::toJSON() const noexcept {
+  llvm::json::Array MembersArray;
+  MembersArray.reserve(Members.size());
+  for (const auto &M : Members) {
+    llvm::json::Object Renames;
+    for (const auto &[From, To] : M.Renames) {
+      Renames[From] = To;
+    }
+    MembersArray.emplace_back(llvm::json::Object{
+        {"name", M.Name},
+        {"input", M.InputDigest},
+        {"output", M.OutputDigest},
+        {"defines", toJSONArray(M.Defines)},
+        {"references", toJSONArray(M.References)},
+        {"renames", std::move(Renames)},
+    });
+  }
+
+  return llvm::json::Object{
+      {"version", Version},
+      {"rewrite_mode", RewriteMode},
+      {"members", std::move(MembersArray)},
+  };
+}
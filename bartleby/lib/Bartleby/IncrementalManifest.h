@@ -0,0 +1,138 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Incremental manifest specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/JSON.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace saq::bartleby {
+
+/// \brief Manifest of a build, used to rebuild an archive incrementally.
+///
+/// The manifest describes each member of an output archive: the digest of
+/// the object it was produced from, the digest of the member itself, the
+/// symbols the object defines and references, and the renames that were
+/// applied to these symbols. A member of a previous build can be reused as
+/// long as its input digest and its renames did not change.
+///
+/// Members are listed in the order of the output archive.
+class IncrementalManifest {
+public:
+  /// \brief Version of the manifest format.
+  static constexpr int64_t Version = 1;
+
+  /// \brief A rename: the original name and the new name of a symbol.
+  using Rename = std::pair<std::string, std::string>;
+
+  /// \brief A member of the output archive.
+  struct Member {
+    /// \brief Name of the member.
+    std::string Name;
+
+    /// \brief Digest of the original object.
+    std::string InputDigest;
+
+    /// \brief Digest of the member, as written in the output archive.
+    std::string OutputDigest;
+
+    /// \brief Symbols defined by the object.
+    std::vector<std::string> Defines;
+
+    /// \brief Symbols referenced, but not defined, by the object.
+    std::vector<std::string> References;
+
+    /// \brief Renames applied to the symbols of the object, sorted by
+    /// original name.
+    std::vector<Rename> Renames;
+  };
+
+  /// \brief Constructs an empty manifest.
+  ///
+  /// \param RewriteMode How objects are rewritten. Members of a manifest
+  /// with another rewrite mode are not reused.
+  explicit IncrementalManifest(llvm::StringRef RewriteMode) noexcept
+      : RewriteMode(RewriteMode) {}
+
+  /// \brief Reads a manifest.
+  ///
+  /// \param Path Path to the manifest.
+  ///
+  /// \returns The manifest, or an error.
+  [[nodiscard]] static llvm::Expected<IncrementalManifest>
+  read(llvm::StringRef Path) noexcept;
+
+  /// \brief Writes the manifest, atomically.
+  ///
+  /// \param Path Path to the manifest.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error write(llvm::StringRef Path) const noexcept;
+
+  /// \brief Returns the rewrite mode.
+  ///
+  /// \returns The rewrite mode.
+  [[nodiscard]] llvm::StringRef getRewriteMode() const noexcept {
+    return RewriteMode;
+  }
+
+  /// \brief Returns the members.
+  ///
+  /// \returns The members.
+  [[nodiscard]] std::vector<Member> &getMembers() noexcept { return Members; }
+
+  /// \brief Returns the members.
+  ///
+  /// \returns The members.
+  [[nodiscard]] const std::vector<Member> &getMembers() const noexcept {
+    return Members;
+  }
+
+  /// \brief Finds a member by the digest of its original object.
+  ///
+  /// \param InputDigest Digest of the original object.
+  ///
+  /// \returns The member, or a null pointer if there is none.
+  [[nodiscard]] const Member *
+  findByInputDigest(llvm::StringRef InputDigest) const noexcept;
+
+  /// \brief Converts the manifest to JSON.
+  ///
+  /// \returns The JSON value.
+  [[nodiscard]] llvm::json::Value toJSON() const noexcept;
+
+private:
+  /// \brief How objects are rewritten.
+  std::string RewriteMode;
+
+  /// \brief Members.
+  std::vector<Member> Members;
+
+  /// \brief Index from input digests to members, built by \p read.
+  llvm::StringMap<size_t> ByInputDigest;
+};
+
+} // end namespace saq::bartleby
@@ -0,0 +1,223 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Input cache implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/InputCache.h"
+#include "Bartleby/Bartleby.h"
+#include "Bartleby/Export.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/BLAKE3.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <chrono>
+#include <utility>
+
+#define DEBUG_TYPE "Bartleby"
+
+using namespace saq::bartleby;
+
+BARTLEBY_API InputCache::~InputCache() noexcept = default;
+
+namespace {
+
+/// \brief Computes the key of a binary from its content.
+///
+/// \param Content Content of the binary.
+///
+/// \returns The key.
+[[nodiscard]] std::string getContentKey(llvm::StringRef Content) noexcept {
+  llvm::BLAKE3 Hasher;
+  Hasher.update(Content);
+  const auto Digest = Hasher.final();
+  return "content:" + llvm::toHex(Digest, /*LowerCase=*/true);
+}
+
+/// \brief Tells whether the status of a file can stand for its content.
+///
+/// A file rewritten in place, with the same size, within the resolution of
+/// its modification time keeps the same status. This cannot be ruled out
+/// if the modification time is a whole second, which suggests a coarse
+/// resolution, nor if it is too recent, as for the racily clean entries of
+/// Git.
+///
+/// \param Status Status of the file.
+///
+/// \returns True if the status can stand for the content of the file.
+[[nodiscard]] bool
+isStatusReliable(const llvm::sys::fs::file_status &Status) noexcept {
+  const auto ModificationTime = Status.getLastModificationTime();
+  if ((ModificationTime.time_since_epoch() % std::chrono::seconds(1))
+          .count() == 0) {
+    return false;
+  }
+  return ModificationTime + std::chrono::seconds(1) <
+         std::chrono::system_clock::now();
+}
+
+} // end anonymous namespace
+
+void InputCache::evict(llvm::StringRef Key) noexcept {
+  const auto It = Entries.find(Key);
+  if (It == Entries.end()) {
+    return;
+  }
+  LLVM_DEBUG(llvm::dbgs() << "evicting " << Key << " from the input cache\n");
+  const auto Data = It->second->Binary.getBinary()->getData();
+  ByData.erase(Data.data());
+  Size -= Data.size();
+  Entries.erase(It);
+}
+
+void InputCache::release(llvm::StringRef Key) noexcept {
+  const auto It = Entries.find(Key);
+  if ((It != Entries.end()) && (--It->second->Paths == 0)) {
+    evict(Key);
+  }
+}
+
+BARTLEBY_API llvm::Expected<llvm::object::OwningBinary<llvm::object::Binary>>
+InputCache::openBinary(llvm::StringRef Path, llvm::StringRef Digest) noexcept {
+  std::optional<llvm::object::OwningBinary<llvm::object::Binary>> Opened;
+  std::string Key;
+  std::optional<FileStamp> Stamp;
+  if (Digest.empty()) {
+    llvm::sys::fs::file_status Status;
+    if (const auto EC = llvm::sys::fs::status(Path, Status)) {
+      return llvm::createFileError(Path, EC);
+    }
+    const FileStamp Current{
+        .Size = Status.getSize(),
+        .ModificationTime = Status.getLastModificationTime(),
+        .ID = Status.getUniqueID(),
+    };
+
+    if (const auto It = ByPath.find(Path);
+        (It != ByPath.end()) && (It->second.Stamp == Current) &&
+        (Entries.find(It->second.Key) != Entries.end())) {
+      Key = It->second.Key;
+      Stamp = Current;
+    } else {
+      // The file has to be mapped to compute a digest.
+      auto BinOrErr = Bartleby::openBinary(Path);
+      if (!BinOrErr) {
+        return BinOrErr.takeError();
+      }
+      Opened.emplace(std::move(*BinOrErr));
+      Key = getContentKey(Opened->getBinary()->getData());
+      ++HashedFiles;
+      if (isStatusReliable(Status)) {
+        Stamp = Current;
+      }
+    }
+  } else {
+    Key = ("digest:" + Digest).str();
+  }
+
+  auto EntryIt = Entries.find(Key);
+  if (EntryIt == Entries.end()) {
+    if (!Opened) {
+      auto BinOrErr = Bartleby::openBinary(Path);
+      if (!BinOrErr) {
+        return BinOrErr.takeError();
+      }
+      Opened.emplace(std::move(*BinOrErr));
+    }
+    ++Misses;
+    auto E = std::make_unique<Entry>();
+    E->Binary = std::move(*Opened);
+    const auto Data = E->Binary.getBinary()->getData();
+    ByData[Data.data()] = E.get();
+    Size += Data.size();
+    EntryIt = Entries.try_emplace(Key, std::move(E)).first;
+  } else {
+    ++Hits;
+  }
+  EntryIt->second->LastUse = ++Clock;
+
+  auto &Info = ByPath[Path];
+  if (Info.Key != Key) {
+    ++EntryIt->second->Paths;
+    if (!Info.Key.empty()) {
+      release(Info.Key);
+    }
+    Info.Key = Key;
+  }
+  Info.Stamp = Stamp;
+
+  const auto Ref = EntryIt->second->Binary.getBinary()->getMemoryBufferRef();
+  auto BinOrErr = llvm::object::createBinary(Ref);
+  if (!BinOrErr) {
+    return BinOrErr.takeError();
+  }
+  return llvm::object::OwningBinary<llvm::object::Binary>(
+      std::move(*BinOrErr),
+      llvm::MemoryBuffer::getMemBuffer(Ref, /*RequiresNullTerminator=*/false));
+}
+
+BARTLEBY_API size_t InputCache::prune() noexcept {
+  if ((MaxSize == 0) || (Size <= MaxSize)) {
+    return 0;
+  }
+
+  std::vector<std::pair<uint64_t, std::string>> ByUse;
+  ByUse.reserve(Entries.size());
+  for (const auto &E : Entries) {
+    ByUse.emplace_back(E.second->LastUse, E.first().str());
+  }
+  llvm::sort(ByUse);
+
+  llvm::StringSet<> Evicted;
+  for (const auto &[LastUse, Key] : ByUse) {
+    if (Size <= MaxSize) {
+      break;
+    }
+    evict(Key);
+    Evicted.insert(Key);
+  }
+  for (auto It = ByPath.begin(); It != ByPath.end();) {
+    auto Next = std::next(It);
+    if (Evicted.contains(It->second.Key)) {
+      ByPath.erase(It);
+    }
+    It = Next;
+  }
+  return Evicted.size();
+}
+
+BARTLEBY_API const std::vector<ObjectSymbols> *InputCache::getSummaries(
+    const llvm::object::Binary &Binary) const noexcept {
+  if (const auto It = ByData.find(Binary.getData().data());
+      (It != ByData.end()) && It->second->Summaries) {
+    return &*It->second->Summaries;
+  }
+  return nullptr;
+}
+
+BARTLEBY_API void
+InputCache::setSummaries(const llvm::object::Binary &Binary,
+                         std::vector<ObjectSymbols> Summaries) noexcept {
+  if (const auto It = ByData.find(Binary.getData().data());
+      It != ByData.end()) {
+    It->second->Summaries = std::move(Summaries);
+  }
+}
@@ -0,0 +1,167 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Memory-mapped archive members implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/MappedMember.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+#include <string>
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief A buffer backed by a read-only file mapping.
+class MappedMemberBuffer : public llvm::MemoryBuffer {
+public:
+  /// \brief Constructs a buffer.
+  ///
+  /// \param Region The mapping.
+  /// \param Name Name of the buffer.
+  MappedMemberBuffer(llvm::sys::fs::mapped_file_region Region,
+                     llvm::StringRef Name) noexcept
+      : Region(std::move(Region)), Name(Name) {
+    const auto *Start = this->Region.const_data();
+    init(Start, Start + this->Region.size(),
+         /*RequiresNullTerminator=*/false);
+  }
+
+  llvm::StringRef getBufferIdentifier() const override { return Name; }
+
+  BufferKind getBufferKind() const override { return MemoryBuffer_MMap; }
+
+private:
+  /// \brief The mapping.
+  llvm::sys::fs::mapped_file_region Region;
+
+  /// \brief Name of the buffer.
+  std::string Name;
+};
+
+/// \brief A buffer referring to a part of another buffer, of the same kind.
+class MemberView : public llvm::MemoryBuffer {
+public:
+  /// \brief Constructs a buffer.
+  ///
+  /// \param Kind Kind of the buffer it refers to.
+  /// \param Data The part of the buffer.
+  /// \param Name Name of the buffer.
+  MemberView(BufferKind Kind, llvm::StringRef Data,
+             llvm::StringRef Name) noexcept
+      : Kind(Kind), Name(Name) {
+    init(Data.begin(), Data.end(), /*RequiresNullTerminator=*/false);
+  }
+
+  llvm::StringRef getBufferIdentifier() const override { return Name; }
+
+  BufferKind getBufferKind() const override { return Kind; }
+
+private:
+  /// \brief Kind of the buffer it refers to.
+  BufferKind Kind;
+
+  /// \brief Name of the buffer.
+  std::string Name;
+};
+
+} // end anonymous namespace
+
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+saq::bartleby::mapMember(const llvm::sys::fs::file_t FD, llvm::StringRef Name,
+                         const uint64_t Size) noexcept {
+  // Empty files cannot be mapped.
+  if (Size == 0) {
+    return llvm::MemoryBuffer::getMemBuffer("", Name,
+                                            /*RequiresNullTerminator=*/false);
+  }
+
+  std::error_code EC;
+  llvm::sys::fs::mapped_file_region Region(
+      FD, llvm::sys::fs::mapped_file_region::readonly, Size, /*offset=*/0, EC);
+  if (EC) {
+    return llvm::createFileError(Name, EC);
+  }
+  return std::make_unique<MappedMemberBuffer>(std::move(Region), Name);
+}
+
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+saq::bartleby::mapFile(llvm::StringRef Path) noexcept {
+  auto FDOrErr = llvm::sys::fs::openNativeFileForRead(Path);
+  if (!FDOrErr) {
+    return FDOrErr.takeError();
+  }
+  llvm::sys::fs::file_status Status;
+  if (const auto EC = llvm::sys::fs::status(*FDOrErr, Status)) {
+    llvm::sys::fs::closeFile(*FDOrErr);
+    return llvm::createFileError(Path, EC);
+  }
+  auto MappedOrErr = mapMember(*FDOrErr, Path, Status.getSize());
+  llvm::sys::fs::closeFile(*FDOrErr);
+  return MappedOrErr;
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+saq::bartleby::viewMember(const llvm::MemoryBuffer &Parent,
+                          llvm::StringRef Data, llvm::StringRef Name) noexcept {
+  assert((Data.begin() >= Parent.getBufferStart()) &&
+         (Data.end() <= Parent.getBufferEnd()));
+  return std::make_unique<MemberView>(Parent.getBufferKind(), Data, Name);
+}
+
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+saq::bartleby::spillMember(llvm::StringRef Content,
+                           llvm::StringRef Directory) noexcept {
+  llvm::SmallString<128> Model(Directory);
+  if (Model.empty()) {
+    llvm::sys::path::system_temp_directory(/*ErasedOnReboot=*/true, Model);
+  }
+  llvm::sys::path::append(Model, "bartleby-%%%%%%%%.o");
+
+  auto TmpOrErr = llvm::sys::fs::TempFile::create(Model);
+  if (!TmpOrErr) {
+    return TmpOrErr.takeError();
+  }
+  {
+    llvm::raw_fd_ostream OS(TmpOrErr->FD, /*shouldClose=*/false);
+    OS << Content;
+    OS.flush();
+    if (const auto EC = OS.error()) {
+      OS.clear_error();
+      llvm::consumeError(TmpOrErr->discard());
+      return llvm::createFileError(TmpOrErr->TmpName, EC);
+    }
+  }
+
+  auto MappedOrErr =
+      mapMember(llvm::sys::fs::convertFDToNativeFile(TmpOrErr->FD),
+                TmpOrErr->TmpName, Content.size());
+  auto Err = TmpOrErr->discard();
+  if (!MappedOrErr) {
+    llvm::consumeError(std::move(Err));
+    return MappedOrErr.takeError();
+  }
+  if (Err) {
+    return std::move(Err);
+  }
+  return std::move(*MappedOrErr);
+}
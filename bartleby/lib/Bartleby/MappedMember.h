@@ -0,0 +1,86 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Memory-mapped archive members specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <cstdint>
+#include <memory>
+
+namespace saq::bartleby {
+
+/// \brief Maps an open file read-only.
+///
+/// Unlike \p llvm::MemoryBuffer::getOpenFile, which reads small files into
+/// the heap, the file is always mapped, whatever its size: the returned
+/// buffer is of kind \p llvm::MemoryBuffer::MemoryBuffer_MMap, and its pages
+/// can be reclaimed by the kernel. An empty file gives an empty buffer.
+///
+/// The file may be closed, or removed, once mapped.
+///
+/// \param FD The file.
+/// \param Name Name of the buffer.
+/// \param Size Size of the file, in bytes.
+///
+/// \returns The mapped file, or an error.
+[[nodiscard]] llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+mapMember(llvm::sys::fs::file_t FD, llvm::StringRef Name,
+          uint64_t Size) noexcept;
+
+/// \brief Opens a file and maps it read-only, whatever its size.
+///
+/// \param Path Path to the file.
+///
+/// \returns The mapped file, or an error.
+[[nodiscard]] llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+mapFile(llvm::StringRef Path) noexcept;
+
+/// \brief Returns a buffer referring to a part of another buffer.
+///
+/// Unlike \p llvm::MemoryBuffer::getMemBuffer, the buffer has the kind of
+/// \p Parent: a part of a mapped file is known to be mapped too.
+///
+/// \param Parent The buffer. It must outlive the returned buffer.
+/// \param Data The part of \p Parent.
+/// \param Name Name of the buffer.
+///
+/// \returns The buffer.
+[[nodiscard]] std::unique_ptr<llvm::MemoryBuffer>
+viewMember(const llvm::MemoryBuffer &Parent, llvm::StringRef Data,
+           llvm::StringRef Name) noexcept;
+
+/// \brief Writes an archive member to a temporary file, and maps it back.
+///
+/// The temporary file is removed right away: its content remains available
+/// through the mapping, which lives as long as the returned buffer.
+///
+/// \param Content The member.
+/// \param Directory Directory of the temporary file. If empty, the system
+/// temporary directory is used.
+///
+/// \returns The mapped member, or an error.
+[[nodiscard]] llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+spillMember(llvm::StringRef Content, llvm::StringRef Directory) noexcept;
+
+} // end namespace saq::bartleby
@@ -0,0 +1,121 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Object cache implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/ObjectCache.h"
+
+#include "Bartleby/MappedMember.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+
+#define DEBUG_TYPE "Bartleby"
+
+using namespace saq::bartleby;
+
+llvm::Expected<std::unique_ptr<ObjectCache>>
+ObjectCache::open(llvm::StringRef Directory, llvm::StringRef Policy) noexcept {
+  auto PolicyOrErr = llvm::parseCachePruningPolicy(Policy);
+  if (!PolicyOrErr) {
+    return PolicyOrErr.takeError();
+  }
+
+  if (const auto EC = llvm::sys::fs::create_directories(Directory)) {
+    return llvm::createFileError(Directory, EC);
+  }
+
+  return std::unique_ptr<ObjectCache>(
+      new ObjectCache(Directory, std::move(*PolicyOrErr)));
+}
+
+std::string ObjectCache::getEntryPath(llvm::StringRef Key) const noexcept {
+  // `llvm::pruneCache` only considers files starting with `llvmcache-`.
+  llvm::SmallString<128> Path(Directory);
+  llvm::sys::path::append(Path, "llvmcache-" + Key);
+  return std::string(Path);
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+ObjectCache::lookup(llvm::StringRef Key) noexcept {
+  const auto Path = getEntryPath(Key);
+
+  auto FDOrErr = llvm::sys::fs::openNativeFileForRead(Path);
+  if (!FDOrErr) {
+    llvm::consumeError(FDOrErr.takeError());
+    ++Misses;
+    return nullptr;
+  }
+  auto FD = *FDOrErr;
+
+  // Entries are mapped whatever their size, so that they do not stay on the
+  // heap until the archive is written.
+  llvm::sys::fs::file_status Status;
+  std::unique_ptr<llvm::MemoryBuffer> Buf;
+  if (!llvm::sys::fs::status(FD, Status)) {
+    auto BufOrErr = mapMember(FD, Path, Status.getSize());
+    if (BufOrErr) {
+      Buf = std::move(*BufOrErr);
+      // Marks the entry as recently used, for pruning.
+      llvm::sys::fs::setLastAccessAndModificationTime(
+          FD, std::chrono::system_clock::now());
+    } else {
+      llvm::consumeError(BufOrErr.takeError());
+    }
+  }
+  llvm::sys::fs::closeFile(FD);
+
+  if (Buf == nullptr) {
+    ++Misses;
+    return nullptr;
+  }
+  LLVM_DEBUG(llvm::dbgs() << "cache hit for " << Key << '\n');
+  ++Hits;
+  return Buf;
+}
+
+llvm::Error ObjectCache::store(llvm::StringRef Key,
+                               llvm::StringRef Content) noexcept {
+  llvm::SmallString<128> Model(Directory);
+  llvm::sys::path::append(Model, "bartleby-tmp-%%%%%%%%");
+
+  auto TmpOrErr = llvm::sys::fs::TempFile::create(Model);
+  if (!TmpOrErr) {
+    return TmpOrErr.takeError();
+  }
+  {
+    llvm::raw_fd_ostream OS(TmpOrErr->FD, /*shouldClose=*/false);
+    OS << Content;
+    OS.flush();
+    if (const auto EC = OS.error()) {
+      OS.clear_error();
+      llvm::consumeError(TmpOrErr->discard());
+      return llvm::createFileError(TmpOrErr->TmpName, EC);
+    }
+  }
+  return TmpOrErr->keep(getEntryPath(Key));
+}
+
+void ObjectCache::prune() noexcept {
+  llvm::pruneCache(Directory, Policy);
+}
@@ -0,0 +1,116 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Object cache specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace saq::bartleby {
+
+/// \brief On-disk cache of rewritten objects.
+///
+/// Entries are files named after their key, stored in a single directory on
+/// the local filesystem. Entries are written atomically, so that several
+/// processes can share the same cache. The cache is pruned using
+/// \p llvm::pruneCache, which evicts the least recently used entries first.
+class ObjectCache {
+public:
+  /// \brief Opens a cache.
+  ///
+  /// The directory is created if it does not exist.
+  ///
+  /// \param Directory Cache directory.
+  /// \param Policy Pruning policy, in the format accepted by
+  /// \p llvm::parseCachePruningPolicy. If empty, the default policy is used.
+  ///
+  /// \returns The cache, or an error.
+  [[nodiscard]] static llvm::Expected<std::unique_ptr<ObjectCache>>
+  open(llvm::StringRef Directory, llvm::StringRef Policy) noexcept;
+
+  /// \brief Looks up an entry.
+  ///
+  /// The entry is mapped, whatever its size.
+  ///
+  /// \param Key Key of the entry.
+  ///
+  /// \returns The content of the entry, or a null pointer if the entry does
+  /// not exist.
+  [[nodiscard]] std::unique_ptr<llvm::MemoryBuffer>
+  lookup(llvm::StringRef Key) noexcept;
+
+  /// \brief Stores an entry.
+  ///
+  /// \param Key Key of the entry.
+  /// \param Content Content of the entry.
+  ///
+  /// \returns An error.
+  [[nodiscard]] llvm::Error store(llvm::StringRef Key,
+                                  llvm::StringRef Content) noexcept;
+
+  /// \brief Prunes the cache according to its policy.
+  void prune() noexcept;
+
+  /// \brief Returns the number of lookups that found an entry.
+  ///
+  /// \returns The number of hits.
+  [[nodiscard]] size_t getHits() const noexcept { return Hits; }
+
+  /// \brief Returns the number of lookups that did not find an entry.
+  ///
+  /// \returns The number of misses.
+  [[nodiscard]] size_t getMisses() const noexcept { return Misses; }
+
+private:
+  /// \brief Constructs a cache.
+  ///
+  /// \param Directory Cache directory.
+  /// \param Policy Pruning policy.
+  ObjectCache(llvm::StringRef Directory,
+              llvm::CachePruningPolicy Policy) noexcept
+      : Directory(Directory), Policy(std::move(Policy)) {}
+
+  /// \brief Returns the path to an entry.
+  ///
+  /// \param Key Key of the entry.
+  ///
+  /// \returns The path.
+  [[nodiscard]] std::string getEntryPath(llvm::StringRef Key) const noexcept;
+
+  /// \brief Cache directory.
+  std::string Directory;
+
+  /// \brief Pruning policy.
+  llvm::CachePruningPolicy Policy;
+
+  /// \brief Number of hits.
+  std::atomic<size_t> Hits = 0;
+
+  /// \brief Number of misses.
+  std::atomic<size_t> Misses = 0;
+};
+
+} // end namespace saq::bartleby
@@ -0,0 +1,219 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Occurrence index and dependency graph implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/OccurrenceIndex.h"
+
+#include "Bartleby/Export.h"
+
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/GraphWriter.h"
+#include "llvm/Support/JSON.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief Magic of the binary format of a dependency graph.
+constexpr llvm::StringLiteral GraphMagic = "BTLYDEPG";
+
+/// \brief Version of the binary format of a dependency graph.
+constexpr uint32_t GraphVersion = 1;
+
+/// \brief Writes a 32-bit little-endian integer.
+///
+/// \param OS Output stream.
+/// \param Value Integer.
+void writeU32(llvm::raw_ostream &OS, const uint32_t Value) noexcept {
+  char Buffer[sizeof(Value)];
+  llvm::support::endian::write32le(Buffer, Value);
+  OS.write(Buffer, sizeof(Buffer));
+}
+
+} // end anonymous namespace
+
+BARTLEBY_API OccurrenceIndex::OccurrenceIndex(
+    const size_t NumSymbols,
+    llvm::ArrayRef<llvm::ArrayRef<SymbolUse>> Uses) noexcept
+    : Offsets(NumSymbols + 1, 0) {
+  for (const auto ObjUses : Uses) {
+    for (const auto &Use : ObjUses) {
+      assert(Use.ID < NumSymbols);
+      ++Offsets[Use.ID + 1];
+    }
+  }
+  for (size_t I = 1; I < Offsets.size(); ++I) {
+    Offsets[I] += Offsets[I - 1];
+  }
+
+  Occurrences.resize(Offsets.back());
+  std::vector<uint32_t> Next(Offsets.begin(), Offsets.end() - 1);
+  for (uint32_t Object = 0; Object < Uses.size(); ++Object) {
+    for (const auto &Use : Uses[Object]) {
+      Occurrences[Next[Use.ID]++] = Occurrence{
+          .Object = Object,
+          .Defined = Use.Defined,
+          .Bind = Use.Bind,
+      };
+    }
+  }
+}
+
+BARTLEBY_API llvm::ArrayRef<Occurrence>
+OccurrenceIndex::lookup(const SymbolID ID) const noexcept {
+  if (ID >= getNumSymbols()) {
+    return {};
+  }
+  return llvm::ArrayRef<Occurrence>(Occurrences)
+      .slice(Offsets[ID], Offsets[ID + 1] - Offsets[ID]);
+}
+
+BARTLEBY_API DependencyGraph::DependencyGraph(
+    const OccurrenceIndex &Index,
+    llvm::ArrayRef<llvm::ArrayRef<SymbolUse>> Uses) noexcept {
+  Offsets.reserve(Uses.size() + 1);
+  Offsets.push_back(0);
+
+  // Number of symbols resolved by each object, for the current object.
+  std::vector<uint32_t> Counts(Uses.size(), 0);
+  std::vector<uint32_t> Targets;
+  for (uint32_t From = 0; From < Uses.size(); ++From) {
+    for (const auto &Use : Uses[From]) {
+      if (Use.Defined) {
+        continue;
+      }
+      // Occurrences are ordered by object, so an object that defines the
+      // symbol more than once is only counted once.
+      uint32_t Last = From;
+      for (const auto &Occ : Index.lookup(Use.ID)) {
+        if (!Occ.Defined || (Occ.Bind == Binding::Local) ||
+            (Occ.Object == Last)) {
+          continue;
+        }
+        Last = Occ.Object;
+        if (Counts[Occ.Object]++ == 0) {
+          Targets.push_back(Occ.Object);
+        }
+      }
+    }
+
+    std::sort(Targets.begin(), Targets.end());
+    for (const auto To : Targets) {
+      Edges.push_back(Edge{.To = To, .Symbols = Counts[To]});
+      Counts[To] = 0;
+    }
+    Targets.clear();
+    Offsets.push_back(Edges.size());
+  }
+}
+
+BARTLEBY_API llvm::ArrayRef<DependencyGraph::Edge>
+DependencyGraph::getDependencies(const uint32_t Object) const noexcept {
+  assert(Object < getNumObjects());
+  return llvm::ArrayRef<Edge>(Edges).slice(
+      Offsets[Object], Offsets[Object + 1] - Offsets[Object]);
+}
+
+BARTLEBY_API void
+DependencyGraph::write(llvm::raw_ostream &OS, const GraphFormat Format,
+                       llvm::ArrayRef<llvm::StringRef> Names) const noexcept {
+  switch (Format) {
+  case GraphFormat::Binary: {
+    writeBinary(OS, Names);
+    return;
+  }
+  case GraphFormat::DOT: {
+    writeDOT(OS, Names);
+    return;
+  }
+  case GraphFormat::JSON: {
+    writeJSON(OS, Names);
+    return;
+  }
+  }
+  __builtin_unreachable();
+}
+
+BARTLEBY_API void DependencyGraph::writeBinary(
+    llvm::raw_ostream &OS,
+    llvm::ArrayRef<llvm::StringRef> Names) const noexcept {
+  assert(Names.size() == getNumObjects());
+  OS << GraphMagic;
+  writeU32(OS, GraphVersion);
+  writeU32(OS, getNumObjects());
+  writeU32(OS, getNumEdges());
+  for (const auto Name : Names) {
+    writeU32(OS, Name.size());
+    OS << Name;
+  }
+  for (const auto Offset : Offsets) {
+    writeU32(OS, Offset);
+  }
+  for (const auto &E : Edges) {
+    writeU32(OS, E.To);
+    writeU32(OS, E.Symbols);
+  }
+}
+
+BARTLEBY_API void DependencyGraph::writeDOT(
+    llvm::raw_ostream &OS,
+    llvm::ArrayRef<llvm::StringRef> Names) const noexcept {
+  assert(Names.size() == getNumObjects());
+  OS << "digraph dependencies {\n";
+  for (uint32_t I = 0; I < getNumObjects(); ++I) {
+    OS << "  n" << I << " [label=\""
+       << llvm::DOT::EscapeString(Names[I].str()) << "\"];\n";
+  }
+  for (uint32_t I = 0; I < getNumObjects(); ++I) {
+    for (const auto &E : getDependencies(I)) {
+      OS << "  n" << I << " -> n" << E.To << " [label=\"" << E.Symbols
+         << "\"];\n";
+    }
+  }
+  OS << "}\n";
+}
+
+BARTLEBY_API void DependencyGraph::writeJSON(
+    llvm::raw_ostream &OS,
+    llvm::ArrayRef<llvm::StringRef> Names) const noexcept {
+  assert(Names.size() == getNumObjects());
+  llvm::json::OStream J(OS, 2);
+  J.object([&] {
+    J.attributeArray("objects", [&] {
+      for (const auto Name : Names) {
+        J.value(Name);
+      }
+    });
+    J.attributeArray("edges", [&] {
+      for (uint32_t I = 0; I < getNumObjects(); ++I) {
+        for (const auto &E : getDependencies(I)) {
+          J.object([&] {
+            J.attribute("from", I);
+            J.attribute("to", E.To);
+            J.attribute("symbols", E.Symbols);
+          });
+        }
+      }
+    });
+  });
+  OS << '\n';
+}
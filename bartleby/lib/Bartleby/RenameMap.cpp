@@ -0,0 +1,308 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Binary rename map implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/RenameMap.h"
+
+#include "Bartleby/Export.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief Magic of the binary format of a rename map.
+constexpr llvm::StringLiteral RenameMapMagic = "BTLYRMAP";
+
+/// \brief Version of the binary format of a rename map.
+constexpr uint32_t RenameMapVersion = 1;
+
+/// \brief Size of the header: the magic, the version, the number of entries,
+/// the number of buckets and the size of the string table.
+constexpr size_t HeaderSize = 8 + (4 * sizeof(uint32_t));
+
+/// \brief Size of an entry.
+constexpr size_t EntrySize = 4 * sizeof(uint32_t);
+
+/// \brief Value of an empty bucket.
+constexpr uint32_t EmptyBucket = std::numeric_limits<uint32_t>::max();
+
+/// \brief Returns the number of buckets of the hash tables of a map.
+///
+/// \param NumEntries Number of entries.
+///
+/// \returns A power of two, at least twice the number of entries.
+[[nodiscard]] uint64_t getNumBuckets(const uint64_t NumEntries) noexcept {
+  return llvm::PowerOf2Ceil(std::max<uint64_t>(NumEntries * 2, 1));
+}
+
+/// \brief Builds a hash table.
+///
+/// \param Names Names, by entry index.
+/// \param NumBuckets Number of buckets, a power of two.
+///
+/// \returns The buckets.
+[[nodiscard]] std::vector<uint32_t>
+buildBuckets(llvm::ArrayRef<llvm::StringRef> Names,
+             const uint64_t NumBuckets) noexcept {
+  std::vector<uint32_t> Buckets(NumBuckets, EmptyBucket);
+  const uint64_t Mask = NumBuckets - 1;
+  for (uint32_t I = 0; I < Names.size(); ++I) {
+    auto B = llvm::xxHash64(Names[I]) & Mask;
+    while (Buckets[B] != EmptyBucket) {
+      B = (B + 1) & Mask;
+    }
+    Buckets[B] = I;
+  }
+  return Buckets;
+}
+
+/// \brief Writes a 32-bit little-endian integer.
+///
+/// \param OS Output stream.
+/// \param Value Integer.
+void writeU32(llvm::raw_ostream &OS, const uint32_t Value) noexcept {
+  char Buffer[sizeof(Value)];
+  llvm::support::endian::write32le(Buffer, Value);
+  OS.write(Buffer, sizeof(Buffer));
+}
+
+/// \brief Creates an error about a malformed map.
+///
+/// \param Msg Error message.
+///
+/// \returns The error.
+[[nodiscard]] llvm::Error makeMalformedError(const llvm::Twine &Msg) noexcept {
+  return llvm::make_error<llvm::StringError>("malformed rename map: " + Msg,
+                                             llvm::inconvertibleErrorCode());
+}
+
+/// \brief Tells whether a character may appear in a symbol name.
+///
+/// \param C The character.
+///
+/// \returns True if it may appear in a symbol name.
+[[nodiscard]] bool isNameChar(const char C) noexcept {
+  return llvm::isAlnum(C) || (C == '_') || (C == '$') || (C == '.');
+}
+
+} // end anonymous namespace
+
+BARTLEBY_API llvm::Error RenameMap::write(
+    llvm::raw_ostream &OS,
+    llvm::ArrayRef<std::pair<llvm::StringRef, llvm::StringRef>>
+        Renames) noexcept {
+  uint64_t StringsSize = 0;
+  for (const auto &[NewName, Name] : Renames) {
+    StringsSize += NewName.size() + Name.size();
+  }
+  if ((getNumBuckets(Renames.size()) > std::numeric_limits<uint32_t>::max()) ||
+      (StringsSize > std::numeric_limits<uint32_t>::max())) {
+    return llvm::make_error<llvm::StringError>(
+        "too many renamed symbols for a binary rename map",
+        llvm::inconvertibleErrorCode());
+  }
+
+  std::vector<uint32_t> ByNewName(Renames.size());
+  std::iota(ByNewName.begin(), ByNewName.end(), 0);
+  std::sort(ByNewName.begin(), ByNewName.end(),
+            [&](const uint32_t L, const uint32_t R) {
+              return Renames[L].first < Renames[R].first;
+            });
+
+  // Entries are laid out by new name, and so are their strings.
+  std::vector<llvm::StringRef> NewNames;
+  std::vector<llvm::StringRef> Names;
+  NewNames.reserve(Renames.size());
+  Names.reserve(Renames.size());
+  for (const auto I : ByNewName) {
+    NewNames.push_back(Renames[I].first);
+    Names.push_back(Renames[I].second);
+  }
+  const auto NumBuckets = getNumBuckets(Renames.size());
+
+  OS << RenameMapMagic;
+  writeU32(OS, RenameMapVersion);
+  writeU32(OS, Renames.size());
+  writeU32(OS, NumBuckets);
+  writeU32(OS, StringsSize);
+  uint32_t Offset = 0;
+  for (size_t I = 0; I < NewNames.size(); ++I) {
+    writeU32(OS, Offset);
+    writeU32(OS, NewNames[I].size());
+    writeU32(OS, Offset + NewNames[I].size());
+    writeU32(OS, Names[I].size());
+    Offset += NewNames[I].size() + Names[I].size();
+  }
+  for (const auto *Table : {&NewNames, &Names}) {
+    for (const auto B : buildBuckets(*Table, NumBuckets)) {
+      writeU32(OS, B);
+    }
+  }
+  for (size_t I = 0; I < NewNames.size(); ++I) {
+    OS << NewNames[I] << Names[I];
+  }
+  return llvm::Error::success();
+}
+
+BARTLEBY_API llvm::Expected<RenameMap>
+RenameMap::create(llvm::MemoryBufferRef Buffer) noexcept {
+  const auto Data = Buffer.getBuffer();
+  if ((Data.size() < HeaderSize) ||
+      (Data.take_front(RenameMapMagic.size()) != RenameMapMagic)) {
+    return makeMalformedError("bad magic");
+  }
+  const auto *Header =
+      reinterpret_cast<const uint8_t *>(Data.data() + RenameMapMagic.size());
+  using llvm::support::endian::read32le;
+  if (const auto Version = read32le(Header); Version != RenameMapVersion) {
+    return makeMalformedError("unsupported version " + llvm::Twine(Version));
+  }
+  const uint64_t NumEntries = read32le(Header + 4);
+  const uint64_t NumBuckets = read32le(Header + 8);
+  const uint64_t StringsSize = read32le(Header + 12);
+  if (NumBuckets != getNumBuckets(NumEntries)) {
+    return makeMalformedError("unexpected number of buckets");
+  }
+  const uint64_t TablesSize =
+      (NumEntries * EntrySize) + (2 * NumBuckets * sizeof(uint32_t));
+  if (Data.size() != HeaderSize + TablesSize + StringsSize) {
+    return makeMalformedError("unexpected size");
+  }
+
+  using Bucket = llvm::support::ulittle32_t;
+  RenameMap Map;
+  const char *Cursor = Data.data() + HeaderSize;
+  Map.Entries =
+      llvm::ArrayRef<Entry>(reinterpret_cast<const Entry *>(Cursor),
+                            static_cast<size_t>(NumEntries));
+  Cursor += NumEntries * EntrySize;
+  Map.NewBuckets = llvm::ArrayRef<Bucket>(
+      reinterpret_cast<const Bucket *>(Cursor), NumBuckets);
+  Cursor += NumBuckets * sizeof(uint32_t);
+  Map.NameBuckets = llvm::ArrayRef<Bucket>(
+      reinterpret_cast<const Bucket *>(Cursor), NumBuckets);
+  Cursor += NumBuckets * sizeof(uint32_t);
+  Map.Strings = llvm::StringRef(Cursor, StringsSize);
+
+  // Validating everything once lets lookups trust the map.
+  for (size_t I = 0; I < Map.Entries.size(); ++I) {
+    const auto &E = Map.Entries[I];
+    if ((uint64_t{E.NewOffset} + E.NewSize > StringsSize) ||
+        (uint64_t{E.NameOffset} + E.NameSize > StringsSize)) {
+      return makeMalformedError("entry " + llvm::Twine(I) +
+                                " is out of the string table");
+    }
+  }
+  for (const auto Buckets : {Map.NewBuckets, Map.NameBuckets}) {
+    for (const uint32_t B : Buckets) {
+      if ((B != EmptyBucket) && (B >= NumEntries)) {
+        return makeMalformedError("bucket points out of the entries");
+      }
+    }
+  }
+  return std::move(Map);
+}
+
+BARTLEBY_API llvm::Expected<RenameMap>
+RenameMap::load(llvm::StringRef Path) noexcept {
+  auto BufOrErr =
+      llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    return llvm::createFileError(Path, BufOrErr.getError());
+  }
+  auto MapOrErr = create((*BufOrErr)->getMemBufferRef());
+  if (!MapOrErr) {
+    return llvm::createFileError(Path, MapOrErr.takeError());
+  }
+  MapOrErr->Owner = std::move(*BufOrErr);
+  return MapOrErr;
+}
+
+BARTLEBY_API std::optional<llvm::StringRef>
+RenameMap::lookup(llvm::StringRef Name, const Direction D) const noexcept {
+  const auto *E = find(Name, D);
+  if (E == nullptr) {
+    return std::nullopt;
+  }
+  return (D == Direction::ToOriginal) ? getName(*E) : getNewName(*E);
+}
+
+const RenameMap::Entry *RenameMap::find(llvm::StringRef Name,
+                                        const Direction D) const noexcept {
+  const auto Buckets =
+      (D == Direction::ToOriginal) ? NewBuckets : NameBuckets;
+  const uint64_t Mask = Buckets.size() - 1;
+  auto B = llvm::xxHash64(Name) & Mask;
+  // Tables are at most half full, but a malformed one may be full.
+  for (size_t Probes = 0; Probes < Buckets.size(); ++Probes) {
+    const uint32_t I = Buckets[B];
+    if (I == EmptyBucket) {
+      return nullptr;
+    }
+    const auto &E = Entries[I];
+    if (((D == Direction::ToOriginal) ? getNewName(E) : getName(E)) == Name) {
+      return &E;
+    }
+    B = (B + 1) & Mask;
+  }
+  return nullptr;
+}
+
+BARTLEBY_API size_t RenameMap::symbolize(llvm::StringRef Text,
+                                         const Direction D,
+                                         llvm::raw_ostream &OS) const noexcept {
+  size_t Replaced = 0;
+  while (!Text.empty()) {
+    const auto Other = Text.take_until(isNameChar);
+    OS << Other;
+    Text = Text.drop_front(Other.size());
+
+    const auto Token = Text.take_while(isNameChar);
+    Text = Text.drop_front(Token.size());
+    if (Token.empty()) {
+      continue;
+    }
+
+    // A name may be followed by a period ending a sentence.
+    auto Name = Token;
+    auto Mapped = lookup(Name, D);
+    if (!Mapped && (Name.back() == '.')) {
+      Name = Name.rtrim('.');
+      Mapped = lookup(Name, D);
+    }
+    if (Mapped) {
+      OS << *Mapped << Token.drop_front(Name.size());
+      ++Replaced;
+    } else {
+      OS << Token;
+    }
+  }
+  return Replaced;
+}
@@ -0,0 +1,469 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Rename policy implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/RenamePolicy.h"
+
+#include "Bartleby/Export.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/GlobPattern.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+#include <bitset>
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief Characters with a special meaning in a glob.
+constexpr llvm::StringLiteral GlobMetaCharacters = "*?[\\";
+
+/// \brief Characters separating the fields of a rule.
+constexpr llvm::StringLiteral Blanks = " \t";
+
+/// \brief Creates an error about a line of a policy.
+///
+/// \param Line Line number, starting from 1.
+/// \param Msg Error message.
+///
+/// \returns The error.
+[[nodiscard]] llvm::Error makeLineError(const size_t Line,
+                                        const llvm::Twine &Msg) noexcept {
+  return llvm::make_error<llvm::StringError>(
+      "line " + llvm::Twine(Line) + ": " + Msg, llvm::inconvertibleErrorCode());
+}
+
+/// \brief Characters with a special meaning in a POSIX extended regular
+/// expression.
+constexpr llvm::StringLiteral RegexMetaCharacters = "^$.[]|()*+?{}\\";
+
+/// \brief Appends a character to a regular expression, escaped if needed.
+///
+/// \param[out] Regex The regular expression.
+/// \param C The character.
+void appendRegexLiteral(std::string &Regex, const char C) noexcept {
+  if (RegexMetaCharacters.find(C) != llvm::StringRef::npos) {
+    Regex += '\\';
+  }
+  Regex += C;
+}
+
+/// \brief Appends a set of characters to a regular expression, as a bracket
+/// expression.
+///
+/// In a bracket expression, \p ] must come first, \p ^ must not, and \p -
+/// must come first or last. Other characters are grouped into ranges, which
+/// do not cross 0x80: \p llvm::Regex compares their bounds as \p char.
+///
+/// \param[out] Regex The regular expression.
+/// \param Set The set. The null character is ignored, as names cannot hold
+/// it.
+void appendRegexBracket(std::string &Regex,
+                        const std::bitset<256> &Set) noexcept {
+  std::string Items;
+  if (Set['^'] && (Set.count() - Set[0] == 1)) {
+    Regex += "\\^";
+    return;
+  }
+  if (Set[']']) {
+    Items += ']';
+  }
+  for (unsigned C = 1; C < 256; ++C) {
+    if (!Set[C] || (C == ']') || (C == '^') || (C == '-')) {
+      continue;
+    }
+    unsigned Last = C;
+    while ((Last + 1 < 256) && (Last + 1 != 0x80) && Set[Last + 1] &&
+           (Last + 1 != ']') && (Last + 1 != '^') && (Last + 1 != '-')) {
+      ++Last;
+    }
+    Items += static_cast<char>(C);
+    if (Last >= C + 2) {
+      Items += '-';
+      Items += static_cast<char>(Last);
+      C = Last;
+    }
+  }
+  if (Set['^']) {
+    if (Items.empty()) {
+      Items += '-';
+    }
+    Items += '^';
+  }
+  if (Set['-'] && (Items.empty() || (Items.front() != '-'))) {
+    Items += '-';
+  }
+  if (Items.empty()) {
+    // Only the null character, which no name holds.
+    Items = "^\x01-\xff";
+  }
+  Regex += '[';
+  Regex += Items;
+  Regex += ']';
+}
+
+/// \brief Translates a glob into a POSIX extended regular expression.
+///
+/// The translation follows \p llvm::GlobPattern: \p * matches any string,
+/// \p ? any character, \p [...] a set of characters, negated by a leading
+/// \p ! or \p ^, where \p ] may come first and \p X-Y is a range, and \p \\
+/// escapes the following character.
+///
+/// \param Glob The glob, valid for \p llvm::GlobPattern.
+///
+/// \returns The regular expression, which does not contain any group.
+[[nodiscard]] std::string globToRegex(llvm::StringRef Glob) noexcept {
+  std::string Regex;
+  while (!Glob.empty()) {
+    const char C = Glob.front();
+    if (C == '*') {
+      Regex += ".*";
+      Glob = Glob.drop_front();
+    } else if (C == '?') {
+      Regex += '.';
+      Glob = Glob.drop_front();
+    } else if ((C == '\\') && (Glob.size() > 1)) {
+      appendRegexLiteral(Regex, Glob[1]);
+      Glob = Glob.drop_front(2);
+    } else if ((C == '[') && (Glob.find(']', 2) != llvm::StringRef::npos)) {
+      const auto End = Glob.find(']', 2);
+      auto Chars = Glob.substr(1, End - 1);
+      Glob = Glob.drop_front(End + 1);
+      const bool Negated = !Chars.empty() &&
+                           ((Chars.front() == '!') || (Chars.front() == '^'));
+      if (Negated) {
+        Chars = Chars.drop_front();
+      }
+      std::bitset<256> Set;
+      while (!Chars.empty()) {
+        const auto First = static_cast<uint8_t>(Chars.front());
+        if ((Chars.size() >= 3) && (Chars[1] == '-')) {
+          const auto Last = static_cast<uint8_t>(Chars[2]);
+          for (unsigned I = First; I <= Last; ++I) {
+            Set.set(I);
+          }
+          Chars = Chars.drop_front(3);
+        } else {
+          Set.set(First);
+          Chars = Chars.drop_front();
+        }
+      }
+      if (Negated) {
+        Set.flip();
+      }
+      appendRegexBracket(Regex, Set);
+    } else {
+      appendRegexLiteral(Regex, C);
+      Glob = Glob.drop_front();
+    }
+  }
+  return Regex;
+}
+
+/// \brief Returns whether a POSIX extended regular expression uses a back
+/// reference.
+///
+/// \param Pattern The regular expression.
+///
+/// \returns True if \p Pattern holds \p \\1 to \p \\9 outside of a bracket
+/// expression.
+[[nodiscard]] bool hasBackReference(llvm::StringRef Pattern) noexcept {
+  for (size_t I = 0; I < Pattern.size(); ++I) {
+    if (Pattern[I] == '\\') {
+      ++I;
+      if ((I < Pattern.size()) && (Pattern[I] >= '1') && (Pattern[I] <= '9')) {
+        return true;
+      }
+      continue;
+    }
+    if (Pattern[I] != '[') {
+      continue;
+    }
+
+    // Skip the bracket expression, where a backslash is an ordinary
+    // character and ']' may come first, or close [:class:], [.sym.] or
+    // [=equiv=].
+    size_t J = I + 1;
+    if ((J < Pattern.size()) && (Pattern[J] == '^')) {
+      ++J;
+    }
+    if ((J < Pattern.size()) && (Pattern[J] == ']')) {
+      ++J;
+    }
+    while ((J < Pattern.size()) && (Pattern[J] != ']')) {
+      if ((Pattern[J] == '[') && (J + 1 < Pattern.size()) &&
+          llvm::StringRef(":.=").contains(Pattern[J + 1])) {
+        const char Close[] = {Pattern[J + 1], ']', '\0'};
+        const auto End = Pattern.find(Close, J + 2);
+        J = (End == llvm::StringRef::npos) ? Pattern.size() : End + 2;
+        continue;
+      }
+      ++J;
+    }
+    I = J;
+  }
+  return false;
+}
+
+/// \brief Joins a regular expression to the ones of an action.
+///
+/// \param[out] Regex Joined regular expression of the action.
+/// \param Pattern The regular expression.
+void joinRegex(std::string &Regex, llvm::StringRef Pattern) noexcept {
+  Regex += Regex.empty() ? "(" : "|(";
+  Regex += Pattern;
+  Regex += ')';
+}
+
+} // end anonymous namespace
+
+void RenamePolicy::PrefixTrie::build(
+    std::vector<std::pair<std::string, ActionMask>> Prefixes) noexcept {
+  Nodes.clear();
+  Labels.clear();
+  Targets.clear();
+  std::sort(Prefixes.begin(), Prefixes.end());
+  buildNode(Prefixes, 0);
+}
+
+uint32_t RenamePolicy::PrefixTrie::buildNode(
+    llvm::ArrayRef<std::pair<std::string, ActionMask>> Prefixes,
+    const size_t Depth) noexcept {
+  const uint32_t Index = Nodes.size();
+  Nodes.emplace_back();
+
+  // Prefixes are sorted, so the one ending at this node comes first.
+  while (!Prefixes.empty() && (Prefixes.front().first.size() == Depth)) {
+    Nodes[Index].Mask |= Prefixes.front().second;
+    Prefixes = Prefixes.drop_front();
+  }
+
+  llvm::SmallVector<llvm::ArrayRef<std::pair<std::string, ActionMask>>, 8>
+      Children;
+  while (!Prefixes.empty()) {
+    const auto Label = Prefixes.front().first[Depth];
+    size_t N = 1;
+    while ((N < Prefixes.size()) && (Prefixes[N].first[Depth] == Label)) {
+      ++N;
+    }
+    Children.push_back(Prefixes.take_front(N));
+    Prefixes = Prefixes.drop_front(N);
+  }
+
+  const uint32_t FirstEdge = Labels.size();
+  Nodes[Index].FirstEdge = FirstEdge;
+  Nodes[Index].NumEdges = Children.size();
+  Labels.resize(FirstEdge + Children.size());
+  Targets.resize(FirstEdge + Children.size());
+  for (size_t I = 0; I < Children.size(); ++I) {
+    Labels[FirstEdge + I] =
+        static_cast<uint8_t>(Children[I].front().first[Depth]);
+    const auto Target = buildNode(Children[I], Depth + 1);
+    Targets[FirstEdge + I] = Target;
+  }
+  return Index;
+}
+
+RenamePolicy::ActionMask
+RenamePolicy::PrefixTrie::match(llvm::StringRef Name) const noexcept {
+  if (Nodes.empty()) {
+    return 0;
+  }
+
+  const auto *N = &Nodes.front();
+  ActionMask Mask = N->Mask;
+  for (const auto C : Name.bytes()) {
+    const auto *First = Labels.data() + N->FirstEdge;
+    const auto *Last = First + N->NumEdges;
+    const auto *It = std::lower_bound(First, Last, C);
+    if ((It == Last) || (*It != C)) {
+      break;
+    }
+    N = &Nodes[Targets[It - Labels.data()]];
+    Mask |= N->Mask;
+  }
+  return Mask;
+}
+
+llvm::Error RenamePolicy::addRule(
+    const Action A, llvm::StringRef Kind, llvm::StringRef Pattern,
+    std::vector<std::pair<std::string, ActionMask>> &Prefixes,
+    std::string &Regex) noexcept {
+  if (Kind == "literal") {
+    Literals[Pattern] |= bit(A);
+    return llvm::Error::success();
+  }
+  if (Kind == "prefix") {
+    Prefixes.emplace_back(Pattern.str(), bit(A));
+    return llvm::Error::success();
+  }
+  if (Kind == "glob") {
+    const auto Meta = Pattern.find_first_of(GlobMetaCharacters);
+    if (Meta == llvm::StringRef::npos) {
+      Literals[Pattern] |= bit(A);
+      return llvm::Error::success();
+    }
+    if ((Meta == Pattern.size() - 1) && (Pattern.back() == '*')) {
+      Prefixes.emplace_back(Pattern.drop_back().str(), bit(A));
+      return llvm::Error::success();
+    }
+    // Only checked, then compiled into the joined regular expression.
+    if (auto GlobOrErr = llvm::GlobPattern::create(Pattern); !GlobOrErr) {
+      return GlobOrErr.takeError();
+    }
+    joinRegex(Regex, globToRegex(Pattern));
+    return llvm::Error::success();
+  }
+  if (Kind == "regex") {
+    std::string Err;
+    if (!llvm::Regex(Pattern).isValid(Err)) {
+      return llvm::make_error<llvm::StringError>(
+          "invalid regex: " + Err, llvm::inconvertibleErrorCode());
+    }
+    // Joined regular expressions renumber groups: back references would
+    // point to the group of another rule.
+    if (hasBackReference(Pattern)) {
+      return llvm::make_error<llvm::StringError>(
+          "back references are not supported in regex rules",
+          llvm::inconvertibleErrorCode());
+    }
+    joinRegex(Regex, Pattern);
+    return llvm::Error::success();
+  }
+  return llvm::make_error<llvm::StringError>(
+      "unknown pattern kind '" + Kind + "'", llvm::inconvertibleErrorCode());
+}
+
+BARTLEBY_API llvm::Expected<RenamePolicy>
+RenamePolicy::parse(llvm::StringRef Text) noexcept {
+  RenamePolicy Policy;
+  std::vector<std::pair<std::string, ActionMask>> Prefixes;
+  std::string KeepRegex;
+  std::string RenameRegex;
+
+  llvm::SmallVector<llvm::StringRef, 64> Lines;
+  Text.split(Lines, '\n');
+  for (size_t I = 0; I < Lines.size(); ++I) {
+    const auto Line = Lines[I].trim();
+    if (Line.empty() || (Line.front() == '#')) {
+      continue;
+    }
+
+    const auto Split = Line.find_first_of(Blanks);
+    const auto Directive = Line.substr(0, Split);
+    const auto Argument = Line.substr(Split).trim();
+    if (Directive == "default") {
+      if (Argument == "keep") {
+        Policy.RenameByDefault = false;
+      } else if (Argument == "rename") {
+        Policy.RenameByDefault = true;
+      } else {
+        return makeLineError(I + 1, "expected 'keep' or 'rename' after "
+                                    "'default', got '" +
+                                        Argument + "'");
+      }
+      continue;
+    }
+
+    Action A;
+    if (Directive == "keep") {
+      A = Action::Keep;
+    } else if (Directive == "rename") {
+      A = Action::Rename;
+    } else {
+      return makeLineError(I + 1, "unknown directive '" + Directive + "'");
+    }
+    const auto [Kind, Pattern] = Argument.split(':');
+    if (Pattern.empty()) {
+      return makeLineError(I + 1, "expected <kind>:<pattern>, got '" +
+                                      Argument + "'");
+    }
+    if (auto Err = Policy.addRule(A, Kind, Pattern, Prefixes,
+                                  (A == Action::Keep) ? KeepRegex
+                                                      : RenameRegex)) {
+      return makeLineError(I + 1, llvm::toString(std::move(Err)));
+    }
+  }
+
+  Policy.Prefixes.build(std::move(Prefixes));
+  if (!KeepRegex.empty()) {
+    Policy.KeepRegex.emplace("^(" + KeepRegex + ")$");
+  }
+  if (!RenameRegex.empty()) {
+    Policy.RenameRegex.emplace("^(" + RenameRegex + ")$");
+  }
+  return std::move(Policy);
+}
+
+BARTLEBY_API llvm::Expected<RenamePolicy>
+RenamePolicy::load(llvm::StringRef Path) noexcept {
+  auto BufOrErr = llvm::MemoryBuffer::getFile(Path, /*IsText=*/true);
+  if (!BufOrErr) {
+    return llvm::createFileError(Path, BufOrErr.getError());
+  }
+  auto PolicyOrErr = parse((*BufOrErr)->getBuffer());
+  if (!PolicyOrErr) {
+    return llvm::createFileError(Path, PolicyOrErr.takeError());
+  }
+  return PolicyOrErr;
+}
+
+BARTLEBY_API RenamePolicy::Action
+RenamePolicy::match(llvm::StringRef Name) const noexcept {
+  ActionMask Mask = Prefixes.match(Name);
+  if (const auto It = Literals.find(Name); It != Literals.end()) {
+    Mask |= It->second;
+  }
+
+  // Keep rules win, so the regular expression of rename rules only runs
+  // when no keep rule matches.
+  if (((Mask & bit(Action::Keep)) != 0) ||
+      (KeepRegex && KeepRegex->match(Name))) {
+    return Action::Keep;
+  }
+  if (((Mask & bit(Action::Rename)) != 0) ||
+      (RenameRegex && RenameRegex->match(Name))) {
+    return Action::Rename;
+  }
+  return Action::Default;
+}
+
+BARTLEBY_API bool RenamePolicy::shouldRename(llvm::StringRef Name,
+                                             const Symbol &Sym) const noexcept {
+  // As with prefixGlobalAndDefinedSymbols, other symbols are never renamed:
+  // rules only choose among global and defined symbols.
+  if (!Sym.isGlobal() || !Sym.isDefined()) {
+    return false;
+  }
+  switch (match(Name)) {
+  case Action::Keep: {
+    return false;
+  }
+  case Action::Rename: {
+    return true;
+  }
+  case Action::Default: {
+    return RenameByDefault;
+  }
+  }
+  __builtin_unreachable();
+}
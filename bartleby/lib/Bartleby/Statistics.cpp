@@ -0,0 +1,300 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Bartleby statistics implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/Statistics.h"
+#include "Bartleby/Export.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+
+using namespace saq::bartleby;
+
+namespace {
+
+/// \brief Returns the peak resident set size of the process.
+///
+/// \returns The peak RSS, in bytes, or 0 if not supported.
+[[nodiscard]] uint64_t getProcessPeakRSS() noexcept {
+#ifdef LLVM_ON_UNIX
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return static_cast<uint64_t>(Usage.ru_maxrss);
+#else
+  return static_cast<uint64_t>(Usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+/// \brief Tells whether a phase runs once per operation of a handle rather
+/// than once per object.
+///
+/// Only the ends of these phases sample the memory usage: on glibc,
+/// \p mallinfo takes the lock of every arena, which the threads rewriting
+/// objects would otherwise contend on.
+///
+/// \param P The phase.
+///
+/// \returns True if the phase is a coarse one.
+[[nodiscard]] bool isCoarsePhase(const Statistics::Phase P) noexcept {
+  switch (P) {
+  case Statistics::Phase::AddBinary:
+  case Statistics::Phase::PrefixSymbols:
+  case Statistics::Phase::WriteArchive: {
+    return true;
+  }
+  case Statistics::Phase::ProcessObjectFile:
+  case Statistics::Phase::ObjCopy: {
+    return false;
+  }
+  }
+  __builtin_unreachable();
+}
+
+/// \brief Converts an unsigned counter to a JSON value.
+///
+/// \param N Counter.
+///
+/// \returns The JSON value.
+[[nodiscard]] llvm::json::Value toJSONCounter(const uint64_t N) noexcept {
+  return static_cast<int64_t>(N);
+}
+
+} // end anonymous namespace
+
+BARTLEBY_API Statistics::Scope::Scope(Statistics *Stats,
+                                      const Phase P) noexcept
+    : Stats(Stats), P(P) {
+  if (Stats != nullptr) {
+    Start = llvm::TimeRecord::getCurrentTime(/*Start=*/true);
+  }
+}
+
+BARTLEBY_API Statistics::Scope::~Scope() noexcept {
+  if (Stats == nullptr) {
+    return;
+  }
+  PhaseRecord Record;
+  Record.Time = llvm::TimeRecord::getCurrentTime(/*Start=*/false);
+  Record.Time -= Start;
+  Record.Calls = 1;
+  Record.BytesIn = BytesIn;
+  Record.BytesOut = BytesOut;
+  Record.Objects = Objects;
+  Record.Symbols = Symbols;
+  Stats->record(P, Record);
+  if (isCoarsePhase(P)) {
+    Stats->sampleMemoryUsage();
+  }
+}
+
+BARTLEBY_API void Statistics::record(const Phase P,
+                                     const PhaseRecord &Record) noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto &R = Phases[static_cast<size_t>(P)];
+  R.Time += Record.Time;
+  R.Calls += Record.Calls;
+  R.BytesIn += Record.BytesIn;
+  R.BytesOut += Record.BytesOut;
+  R.Objects += Record.Objects;
+  R.Symbols += Record.Symbols;
+}
+
+BARTLEBY_API void Statistics::sampleMemoryUsage() noexcept {
+  const uint64_t MallocUsage = llvm::sys::Process::GetMallocUsage();
+  const uint64_t RSS = getProcessPeakRSS();
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  PeakMallocUsage = std::max(PeakMallocUsage, MallocUsage);
+  PeakRSS = std::max(PeakRSS, RSS);
+}
+
+BARTLEBY_API void
+Statistics::recordCacheLookups(const uint64_t Hits,
+                               const uint64_t Misses) noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  CacheHits += Hits;
+  CacheMisses += Misses;
+}
+
+BARTLEBY_API void Statistics::recordReusedMembers(const uint64_t N) noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  ReusedMembers += N;
+}
+
+BARTLEBY_API void
+Statistics::recordPassthroughMembers(const uint64_t N) noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  PassthroughMembers += N;
+}
+
+BARTLEBY_API void
+Statistics::recordDuplicateMembers(const uint64_t N) noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  DuplicateMembers += N;
+}
+
+BARTLEBY_API Statistics::PhaseRecord
+Statistics::getPhase(const Phase P) const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Phases[static_cast<size_t>(P)];
+}
+
+BARTLEBY_API uint64_t Statistics::getCacheHits() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return CacheHits;
+}
+
+BARTLEBY_API uint64_t Statistics::getCacheMisses() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return CacheMisses;
+}
+
+BARTLEBY_API uint64_t Statistics::getReusedMembers() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return ReusedMembers;
+}
+
+BARTLEBY_API uint64_t Statistics::getPassthroughMembers() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return PassthroughMembers;
+}
+
+BARTLEBY_API uint64_t Statistics::getDuplicateMembers() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return DuplicateMembers;
+}
+
+BARTLEBY_API uint64_t Statistics::getPeakMallocUsage() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return PeakMallocUsage;
+}
+
+BARTLEBY_API uint64_t Statistics::getPeakRSS() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return PeakRSS;
+}
+
+BARTLEBY_API llvm::StringRef Statistics::getPhaseName(const Phase P) noexcept {
+  switch (P) {
+  case Phase::AddBinary: {
+    return "add_binary";
+  }
+  case Phase::ProcessObjectFile: {
+    return "process_object_file";
+  }
+  case Phase::PrefixSymbols: {
+    return "prefix_symbols";
+  }
+  case Phase::ObjCopy: {
+    return "objcopy";
+  }
+  case Phase::WriteArchive: {
+    return "write_archive";
+  }
+  }
+  __builtin_unreachable();
+}
+
+BARTLEBY_API void
+Statistics::printReport(llvm::raw_ostream &OS) const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  llvm::StringMap<llvm::TimeRecord> Records;
+  for (size_t I = 0; I < NumPhases; ++I) {
+    if (Phases[I].Calls > 0) {
+      Records[getPhaseName(static_cast<Phase>(I))] = Phases[I].Time;
+    }
+  }
+  if (!Records.empty()) {
+    llvm::TimerGroup Group("bartleby", "Bartleby time report", Records);
+    Group.print(OS);
+  }
+
+  OS << "===" << std::string(73, '-') << "===\n"
+     << std::string(28, ' ') << "Bartleby counters\n"
+     << "===" << std::string(73, '-') << "===\n\n";
+  OS << "     Calls    Objects    Symbols       Bytes in      Bytes out"
+     << "  Name\n";
+  for (size_t I = 0; I < NumPhases; ++I) {
+    const auto &R = Phases[I];
+    OS << llvm::format("%10llu %10llu %10llu %14llu %14llu  ",
+                       static_cast<unsigned long long>(R.Calls),
+                       static_cast<unsigned long long>(R.Objects),
+                       static_cast<unsigned long long>(R.Symbols),
+                       static_cast<unsigned long long>(R.BytesIn),
+                       static_cast<unsigned long long>(R.BytesOut))
+       << getPhaseName(static_cast<Phase>(I)) << '\n';
+  }
+  OS << '\n'
+     << "rewrite cache: " << CacheHits << " hit(s), " << CacheMisses
+     << " miss(es)\n"
+     << "reused members: " << ReusedMembers << '\n'
+     << "passthrough members: " << PassthroughMembers << '\n'
+     << "duplicate members: " << DuplicateMembers << '\n'
+     << "peak malloc usage: " << PeakMallocUsage << " bytes\n"
+     << "peak RSS: " << PeakRSS << " bytes\n";
+}
+
+BARTLEBY_API llvm::json::Value Statistics::toJSON() const noexcept {
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  llvm::json::Object PhasesObj;
+  for (size_t I = 0; I < NumPhases; ++I) {
+    const auto &R = Phases[I];
+    PhasesObj[getPhaseName(static_cast<Phase>(I))] = llvm::json::Object{
+        {"calls", toJSONCounter(R.Calls)},
+        {"wall_seconds", R.Time.getWallTime()},
+        {"user_seconds", R.Time.getUserTime()},
+        {"system_seconds", R.Time.getSystemTime()},
+        {"mem_used_bytes", static_cast<int64_t>(R.Time.getMemUsed())},
+        {"bytes_in", toJSONCounter(R.BytesIn)},
+        {"bytes_out", toJSONCounter(R.BytesOut)},
+        {"objects", toJSONCounter(R.Objects)},
+        {"symbols", toJSONCounter(R.Symbols)},
+    };
+  }
+
+  return llvm::json::Object{
+      {"phases", std::move(PhasesObj)},
+      {"cache",
+       llvm::json::Object{
+           {"hits", toJSONCounter(CacheHits)},
+           {"misses", toJSONCounter(CacheMisses)},
+       }},
+      {"reused_members", toJSONCounter(ReusedMembers)},
+      {"passthrough_members", toJSONCounter(PassthroughMembers)},
+      {"duplicate_members", toJSONCounter(DuplicateMembers)},
+      {"peak_malloc_bytes", toJSONCounter(PeakMallocUsage)},
+      {"peak_rss_bytes", toJSONCounter(PeakRSS)},
+  };
+}
@@ -35,6 +35,10 @@ BARTLEBY_API Symbol::Symbol() noexcept {}
 void Symbol::updateWithNewSymbolInfo(const SymbolInfo &SymInfo) noexcept {
   assert(SymInfo.Err == false);
 
+  if (*SymInfo.Flags & llvm::object::BasicSymbolRef::Flags::SF_Undefined) {
+    ++References;
+  }
+
   if ((*SymInfo.Flags & llvm::object::BasicSymbolRef::Flags::SF_Weak) == 0) {
     if ((*SymInfo.Flags & llvm::object::BasicSymbolRef::Flags::SF_Undefined) ==
         0) {
@@ -49,19 +53,59 @@ void Symbol::updateWithNewSymbolInfo(const SymbolInfo &SymInfo) noexcept {
   Type = SymInfo.ObjectType;
 }
 
+void Symbol::merge(const Symbol &Other) noexcept {
+  Defined |= Other.Defined;
+  Global |= Other.Global;
+  References += Other.References;
+  Type = Other.Type;
+}
+
 bool Symbol::isMachO() const noexcept {
   return Type == llvm::Triple::ObjectFormatType::MachO;
 }
 
-BARTLEBY_API void Symbol::setName(std::string Name) noexcept {
-  OverwriteName = Name;
+void Symbol::setNewName(llvm::StringRef Name) noexcept {
+  NewName = Name;
+  Rename = RenameKind::Replace;
+}
+
+void Symbol::setPrefix(llvm::StringRef Prefix) noexcept {
+  NewName = Prefix;
+  Rename = RenameKind::Prefix;
 }
 
 BARTLEBY_API bool Symbol::isGlobal() const noexcept { return Global; }
 
 BARTLEBY_API bool Symbol::isDefined() const noexcept { return Defined; }
 
+BARTLEBY_API size_t Symbol::getReferences() const noexcept {
+  return References;
+}
+
+BARTLEBY_API bool Symbol::isRenamed() const noexcept {
+  return Rename != RenameKind::None;
+}
+
 BARTLEBY_API std::optional<llvm::StringRef>
-Symbol::getOverwriteName() const noexcept {
-  return OverwriteName;
+Symbol::getNewName(llvm::StringRef Name,
+                   llvm::SmallVectorImpl<char> &Storage) const noexcept {
+  switch (Rename) {
+  case RenameKind::None: {
+    return std::nullopt;
+  }
+  case RenameKind::Replace: {
+    return NewName;
+  }
+  case RenameKind::Prefix: {
+    Storage.clear();
+    if (isMachO()) {
+      Storage.push_back('_');
+      Name = Name.substr(1);
+    }
+    Storage.append(NewName.begin(), NewName.end());
+    Storage.append(Name.begin(), Name.end());
+    return llvm::StringRef(Storage.data(), Storage.size());
+  }
+  }
+  __builtin_unreachable();
 }
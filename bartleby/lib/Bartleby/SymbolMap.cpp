@@ -0,0 +1,103 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Symbol map implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/SymbolMap.h"
+
+#include "Bartleby/Export.h"
+
+#include <cassert>
+#include <cstring>
+
+using namespace saq::bartleby;
+
+llvm::StringRef SymbolMap::save(llvm::StringRef Str) noexcept {
+  if (Str.empty()) {
+    return {};
+  }
+  auto *Ptr = Arena.Allocate<char>(Str.size());
+  std::memcpy(Ptr, Str.data(), Str.size());
+  return {Ptr, Str.size()};
+}
+
+llvm::StringRef SymbolMap::intern(llvm::StringRef Str) noexcept {
+  const llvm::CachedHashStringRef Key(Str);
+  if (const auto It = Interned.find(Key); It != Interned.end()) {
+    return It->val();
+  }
+  const auto Saved = save(Str);
+  Interned.insert(llvm::CachedHashStringRef(Saved, Key.hash()));
+  return Saved;
+}
+
+BARTLEBY_API std::pair<SymbolID, bool>
+SymbolMap::insert(llvm::StringRef Name) noexcept {
+  const llvm::CachedHashStringRef Key(Name);
+  if (const auto It = Index.find(Key); It != Index.end()) {
+    return {It->second, false};
+  }
+
+  const auto ID = static_cast<SymbolID>(Entries.size());
+  const auto Saved = save(Name);
+  Entries.push_back(Entry(Saved));
+  Index.try_emplace(llvm::CachedHashStringRef(Saved, Key.hash()), ID);
+  return {ID, true};
+}
+
+BARTLEBY_API std::optional<SymbolID>
+SymbolMap::getID(llvm::StringRef Name) const noexcept {
+  if (const auto It = Index.find(llvm::CachedHashStringRef(Name));
+      It != Index.end()) {
+    return It->second;
+  }
+  return std::nullopt;
+}
+
+BARTLEBY_API SymbolMap::iterator
+SymbolMap::find(llvm::StringRef Name) noexcept {
+  if (const auto ID = getID(Name)) {
+    return Entries.begin() + *ID;
+  }
+  return Entries.end();
+}
+
+BARTLEBY_API SymbolMap::const_iterator
+SymbolMap::find(llvm::StringRef Name) const noexcept {
+  if (const auto ID = getID(Name)) {
+    return Entries.begin() + *ID;
+  }
+  return Entries.end();
+}
+
+BARTLEBY_API void SymbolMap::setNewName(const SymbolID ID,
+                                        llvm::StringRef NewName) noexcept {
+  assert(ID < Entries.size());
+  Entries[ID].Value.setNewName(save(NewName));
+}
+
+BARTLEBY_API void SymbolMap::setPrefix(const SymbolID ID,
+                                       llvm::StringRef Prefix) noexcept {
+  assert(ID < Entries.size());
+  Entries[ID].Value.setPrefix(intern(Prefix));
+}
+
+BARTLEBY_API void SymbolMap::reserve(const size_t N) noexcept {
+  Entries.reserve(N);
+  Index.reserve(N);
+}
@@ -0,0 +1,247 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Format-specialized symbol scanners implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/SymbolScanner.h"
+
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/BinaryFormat/MachO.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/MachO.h"
+#include "llvm/Support/Debug.h"
+
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+
+#define DEBUG_TYPE "Bartleby"
+
+using namespace saq::bartleby;
+
+namespace {
+
+using llvm::object::SymbolRef;
+
+/// \brief Tells whether the name of an ELF symbol marks it as format
+/// specific on a given machine, as \p llvm::object::ELFObjectFile does for
+/// mapping symbols, and for the fake labels of RISC-V.
+///
+/// \param Machine Machine of the object.
+/// \param Name Name of the symbol.
+///
+/// \returns True if the symbol is format specific.
+[[nodiscard]] bool isELFMappingSymbol(const uint16_t Machine,
+                                      llvm::StringRef Name) noexcept {
+  const auto Starts = [Name](llvm::StringRef Prefix) {
+    return Name.substr(0, Prefix.size()) == Prefix;
+  };
+  switch (Machine) {
+  case llvm::ELF::EM_AARCH64:
+    return Starts("$d") || Starts("$x");
+  case llvm::ELF::EM_ARM:
+    return Name.empty() || Starts("$d") || Starts("$t") || Starts("$a");
+  case llvm::ELF::EM_CSKY:
+    return Starts("$d") || Starts("$t");
+  case llvm::ELF::EM_RISCV:
+    return Starts(".L0 ") || Starts("$d") || Starts("$x");
+  default:
+    return false;
+  }
+}
+
+/// \brief Scans the symbol table of an ELF object.
+///
+/// \tparam ELFT ELF class and endianness.
+///
+/// \param Obj The object.
+/// \param Callback Callback receiving the symbols.
+///
+/// \returns The number of symbols, or nullopt if the object is not
+/// supported.
+template <class ELFT>
+[[nodiscard]] std::optional<size_t>
+scanELFSymbols(const llvm::object::ELFObjectFile<ELFT> &Obj,
+               ScannedSymbolCallback Callback) noexcept {
+  const auto &EF = Obj.getELFFile();
+  auto SectionsOrErr = EF.sections();
+  if (!SectionsOrErr) {
+    llvm::consumeError(SectionsOrErr.takeError());
+    return std::nullopt;
+  }
+
+  // Like llvm::object::ELFObjectFile, only the first symbol table is read.
+  // A dynamic symbol table changes which symbols are format specific, and
+  // is left to the generic path.
+  const typename ELFT::Shdr *SymTab = nullptr;
+  for (const auto &Sec : *SectionsOrErr) {
+    if (Sec.sh_type == llvm::ELF::SHT_DYNSYM) {
+      return std::nullopt;
+    }
+    if ((Sec.sh_type == llvm::ELF::SHT_SYMTAB) && (SymTab == nullptr)) {
+      SymTab = &Sec;
+    }
+  }
+  if (SymTab == nullptr) {
+    return 0;
+  }
+
+  // Errors here would fail every symbol on the generic path, which then
+  // reports them.
+  auto SymsOrErr = EF.symbols(SymTab);
+  if (!SymsOrErr) {
+    llvm::consumeError(SymsOrErr.takeError());
+    return std::nullopt;
+  }
+  auto StrTabOrErr = EF.getStringTableForSymtab(*SymTab, *SectionsOrErr);
+  if (!StrTabOrErr) {
+    llvm::consumeError(StrTabOrErr.takeError());
+    return std::nullopt;
+  }
+  const llvm::StringRef StrTab = *StrTabOrErr;
+  const uint16_t Machine = EF.getHeader().e_machine;
+
+  // The null symbol is skipped, as llvm::object::ELFObjectFile does.
+  const auto Syms = SymsOrErr->drop_front(SymsOrErr->empty() ? 0 : 1);
+  for (const auto &Sym : Syms) {
+    const uint8_t Type = Sym.getType();
+    if ((Type == llvm::ELF::STT_SECTION) || (Type == llvm::ELF::STT_FILE)) {
+      continue;
+    }
+    const uint32_t NameOffset = Sym.st_name;
+    if (NameOffset >= StrTab.size()) {
+      continue;
+    }
+    // The string table is known to be null-terminated.
+    const llvm::StringRef Name(StrTab.data() + NameOffset);
+
+    uint32_t Flags = SymbolRef::SF_None;
+    const uint8_t Binding = Sym.getBinding();
+    if (Binding != llvm::ELF::STB_LOCAL) {
+      Flags |= SymbolRef::SF_Global;
+    }
+    if (Binding == llvm::ELF::STB_WEAK) {
+      Flags |= SymbolRef::SF_Weak;
+    }
+    if (isELFMappingSymbol(Machine, Name)) {
+      Flags |= SymbolRef::SF_FormatSpecific;
+    }
+    if (Sym.st_shndx == llvm::ELF::SHN_UNDEF) {
+      Flags |= SymbolRef::SF_Undefined;
+    }
+    Callback(Name, Flags);
+  }
+  return Syms.size();
+}
+
+/// \brief Scans the symbol table of a Mach-O object.
+///
+/// \tparam Is64 Whether the object is a 64-bit one.
+///
+/// \param Obj The object.
+/// \param Callback Callback receiving the symbols.
+///
+/// \returns The number of symbols.
+template <bool Is64>
+[[nodiscard]] size_t
+scanMachOSymbols(const llvm::object::MachOObjectFile &Obj,
+                 ScannedSymbolCallback Callback) noexcept {
+  using NList = std::conditional_t<Is64, llvm::MachO::nlist_64,
+                                   llvm::MachO::nlist>;
+  const auto Symtab = Obj.getSymtabLoadCommand();
+  if (Symtab.nsyms == 0) {
+    return 0;
+  }
+
+  // The bounds of the symbol and string tables were checked when the object
+  // was created, but not the ones of the names.
+  const auto Data = Obj.getData();
+  const llvm::StringRef StrTab = Obj.getStringTableData();
+  const size_t NumSections =
+      std::distance(Obj.section_begin(), Obj.section_end());
+  const char *Entry = Data.data() + Symtab.symoff;
+  for (uint32_t I = 0; I < Symtab.nsyms; ++I, Entry += sizeof(NList)) {
+    llvm::object::DataRefImpl DRI;
+    DRI.p = reinterpret_cast<uintptr_t>(Entry);
+    NList Sym;
+    if constexpr (Is64) {
+      Sym = Obj.getSymbol64TableEntry(DRI);
+    } else {
+      Sym = Obj.getSymbolTableEntry(DRI);
+    }
+
+    const uint8_t Type = Sym.n_type;
+    if ((Type & llvm::MachO::N_STAB) != 0) {
+      continue;
+    }
+    if (((Type & llvm::MachO::N_TYPE) == llvm::MachO::N_SECT) &&
+        (Sym.n_sect > NumSections)) {
+      continue;
+    }
+    llvm::StringRef Name;
+    if (Sym.n_strx != 0) {
+      if (Sym.n_strx >= StrTab.size()) {
+        LLVM_DEBUG(llvm::dbgs() << "bad string index: " << Sym.n_strx
+                                << " for symbol at index " << I << '\n');
+        continue;
+      }
+      const char *Start = StrTab.data() + Sym.n_strx;
+      Name = llvm::StringRef(Start, strnlen(Start, StrTab.end() - Start));
+    }
+
+    uint32_t Flags = SymbolRef::SF_None;
+    if ((Type & llvm::MachO::N_EXT) != 0) {
+      Flags |= SymbolRef::SF_Global;
+      if (((Type & llvm::MachO::N_TYPE) == llvm::MachO::N_UNDF) &&
+          (Sym.n_value == 0)) {
+        Flags |= SymbolRef::SF_Undefined;
+      }
+    }
+    if ((Sym.n_desc & (llvm::MachO::N_WEAK_REF | llvm::MachO::N_WEAK_DEF)) !=
+        0) {
+      Flags |= SymbolRef::SF_Weak;
+    }
+    Callback(Name, Flags);
+  }
+  return Symtab.nsyms;
+}
+
+} // end anonymous namespace
+
+std::optional<size_t>
+saq::bartleby::scanSymbols(const llvm::object::ObjectFile &Obj,
+                           ScannedSymbolCallback Callback) noexcept {
+  using namespace llvm::object;
+  if (const auto *O = llvm::dyn_cast<ELF32LEObjectFile>(&Obj)) {
+    return scanELFSymbols(*O, Callback);
+  }
+  if (const auto *O = llvm::dyn_cast<ELF32BEObjectFile>(&Obj)) {
+    return scanELFSymbols(*O, Callback);
+  }
+  if (const auto *O = llvm::dyn_cast<ELF64LEObjectFile>(&Obj)) {
+    return scanELFSymbols(*O, Callback);
+  }
+  if (const auto *O = llvm::dyn_cast<ELF64BEObjectFile>(&Obj)) {
+    return scanELFSymbols(*O, Callback);
+  }
+  if (const auto *O = llvm::dyn_cast<MachOObjectFile>(&Obj)) {
+    return O->is64Bit() ? scanMachOSymbols<true>(*O, Callback)
+                        : scanMachOSymbols<false>(*O, Callback);
+  }
+  return std::nullopt;
+}
@@ -0,0 +1,66 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief Format-specialized symbol scanners specification.
+///
+/// \author thb-sb
+
+#pragma once
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Object/ObjectFile.h"
+
+#include <cstdint>
+#include <optional>
+
+namespace saq::bartleby {
+
+/// \brief Flags reported by the scanners: the subset of
+/// \p llvm::object::SymbolRef flags bartleby relies on.
+constexpr uint32_t ScannedSymbolFlags =
+    llvm::object::SymbolRef::SF_Undefined | llvm::object::SymbolRef::SF_Global |
+    llvm::object::SymbolRef::SF_Weak |
+    llvm::object::SymbolRef::SF_FormatSpecific;
+
+/// \brief Callback receiving the name and the flags of a symbol.
+using ScannedSymbolCallback =
+    llvm::function_ref<void(llvm::StringRef Name, uint32_t Flags)>;
+
+/// \brief Scans the symbols of an object by walking its raw symbol table.
+///
+/// Scanners are instantiated for each ELF class and endianness, and for
+/// 32-bit and 64-bit Mach-O. They read the name, binding and definedness of
+/// each symbol straight from its symbol table entry, instead of going
+/// through the \p llvm::object::SymbolRef interface.
+///
+/// \p Callback is called for each symbol that the generic path would keep:
+/// symbols which are neither debug nor file symbols, and whose name and
+/// flags can be read, a Mach-O name having to start within the string
+/// table. Flags are those \p llvm::object::SymbolRef::getFlags
+/// would return, restricted to \p ScannedSymbolFlags.
+///
+/// \param Obj The object.
+/// \param Callback Callback receiving the symbols.
+///
+/// \returns The number of entries of the symbol table, or nullopt if the
+/// object is not supported, in which case \p Callback has not been called
+/// and the generic path must be used.
+[[nodiscard]] std::optional<size_t>
+scanSymbols(const llvm::object::ObjectFile &Obj,
+            ScannedSymbolCallback Callback) noexcept;
+
+} // end namespace saq::bartleby
@@ -19,12 +19,26 @@
 /// \author thb-sb
 
 #include "Bartleby-c/Bartleby.h"
+#include "Bartleby/ArchiveIndex.h"
 #include "Bartleby/Bartleby.h"
+#include "Bartleby/MappedMember.h"
+#include "Bartleby/SymbolScanner.h"
 
 #include "llvm/ADT/Twine.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/ArchiveWriter.h"
 #include "llvm/Object/Binary.h"
+#include "llvm/Object/MachO.h"
+#include "llvm/Object/MachOUniversal.h"
+#include "llvm/Object/MachOUniversalWriter.h"
 #include "llvm/ObjectYAML/yaml2obj.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/GlobPattern.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/SmallVectorMemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/YAMLParser.h"
@@ -33,6 +47,9 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <tuple>
+
 #include "gtest/gtest.h"
 
 namespace {
@@ -217,7 +234,7 @@ readYAMLFile(llvm::StringRef Filepath,
 #define ASSERT_SYM_OVERWRITTEN(_b_, _name_, _exp_)                             \
   do {                                                                         \
     ASSERT_SYM_RESOLVE((_b_), (_name_));                                       \
-    ASSERT_TRUE(_s_->getValue().getOverwriteName().has_value() == _exp_);      \
+    ASSERT_TRUE(_s_->getValue().isRenamed() == _exp_);                         \
   } while (0)
 
 /// \brief Asserts that a symbol name will be overwritten.
@@ -318,7 +335,7 @@ TEST(BartleByObjectYamlELF, Object386) {
 }
 
 /// \brief Test that passing two objects with different format types is
-/// an error.
+/// an error, which names the faulty binary.
 TEST(BartleByObjectYamlError, ObjectTypeMisMatch) {
   llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
       Objects;
@@ -327,11 +344,15 @@ TEST(BartleByObjectYamlError, ObjectTypeMisMatch) {
 
   ASSERT_TRUE(YAML2Objects("simple_x86_64.yaml",
                            llvm::Triple::ObjectFormatType::ELF, Objects));
+  const auto Name = Objects[1].getBinary()->getFileName().str();
+  ASSERT_FALSE(Name.empty());
 
   Bartleby B;
   ASSERT_FALSE(B.addBinary(std::move(Objects[0])));
   auto Err = B.addBinary(std::move(Objects[1]));
   ASSERT_TRUE(!!Err);
+  const auto Msg = llvm::toString(std::move(Err));
+  EXPECT_NE(Msg.find("'" + Name + "'"), std::string::npos) << Msg;
 }
 
 /// \brief Test that a symbol in a BSS section is well renamed.
@@ -351,6 +372,1439 @@ TEST(BartleByObjectYamlELF, SymbolInBSS) {
   ASSERT_SYM_WILL_BE_RENAMED(B, "thread_local_var");
 }
 
+/// \brief Test that rewriting objects on several threads produces the same
+/// archive as the serial path.
+TEST(BartleByObjectYamlELF, ParallelRewrite) {
+  std::unique_ptr<llvm::MemoryBuffer> Serial;
+  for (const unsigned Threads : {1U, 4U}) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+    Bartleby B;
+    for (auto &Obj : Objects) {
+      ASSERT_FALSE(B.addBinary(std::move(Obj)));
+    }
+    B.prefixGlobalAndDefinedSymbols("prefix_");
+
+    BuildOptions Options;
+    Options.Threads = Threads;
+    auto ArOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+    ASSERT_TRUE(!!ArOrErr);
+    if (Serial == nullptr) {
+      Serial = std::move(*ArOrErr);
+    } else {
+      ASSERT_EQ(Serial->getBuffer(), (*ArOrErr)->getBuffer());
+    }
+  }
+}
+
+/// \brief Test that handles sharing a thread pool, one after the other,
+/// build the same archive as on a single thread.
+TEST(BartleByObjectYamlELF, SharedThreadPool) {
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(4));
+  std::unique_ptr<llvm::MemoryBuffer> Serial;
+  for (auto *SharedPool : {static_cast<llvm::ThreadPool *>(nullptr), &Pool,
+                           &Pool}) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+    const unsigned Threads = (SharedPool == nullptr) ? 1 : 4;
+    Bartleby B;
+    B.setThreadPool(SharedPool);
+    ASSERT_FALSE(B.addBinaries(Objects, Threads));
+    B.prefixGlobalAndDefinedSymbols("prefix_");
+
+    BuildOptions Options;
+    Options.Threads = Threads;
+    auto ArOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+    ASSERT_TRUE(!!ArOrErr);
+    if (Serial == nullptr) {
+      Serial = std::move(*ArOrErr);
+    } else {
+      ASSERT_EQ(Serial->getBuffer(), (*ArOrErr)->getBuffer());
+    }
+  }
+}
+
+/// \brief Test that the slices of a fat Mach-O are built the same way on
+/// one or several threads, and in the order of the input.
+TEST(BartleByObjectYamlMachO, FatSlices) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 1>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("arm64.yaml", llvm::Triple::ObjectFormatType::MachO,
+                           Objects));
+
+  // Makes a x86_64 twin of the arm64 object, by patching its CPU type.
+  const auto ARM64Data = Objects[0].getBinary()->getData();
+  std::string X86Data = ARM64Data.str();
+  const uint32_t CPUType[] = {llvm::MachO::CPU_TYPE_X86_64,
+                              llvm::MachO::CPU_SUBTYPE_X86_64_ALL};
+  std::memcpy(X86Data.data() + 4, CPUType, sizeof(CPUType));
+
+  auto ARM64OrErr = llvm::object::ObjectFile::createMachOObjectFile(
+      llvm::MemoryBufferRef(ARM64Data, "arm64.o"));
+  ASSERT_TRUE(!!ARM64OrErr);
+  auto X86OrErr = llvm::object::ObjectFile::createMachOObjectFile(
+      llvm::MemoryBufferRef(X86Data, "x86_64.o"));
+  ASSERT_TRUE(!!X86OrErr);
+  // Alignments are chosen so that the second slice needs padding.
+  const uint32_t Alignments[] = {12, 2};
+  using llvm::object::MachOObjectFile;
+  const llvm::object::Slice Slices[] = {
+      llvm::object::Slice(llvm::cast<MachOObjectFile>(**ARM64OrErr),
+                          Alignments[0]),
+      llvm::object::Slice(llvm::cast<MachOObjectFile>(**X86OrErr),
+                          Alignments[1]),
+  };
+  std::string Fat;
+  llvm::raw_string_ostream FatOS(Fat);
+  ASSERT_FALSE(llvm::object::writeUniversalBinaryToStream(Slices, FatOS));
+  FatOS.flush();
+
+  std::unique_ptr<llvm::MemoryBuffer> Serial;
+  for (const unsigned Threads : {1U, 4U}) {
+    auto Buffer = llvm::MemoryBuffer::getMemBufferCopy(Fat);
+    auto BinOrErr = llvm::object::createBinary(Buffer->getMemBufferRef());
+    ASSERT_TRUE(!!BinOrErr);
+
+    Bartleby B;
+    ASSERT_FALSE(B.addBinary(llvm::object::OwningBinary<llvm::object::Binary>(
+        std::move(*BinOrErr), std::move(Buffer))));
+    B.prefixGlobalAndDefinedSymbols("prefix_");
+
+    BuildOptions Options;
+    Options.Threads = Threads;
+    auto OutOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+    ASSERT_TRUE(!!OutOrErr);
+    if (Serial != nullptr) {
+      ASSERT_EQ(Serial->getBuffer(), (*OutOrErr)->getBuffer());
+      continue;
+    }
+    Serial = std::move(*OutOrErr);
+
+    auto OutFatOrErr =
+        llvm::object::MachOUniversalBinary::create(Serial->getMemBufferRef());
+    ASSERT_TRUE(!!OutFatOrErr);
+    ASSERT_EQ((*OutFatOrErr)->getNumberOfObjects(), 2U);
+    const uint32_t ExpectedCPUTypes[] = {llvm::MachO::CPU_TYPE_ARM64,
+                                         llvm::MachO::CPU_TYPE_X86_64};
+    std::vector<std::unique_ptr<llvm::object::Archive>> OutArchives;
+    llvm::SmallVector<llvm::object::Slice, 2> OutSlices;
+    size_t I = 0;
+    for (const auto &Ofa : (*OutFatOrErr)->objects()) {
+      EXPECT_EQ(Ofa.getCPUType(), ExpectedCPUTypes[I]);
+      EXPECT_EQ(Ofa.getAlign(), Alignments[I]);
+      EXPECT_EQ(Ofa.getOffset() % (uint64_t{1} << Alignments[I]), 0U);
+      ++I;
+      auto ArOrErr = Ofa.getAsArchive();
+      ASSERT_TRUE(!!ArOrErr);
+      llvm::Error Err = llvm::Error::success();
+      size_t Members = 0;
+      for (const auto &Child : (*ArOrErr)->children(Err)) {
+        auto ObjOrErr = Child.getAsBinary();
+        ASSERT_TRUE(!!ObjOrErr);
+        EXPECT_TRUE((*ObjOrErr)->isMachO());
+        ++Members;
+      }
+      ASSERT_FALSE(!!Err);
+      EXPECT_EQ(Members, 1U);
+      OutArchives.push_back(std::move(*ArOrErr));
+      OutSlices.emplace_back(*OutArchives.back(), Ofa.getCPUType(),
+                             Ofa.getCPUSubType(), Ofa.getArchFlagName(),
+                             Ofa.getAlign());
+    }
+
+    // The header, the architecture table and the padding between slices
+    // are those \p llvm::object::writeUniversalBinaryToStream writes.
+    std::string Expected;
+    llvm::raw_string_ostream ExpectedOS(Expected);
+    ASSERT_FALSE(
+        llvm::object::writeUniversalBinaryToStream(OutSlices, ExpectedOS));
+    ExpectedOS.flush();
+    ASSERT_EQ(Serial->getBuffer(), Expected);
+  }
+}
+
+/// \brief Test that adding binaries on several threads collects the same
+/// symbols as adding them one by one.
+TEST(BartleByObjectYamlELF, ParallelAddBinaries) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+  Bartleby B;
+  ASSERT_FALSE(B.addBinaries(Objects, 4));
+
+  ASSERT_SYM_DEFINED(B, "defined_local_symbol");
+  ASSERT_SYM_LOCAL(B, "defined_local_symbol");
+
+  ASSERT_SYM_DEFINED(B, "defined_global_symbol");
+  ASSERT_SYM_GLOBAL(B, "defined_global_symbol");
+
+  // Object 2 defined `undefined_symbol`.
+  ASSERT_SYM_DEFINED(B, "undefined_symbol");
+  ASSERT_SYM_GLOBAL(B, "undefined_symbol");
+
+  ASSERT_SYM_UNDEFINED(B, "weak_symbol");
+  ASSERT_SYM_LOCAL(B, "weak_symbol");
+}
+
+/// \brief Test that the ELF fast path renames symbols.
+TEST(BartleByObjectYamlELF, FastRename) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+  Bartleby B;
+  ASSERT_FALSE(B.addBinaries(Objects, 1));
+  B.prefixGlobalAndDefinedSymbols("prefix_");
+
+  BuildOptions Options;
+  Options.FastRename = true;
+  auto ArOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+  ASSERT_TRUE(!!ArOrErr);
+  auto ArContent = std::move(*ArOrErr);
+
+  auto Ar = llvm::object::createBinary(*ArContent);
+  ASSERT_TRUE(!!Ar);
+
+  B = Bartleby();
+  ASSERT_FALSE(B.addBinary({std::move(*Ar), std::move(ArContent)}));
+
+  ASSERT_SYM_DEFINED(B, "defined_local_symbol");
+  ASSERT_SYM_LOCAL(B, "defined_local_symbol");
+
+  ASSERT_SYM_DEFINED(B, "prefix_defined_global_symbol");
+  ASSERT_SYM_GLOBAL(B, "prefix_defined_global_symbol");
+
+  ASSERT_SYM_DEFINED(B, "prefix_undefined_symbol");
+  ASSERT_SYM_GLOBAL(B, "prefix_undefined_symbol");
+
+  ASSERT_SYM_UNDEFINED(B, "weak_symbol");
+  ASSERT_SYM_LOCAL(B, "weak_symbol");
+}
+
+/// \brief Test that spilling rewritten objects to disk produces the same
+/// archive as keeping them in memory.
+TEST(BartleByObjectYamlELF, StreamMembers) {
+  std::unique_ptr<llvm::MemoryBuffer> InMemory;
+  for (const bool Stream : {false, true}) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+    Bartleby B;
+    ASSERT_FALSE(B.addBinaries(Objects, 1));
+    B.prefixGlobalAndDefinedSymbols("prefix_");
+
+    BuildOptions Options;
+    Options.StreamMembers = Stream;
+    llvm::SmallVector<char, 0> Content;
+    llvm::raw_svector_ostream OS(Content);
+    ASSERT_FALSE(Bartleby::buildFinalArchive(std::move(B), OS, Options));
+    if (InMemory == nullptr) {
+      InMemory = llvm::MemoryBuffer::getMemBufferCopy(OS.str());
+    } else {
+      ASSERT_EQ(InMemory->getBuffer(), OS.str());
+    }
+  }
+}
+
+/// \brief Test that spilled members are mapped, even when smaller than the
+/// size under which \p llvm::MemoryBuffer reads files into the heap, and
+/// that their temporary file is removed.
+TEST(BartlebyMappedMember, SpillMember) {
+  llvm::SmallString<128> TmpDir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("bartleby-spill", TmpDir));
+
+  for (const size_t Size : {size_t{64}, size_t{4096}, size_t{1} << 16}) {
+    const std::string Content(Size, 'x');
+    auto MemberOrErr = spillMember(Content, TmpDir);
+    ASSERT_TRUE(!!MemberOrErr);
+    EXPECT_EQ((*MemberOrErr)->getBufferKind(),
+              llvm::MemoryBuffer::MemoryBuffer_MMap);
+    EXPECT_EQ((*MemberOrErr)->getBuffer(), Content);
+  }
+
+  std::error_code EC;
+  llvm::sys::fs::directory_iterator It(TmpDir, EC);
+  ASSERT_FALSE(EC);
+  EXPECT_EQ(It, llvm::sys::fs::directory_iterator());
+  ASSERT_FALSE(llvm::sys::fs::remove_directories(TmpDir));
+}
+
+/// \brief Test that a memory budget, which releases parsed archive members
+/// and throttles the rewrites, produces the same archive as no budget.
+TEST(BartleByObjectYamlELF, MemoryBudget) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+  Bartleby Input;
+  ASSERT_FALSE(Input.addBinaries(Objects, 1));
+  auto InputOrErr = Bartleby::buildFinalArchive(std::move(Input));
+  ASSERT_TRUE(!!InputOrErr);
+  std::unique_ptr<llvm::MemoryBuffer> InputAr = std::move(*InputOrErr);
+
+  std::unique_ptr<llvm::MemoryBuffer> Unbounded;
+  for (const uint64_t Budget : {uint64_t{0}, uint64_t{1}, uint64_t{1} << 30}) {
+    auto Ar = llvm::object::createBinary(InputAr->getMemBufferRef());
+    ASSERT_TRUE(!!Ar);
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 1>
+        Binaries;
+    Binaries.emplace_back(std::move(*Ar), nullptr);
+
+    Bartleby B;
+    B.setMemoryBudget(Budget);
+    ASSERT_FALSE(B.addBinaries(Binaries, 4));
+    B.prefixGlobalAndDefinedSymbols("prefix_");
+
+    BuildOptions Options;
+    Options.Threads = 4;
+    auto ArOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+    ASSERT_TRUE(!!ArOrErr);
+    if (Unbounded == nullptr) {
+      Unbounded = std::move(*ArOrErr);
+    } else {
+      ASSERT_EQ(Unbounded->getBuffer(), (*ArOrErr)->getBuffer());
+    }
+  }
+}
+
+/// \brief Test that, under a memory budget, final members do not stay on the
+/// heap until the archive is written, whether they are rewritten, found in
+/// the rewrite cache or reused from a previous build.
+///
+/// Members are smaller than the size under which \p llvm::MemoryBuffer reads
+/// files into the heap rather than mapping them.
+TEST(BartleByObjectYamlELF, MemoryBudgetHeap) {
+  if (llvm::sys::Process::GetMallocUsage() == 0) {
+    GTEST_SKIP() << "malloc usage is not available";
+  }
+
+  constexpr size_t N = 256;
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("bartleby-heap", Dir));
+  llvm::SmallString<128> OutPath(Dir);
+  llvm::sys::path::append(OutPath, "out.a");
+  llvm::SmallString<128> ManifestPath(Dir);
+  llvm::sys::path::append(ManifestPath, "out.a.bartleby-manifest.json");
+  llvm::SmallString<128> CacheDir(Dir);
+  llvm::sys::path::append(CacheDir, "cache");
+
+  uint64_t MembersSize = 0;
+
+  // Builds the archive, and returns how much the heap grew meanwhile.
+  const auto Build = [&](const bool Budget, const bool Cache,
+                         const bool Incremental, Statistics &Stats) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, N>
+        Objects;
+    for (size_t I = 0; I < N; ++I) {
+      EXPECT_TRUE(YAML2Objects("large_member.yaml",
+                               llvm::Triple::ObjectFormatType::ELF, Objects));
+    }
+    MembersSize = N * Objects[0].getBinary()->getData().size();
+
+    Bartleby B;
+    B.setMemoryBudget(Budget ? (uint64_t{1} << 30) : 0);
+    EXPECT_FALSE(B.addBinaries(Objects, 1));
+    B.prefixGlobalAndDefinedSymbols("prefix_");
+
+    BuildOptions Options;
+    Options.Stats = &Stats;
+    if (Cache) {
+      Options.CacheDirectory = std::string(CacheDir);
+    }
+    if (Incremental) {
+      Options.ManifestPath = std::string(ManifestPath);
+    }
+    const uint64_t Before = llvm::sys::Process::GetMallocUsage();
+    EXPECT_FALSE(Bartleby::buildFinalArchive(std::move(B), OutPath, Options));
+    const uint64_t Peak = Stats.getPeakMallocUsage();
+    return (Peak > Before) ? (Peak - Before) : 0;
+  };
+
+  // Without a budget, rewritten members stay on the heap.
+  Statistics Unbounded;
+  EXPECT_GT(Build(/*Budget=*/false, /*Cache=*/false, /*Incremental=*/false,
+                  Unbounded),
+            MembersSize / 2);
+
+  Statistics Rewritten;
+  EXPECT_LT(Build(/*Budget=*/true, /*Cache=*/false, /*Incremental=*/false,
+                  Rewritten),
+            MembersSize / 4);
+
+  Statistics FillCache;
+  (void)Build(/*Budget=*/false, /*Cache=*/true, /*Incremental=*/false,
+              FillCache);
+  Statistics Cached;
+  EXPECT_LT(Build(/*Budget=*/true, /*Cache=*/true, /*Incremental=*/false,
+                  Cached),
+            MembersSize / 4);
+  EXPECT_EQ(Cached.getCacheHits(), N);
+
+  Statistics FillManifest;
+  (void)Build(/*Budget=*/false, /*Cache=*/false, /*Incremental=*/true,
+              FillManifest);
+  Statistics Reused;
+  EXPECT_LT(Build(/*Budget=*/true, /*Cache=*/false, /*Incremental=*/true,
+                  Reused),
+            MembersSize / 4);
+  EXPECT_EQ(Reused.getReusedMembers(), N);
+
+  ASSERT_FALSE(llvm::sys::fs::remove_directories(Dir));
+}
+
+/// \brief Test that identical members are detected, and that sharing them
+/// builds the same archive as keeping them while collapsing them emits them
+/// once.
+TEST(BartleByObjectYamlELF, DuplicateMembers) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+  Bartleby Input;
+  ASSERT_FALSE(Input.addBinaries(Objects, 1));
+  auto InputOrErr = Bartleby::buildFinalArchive(std::move(Input));
+  ASSERT_TRUE(!!InputOrErr);
+  std::unique_ptr<llvm::MemoryBuffer> InputAr = std::move(*InputOrErr);
+
+  // The same archive is given twice, as different cc_library dependencies
+  // may pull the same archive in.
+  const auto Build =
+      [&](const DuplicateMembers Mode, const size_t NumCopies,
+          std::unique_ptr<llvm::MemoryBuffer> &Out,
+          std::vector<std::tuple<std::string, bool, bool, size_t>> &Syms,
+          size_t &NumDuplicates) {
+        llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+            Binaries;
+        for (size_t I = 0; I < NumCopies; ++I) {
+          auto Ar = llvm::object::createBinary(InputAr->getMemBufferRef());
+          ASSERT_TRUE(!!Ar);
+          Binaries.emplace_back(std::move(*Ar), nullptr);
+        }
+
+        Bartleby B;
+        B.setDuplicateMembers(Mode);
+        ASSERT_FALSE(B.addBinaries(Binaries, 4));
+        NumDuplicates = B.getDuplicates().size();
+        for (const auto &Dup : B.getDuplicates()) {
+          ASSERT_EQ(Dup.Name, Dup.OriginalName);
+          ASSERT_GT(Dup.Size, 0U);
+        }
+        for (const auto &Entry : B.getSymbols()) {
+          const auto &Sym = Entry.getValue();
+          Syms.emplace_back(Entry.first().str(), Sym.isDefined(),
+                            Sym.isGlobal(), Sym.getReferences());
+        }
+        B.prefixGlobalAndDefinedSymbols("prefix_");
+
+        BuildOptions Options;
+        Options.Threads = 4;
+        auto ArOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+        ASSERT_TRUE(!!ArOrErr);
+        Out = std::move(*ArOrErr);
+      };
+
+  std::unique_ptr<llvm::MemoryBuffer> Kept;
+  std::unique_ptr<llvm::MemoryBuffer> Shared;
+  std::unique_ptr<llvm::MemoryBuffer> Collapsed;
+  std::unique_ptr<llvm::MemoryBuffer> Single;
+  std::vector<std::tuple<std::string, bool, bool, size_t>> KeptSyms;
+  std::vector<std::tuple<std::string, bool, bool, size_t>> SharedSyms;
+  std::vector<std::tuple<std::string, bool, bool, size_t>> Unused;
+  size_t NumDuplicates = 0;
+
+  Build(DuplicateMembers::Keep, 2, Kept, KeptSyms, NumDuplicates);
+  ASSERT_EQ(NumDuplicates, 0U);
+  Build(DuplicateMembers::Share, 2, Shared, SharedSyms, NumDuplicates);
+  ASSERT_EQ(NumDuplicates, 5U);
+  ASSERT_EQ(KeptSyms, SharedSyms);
+  ASSERT_EQ(Kept->getBuffer(), Shared->getBuffer());
+
+  Build(DuplicateMembers::Collapse, 2, Collapsed, Unused, NumDuplicates);
+  ASSERT_EQ(NumDuplicates, 5U);
+  Build(DuplicateMembers::Keep, 1, Single, Unused, NumDuplicates);
+  ASSERT_EQ(Single->getBuffer(), Collapsed->getBuffer());
+  ASSERT_LT(Collapsed->getBufferSize(), Kept->getBufferSize());
+}
+
+/// \brief Test that the rewrite cache is hit when neither the objects nor
+/// the renames change, and that cached objects produce the same archive.
+TEST(BartleByObjectYamlELF, RewriteCache) {
+  llvm::SmallString<128> CacheDir;
+  ASSERT_FALSE(
+      llvm::sys::fs::createUniqueDirectory("bartleby-cache", CacheDir));
+
+  std::unique_ptr<llvm::MemoryBuffer> First;
+  for (const llvm::StringRef Prefix : {"prefix_", "prefix_", "other_"}) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+    Bartleby B;
+    ASSERT_FALSE(B.addBinaries(Objects, 1));
+    B.prefixGlobalAndDefinedSymbols(Prefix);
+
+    Statistics Stats;
+    BuildOptions Options;
+    Options.CacheDirectory = std::string(CacheDir);
+    Options.Stats = &Stats;
+    auto ArOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+    ASSERT_TRUE(!!ArOrErr);
+
+    if (First == nullptr) {
+      ASSERT_EQ(Stats.getCacheHits(), 0U);
+      ASSERT_EQ(Stats.getCacheMisses(), 2U);
+      First = std::move(*ArOrErr);
+    } else if (Prefix == "prefix_") {
+      ASSERT_EQ(Stats.getCacheHits(), 2U);
+      ASSERT_EQ(Stats.getCacheMisses(), 0U);
+      ASSERT_EQ(First->getBuffer(), (*ArOrErr)->getBuffer());
+    } else {
+      ASSERT_EQ(Stats.getCacheHits(), 0U);
+      ASSERT_EQ(Stats.getCacheMisses(), 2U);
+    }
+  }
+
+  ASSERT_FALSE(llvm::sys::fs::remove_directories(CacheDir));
+}
+
+/// \brief Test that an incremental build reuses unchanged members.
+TEST(BartleByObjectYamlELF, Incremental) {
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("bartleby-incr", Dir));
+  llvm::SmallString<128> OutPath(Dir);
+  llvm::sys::path::append(OutPath, "out.a");
+  llvm::SmallString<128> ManifestPath(Dir);
+  llvm::sys::path::append(ManifestPath, "out.a.bartleby-manifest.json");
+
+  std::string First;
+  for (const llvm::StringRef Prefix : {"prefix_", "prefix_", "other_"}) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+    Bartleby B;
+    ASSERT_FALSE(B.addBinaries(Objects, 1));
+    B.prefixGlobalAndDefinedSymbols(Prefix);
+
+    Statistics Stats;
+    BuildOptions Options;
+    Options.ManifestPath = std::string(ManifestPath);
+    Options.Stats = &Stats;
+    ASSERT_FALSE(Bartleby::buildFinalArchive(std::move(B), OutPath, Options));
+    ASSERT_TRUE(llvm::sys::fs::exists(ManifestPath));
+
+    auto BufOrErr = llvm::MemoryBuffer::getFile(OutPath);
+    ASSERT_TRUE(!!BufOrErr);
+    if (First.empty()) {
+      ASSERT_EQ(Stats.getReusedMembers(), 0U);
+      First = (*BufOrErr)->getBuffer().str();
+    } else if (Prefix == "prefix_") {
+      ASSERT_EQ(Stats.getReusedMembers(), 2U);
+      ASSERT_EQ(First, (*BufOrErr)->getBuffer());
+    } else {
+      ASSERT_EQ(Stats.getReusedMembers(), 0U);
+    }
+  }
+
+  ASSERT_FALSE(llvm::sys::fs::remove_directories(Dir));
+}
+
+/// \brief Test that thin archives reference member files, which are left
+/// untouched when they did not change.
+TEST(BartleByObjectYamlELF, Thin) {
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("bartleby-thin", Dir));
+  llvm::SmallString<128> OutPath(Dir);
+  llvm::sys::path::append(OutPath, "out.a");
+  llvm::SmallString<128> MembersDir(Dir);
+  llvm::sys::path::append(MembersDir, "members");
+
+  const auto NewHandle = [](Bartleby &B) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+    ASSERT_FALSE(B.addBinaries(Objects, 1));
+    B.prefixGlobalAndDefinedSymbols("prefix_");
+  };
+
+  BuildOptions Options;
+  Options.ThinMembersDirectory = std::string(MembersDir);
+  Options.Threads = 2;
+
+  std::vector<llvm::sys::TimePoint<>> ModificationTimes;
+  for (size_t Run = 0; Run < 2; ++Run) {
+    Bartleby B;
+    NewHandle(B);
+    ASSERT_FALSE(Bartleby::buildFinalArchive(std::move(B), OutPath, Options));
+
+    auto BufOrErr = llvm::MemoryBuffer::getFile(OutPath);
+    ASSERT_TRUE(!!BufOrErr);
+    auto ArOrErr = llvm::object::Archive::create(**BufOrErr);
+    ASSERT_TRUE(!!ArOrErr);
+    ASSERT_TRUE((*ArOrErr)->isThin());
+
+    size_t I = 0;
+    llvm::Error Err = llvm::Error::success();
+    for (const auto &Child : (*ArOrErr)->children(Err)) {
+      auto NameOrErr = Child.getName();
+      ASSERT_TRUE(!!NameOrErr);
+      ASSERT_TRUE(llvm::sys::path::is_relative(*NameOrErr));
+      auto FullNameOrErr = Child.getFullName();
+      ASSERT_TRUE(!!FullNameOrErr);
+      llvm::sys::fs::file_status Status;
+      ASSERT_FALSE(llvm::sys::fs::status(*FullNameOrErr, Status));
+      if (Run == 0) {
+        ModificationTimes.push_back(Status.getLastModificationTime());
+      } else {
+        ASSERT_EQ(ModificationTimes[I], Status.getLastModificationTime());
+      }
+      auto DataOrErr = Child.getBuffer();
+      ASSERT_TRUE(!!DataOrErr);
+      ASSERT_FALSE(DataOrErr->empty());
+      ++I;
+    }
+    ASSERT_FALSE(!!Err);
+    ASSERT_EQ(I, 2U);
+  }
+
+  Bartleby B;
+  NewHandle(B);
+  auto OutOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+  ASSERT_TRUE(!!OutOrErr);
+  auto ArOrErr = llvm::object::Archive::create(**OutOrErr);
+  ASSERT_TRUE(!!ArOrErr);
+  llvm::Error Err = llvm::Error::success();
+  for (const auto &Child : (*ArOrErr)->children(Err)) {
+    auto NameOrErr = Child.getName();
+    ASSERT_TRUE(!!NameOrErr);
+    ASSERT_TRUE(llvm::sys::path::is_absolute(*NameOrErr));
+  }
+  ASSERT_FALSE(!!Err);
+
+  ASSERT_FALSE(llvm::sys::fs::remove_directories(Dir));
+}
+
+/// \brief Test that the symbol table built from the collected symbols is the
+/// one LLVM computes from the rewritten members.
+TEST(BartleByObjectYamlELF, ArchiveIndex) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+  Bartleby B;
+  ASSERT_FALSE(B.addBinaries(Objects, 1));
+  B.prefixGlobalAndDefinedSymbols("prefix_");
+
+  auto OutOrErr = Bartleby::buildFinalArchive(std::move(B));
+  ASSERT_TRUE(!!OutOrErr);
+  auto ArOrErr = llvm::object::Archive::create(**OutOrErr);
+  ASSERT_TRUE(!!ArOrErr);
+
+  size_t Symbols = 0;
+  for (const auto &Sym : (*ArOrErr)->symbols()) {
+    EXPECT_EQ(Sym.getName().substr(0, 7), "prefix_");
+    ++Symbols;
+  }
+  ASSERT_GT(Symbols, 0U);
+
+  std::vector<llvm::NewArchiveMember> Members;
+  llvm::Error Err = llvm::Error::success();
+  for (const auto &Child : (*ArOrErr)->children(Err)) {
+    auto NameOrErr = Child.getName();
+    ASSERT_TRUE(!!NameOrErr);
+    auto BufOrErr = Child.getMemoryBufferRef();
+    ASSERT_TRUE(!!BufOrErr);
+    auto &Member = Members.emplace_back();
+    Member.Buf = llvm::MemoryBuffer::getMemBuffer(*BufOrErr, false);
+    Member.MemberName = *NameOrErr;
+  }
+  ASSERT_FALSE(!!Err);
+
+  auto ExpectedOrErr = llvm::writeArchiveToBuffer(
+      Members, llvm::SymtabWritingMode::NormalSymtab, (*ArOrErr)->kind(),
+      /*Deterministic=*/true, /*Thin=*/false);
+  ASSERT_TRUE(!!ExpectedOrErr);
+  ASSERT_EQ((*ExpectedOrErr)->getBuffer(), (*OutOrErr)->getBuffer());
+}
+
+/// \brief Test that the archives written from an index are the ones
+/// \p llvm::writeArchiveToBuffer writes, byte for byte, in every supported
+/// format and for name tables of various sizes.
+TEST(BartlebyArchiveIndex, MatchesWriteArchive) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+  for (size_t N = 1; N <= Objects.size(); ++N) {
+    std::vector<llvm::NewArchiveMember> Members;
+    for (size_t I = 0; I < N; ++I) {
+      auto &Member = Members.emplace_back();
+      Member.Buf = llvm::MemoryBuffer::getMemBuffer(
+          Objects[I].getBinary()->getMemoryBufferRef(), false);
+      Member.MemberName = (I == 1) ? "a_rather_long_member_name.o" : "m.o";
+    }
+
+    // Symbols, and the member defining each of them, as LLVM finds them.
+    auto GNUOrErr = llvm::writeArchiveToBuffer(
+        Members, llvm::SymtabWritingMode::NormalSymtab,
+        llvm::object::Archive::K_GNU, /*Deterministic=*/true,
+        /*Thin=*/false);
+    ASSERT_TRUE(!!GNUOrErr);
+    auto GNUArOrErr = llvm::object::Archive::create(**GNUOrErr);
+    ASSERT_TRUE(!!GNUArOrErr);
+    std::vector<uint64_t> ChildOffsets;
+    llvm::Error Err = llvm::Error::success();
+    for (const auto &Child : (*GNUArOrErr)->children(Err)) {
+      ChildOffsets.push_back(Child.getChildOffset());
+    }
+    ASSERT_FALSE(!!Err);
+    ASSERT_EQ(ChildOffsets.size(), N);
+    std::vector<std::pair<std::string, size_t>> Symbols;
+    for (const auto &Sym : (*GNUArOrErr)->symbols()) {
+      auto ChildOrErr = Sym.getMember();
+      ASSERT_TRUE(!!ChildOrErr);
+      const auto It = llvm::find(ChildOffsets, ChildOrErr->getChildOffset());
+      ASSERT_NE(It, ChildOffsets.end());
+      Symbols.emplace_back(Sym.getName().str(), It - ChildOffsets.begin());
+    }
+    ASSERT_FALSE(Symbols.empty());
+
+    for (const auto Kind :
+         {llvm::object::Archive::K_GNU, llvm::object::Archive::K_GNU64,
+          llvm::object::Archive::K_BSD, llvm::object::Archive::K_DARWIN,
+          llvm::object::Archive::K_DARWIN64}) {
+      for (const bool Thin : {false, true}) {
+        if (Thin && (Kind != llvm::object::Archive::K_GNU)) {
+          continue;
+        }
+        ArchiveIndex Index(Kind, Thin);
+        size_t Sym = 0;
+        for (size_t I = 0; I < N; ++I) {
+          Index.addMember(Members[I]);
+          for (; (Sym < Symbols.size()) && (Symbols[Sym].second == I); ++Sym) {
+            Index.addSymbol(Symbols[Sym].first);
+          }
+        }
+        ASSERT_EQ(Sym, Symbols.size());
+
+        std::string Content;
+        llvm::raw_string_ostream OS(Content);
+        ASSERT_FALSE(Index.writeArchive(OS, Members));
+        OS.flush();
+
+        auto ExpectedOrErr = llvm::writeArchiveToBuffer(
+            Members, llvm::SymtabWritingMode::NormalSymtab, Kind,
+            /*Deterministic=*/true, Thin);
+        ASSERT_TRUE(!!ExpectedOrErr);
+        EXPECT_EQ((*ExpectedOrErr)->getBuffer(), Content)
+            << "kind " << Kind << ", " << N << " member(s)"
+            << (Thin ? ", thin" : "");
+      }
+    }
+  }
+}
+
+/// \brief Test that objects without any renamed symbol are copied verbatim.
+TEST(BartleByObjectYamlELF, Passthrough) {
+  for (const bool Prefix : {false, true}) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+    std::vector<std::string> Inputs;
+    for (const auto &Obj : Objects) {
+      Inputs.push_back(Obj.getBinary()->getData().str());
+    }
+
+    Bartleby B;
+    ASSERT_FALSE(B.addBinaries(Objects, 1));
+    if (Prefix) {
+      B.prefixGlobalAndDefinedSymbols("prefix_");
+    }
+
+    Statistics Stats;
+    BuildOptions Options;
+    Options.Stats = &Stats;
+    auto OutOrErr = Bartleby::buildFinalArchive(std::move(B), Options);
+    ASSERT_TRUE(!!OutOrErr);
+    ASSERT_EQ(Stats.getPassthroughMembers(), Prefix ? 0U : 2U);
+    if (Prefix) {
+      continue;
+    }
+
+    auto ArOrErr = llvm::object::Archive::create(**OutOrErr);
+    ASSERT_TRUE(!!ArOrErr);
+    size_t I = 0;
+    llvm::Error Err = llvm::Error::success();
+    for (const auto &Child : (*ArOrErr)->children(Err)) {
+      auto DataOrErr = Child.getBuffer();
+      ASSERT_TRUE(!!DataOrErr);
+      ASSERT_LT(I, Inputs.size());
+      EXPECT_EQ(*DataOrErr, Inputs[I++]);
+    }
+    ASSERT_FALSE(!!Err);
+    ASSERT_EQ(I, 2U);
+  }
+}
+
+/// \brief Test that only the objects reachable from the roots are kept.
+TEST(BartleByObjectYamlELF, PruneUnreachableObjects) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+  Bartleby B;
+  ASSERT_FALSE(B.addBinaries(Objects, 1));
+  ASSERT_EQ(B.getNumObjects(), 5U);
+
+  // api.o pulls the first definition of helper, which pulls leaf.o.
+  const llvm::StringRef Roots[] = {"api", "unknown"};
+  ASSERT_EQ(B.pruneUnreachableObjects(Roots), 2U);
+  ASSERT_EQ(B.getNumObjects(), 3U);
+
+  auto OutOrErr = Bartleby::buildFinalArchive(std::move(B));
+  ASSERT_TRUE(!!OutOrErr);
+  auto ArOrErr = llvm::object::Archive::create(**OutOrErr);
+  ASSERT_TRUE(!!ArOrErr);
+  std::vector<std::string> Symbols;
+  for (const auto &Sym : (*ArOrErr)->symbols()) {
+    Symbols.push_back(Sym.getName().str());
+  }
+  const std::vector<std::string> Expected = {"api", "helper", "leaf"};
+  ASSERT_EQ(Symbols, Expected);
+
+  // Without any reachable object, there is no archive to build.
+  const llvm::StringRef UnknownRoots[] = {"unknown"};
+  for (int Output = 0; Output < 3; ++Output) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+        EmptyObjects;
+    ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, EmptyObjects,
+                             5));
+    Bartleby Empty;
+    ASSERT_FALSE(Empty.addBinaries(EmptyObjects, 1));
+    ASSERT_EQ(Empty.pruneUnreachableObjects(UnknownRoots), 5U);
+    ASSERT_EQ(Empty.getNumObjects(), 0U);
+    if (Output == 0) {
+      EXPECT_FALSE(!!Bartleby::buildFinalArchive(std::move(Empty)));
+    } else if (Output == 1) {
+      std::string Content;
+      llvm::raw_string_ostream OS(Content);
+      auto Err = Bartleby::buildFinalArchive(std::move(Empty), OS);
+      EXPECT_TRUE(!!Err);
+      llvm::consumeError(std::move(Err));
+    } else {
+      llvm::SmallString<128> Path;
+      ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("bartleby", "a", Path));
+      ASSERT_FALSE(llvm::sys::fs::remove(Path));
+      auto Err = Bartleby::buildFinalArchive(std::move(Empty), Path);
+      EXPECT_TRUE(!!Err);
+      llvm::consumeError(std::move(Err));
+      EXPECT_FALSE(llvm::sys::fs::exists(Path));
+    }
+  }
+}
+
+/// \brief Test the occurrence index and the dependency graph.
+TEST(BartleByObjectYamlELF, Occurrences) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+  Bartleby B;
+  ASSERT_FALSE(B.addBinaries(Objects, 1));
+
+  const auto Helper = B.getOccurrences("helper");
+  ASSERT_EQ(Helper.size(), 3U);
+  EXPECT_EQ(Helper[0].Object, 0U);
+  EXPECT_FALSE(Helper[0].Defined);
+  EXPECT_EQ(Helper[1].Object, 1U);
+  EXPECT_TRUE(Helper[1].Defined);
+  EXPECT_EQ(Helper[1].Bind, Binding::Global);
+  EXPECT_EQ(Helper[2].Object, 4U);
+  EXPECT_TRUE(B.getOccurrences("unknown").empty());
+
+  const auto &Symbols = B.getSymbols();
+  EXPECT_EQ(Symbols.find("api")->getValue().getReferences(), 0U);
+  EXPECT_EQ(Symbols.find("helper")->getValue().getReferences(), 1U);
+  EXPECT_EQ(Symbols.find("leaf")->getValue().getReferences(), 2U);
+
+  // api.o depends on both definitions of helper.
+  const auto Graph = B.getDependencyGraph();
+  ASSERT_EQ(Graph.getNumObjects(), 5U);
+  ASSERT_EQ(Graph.getNumEdges(), 4U);
+  const auto Deps = Graph.getDependencies(0);
+  ASSERT_EQ(Deps.size(), 2U);
+  EXPECT_EQ(Deps[0].To, 1U);
+  EXPECT_EQ(Deps[0].Symbols, 1U);
+  EXPECT_EQ(Deps[1].To, 4U);
+  EXPECT_TRUE(Graph.getDependencies(2).empty());
+
+  std::string DOT;
+  llvm::raw_string_ostream DOTOS(DOT);
+  B.writeDependencyGraph(DOTOS, GraphFormat::DOT);
+  EXPECT_TRUE(llvm::StringRef(DOTOS.str()).contains("n3 -> n2 [label=\"1\"]"));
+
+  std::string JSON;
+  llvm::raw_string_ostream JSONOS(JSON);
+  B.writeDependencyGraph(JSONOS, GraphFormat::JSON);
+  auto JSONOrErr = llvm::json::parse(JSONOS.str());
+  ASSERT_TRUE(!!JSONOrErr);
+  const auto *Edges = JSONOrErr->getAsObject()->getArray("edges");
+  ASSERT_NE(Edges, nullptr);
+  EXPECT_EQ(Edges->size(), 4U);
+
+  std::string Binary;
+  llvm::raw_string_ostream BinaryOS(Binary);
+  B.writeDependencyGraph(BinaryOS, GraphFormat::Binary);
+  const llvm::StringRef Data(BinaryOS.str());
+  ASSERT_TRUE(Data.size() > 20);
+  EXPECT_EQ(Data.substr(0, 8), "BTLYDEPG");
+  EXPECT_EQ(llvm::support::endian::read32le(Data.data() + 12), 5U);
+  EXPECT_EQ(llvm::support::endian::read32le(Data.data() + 16), 4U);
+
+  // Pruning invalidates the index.
+  const llvm::StringRef Roots[] = {"api"};
+  ASSERT_EQ(B.pruneUnreachableObjects(Roots), 2U);
+  EXPECT_EQ(B.getOccurrences("helper").size(), 2U);
+  EXPECT_TRUE(B.getOccurrences("unused").empty());
+}
+
+/// \brief Test the rename policies.
+TEST(BartleByObjectYamlELF, RenamePolicy) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+  auto PolicyOrErr = RenamePolicy::parse(R"(
+# Public API.
+keep literal:api
+keep regex:un.*
+rename glob:h?lp*r
+rename prefix:le
+rename regex:unus.d
+default keep
+)");
+  ASSERT_TRUE(!!PolicyOrErr) << llvm::toString(PolicyOrErr.takeError());
+  EXPECT_EQ(PolicyOrErr->match("api"), RenamePolicy::Action::Keep);
+  EXPECT_EQ(PolicyOrErr->match("unused"), RenamePolicy::Action::Keep);
+  EXPECT_EQ(PolicyOrErr->match("helper"), RenamePolicy::Action::Rename);
+  EXPECT_EQ(PolicyOrErr->match("leaf"), RenamePolicy::Action::Rename);
+  EXPECT_EQ(PolicyOrErr->match("l"), RenamePolicy::Action::Default);
+  EXPECT_EQ(PolicyOrErr->match("apis"), RenamePolicy::Action::Default);
+
+  Bartleby B;
+  ASSERT_FALSE(B.addBinaries(Objects, 1));
+  ASSERT_EQ(B.applyRenamePolicy(*PolicyOrErr, "prefix_", 4), 2U);
+  const auto &Symbols = B.getSymbols();
+  EXPECT_FALSE(Symbols.find("api")->getValue().isRenamed());
+  EXPECT_TRUE(Symbols.find("helper")->getValue().isRenamed());
+  EXPECT_TRUE(Symbols.find("leaf")->getValue().isRenamed());
+  EXPECT_FALSE(Symbols.find("unused")->getValue().isRenamed());
+
+  // Without rules, the policy behaves as prefixGlobalAndDefinedSymbols.
+  Objects.clear();
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+  Bartleby Default;
+  ASSERT_FALSE(Default.addBinaries(Objects, 1));
+  ASSERT_EQ(Default.applyRenamePolicy(RenamePolicy(), "prefix_"), 4U);
+
+  auto ErrOrPolicy = RenamePolicy::parse("keep literal:api\nrename foo\n");
+  ASSERT_FALSE(!!ErrOrPolicy);
+  EXPECT_EQ(llvm::toString(ErrOrPolicy.takeError()),
+            "line 2: expected <kind>:<pattern>, got 'foo'");
+  ErrOrPolicy = RenamePolicy::parse("keep regex:(\n");
+  ASSERT_FALSE(!!ErrOrPolicy);
+  llvm::consumeError(ErrOrPolicy.takeError());
+
+  // Joined regular expressions cannot hold back references.
+  ErrOrPolicy = RenamePolicy::parse("keep regex:(a)\\1\n");
+  ASSERT_FALSE(!!ErrOrPolicy);
+  EXPECT_EQ(llvm::toString(ErrOrPolicy.takeError()),
+            "line 1: back references are not supported in regex rules");
+  ErrOrPolicy = RenamePolicy::parse("keep regex:[\\1]x\\.\n");
+  ASSERT_TRUE(!!ErrOrPolicy) << llvm::toString(ErrOrPolicy.takeError());
+  EXPECT_EQ(ErrOrPolicy->match("\\x."), RenamePolicy::Action::Keep);
+
+  // Rules only choose among global and defined symbols: the file symbols of
+  // the objects are local.
+  Objects.clear();
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+  PolicyOrErr = RenamePolicy::parse("rename glob:*.c\ndefault keep\n");
+  ASSERT_TRUE(!!PolicyOrErr) << llvm::toString(PolicyOrErr.takeError());
+  EXPECT_EQ(PolicyOrErr->match("api.c"), RenamePolicy::Action::Rename);
+  Bartleby Locals;
+  ASSERT_FALSE(Locals.addBinaries(Objects, 1));
+  ASSERT_EQ(Locals.applyRenamePolicy(*PolicyOrErr, "prefix_"), 0U);
+}
+
+/// \brief Test that globs compiled into regular expressions match the names
+/// \p llvm::GlobPattern matches.
+TEST(BartlebyRenamePolicy, Globs) {
+  const llvm::StringRef Globs[] = {
+      "h?lp*r", "*.c",    "[]a]x",   "[!]a]x", "[^-]*", "[a-c-]?",
+      "x[^^]",  "a\\*b", "*[.$()|+{}]*", "[-^]",  "[^]y",  "[!a-z]*",
+      "[^]",    "[]-a]",  "*[[:]*",  "*\\\\*"};
+  const llvm::StringRef Names[] = {
+      "helper", "hlpr", "api.c", "]x", "ax", "bx", "-", "^", "a*b", "ab",
+      "a.b", "x^", "xy", "a(b", "a|b", "a{b", "\xc3\xa9", "b-", "cz", "-y",
+      "Zebra", "zebra", "", "[", ":", "a\\b", "\\", "]", "_"};
+  for (const auto Glob : Globs) {
+    auto PatternOrErr = llvm::GlobPattern::create(Glob);
+    ASSERT_TRUE(!!PatternOrErr) << Glob.str();
+    auto PolicyOrErr = RenamePolicy::parse(("rename glob:" + Glob).str());
+    ASSERT_TRUE(!!PolicyOrErr) << llvm::toString(PolicyOrErr.takeError());
+    for (const auto Name : Names) {
+      EXPECT_EQ(PolicyOrErr->match(Name) == RenamePolicy::Action::Rename,
+                PatternOrErr->match(Name))
+          << "glob '" << Glob.str() << "', name '" << Name.str() << "'";
+    }
+  }
+}
+
+/// \brief Test that symbols are renamed into short, stable hashed names.
+TEST(BartleByObjectYamlELF, HashNames) {
+  std::string Maps[2];
+  for (auto &Map : Maps) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+    Bartleby B;
+    ASSERT_FALSE(B.addBinaries(Objects, 1));
+    ASSERT_EQ(B.hashGlobalAndDefinedSymbols("p_"), 4U);
+
+    llvm::SmallString<64> Storage;
+    const auto &Symbols = B.getSymbols();
+    const auto NewNameOrNone =
+        Symbols.find("helper")->getValue().getNewName("helper", Storage);
+    ASSERT_TRUE(NewNameOrNone.has_value());
+    const auto NewName = NewNameOrNone->str();
+    EXPECT_EQ(llvm::StringRef(NewName).substr(0, 2), "p_");
+    EXPECT_EQ(NewName.size(), 10U);
+
+    llvm::raw_string_ostream OS(Map);
+    B.writeRenameMap(OS);
+    OS.flush();
+
+    auto OutOrErr = Bartleby::buildFinalArchive(std::move(B));
+    ASSERT_TRUE(!!OutOrErr) << llvm::toString(OutOrErr.takeError());
+    EXPECT_TRUE((*OutOrErr)->getBuffer().contains(NewName));
+  }
+
+  // New names are stable across runs.
+  EXPECT_EQ(Maps[0], Maps[1]);
+  llvm::SmallVector<llvm::StringRef, 4> Lines;
+  llvm::StringRef(Maps[0]).split(Lines, '\n', -1, /*KeepEmpty=*/false);
+  ASSERT_EQ(Lines.size(), 4U);
+  EXPECT_TRUE(std::is_sorted(Lines.begin(), Lines.end()));
+  EXPECT_EQ(Lines[0].substr(0, 2), "p_");
+  EXPECT_TRUE(Lines[0].contains('\t'));
+}
+
+/// \brief Test that the resolution of a collision between two hashed names
+/// does not depend on the order of the inputs.
+TEST(BartleByObjectYamlELF, HashNamesCollision) {
+  std::string Maps[2];
+  for (size_t I = 0; I < 2; ++I) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+        Objects;
+    ASSERT_TRUE(YAML2Objects("hash_collision.yaml",
+                             llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+    if (I == 1) {
+      std::swap(Objects[0], Objects[1]);
+    }
+
+    Bartleby B;
+    ASSERT_FALSE(B.addBinaries(Objects, 1));
+    ASSERT_EQ(B.hashGlobalAndDefinedSymbols("p_"), 2U);
+    llvm::raw_string_ostream OS(Maps[I]);
+    B.writeRenameMap(OS);
+    OS.flush();
+  }
+
+  EXPECT_EQ(Maps[0], Maps[1]);
+  llvm::SmallVector<llvm::StringRef, 2> Lines;
+  llvm::StringRef(Maps[0]).split(Lines, '\n', -1, /*KeepEmpty=*/false);
+  ASSERT_EQ(Lines.size(), 2U);
+  EXPECT_NE(Lines[0].split('\t').first, Lines[1].split('\t').first);
+}
+
+/// \brief Test that the binary rename map maps names in both directions,
+/// and that malformed maps are rejected.
+TEST(BartleByObjectYamlELF, BinaryRenameMap) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+  Bartleby B;
+  ASSERT_FALSE(B.addBinaries(Objects, 1));
+  ASSERT_EQ(B.prefixGlobalAndDefinedSymbols("prefix_"), 4U);
+
+  std::string Content;
+  llvm::raw_string_ostream OS(Content);
+  ASSERT_FALSE(B.writeBinaryRenameMap(OS));
+  OS.flush();
+
+  auto MapOrErr =
+      RenameMap::create(llvm::MemoryBufferRef(Content, "rename-map"));
+  ASSERT_TRUE(!!MapOrErr) << llvm::toString(MapOrErr.takeError());
+  const auto &Map = *MapOrErr;
+  EXPECT_EQ(Map.size(), 4U);
+
+  using Direction = RenameMap::Direction;
+  EXPECT_EQ(Map.lookup("prefix_helper", Direction::ToOriginal), "helper");
+  EXPECT_EQ(Map.lookup("helper", Direction::ToRenamed), "prefix_helper");
+  EXPECT_FALSE(Map.lookup("helper", Direction::ToOriginal).has_value());
+  EXPECT_FALSE(Map.lookup("prefix_", Direction::ToOriginal).has_value());
+
+  std::string Trace;
+  llvm::raw_string_ostream TraceOS(Trace);
+  EXPECT_EQ(Map.symbolize("#0 0x1234 in prefix_helper+0x10 (prefix_helper.)",
+                          Direction::ToOriginal, TraceOS),
+            2U);
+  TraceOS.flush();
+  EXPECT_EQ(Trace, "#0 0x1234 in helper+0x10 (helper.)");
+
+  Content[0] = 'X';
+  auto BadOrErr =
+      RenameMap::create(llvm::MemoryBufferRef(Content, "rename-map"));
+  EXPECT_FALSE(!!BadOrErr);
+  llvm::consumeError(BadOrErr.takeError());
+}
+
+/// \brief Test that the input cache reuses binaries and their symbols, tells
+/// rewritten files apart without hashing unchanged ones, and can be pruned.
+TEST(BartleByObjectYamlELF, InputCache) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 1>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 1));
+
+  llvm::SmallString<128> Path;
+  int FD;
+  ASSERT_FALSE(
+      llvm::sys::fs::createTemporaryFile("bartleby-input", "o", FD, Path));
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Objects[0].getBinary()->getData();
+  }
+
+  InputCache Cache;
+  for (size_t I = 0; I < 2; ++I) {
+    Statistics Stats;
+    Bartleby B;
+    B.setStatistics(&Stats);
+    B.setInputCache(&Cache);
+    auto BinOrErr = Cache.openBinary(Path, "digest");
+    ASSERT_TRUE(!!BinOrErr);
+    ASSERT_FALSE(B.addBinary(std::move(*BinOrErr)));
+    ASSERT_SYM_DEFINED(B, "defined_global_symbol");
+    ASSERT_SYM_GLOBAL(B, "defined_global_symbol");
+
+    ASSERT_EQ(Cache.size(), 1U);
+    ASSERT_EQ(Cache.getHits(), I);
+    ASSERT_EQ(Cache.getMisses(), 1U);
+    ASSERT_EQ(Stats.getPhase(Statistics::Phase::ProcessObjectFile).Calls,
+              (I == 0) ? 1U : 0U);
+    ASSERT_EQ(B.prefixGlobalAndDefinedSymbols("prefix_"), 1U);
+    ASSERT_TRUE(!!Bartleby::buildFinalArchive(std::move(B)));
+  }
+
+  auto BinOrErr = Cache.openBinary(Path, "other digest");
+  ASSERT_TRUE(!!BinOrErr);
+  ASSERT_EQ(Cache.size(), 1U);
+  ASSERT_EQ(Cache.getMisses(), 2U);
+
+  // Without a digest, the content is hashed: rewriting the file in place,
+  // with the same size and within the same second, is noticed.
+  std::string Content = Objects[0].getBinary()->getData().str();
+  BinOrErr = Cache.openBinary(Path);
+  ASSERT_TRUE(!!BinOrErr);
+  ASSERT_EQ(BinOrErr->getBinary()->getData(), Content);
+  ASSERT_EQ(Cache.getMisses(), 3U);
+  BinOrErr = Cache.openBinary(Path);
+  ASSERT_TRUE(!!BinOrErr);
+  ASSERT_EQ(Cache.getHits(), 2U);
+
+  const auto Pos = Content.find("defined_global_symbol");
+  ASSERT_NE(Pos, std::string::npos);
+  Content[Pos] = 'D';
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC);
+    ASSERT_FALSE(EC);
+    OS << Content;
+  }
+  BinOrErr = Cache.openBinary(Path);
+  ASSERT_TRUE(!!BinOrErr);
+  ASSERT_EQ(BinOrErr->getBinary()->getData(), Content);
+  ASSERT_EQ(Cache.getMisses(), 4U);
+  ASSERT_EQ(Cache.size(), 1U);
+  ASSERT_EQ(Cache.getSize(), Content.size());
+
+  // Pruning evicts the least recently used binaries beyond the bound.
+  ASSERT_EQ(Cache.prune(), 0U);
+  Cache.setMaxSize(1);
+  ASSERT_EQ(Cache.prune(), 1U);
+  ASSERT_EQ(Cache.size(), 0U);
+  ASSERT_EQ(Cache.getSize(), 0U);
+  BinOrErr = Cache.openBinary(Path);
+  ASSERT_TRUE(!!BinOrErr);
+  ASSERT_EQ(Cache.getMisses(), 5U);
+
+  // Without a digest, a file is only hashed again once its size,
+  // modification time, device or inode changes, unless its modification
+  // time is too recent or too coarse to tell a rewrite apart.
+  const auto SetModificationTime = [&Path](llvm::sys::TimePoint<> Time) {
+    int WriteFD;
+    ASSERT_FALSE(llvm::sys::fs::openFileForWrite(
+        Path, WriteFD, llvm::sys::fs::CD_OpenExisting));
+    ASSERT_FALSE(
+        llvm::sys::fs::setLastAccessAndModificationTime(WriteFD, Time));
+    ASSERT_FALSE(llvm::sys::Process::SafelyCloseFileDescriptor(WriteFD));
+  };
+  const auto HourAgo = std::chrono::time_point_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now() - std::chrono::hours(1));
+
+  SetModificationTime(HourAgo + std::chrono::nanoseconds(123456789));
+  size_t Hashed = Cache.getHashedFiles();
+  for (size_t I = 0; I < 3; ++I) {
+    BinOrErr = Cache.openBinary(Path);
+    ASSERT_TRUE(!!BinOrErr);
+    ASSERT_EQ(BinOrErr->getBinary()->getData(), Content);
+    ASSERT_EQ(Cache.getHashedFiles(), Hashed + 1);
+  }
+
+  Content[Pos] = 'd';
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC);
+    ASSERT_FALSE(EC);
+    OS << Content;
+  }
+  Hashed = Cache.getHashedFiles();
+  for (size_t I = 1; I <= 2; ++I) {
+    BinOrErr = Cache.openBinary(Path);
+    ASSERT_TRUE(!!BinOrErr);
+    ASSERT_EQ(BinOrErr->getBinary()->getData(), Content);
+    ASSERT_EQ(Cache.getHashedFiles(), Hashed + I);
+  }
+
+  SetModificationTime(HourAgo);
+  Hashed = Cache.getHashedFiles();
+  for (size_t I = 1; I <= 2; ++I) {
+    BinOrErr = Cache.openBinary(Path);
+    ASSERT_TRUE(!!BinOrErr);
+    ASSERT_EQ(Cache.getHashedFiles(), Hashed + I);
+  }
+
+  ASSERT_FALSE(llvm::sys::fs::remove(Path));
+}
+
+/// \brief Test that statistics are recorded for each phase.
+TEST(BartleByObjectYamlELF, Statistics) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+  Statistics Stats;
+  Bartleby B;
+  B.setStatistics(&Stats);
+  ASSERT_FALSE(B.addBinaries(Objects, 1));
+  const auto N = B.prefixGlobalAndDefinedSymbols("prefix_");
+  auto ArOrErr = Bartleby::buildFinalArchive(std::move(B));
+  ASSERT_TRUE(!!ArOrErr);
+
+  const auto Add = Stats.getPhase(Statistics::Phase::AddBinary);
+  ASSERT_EQ(Add.Calls, 1U);
+  ASSERT_EQ(Add.Objects, 2U);
+  ASSERT_GT(Add.BytesIn, 0U);
+
+  const auto Process = Stats.getPhase(Statistics::Phase::ProcessObjectFile);
+  ASSERT_EQ(Process.Calls, 2U);
+  ASSERT_GT(Process.Symbols, 0U);
+
+  const auto Prefix = Stats.getPhase(Statistics::Phase::PrefixSymbols);
+  ASSERT_EQ(Prefix.Calls, 1U);
+  ASSERT_EQ(Prefix.Symbols, N);
+
+  const auto ObjCopy = Stats.getPhase(Statistics::Phase::ObjCopy);
+  ASSERT_EQ(ObjCopy.Calls, 2U);
+  ASSERT_EQ(ObjCopy.BytesIn, Add.BytesIn);
+
+  const auto Write = Stats.getPhase(Statistics::Phase::WriteArchive);
+  ASSERT_EQ(Write.Calls, 1U);
+  ASSERT_EQ(Write.BytesIn, ObjCopy.BytesOut);
+  ASSERT_EQ(Write.BytesOut, (*ArOrErr)->getBufferSize());
+
+  const auto JSON = Stats.toJSON();
+  const auto *Root = JSON.getAsObject();
+  ASSERT_NE(Root, nullptr);
+  const auto *Phases = Root->getObject("phases");
+  ASSERT_NE(Phases, nullptr);
+  ASSERT_NE(Phases->getObject("objcopy"), nullptr);
+}
+
+/// \brief Test the symbol map.
+TEST(BartlebySymbolMap, SymbolMap) {
+  SymbolMap Symbols;
+  const auto [Foo, FooInserted] = Symbols.insert("foo");
+  ASSERT_TRUE(FooInserted);
+  const auto [Bar, BarInserted] = Symbols.insert("bar");
+  ASSERT_TRUE(BarInserted);
+  ASSERT_NE(Foo, Bar);
+  ASSERT_EQ(Symbols.insert("foo").first, Foo);
+  ASSERT_FALSE(Symbols.insert("foo").second);
+  ASSERT_EQ(Symbols.size(), 2U);
+
+  ASSERT_EQ(Symbols.getID("bar"), Bar);
+  ASSERT_FALSE(Symbols.getID("baz").has_value());
+  ASSERT_EQ(Symbols.find("baz"), Symbols.end());
+  ASSERT_EQ(Symbols.find("foo")->first(), "foo");
+  ASSERT_EQ(Symbols.begin()->first(), "foo");
+
+  llvm::SmallString<32> Storage;
+  ASSERT_FALSE(Symbols.getEntry(Foo).getValue().isRenamed());
+  ASSERT_FALSE(
+      Symbols.getEntry(Foo).getValue().getNewName("foo", Storage).has_value());
+
+  Symbols.setPrefix(Foo, "prefix_");
+  Symbols.setNewName(Bar, "qux");
+  ASSERT_TRUE(Symbols.getEntry(Foo).getValue().isRenamed());
+  ASSERT_EQ(*Symbols.getEntry(Foo).getValue().getNewName("foo", Storage),
+            "prefix_foo");
+  ASSERT_EQ(*Symbols.getEntry(Bar).getValue().getNewName("bar", Storage),
+            "qux");
+}
+
+/// \brief Test that the format-specialized scanners report the same symbols
+/// and flags as the generic \p llvm::object::SymbolRef interface.
+TEST(BartlebySymbolScanner, MatchesGeneric) {
+  using Scanned = std::pair<std::string, uint32_t>;
+  const std::tuple<llvm::StringRef, llvm::Triple::ObjectFormatType, size_t>
+      Inputs[] = {
+          {"reachability.yaml", llvm::Triple::ObjectFormatType::ELF, 5},
+          {"simple_x86_64.yaml", llvm::Triple::ObjectFormatType::ELF, 1},
+          {"symbols_visibility.yaml", llvm::Triple::ObjectFormatType::ELF, 2},
+          {"uninit_symbol_in_BSS.yaml", llvm::Triple::ObjectFormatType::ELF,
+           1},
+          {"mapping_symbols.yaml", llvm::Triple::ObjectFormatType::ELF, 4},
+          {"arm64.yaml", llvm::Triple::ObjectFormatType::MachO, 1},
+      };
+  for (const auto &[Filepath, ObjFormat, N] : Inputs) {
+    llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+        Objects;
+    ASSERT_TRUE(YAML2Objects(Filepath, ObjFormat, Objects, N));
+    for (auto &Object : Objects) {
+      const auto &Obj =
+          *llvm::cast<llvm::object::ObjectFile>(Object.getBinary());
+
+      std::vector<Scanned> Generic;
+      size_t NumGeneric = 0;
+      for (const auto &Sym : Obj.symbols()) {
+        ++NumGeneric;
+        auto NameOrErr = Sym.getName();
+        auto FlagsOrErr = Sym.getFlags();
+        auto TypeOrErr = Sym.getType();
+        ASSERT_TRUE(NameOrErr && FlagsOrErr && TypeOrErr);
+        if ((*TypeOrErr == llvm::object::SymbolRef::ST_Debug) ||
+            (*TypeOrErr == llvm::object::SymbolRef::ST_File)) {
+          continue;
+        }
+        Generic.emplace_back(NameOrErr->str(),
+                             *FlagsOrErr & ScannedSymbolFlags);
+      }
+
+      std::vector<Scanned> Specialized;
+      const auto NumSpecialized =
+          scanSymbols(Obj, [&](llvm::StringRef Name, const uint32_t Flags) {
+            Specialized.emplace_back(Name.str(), Flags);
+          });
+      ASSERT_TRUE(NumSpecialized.has_value()) << Filepath.str();
+      EXPECT_EQ(*NumSpecialized, NumGeneric) << Filepath.str();
+      EXPECT_FALSE(Specialized.empty()) << Filepath.str();
+      EXPECT_EQ(Specialized, Generic) << Filepath.str();
+    }
+  }
+}
+
+/// \brief Test that the ELF scanner marks the mapping symbols of AArch64, ARM,
+/// RISC-V and CSKY as format specific.
+TEST(BartlebySymbolScanner, MappingSymbols) {
+  // The objects of mapping_symbols.yaml, in order, share the same symbols.
+  const std::vector<std::string> Expected[] = {
+      {"$d", "$d.1", "$x"},
+      {"", "$d", "$d.1", "$t", "$a"},
+      {"$d", "$d.1", "$x", ".L0 "},
+      {"$d", "$d.1", "$t"},
+  };
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 4>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("mapping_symbols.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects,
+                           std::size(Expected)));
+  for (size_t I = 0; I < Objects.size(); ++I) {
+    const auto &Obj =
+        *llvm::cast<llvm::object::ObjectFile>(Objects[I].getBinary());
+    std::vector<std::string> FormatSpecific;
+    size_t NumScanned = 0;
+    const auto NumSymbols =
+        scanSymbols(Obj, [&](llvm::StringRef Name, const uint32_t Flags) {
+          ++NumScanned;
+          if ((Flags & llvm::object::SymbolRef::SF_FormatSpecific) != 0) {
+            FormatSpecific.push_back(Name.str());
+          }
+        });
+    ASSERT_TRUE(NumSymbols.has_value()) << I;
+    EXPECT_EQ(NumScanned, 10) << I;
+    EXPECT_EQ(FormatSpecific, Expected[I]) << I;
+  }
+}
+
+/// \brief Test that the Mach-O scanner skips the symbols whose name does not
+/// start within the string table.
+TEST(BartlebySymbolScanner, MachOBadStringIndex) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 1>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("bad_string_index.yaml",
+                           llvm::Triple::ObjectFormatType::MachO, Objects));
+  const auto &Obj =
+      *llvm::cast<llvm::object::ObjectFile>(Objects[0].getBinary());
+
+  std::vector<std::string> Names;
+  const auto NumSymbols =
+      scanSymbols(Obj, [&](llvm::StringRef Name, const uint32_t) {
+        Names.push_back(Name.str());
+      });
+  ASSERT_TRUE(NumSymbols.has_value());
+  EXPECT_EQ(*NumSymbols, 3);
+  EXPECT_EQ(Names, (std::vector<std::string>{"ltmp1", "_foo"}));
+}
+
 /// \brief Test the C API.
 TEST(BartlebyCAPI, CAPI) {
   llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
@@ -377,6 +1831,187 @@ TEST(BartlebyCAPI, CAPI) {
   ::free(out);
 }
 
+/// \brief Test the C API with a borrowed buffer.
+TEST(BartlebyCAPI, CAPI_Borrowed) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+  auto *bh = ::saq_bartleby_new();
+  ASSERT_NE(bh, nullptr);
+
+  for (const auto &Obj : Objects) {
+    const auto data = Obj.getBinary()->getData();
+    ASSERT_EQ(::saq_bartleby_add_binary_borrowed(bh, data.data(), data.size()),
+              0);
+  }
+  ASSERT_EQ(::saq_bartleby_add_binary_borrowed(bh, nullptr, 1), EINVAL);
+
+  ASSERT_EQ(::saq_bartleby_set_prefix(bh, "prefix_"), 0);
+
+  void *out = nullptr;
+  size_t out_n = 0;
+
+  ASSERT_EQ(::saq_bartleby_build_archive(bh, &out, &out_n), 0);
+  ASSERT_TRUE(out_n > 0);
+  ASSERT_NE(out, nullptr);
+
+  ::free(out);
+}
+
+/// \brief Test the streaming outputs of the C API.
+TEST(BartlebyCAPI, CAPI_Stream) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 2>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 2));
+
+  const auto NewHandle = [&Objects]() {
+    auto *bh = ::saq_bartleby_new();
+    for (const auto &Obj : Objects) {
+      const auto data = Obj.getBinary()->getData();
+      EXPECT_EQ(
+          ::saq_bartleby_add_binary_borrowed(bh, data.data(), data.size()), 0);
+    }
+    EXPECT_EQ(::saq_bartleby_set_prefix(bh, "prefix_"), 0);
+    return bh;
+  };
+
+  void *out = nullptr;
+  size_t out_n = 0;
+  ASSERT_EQ(::saq_bartleby_build_archive(NewHandle(), &out, &out_n), 0);
+  const std::string Expected(static_cast<const char *>(out), out_n);
+  ::free(out);
+
+  const auto Append = [](void *ctx, const void *s, size_t n) -> int {
+    static_cast<std::string *>(ctx)->append(static_cast<const char *>(s), n);
+    return 0;
+  };
+  std::string Written;
+  ASSERT_EQ(
+      ::saq_bartleby_build_archive_to_writer(NewHandle(), Append, &Written), 0);
+  EXPECT_EQ(Written, Expected);
+
+  const auto Fail = [](void *, const void *, size_t) -> int { return ENOSPC; };
+  EXPECT_EQ(::saq_bartleby_build_archive_to_writer(NewHandle(), Fail, nullptr),
+            ENOSPC);
+  EXPECT_EQ(::saq_bartleby_build_archive_to_writer(NewHandle(), nullptr,
+                                                   nullptr),
+            EINVAL);
+
+  int FD = -1;
+  llvm::SmallString<128> Path;
+  ASSERT_FALSE(
+      llvm::sys::fs::createTemporaryFile("bartleby-capi", "a", FD, Path));
+  ASSERT_EQ(::saq_bartleby_build_archive_to_fd(NewHandle(), FD), 0);
+  ::close(FD);
+  auto BufOrErr = llvm::MemoryBuffer::getFile(Path);
+  ASSERT_TRUE(BufOrErr);
+  EXPECT_EQ((*BufOrErr)->getBuffer(), Expected);
+  llvm::sys::fs::remove(Path);
+
+  EXPECT_EQ(::saq_bartleby_build_archive_to_fd(NewHandle(), -1), EBADF);
+}
+
+/// \brief Test the statistics of the C API.
+TEST(BartlebyCAPI, CAPI_Statistics) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 1>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("symbols_visibility.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects));
+
+  auto *stats = ::saq_bartleby_statistics_new();
+  ASSERT_NE(stats, nullptr);
+
+  auto *bh = ::saq_bartleby_new();
+  ASSERT_NE(bh, nullptr);
+  ASSERT_EQ(::saq_bartleby_set_statistics(nullptr, stats), EINVAL);
+  ASSERT_EQ(::saq_bartleby_set_statistics(bh, stats), 0);
+
+  const auto data = Objects[0].getBinary()->getData();
+  ASSERT_EQ(::saq_bartleby_add_binary(bh, data.data(), data.size()), 0);
+  ASSERT_EQ(::saq_bartleby_set_prefix(bh, "prefix_"), 0);
+
+  void *out = nullptr;
+  size_t out_n = 0;
+  ASSERT_EQ(::saq_bartleby_build_archive(bh, &out, &out_n), 0);
+  ::free(out);
+
+  char *json = nullptr;
+  size_t json_n = 0;
+  ASSERT_EQ(::saq_bartleby_statistics_to_json(stats, &json, &json_n), 0);
+  ASSERT_NE(json, nullptr);
+  ASSERT_EQ(::strlen(json), json_n);
+  auto JSON = llvm::json::parse(llvm::StringRef(json, json_n));
+  ASSERT_TRUE(!!JSON);
+  ::free(json);
+
+  char *report = nullptr;
+  size_t report_n = 0;
+  ASSERT_EQ(::saq_bartleby_statistics_report(stats, &report, &report_n), 0);
+  ASSERT_TRUE(llvm::StringRef(report, report_n).contains("write_archive"));
+  ::free(report);
+
+  ASSERT_EQ(::saq_bartleby_statistics_to_json(nullptr, &json, &json_n),
+            EINVAL);
+  ::saq_bartleby_statistics_free(stats);
+}
+
+/// \brief Test the occurrences and the dependency graph of the C API.
+TEST(BartlebyCAPI, CAPI_Occurrences) {
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 5>
+      Objects;
+  ASSERT_TRUE(YAML2Objects("reachability.yaml",
+                           llvm::Triple::ObjectFormatType::ELF, Objects, 5));
+
+  auto *bh = ::saq_bartleby_new();
+  ASSERT_NE(bh, nullptr);
+  for (const auto &Obj : Objects) {
+    const auto data = Obj.getBinary()->getData();
+    ASSERT_EQ(::saq_bartleby_add_binary(bh, data.data(), data.size()), 0);
+  }
+
+  size_t num_objects = 0;
+  ASSERT_EQ(::saq_bartleby_get_num_objects(bh, &num_objects), 0);
+  ASSERT_EQ(num_objects, 5U);
+
+  struct BartlebyOccurrence *occurrences = nullptr;
+  size_t n = 0;
+  ASSERT_EQ(::saq_bartleby_get_occurrences(bh, "leaf", &occurrences, &n), 0);
+  ASSERT_EQ(n, 3U);
+  EXPECT_EQ(occurrences[0].object, 1U);
+  EXPECT_EQ(occurrences[0].defined, 0);
+  EXPECT_EQ(occurrences[1].object, 2U);
+  EXPECT_EQ(occurrences[1].defined, 1);
+  EXPECT_EQ(occurrences[1].binding, SAQ_BARTLEBY_BINDING_GLOBAL);
+  ::free(occurrences);
+  ASSERT_EQ(::saq_bartleby_get_occurrences(bh, "unknown", &occurrences, &n),
+            0);
+  EXPECT_EQ(occurrences, nullptr);
+  EXPECT_EQ(n, 0U);
+
+  char *name = nullptr;
+  ASSERT_EQ(::saq_bartleby_get_object_name(bh, 2, &name, &n), 0);
+  EXPECT_EQ(llvm::StringRef(name, n), "3.o");
+  ::free(name);
+  EXPECT_EQ(::saq_bartleby_get_object_name(bh, 5, &name, &n), ERANGE);
+
+  const auto Append = [](void *ctx, const void *s, size_t n) -> int {
+    static_cast<std::string *>(ctx)->append(static_cast<const char *>(s), n);
+    return 0;
+  };
+  std::string DOT;
+  ASSERT_EQ(::saq_bartleby_write_dependency_graph(bh, SAQ_BARTLEBY_GRAPH_DOT,
+                                                  Append, &DOT),
+            0);
+  EXPECT_TRUE(llvm::StringRef(DOT).contains("n0 -> n1"));
+  EXPECT_EQ(::saq_bartleby_write_dependency_graph(bh, 42, Append, &DOT),
+            EINVAL);
+
+  ::saq_bartleby_free(bh);
+}
+
 /// \brief Test the C API with invalid inputs.
 TEST(BartlebyCAPI, CAPI_Invalid_Input) {
   auto *bh = ::saq_bartleby_new();
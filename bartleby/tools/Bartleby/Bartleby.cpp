@@ -20,13 +20,27 @@
 
 #include "Bartleby/Bartleby.h"
 
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/WithColor.h"
 
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+
 namespace bartleby = saq::bartleby;
 
 namespace {
@@ -43,122 +57,969 @@ llvm::cl::list<std::string> InputFileNames(llvm::cl::Positional,
 llvm::cl::opt<std::string>
     Prefix("prefix",
            llvm::cl::desc("Prefix to set to global and defined symbols"),
-           llvm::cl::value_desc("prefix"), llvm::cl::cat(Cat));
+           llvm::cl::value_desc("prefix"), llvm::cl::init(""),
+           llvm::cl::cat(Cat));
+
+/// \brief Renames symbols into short hashed names instead of prefixing them.
+llvm::cl::opt<bool> HashNames(
+    "hash-names",
+    llvm::cl::desc("Rename symbols into the prefix followed by a short hash "
+                   "of their name, instead of prefixing them"),
+    llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief File to write the map of the renamed symbols to.
+llvm::cl::opt<std::string> RenameMapFile(
+    "rename-map-file",
+    llvm::cl::desc("Write the new and original names of the renamed symbols "
+                   "to a file"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Format of a rename map.
+enum class RenameMapFormat : uint8_t {
+  /// \brief One tab-separated line per symbol.
+  Text = 0,
+
+  /// \brief Binary format of \p bartleby::RenameMap.
+  Binary,
+};
+
+/// \brief Format of the rename map.
+llvm::cl::opt<RenameMapFormat> RenameMapFormatOpt(
+    "rename-map-format", llvm::cl::desc("Format of the rename map"),
+    llvm::cl::values(clEnumValN(RenameMapFormat::Text, "text",
+                                "Tab-separated new and original names"),
+                     clEnumValN(RenameMapFormat::Binary, "binary",
+                                "Sorted binary map, for bartleby-symbolize")),
+    llvm::cl::init(RenameMapFormat::Text), llvm::cl::cat(Cat));
 
 /// \brief Output file.
-llvm::cl::opt<std::string> OutputFileName(llvm::cl::Required, "o",
-                                          llvm::cl::desc("Output filename"),
-                                          llvm::cl::value_desc("filename"),
-                                          llvm::cl::cat(Cat));
+///
+/// It is required unless \p BatchFile is given, which is checked by hand.
+llvm::cl::opt<std::string>
+    OutputFileName("o", llvm::cl::desc("Output filename"),
+                   llvm::cl::value_desc("filename"), llvm::cl::init(""),
+                   llvm::cl::cat(Cat));
 
 /// \brief Displays the list of symbols.
-llvm::cl::opt<bool> DisplaySymbolList("display-symbols",
-                                      llvm::cl::desc("Display list of symbols"),
-                                      llvm::cl::cat(Cat));
+llvm::cl::opt<bool>
+    DisplaySymbolList("display-symbols",
+                      llvm::cl::desc("Display list of symbols"),
+                      llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Number of threads to use for reading and rewriting objects.
+llvm::cl::opt<unsigned>
+    Threads("threads",
+            llvm::cl::desc("Number of threads to use for reading and "
+                           "rewriting objects (0 uses all available threads)"),
+            llvm::cl::value_desc("N"), llvm::cl::init(1), llvm::cl::cat(Cat));
+
+/// \brief Alias for \p Threads.
+llvm::cl::alias ThreadsAlias("j", llvm::cl::desc("Alias for --threads"),
+                             llvm::cl::aliasopt(Threads), llvm::cl::cat(Cat));
+
+/// \brief Renames symbols of ELF objects without going through objcopy.
+llvm::cl::opt<bool> FastRename(
+    "fast-rename",
+    llvm::cl::desc("Rename symbols of ELF objects by rewriting their string "
+                   "table only, falling back to objcopy when not supported"),
+    llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Writes rewritten objects to temporary files instead of keeping them
+/// in memory.
+llvm::cl::opt<bool> StreamMembers(
+    "stream-members",
+    llvm::cl::desc("Write rewritten objects to temporary files as soon as "
+                   "they are produced, to bound memory usage"),
+    llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Memory budget, with an optional K, M or G suffix.
+llvm::cl::opt<std::string> MaxMemory(
+    "max-memory",
+    llvm::cl::desc("Approximate memory budget (e.g. 512M or 4G): parsed "
+                   "archive members are released after symbol collection, "
+                   "rewritten objects are written to temporary files and "
+                   "parallelism is throttled to stay within the budget"),
+    llvm::cl::value_desc("size"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief How identical input members are handled.
+llvm::cl::opt<bartleby::DuplicateMembers> DuplicateMembersMode(
+    "duplicate-members",
+    llvm::cl::desc("How input members identical to a previous one are "
+                   "handled"),
+    llvm::cl::values(
+        clEnumValN(bartleby::DuplicateMembers::Keep, "keep",
+                   "Process and emit every copy"),
+        clEnumValN(bartleby::DuplicateMembers::Share, "share",
+                   "Process once, emit every copy"),
+        clEnumValN(bartleby::DuplicateMembers::Collapse, "collapse",
+                   "Process and emit once")),
+    llvm::cl::init(bartleby::DuplicateMembers::Keep), llvm::cl::cat(Cat));
+
+/// \brief File to write the list of duplicate input members to.
+llvm::cl::opt<std::string> DuplicatesReportFile(
+    "duplicates-report",
+    llvm::cl::desc("Write the input members found identical to a previous "
+                   "one to a file, with --duplicate-members"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Directory for temporary files.
+llvm::cl::opt<std::string>
+    TemporaryDirectory("temp-dir",
+                       llvm::cl::desc("Directory for temporary files"),
+                       llvm::cl::value_desc("directory"), llvm::cl::init(""),
+                       llvm::cl::cat(Cat));
+
+/// \brief Directory of the rewrite cache.
+llvm::cl::opt<std::string> CacheDirectory(
+    "cache-dir",
+    llvm::cl::desc("Directory where rewritten objects are cached across runs"),
+    llvm::cl::value_desc("directory"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Pruning policy of the rewrite cache.
+llvm::cl::opt<std::string> CachePolicy(
+    "cache-policy",
+    llvm::cl::desc("Pruning policy of the rewrite cache, e.g. "
+                   "'prune_after=24h:cache_size_bytes=1g'"),
+    llvm::cl::value_desc("policy"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Only rewrites the objects that changed since the previous build.
+llvm::cl::opt<bool> Incremental(
+    "incremental",
+    llvm::cl::desc("Reuse the members of the previous output whose objects "
+                   "and renames did not change, using a manifest stored "
+                   "next to the output"),
+    llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Produces a thin archive.
+llvm::cl::opt<bool>
+    Thin("thin",
+         llvm::cl::desc("Write rewritten objects to their own file and "
+                        "produce a thin archive referencing them"),
+         llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Directory of the members of a thin archive.
+llvm::cl::opt<std::string> ThinMembersDirectory(
+    "thin-members-dir",
+    llvm::cl::desc("Directory where the members of a thin archive are "
+                   "written (defaults to <output>.members)"),
+    llvm::cl::value_desc("directory"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Root symbols, from which unreachable members are pruned.
+llvm::cl::list<std::string>
+    Roots("roots",
+          llvm::cl::desc("Only keep the members reachable from these "
+                         "symbols (comma separated)"),
+          llvm::cl::value_desc("symbols"), llvm::cl::CommaSeparated,
+          llvm::cl::cat(Cat));
+
+/// \brief File listing root symbols, one per line.
+llvm::cl::opt<std::string> ExportsFile(
+    "exports-file",
+    llvm::cl::desc("Only keep the members reachable from the symbols listed "
+                   "in this file, one per line"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Rename policy file.
+llvm::cl::opt<std::string> RenamePolicyFile(
+    "rename-policy",
+    llvm::cl::desc("Select the symbols to prefix using a policy file of "
+                   "keep/rename rules"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief File to write the dependency graph of the members to.
+llvm::cl::opt<std::string> GraphFile(
+    "graph-file",
+    llvm::cl::desc("Write the dependency graph of the members to a file"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Format of the dependency graph.
+llvm::cl::opt<bartleby::GraphFormat> GraphFormat(
+    "graph-format", llvm::cl::desc("Format of the dependency graph"),
+    llvm::cl::values(
+        clEnumValN(bartleby::GraphFormat::Binary, "binary", "Compact binary"),
+        clEnumValN(bartleby::GraphFormat::DOT, "dot", "Graphviz DOT"),
+        clEnumValN(bartleby::GraphFormat::JSON, "json", "JSON")),
+    llvm::cl::init(bartleby::GraphFormat::DOT), llvm::cl::cat(Cat));
+
+/// \brief Prints timings and counters of each phase.
+llvm::cl::opt<bool>
+    TimeReport("time-report",
+               llvm::cl::desc("Print timings and counters of each phase"),
+               llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Writes timings and counters of each phase to a JSON file.
+llvm::cl::opt<std::string> StatsJSON(
+    "stats-json-file",
+    llvm::cl::desc("Write timings and counters of each phase to a JSON file"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Batch file, listing independent jobs to run in this process.
+llvm::cl::opt<std::string> BatchFile(
+    "batch",
+    llvm::cl::desc("Run the jobs listed in a JSON file, sharing the input "
+                   "files and the threads between them"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""), llvm::cl::cat(Cat));
+
+/// \brief Bound of the input files kept in memory across jobs or requests.
+llvm::cl::opt<std::string> InputCacheSize(
+    "input-cache-size",
+    llvm::cl::desc("Maximum total size of the input files kept in memory "
+                   "across the jobs of a batch or the requests of a "
+                   "persistent worker (e.g. 512M or 4G), or 0 for no limit"),
+    llvm::cl::value_desc("size"), llvm::cl::init("2G"), llvm::cl::cat(Cat));
+
+/// \brief File to write the results of the jobs of a batch to.
+llvm::cl::opt<std::string> BatchResultFile(
+    "batch-result-file",
+    llvm::cl::desc("Write the status and timings of each job of a batch to "
+                   "a JSON file (defaults to stdout)"),
+    llvm::cl::value_desc("filename"), llvm::cl::init("-"), llvm::cl::cat(Cat));
 
 /// \brief Tool name;
 constexpr llvm::StringRef ToolName = "bartleby";
 
+/// \brief Overview of the tool.
+constexpr llvm::StringRef Overview =
+    "Combine and optionally prefix libraries and objects";
+
+/// \brief Flag given by Bazel to start a persistent worker.
+constexpr llvm::StringRef PersistentWorkerFlag = "--persistent_worker";
+
+/// \brief Options of \p llvm::cl which print something and exit the process.
+constexpr llvm::StringRef ExitingOptions[] = {
+    "h", "help", "help-hidden", "help-list", "help-list-hidden", "version",
+};
+
+/// \brief Finds an option which would exit the process once parsed.
+///
+/// Such options cannot be given to a job of a batch or to a work request,
+/// which run in a process shared with other ones.
+///
+/// \param Argv Arguments, including the program name.
+///
+/// \returns The option, or nullopt if there is none.
+[[nodiscard]] std::optional<llvm::StringRef>
+findExitingOption(llvm::ArrayRef<const char *> Argv) noexcept {
+  for (const llvm::StringRef Arg : Argv.drop_front()) {
+    if (Arg == "--") {
+      break;
+    }
+    if ((Arg.size() < 2) || (Arg.front() != '-')) {
+      continue;
+    }
+    const auto Name =
+        Arg.drop_while([](const char C) { return C == '-'; }).split('=').first;
+    if (llvm::is_contained(ExitingOptions, Name)) {
+      return Arg;
+    }
+  }
+  return std::nullopt;
+}
+
 /// \brief Reports an error by displaying a message.
 ///
+/// \param OS Output stream.
 /// \param Message Message to display as an error string.
-[[noreturn]] void reportError(llvm::Twine Message) noexcept {
-  llvm::WithColor::error(llvm::errs(), ToolName) << Message << '\n';
-  llvm::errs().flush();
-  std::exit(EXIT_FAILURE);
+///
+/// \returns The exit code.
+int reportError(llvm::raw_ostream &OS, llvm::Twine Message) noexcept {
+  llvm::WithColor::error(OS, ToolName) << Message << '\n';
+  OS.flush();
+  return EXIT_FAILURE;
 }
 
 /// \brief Reports an error by extracting the message from a \p llvm::Error.
 ///
+/// \param OS Output stream.
 /// \param E The error to report.
-[[noreturn]] void reportError(llvm::Error E) noexcept {
+///
+/// \returns The exit code.
+int reportError(llvm::raw_ostream &OS, llvm::Error E) noexcept {
   assert(E);
   std::string Buf;
-  llvm::raw_string_ostream OS(Buf);
-  llvm::logAllUnhandledErrors(std::move(E), OS);
-  OS.flush();
-  reportError(Buf);
+  llvm::raw_string_ostream BufOS(Buf);
+  llvm::logAllUnhandledErrors(std::move(E), BufOS);
+  BufOS.flush();
+  return reportError(OS, Buf);
 }
 
 /// \brief Reports an error related to a certain file manipulation.
 ///
+/// \param OS Output stream.
 /// \param Filepath The file involved in the error.
 /// \param E The error to report.
-[[noreturn]] void reportError(llvm::StringRef Filepath, llvm::Error E) {
+///
+/// \returns The exit code.
+int reportError(llvm::raw_ostream &OS, llvm::StringRef Filepath,
+                llvm::Error E) {
   assert(E);
   std::string Buf;
-  llvm::raw_string_ostream OS(Buf);
-  llvm::logAllUnhandledErrors(std::move(E), OS);
+  llvm::raw_string_ostream BufOS(Buf);
+  llvm::logAllUnhandledErrors(std::move(E), BufOS);
+  BufOS.flush();
+  llvm::WithColor::error(OS, ToolName) << "'" << Filepath << "': " << Buf;
   OS.flush();
-  llvm::WithColor::error(llvm::errs(), ToolName)
-      << "'" << Filepath << "': " << Buf;
-  std::exit(EXIT_FAILURE);
+  return EXIT_FAILURE;
+}
+
+/// \brief Parses a size such as \p 512M or \p 4G.
+///
+/// \param Value Size, in bytes unless it ends with K, M or G.
+///
+/// \returns The size in bytes, or nullopt if \p Value is malformed.
+[[nodiscard]] std::optional<uint64_t>
+parseSize(llvm::StringRef Value) noexcept {
+  unsigned Shift = 0;
+  if (!Value.empty()) {
+    switch (llvm::toUpper(Value.back())) {
+    case 'K':
+      Shift = 10;
+      break;
+    case 'M':
+      Shift = 20;
+      break;
+    case 'G':
+      Shift = 30;
+      break;
+    default:
+      break;
+    }
+  }
+  if (Shift != 0) {
+    Value = Value.drop_back();
+  }
+  uint64_t Size;
+  if (Value.getAsInteger(10, Size) || (Size == 0) ||
+      (Size > (UINT64_MAX >> Shift))) {
+    return std::nullopt;
+  }
+  return Size << Shift;
 }
 
 /// \brief Collects all input files.
 ///
+/// \param Stats Statistics to attach to the handle. Can be null.
+/// \param Cache Input cache to open the files through. Can be null.
+/// \param Pool Thread pool to run the tasks on. Can be null.
+/// \param MemoryBudget Memory budget in bytes, or 0 for no budget.
+/// \param Digests Digests of the input files, by path, if known.
+/// \param OS Output stream for errors.
+///
 /// \returns The bartleby handle, or nullopt if an error occurred.
-[[nodiscard]] bartleby::Bartleby CollectObjects() noexcept {
+[[nodiscard]] std::optional<bartleby::Bartleby>
+CollectObjects(bartleby::Statistics *Stats, bartleby::InputCache *Cache,
+               llvm::ThreadPool *Pool, const uint64_t MemoryBudget,
+               const llvm::StringMap<std::string> &Digests,
+               llvm::raw_ostream &OS) noexcept {
   bartleby::Bartleby B;
+  B.setStatistics(Stats);
+  B.setInputCache(Cache);
+  B.setThreadPool(Pool);
+  B.setMemoryBudget(MemoryBudget);
+  B.setDuplicateMembers(DuplicateMembersMode);
 
+  llvm::SmallVector<llvm::object::OwningBinary<llvm::object::Binary>, 16>
+      Binaries;
   for (const auto &InputFile : InputFileNames) {
-    if (auto OwnedBinary = llvm::object::createBinary(InputFile);
-        !OwnedBinary) {
-      reportError(InputFile, OwnedBinary.takeError());
-    } else if (auto Err = B.addBinary(std::move(*OwnedBinary))) {
-      reportError(InputFile, std::move(Err));
+    auto OwnedBinary =
+        (Cache != nullptr)
+            ? Cache->openBinary(InputFile, Digests.lookup(InputFile))
+            : bartleby::Bartleby::openBinary(InputFile);
+    if (!OwnedBinary) {
+      reportError(OS, InputFile, OwnedBinary.takeError());
+      return std::nullopt;
     }
+    Binaries.push_back(std::move(*OwnedBinary));
+  }
+
+  if (auto Err = B.addBinaries(Binaries, Threads)) {
+    reportError(OS, std::move(Err));
+    return std::nullopt;
   }
 
   return B;
 }
 
+/// \brief Writes the input members found identical to a previous one.
+///
+/// Each duplicate is written on its own line, as the member, the member it
+/// is identical to and its size in bytes, separated by tabs. Members are
+/// written as \p input(name).
+///
+/// \param B Bartleby handle.
+/// \param OS Output stream.
+void writeDuplicatesReport(const bartleby::Bartleby &B,
+                           llvm::raw_ostream &OS) noexcept {
+  for (const auto &Dup : B.getDuplicates()) {
+    OS << Dup.Input << '(' << Dup.Name << ")\t" << Dup.OriginalInput << '('
+       << Dup.OriginalName << ")\t" << Dup.Size << '\n';
+  }
+}
+
 /// \brief Displays the symbols previously collected.
 ///
 /// \param B Bartleby handle.
-void displaySymbols(const bartleby::Bartleby &B) noexcept {
+/// \param OS Output stream.
+void displaySymbols(const bartleby::Bartleby &B,
+                    llvm::raw_ostream &OS) noexcept {
   const auto End = B.getSymbols().end();
   for (auto Entry = B.getSymbols().begin(); Entry != End; ++Entry) {
     const auto &Name = Entry->first();
     const auto &Sym = Entry->getValue();
     const auto Defined = Sym.isDefined();
     const auto Global = Sym.isGlobal();
-    llvm::outs() << "Symbol " << Name << " is "
-                 << (Defined ? "defined" : "undefined") << " and "
-                 << (Global ? "global" : "local");
+    OS << "Symbol " << Name << " is " << (Defined ? "defined" : "undefined")
+       << " and " << (Global ? "global" : "local");
 
-    if (Defined && Global && !Prefix.empty()) {
-      llvm::outs() << " (to be prefixed by " << Prefix << ')';
+    if (HashNames && Sym.isRenamed()) {
+      llvm::SmallString<64> Storage;
+      OS << " (to be renamed to " << *Sym.getNewName(Name, Storage) << ')';
+    } else if (Sym.isRenamed()) {
+      OS << " (to be prefixed by " << Prefix << ')';
     } else {
-      llvm::outs() << " (left unchanged)";
+      OS << " (left unchanged)";
     }
-    llvm::outs() << '\n';
+    OS << '\n';
   }
 }
 
-} // end anonymous namespace
+/// \brief Collects the root symbols given by \p Roots and \p ExportsFile.
+///
+/// Empty lines and lines starting with \p # in the exports file are ignored.
+///
+/// \param Saver Saver owning the names read from the exports file.
+/// \param[out] Names Where to store the names of the root symbols.
+///
+/// \returns An error.
+[[nodiscard]] llvm::Error
+collectRoots(llvm::StringSaver &Saver,
+             llvm::SmallVectorImpl<llvm::StringRef> &Names) noexcept {
+  for (const auto &Root : Roots) {
+    Names.push_back(Root);
+  }
+  if (ExportsFile.empty()) {
+    return llvm::Error::success();
+  }
 
-int main(int argc, char **argv) {
-  llvm::cl::HideUnrelatedOptions(Cat);
-  llvm::cl::ParseCommandLineOptions(
-      argc, argv, "Combine and optionally prefix libraries and objects");
+  auto BufOrErr = llvm::MemoryBuffer::getFile(ExportsFile, /*IsText=*/true);
+  if (!BufOrErr) {
+    return llvm::createFileError(ExportsFile, BufOrErr.getError());
+  }
+  llvm::SmallVector<llvm::StringRef, 64> Lines;
+  (*BufOrErr)->getBuffer().split(Lines, '\n', /*MaxSplit=*/-1,
+                                 /*KeepEmpty=*/false);
+  for (auto Line : Lines) {
+    Line = Line.trim();
+    if (!Line.empty() && (Line.front() != '#')) {
+      Names.push_back(Saver.save(Line));
+    }
+  }
+  return llvm::Error::success();
+}
+
+/// \brief Runs bartleby using the options parsed from the command line.
+///
+/// \param Cache Input cache to open the files through. Can be null.
+/// \param Pool Thread pool to run the tasks on. Can be null.
+/// \param Digests Digests of the input files, by path, if known.
+/// \param OS Output stream for messages.
+/// \param ErrOS Output stream for errors and reports.
+/// \param[out] RunStats Where to record statistics. If null, they are only
+/// recorded if an option needs them.
+///
+/// \returns The exit code.
+int run(bartleby::InputCache *Cache, llvm::ThreadPool *Pool,
+        const llvm::StringMap<std::string> &Digests, llvm::raw_ostream &OS,
+        llvm::raw_ostream &ErrOS,
+        bartleby::Statistics *RunStats = nullptr) noexcept {
+  if (OutputFileName.empty()) {
+    return reportError(ErrOS, "no output file, use -o");
+  }
+
+  bartleby::Statistics LocalStats;
+  auto &Stats = (RunStats != nullptr) ? *RunStats : LocalStats;
+  const bool CollectStats = (RunStats != nullptr) || TimeReport ||
+                            !StatsJSON.empty() || !CacheDirectory.empty() ||
+                            Incremental;
+
+  uint64_t MemoryBudget = 0;
+  if (!MaxMemory.empty()) {
+    const auto Size = parseSize(MaxMemory);
+    if (!Size) {
+      return reportError(ErrOS, "invalid memory budget '" + MaxMemory + "'");
+    }
+    MemoryBudget = *Size;
+  }
 
-  auto B = CollectObjects();
+  auto B = CollectObjects(CollectStats ? &Stats : nullptr, Cache, Pool,
+                          MemoryBudget, Digests, ErrOS);
+  if (!B) {
+    return EXIT_FAILURE;
+  }
+
+  if (DuplicateMembersMode != bartleby::DuplicateMembers::Keep) {
+    OS << B->getDuplicates().size() << " duplicate member(s) "
+       << ((DuplicateMembersMode == bartleby::DuplicateMembers::Collapse)
+               ? "collapsed"
+               : "shared")
+       << '\n';
+    if (!DuplicatesReportFile.empty()) {
+      std::error_code EC;
+      llvm::raw_fd_ostream ReportOS(DuplicatesReportFile, EC);
+      if (EC) {
+        return reportError(ErrOS, DuplicatesReportFile,
+                           llvm::errorCodeToError(EC));
+      }
+      writeDuplicatesReport(*B, ReportOS);
+    }
+  }
+
+  if (!Roots.empty() || !ExportsFile.empty()) {
+    llvm::BumpPtrAllocator Alloc;
+    llvm::StringSaver Saver(Alloc);
+    llvm::SmallVector<llvm::StringRef, 64> Names;
+    if (auto Err = collectRoots(Saver, Names)) {
+      return reportError(ErrOS, std::move(Err));
+    }
+    for (const auto Name : Names) {
+      if (!B->getSymbols().getID(Name)) {
+        llvm::WithColor::warning(ErrOS, ToolName)
+            << "root symbol '" << Name << "' not found\n";
+      }
+    }
+    const auto N = B->pruneUnreachableObjects(Names);
+    OS << N << " member(s) pruned\n";
+    if (B->getNumObjects() == 0) {
+      return reportError(ErrOS, "no member is reachable from the roots");
+    }
+  }
+
+  if (HashNames && Prefix.empty()) {
+    return reportError(ErrOS, "--hash-names requires --prefix");
+  }
+  if (!RenamePolicyFile.empty()) {
+    if (Prefix.empty()) {
+      return reportError(ErrOS, "--rename-policy requires --prefix");
+    }
+    auto PolicyOrErr = bartleby::RenamePolicy::load(RenamePolicyFile);
+    if (!PolicyOrErr) {
+      return reportError(ErrOS, PolicyOrErr.takeError());
+    }
+    const auto Style = HashNames ? bartleby::RenameStyle::Hash
+                                 : bartleby::RenameStyle::Prefix;
+    const auto N = B->applyRenamePolicy(*PolicyOrErr, Prefix, Threads, Style);
+    OS << N << " symbol(s) " << (HashNames ? "renamed" : "prefixed") << '\n';
+  } else if (HashNames) {
+    const auto N = B->hashGlobalAndDefinedSymbols(Prefix);
+    OS << N << " symbol(s) renamed\n";
+  } else if (!Prefix.empty()) {
+    const auto N = B->prefixGlobalAndDefinedSymbols(Prefix);
+    OS << N << " symbol(s) prefixed\n";
+  }
 
-  if (!Prefix.empty()) {
-    const auto N = B.prefixGlobalAndDefinedSymbols(Prefix);
-    llvm::outs() << N << " symbol(s) prefixed\n";
+  if (!RenameMapFile.empty()) {
+    std::error_code EC;
+    llvm::raw_fd_ostream MapOS(RenameMapFile, EC);
+    if (EC) {
+      return reportError(ErrOS, RenameMapFile, llvm::errorCodeToError(EC));
+    }
+    if (RenameMapFormatOpt == RenameMapFormat::Binary) {
+      if (auto Err = B->writeBinaryRenameMap(MapOS)) {
+        return reportError(ErrOS, RenameMapFile, std::move(Err));
+      }
+    } else {
+      B->writeRenameMap(MapOS);
+    }
   }
 
   if (DisplaySymbolList) {
-    displaySymbols(B);
+    displaySymbols(*B, OS);
   }
 
-  if (auto Err =
-          bartleby::Bartleby::buildFinalArchive(std::move(B), OutputFileName)) {
-    reportError(std::move(Err));
+  if (!GraphFile.empty()) {
+    std::error_code EC;
+    llvm::raw_fd_ostream GraphOS(GraphFile, EC);
+    if (EC) {
+      return reportError(ErrOS, GraphFile, llvm::errorCodeToError(EC));
+    }
+    B->writeDependencyGraph(GraphOS, GraphFormat);
+  }
+
+  bartleby::BuildOptions Options;
+  Options.Threads = Threads;
+  Options.FastRename = FastRename;
+  Options.StreamMembers = StreamMembers;
+  Options.TemporaryDirectory = TemporaryDirectory;
+  Options.CacheDirectory = CacheDirectory;
+  Options.CachePolicy = CachePolicy;
+  Options.Stats = CollectStats ? &Stats : nullptr;
+  if (Incremental) {
+    Options.ManifestPath = OutputFileName + ".bartleby-manifest.json";
+  }
+  if (Thin) {
+    Options.ThinMembersDirectory = ThinMembersDirectory.empty()
+                                       ? OutputFileName + ".members"
+                                       : std::string(ThinMembersDirectory);
+  }
+
+  if (auto Err = bartleby::Bartleby::buildFinalArchive(
+          std::move(*B), OutputFileName, Options)) {
+    return reportError(ErrOS, std::move(Err));
+  }
+  if (!CacheDirectory.empty()) {
+    OS << "rewrite cache: " << Stats.getCacheHits() << " hit(s), "
+       << Stats.getCacheMisses() << " miss(es)\n";
+  }
+  if (Incremental) {
+    OS << Stats.getReusedMembers()
+       << " member(s) reused from the previous build\n";
+  }
+  if (CollectStats) {
+    OS << Stats.getPassthroughMembers() << " member(s) copied verbatim\n";
+  }
+  OS << OutputFileName << " produced.\n";
+
+  if (TimeReport) {
+    Stats.printReport(ErrOS);
+  }
+
+  if (!StatsJSON.empty()) {
+    std::error_code EC;
+    llvm::raw_fd_ostream JSONOS(StatsJSON, EC);
+    if (EC) {
+      return reportError(ErrOS, StatsJSON, llvm::errorCodeToError(EC));
+    }
+    JSONOS << llvm::formatv("{0:2}", Stats.toJSON()) << '\n';
   }
-  llvm::outs() << OutputFileName << " produced.\n";
 
   return EXIT_SUCCESS;
 }
+
+/// \brief Runs a work request of the Bazel JSON worker protocol.
+///
+/// Arguments starting with `@` are parameter files, expanded as
+/// \p llvm::cl::ParseCommandLineOptions does on the command line. Options are
+/// reset to their initial value before being parsed, which is why each of
+/// them has an explicit initial value. Options which would print something
+/// and exit, such as `--help`, are rejected. Once the request has run, the
+/// input cache is pruned down to \p --input-cache-size.
+///
+/// \param Request The work request.
+/// \param Cache Input cache shared by all the work requests.
+/// \param OS Output stream for messages and errors.
+///
+/// \returns The exit code.
+int runWorkRequest(const llvm::json::Object &Request,
+                   bartleby::InputCache &Cache,
+                   llvm::raw_ostream &OS) noexcept {
+  llvm::BumpPtrAllocator Alloc;
+  llvm::StringSaver Saver(Alloc);
+  llvm::SmallVector<const char *, 32> Argv{ToolName.data()};
+
+  if (const auto *Arguments = Request.getArray("arguments")) {
+    for (const auto &Argument : *Arguments) {
+      const auto Arg = Argument.getAsString();
+      if (!Arg) {
+        return reportError(OS, "malformed work request: expected a string");
+      }
+      Argv.push_back(Saver.save(*Arg).data());
+    }
+  }
+#ifdef _WIN32
+  const auto Tokenizer = llvm::cl::TokenizeWindowsCommandLine;
+#else
+  const auto Tokenizer = llvm::cl::TokenizeGNUCommandLine;
+#endif
+  if (!llvm::cl::ExpandResponseFiles(Saver, Tokenizer, Argv)) {
+    return reportError(OS, "cannot read a parameter file");
+  }
+  if (const auto Option = findExitingOption(Argv)) {
+    return reportError(OS, "'" + *Option +
+                               "' cannot be used in a work request");
+  }
+
+  llvm::StringMap<std::string> Digests;
+  if (const auto *Inputs = Request.getArray("inputs")) {
+    for (const auto &Input : *Inputs) {
+      const auto *Obj = Input.getAsObject();
+      if (Obj == nullptr) {
+        continue;
+      }
+      const auto Path = Obj->getString("path");
+      const auto Digest = Obj->getString("digest");
+      if (Path && Digest) {
+        Digests[*Path] = Digest->str();
+      }
+    }
+  }
+
+  llvm::cl::ResetAllOptionOccurrences();
+  if (!llvm::cl::ParseCommandLineOptions(static_cast<int>(Argv.size()),
+                                         Argv.data(), Overview, &OS)) {
+    OS.flush();
+    return EXIT_FAILURE;
+  }
+  const auto MaxCacheSize = parseSize(InputCacheSize);
+  if (!MaxCacheSize) {
+    return reportError(OS, "invalid input cache size '" + InputCacheSize +
+                               "'");
+  }
+  Cache.setMaxSize(*MaxCacheSize);
+  const int ExitCode = run(&Cache, /*Pool=*/nullptr, Digests, OS, OS);
+  Cache.prune();
+  return ExitCode;
+}
+
+/// \brief Runs a Bazel persistent worker, using the JSON worker protocol.
+///
+/// Work requests are read from the standard input, one per line, and work
+/// responses are written to the standard output. Input binaries and their
+/// symbols are kept in memory across requests, keyed by the digests given by
+/// Bazel, within the bound given by \p --input-cache-size.
+///
+/// \returns The exit code.
+int runPersistentWorker() noexcept {
+  bartleby::InputCache Cache;
+  std::string Line;
+  while (std::getline(std::cin, Line)) {
+    if (Line.empty()) {
+      continue;
+    }
+
+    std::string Output;
+    llvm::raw_string_ostream OS(Output);
+    int ExitCode = EXIT_FAILURE;
+    int64_t RequestID = 0;
+    if (auto RequestOrErr = llvm::json::parse(Line); !RequestOrErr) {
+      ExitCode = reportError(OS, RequestOrErr.takeError());
+    } else if (const auto *Request = RequestOrErr->getAsObject();
+               Request == nullptr) {
+      ExitCode = reportError(OS, "malformed work request");
+    } else {
+      if (const auto ID = Request->getInteger("requestId")) {
+        RequestID = *ID;
+      }
+      ExitCode = runWorkRequest(*Request, Cache, OS);
+    }
+    OS.flush();
+
+    if (!llvm::json::isUTF8(Output)) {
+      Output = llvm::json::fixUTF8(Output);
+    }
+    llvm::outs() << llvm::json::Value(llvm::json::Object{
+                        {"exitCode", ExitCode},
+                        {"output", std::move(Output)},
+                        {"requestId", RequestID},
+                    })
+                 << '\n';
+    llvm::outs().flush();
+  }
+  return EXIT_SUCCESS;
+}
+
+/// \brief Runs a job of a batch.
+///
+/// The job is turned into the arguments of an equivalent command line, which
+/// are parsed after resetting the options to their initial value.
+///
+/// \param Job The job.
+/// \param DefaultThreads Number of threads of the job, unless it sets its
+/// own.
+/// \param Cache Input cache shared by all the jobs.
+/// \param Pool Thread pool shared by all the jobs.
+/// \param OS Output stream for messages and errors.
+/// \param[out] Stats Where to record the statistics of the job.
+///
+/// \returns The exit code.
+int runBatchJob(const llvm::json::Object &Job, const unsigned DefaultThreads,
+                bartleby::InputCache &Cache, llvm::ThreadPool &Pool,
+                llvm::raw_ostream &OS, bartleby::Statistics &Stats) noexcept {
+  llvm::BumpPtrAllocator Alloc;
+  llvm::StringSaver Saver(Alloc);
+  llvm::SmallVector<const char *, 32> Argv{ToolName.data()};
+
+  const auto Output = Job.getString("output");
+  if (!Output) {
+    return reportError(OS, "malformed job: expected an 'output' string");
+  }
+  Argv.push_back("-o");
+  Argv.push_back(Saver.save(*Output).data());
+  if (const auto Prefix = Job.getString("prefix")) {
+    Argv.push_back(Saver.save("--prefix=" + *Prefix).data());
+  }
+  const auto JobThreads = Job.getInteger("threads");
+  const int64_t NumThreads = JobThreads ? *JobThreads : DefaultThreads;
+  Argv.push_back(Saver.save("--threads=" + llvm::Twine(NumThreads)).data());
+
+  for (const auto *Key : {"arguments", "inputs"}) {
+    const auto *Array = Job.getArray(Key);
+    if (Array == nullptr) {
+      continue;
+    }
+    for (const auto &Value : *Array) {
+      const auto Str = Value.getAsString();
+      if (!Str) {
+        return reportError(OS, llvm::Twine("malformed job: expected strings "
+                                           "in '") +
+                                   Key + "'");
+      }
+      Argv.push_back(Saver.save(*Str).data());
+    }
+  }
+
+  if (const auto Option = findExitingOption(Argv)) {
+    return reportError(OS, "'" + *Option + "' cannot be used in a job");
+  }
+
+  llvm::cl::ResetAllOptionOccurrences();
+  if (!llvm::cl::ParseCommandLineOptions(static_cast<int>(Argv.size()),
+                                         Argv.data(), Overview, &OS)) {
+    OS.flush();
+    return EXIT_FAILURE;
+  }
+  if (!BatchFile.empty()) {
+    return reportError(OS, "a job cannot run a batch");
+  }
+  return run(&Cache, &Pool, /*Digests=*/{}, OS, OS, &Stats);
+}
+
+/// \brief Runs the jobs of a batch file, one after the other.
+///
+/// A batch file is a JSON object holding an array of jobs, \p jobs. Each job
+/// is an object with the following members:
+///  - \p name: name of the job, reported in the results;
+///  - \p inputs: array of input files;
+///  - \p output: output file;
+///  - \p prefix: prefix, optional;
+///  - \p threads: number of threads, optional, defaults to \p --threads;
+///  - \p arguments: array of other options, optional.
+///
+/// Input files are opened through a cache shared by all the jobs, keyed by a
+/// digest of their content, so that the inputs shared by several jobs are
+/// only scanned once. The cache is pruned down to \p --input-cache-size
+/// after each job. Tasks of all the jobs run on a single thread pool.
+///
+/// The results are written to \p BatchResultFile, as a JSON object holding
+/// an array of results, \p jobs, each with the name of the job, its exit
+/// code, its wall time, its output and its statistics, followed by the
+/// number of failed jobs and the total wall time.
+///
+/// \returns The exit code: failure if a job failed.
+int runBatch() noexcept {
+  using Clock = std::chrono::steady_clock;
+  const auto Start = Clock::now();
+  const auto Elapsed = [](Clock::time_point From) {
+    return std::chrono::duration<double>(Clock::now() - From).count();
+  };
+
+  if (!OutputFileName.empty() || !InputFileNames.empty()) {
+    return reportError(llvm::errs(),
+                       "--batch cannot be used with input files or -o");
+  }
+
+  // Options are reset by each job, so the ones of the batch are saved first.
+  const std::string Path = BatchFile;
+  const std::string ResultPath = BatchResultFile;
+  const unsigned BatchThreads = Threads;
+  const auto MaxCacheSize = parseSize(InputCacheSize);
+  if (!MaxCacheSize) {
+    return reportError(llvm::errs(), "invalid input cache size '" +
+                                         InputCacheSize + "'");
+  }
+
+  auto BufOrErr = llvm::MemoryBuffer::getFile(Path, /*IsText=*/true);
+  if (!BufOrErr) {
+    return reportError(llvm::errs(), Path,
+                       llvm::errorCodeToError(BufOrErr.getError()));
+  }
+  auto BatchOrErr = llvm::json::parse((*BufOrErr)->getBuffer());
+  if (!BatchOrErr) {
+    return reportError(llvm::errs(), Path, BatchOrErr.takeError());
+  }
+  const auto *Batch = BatchOrErr->getAsObject();
+  const auto *Jobs = (Batch != nullptr) ? Batch->getArray("jobs") : nullptr;
+  if (Jobs == nullptr) {
+    return reportError(llvm::errs(), Path,
+                       llvm::make_error<llvm::StringError>(
+                           "expected an object with a 'jobs' array",
+                           llvm::inconvertibleErrorCode()));
+  }
+
+  bartleby::InputCache Cache;
+  Cache.setMaxSize(*MaxCacheSize);
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(BatchThreads));
+  llvm::json::Array Results;
+  int64_t Failures = 0;
+  for (size_t I = 0; I < Jobs->size(); ++I) {
+    const auto *Job = (*Jobs)[I].getAsObject();
+    std::string Name = ("#" + llvm::Twine(I)).str();
+    if (Job != nullptr) {
+      if (const auto JobName = Job->getString("name")) {
+        Name = JobName->str();
+      }
+    }
+
+    std::string Output;
+    llvm::raw_string_ostream OS(Output);
+    bartleby::Statistics Stats;
+    const auto JobStart = Clock::now();
+    const int ExitCode =
+        (Job != nullptr)
+            ? runBatchJob(*Job, BatchThreads, Cache, Pool, OS, Stats)
+            : reportError(OS, "malformed job: expected an object");
+    const auto Seconds = Elapsed(JobStart);
+    OS.flush();
+    Cache.prune();
+
+    if (ExitCode != EXIT_SUCCESS) {
+      ++Failures;
+    }
+    if (!llvm::json::isUTF8(Output)) {
+      Output = llvm::json::fixUTF8(Output);
+    }
+    Results.push_back(llvm::json::Object{
+        {"name", std::move(Name)},
+        {"exit_code", ExitCode},
+        {"seconds", Seconds},
+        {"output", std::move(Output)},
+        {"statistics", Stats.toJSON()},
+    });
+  }
+
+  llvm::json::Value Report = llvm::json::Object{
+      {"jobs", std::move(Results)},
+      {"failures", Failures},
+      {"seconds", Elapsed(Start)},
+      {"input_cache",
+       llvm::json::Object{
+           {"hits", static_cast<int64_t>(Cache.getHits())},
+           {"misses", static_cast<int64_t>(Cache.getMisses())},
+       }},
+  };
+  std::error_code EC;
+  llvm::raw_fd_ostream ResultOS(ResultPath, EC);
+  if (EC) {
+    return reportError(llvm::errs(), ResultPath, llvm::errorCodeToError(EC));
+  }
+  ResultOS << llvm::formatv("{0:2}", Report) << '\n';
+
+  return (Failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  llvm::cl::HideUnrelatedOptions(Cat);
+  for (int I = 1; I < argc; ++I) {
+    if (PersistentWorkerFlag == argv[I]) {
+      return runPersistentWorker();
+    }
+  }
+
+  llvm::cl::ParseCommandLineOptions(argc, argv, Overview);
+  if (!BatchFile.empty()) {
+    return runBatch();
+  }
+  return run(/*Cache=*/nullptr, /*Pool=*/nullptr, /*Digests=*/{}, llvm::outs(),
+             llvm::errs());
+}
@@ -0,0 +1,129 @@
+// Copyright 2023 SandboxAQ
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+///
+/// \file
+/// \brief bartleby-symbolize tool implementation.
+///
+/// \author thb-sb
+
+#include "Bartleby/RenameMap.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <iostream>
+#include <string>
+
+namespace bartleby = saq::bartleby;
+
+namespace {
+
+llvm::cl::OptionCategory Cat("bartleby-symbolize Options");
+
+/// \brief Input files.
+llvm::cl::list<std::string>
+    InputFileNames(llvm::cl::Positional,
+                   llvm::cl::desc("Files to symbolize, or - for the standard "
+                                  "input (the default)"),
+                   llvm::cl::value_desc("filename"), llvm::cl::cat(Cat));
+
+/// \brief Binary rename map.
+llvm::cl::opt<std::string>
+    MapFileName("map",
+                llvm::cl::desc("Binary rename map, as written by bartleby "
+                               "--rename-map-format=binary"),
+                llvm::cl::value_desc("filename"), llvm::cl::Required,
+                llvm::cl::cat(Cat));
+
+/// \brief Maps original names to new names instead.
+llvm::cl::opt<bool>
+    Reverse("reverse",
+            llvm::cl::desc("Replace original names by their new names, "
+                           "instead of new names by their original names"),
+            llvm::cl::init(false), llvm::cl::cat(Cat));
+
+/// \brief Overview of the tool.
+constexpr char Overview[] =
+    "Replace the names of symbols renamed by bartleby, in stack traces or "
+    "any other text";
+
+/// \brief Reports an error.
+///
+/// \param E The error to report.
+///
+/// \returns The exit code.
+int reportError(llvm::Error E) noexcept {
+  llvm::WithColor::error(llvm::errs(), "bartleby-symbolize")
+      << llvm::toString(std::move(E)) << '\n';
+  return EXIT_FAILURE;
+}
+
+/// \brief Symbolizes the standard input, line by line.
+///
+/// The output is flushed whenever no more input is readily available, so
+/// that the tool can be used on a live stream.
+///
+/// \param Map The rename map.
+/// \param D Direction of the lookups.
+void symbolizeStandardInput(const bartleby::RenameMap &Map,
+                            const bartleby::RenameMap::Direction D) noexcept {
+  auto &OS = llvm::outs();
+  std::string Line;
+  while (std::getline(std::cin, Line)) {
+    Map.symbolize(Line, D, OS);
+    if (!std::cin.eof()) {
+      OS << '\n';
+    }
+    if (std::cin.rdbuf()->in_avail() <= 0) {
+      OS.flush();
+    }
+  }
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  std::ios::sync_with_stdio(false);
+  llvm::cl::HideUnrelatedOptions(Cat);
+  llvm::cl::ParseCommandLineOptions(argc, argv, Overview);
+
+  auto MapOrErr = bartleby::RenameMap::load(MapFileName);
+  if (!MapOrErr) {
+    return reportError(MapOrErr.takeError());
+  }
+  const auto D = Reverse ? bartleby::RenameMap::Direction::ToRenamed
+                         : bartleby::RenameMap::Direction::ToOriginal;
+
+  if (InputFileNames.empty()) {
+    InputFileNames.push_back("-");
+  }
+  for (const auto &InputFile : InputFileNames) {
+    if (InputFile == "-") {
+      symbolizeStandardInput(*MapOrErr, D);
+      continue;
+    }
+    auto BufOrErr = llvm::MemoryBuffer::getFile(
+        InputFile, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!BufOrErr) {
+      return reportError(
+          llvm::createFileError(InputFile, BufOrErr.getError()));
+    }
+    MapOrErr->symbolize((*BufOrErr)->getBuffer(), D, llvm::outs());
+  }
+  return EXIT_SUCCESS;
+}
@@ -30,13 +30,72 @@ extern "C" {
         s: *const std::ffi::c_void,
         n: usize,
     ) -> std::ffi::c_int;
+    fn saq_bartleby_add_binary_borrowed(
+        bh: BartlebyHandleMutPtr,
+        s: *const std::ffi::c_void,
+        n: usize,
+    ) -> std::ffi::c_int;
     fn saq_bartleby_build_archive(
         bh: BartlebyHandleMutPtr,
         s: *mut *mut std::ffi::c_void,
         n: *mut usize,
     ) -> std::ffi::c_int;
+    fn saq_bartleby_build_archive_to_fd(
+        bh: BartlebyHandleMutPtr,
+        fd: std::ffi::c_int,
+    ) -> std::ffi::c_int;
+    fn saq_bartleby_build_archive_to_writer(
+        bh: BartlebyHandleMutPtr,
+        write: WriteFn,
+        ctx: *mut std::ffi::c_void,
+    ) -> std::ffi::c_int;
 }
 
+/// Callback receiving the content of an archive.
+type WriteFn = unsafe extern "C" fn(
+    ctx: *mut std::ffi::c_void,
+    s: *const std::ffi::c_void,
+    n: usize,
+) -> std::ffi::c_int;
+
+/// Context of [`write_trampoline`].
+struct WriteContext<'w, W: std::io::Write> {
+    /// The destination.
+    writer: &'w mut W,
+
+    /// The first error returned by `writer`.
+    error: Option<std::io::Error>,
+}
+
+/// Forwards the content of an archive to a [`std::io::Write`].
+unsafe extern "C" fn write_trampoline<W: std::io::Write>(
+    ctx: *mut std::ffi::c_void,
+    s: *const std::ffi::c_void,
+    n: usize,
+) -> std::ffi::c_int {
+    let ctx = &mut *ctx.cast::<WriteContext<'_, W>>();
+    let buf = std::slice::from_raw_parts(s.cast::<u8>(), n);
+    let writer = &mut *ctx.writer;
+    match std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| writer.write_all(buf))) {
+        Ok(Ok(())) => 0,
+        Ok(Err(e)) => {
+            let code = e.raw_os_error().unwrap_or(EIO);
+            ctx.error = Some(e);
+            code
+        }
+        Err(_) => {
+            ctx.error = Some(std::io::Error::new(
+                std::io::ErrorKind::Other,
+                "the writer panicked",
+            ));
+            EIO
+        }
+    }
+}
+
+/// `EIO`, reported when an I/O error has no OS error code.
+const EIO: std::ffi::c_int = 5;
+
 /// The final archive.
 /// This structure wraps a buffer allocated by C using `malloc` to avoid a
 /// copy.
@@ -118,6 +177,20 @@ impl Bartleby {
         }
     }
 
+    /// Adds a binary to Bartleby without copying it.
+    ///
+    /// # Safety
+    ///
+    /// `bin` must remain valid and unmodified until `self` is dropped or
+    /// consumed by [`Bartleby::into_archive`], [`Bartleby::write_archive`] or
+    /// [`Bartleby::write_archive_to_fd`].
+    pub unsafe fn add_binary_borrowed(&mut self, bin: &[u8]) -> Result<(), String> {
+        match saq_bartleby_add_binary_borrowed(self.0, bin.as_ptr().cast(), bin.len()) {
+            0 => Ok(()),
+            n => Err(format!("`saq_bartleby_add_binary_borrowed` returned {n}")),
+        }
+    }
+
     /// Builds the final archive.
     pub fn into_archive(mut self) -> Result<Archive, String> {
         let mut out: *mut std::ffi::c_void = std::ptr::null_mut();
@@ -135,4 +208,46 @@ impl Bartleby {
             n => Err(format!("`saq_bartleby_build_archive` returned {n}")),
         }
     }
+
+    /// Builds the final archive and writes it to `writer`.
+    ///
+    /// The archive is written as it is produced, without building it in
+    /// memory first. If `writer` fails, its error is returned as is.
+    pub fn write_archive<W: std::io::Write>(mut self, writer: &mut W) -> std::io::Result<()> {
+        let mut ctx = WriteContext {
+            writer,
+            error: None,
+        };
+        let r = unsafe {
+            saq_bartleby_build_archive_to_writer(
+                self.0,
+                write_trampoline::<W>,
+                (&mut ctx as *mut WriteContext<'_, W>).cast(),
+            )
+        };
+        self.0 = std::ptr::null_mut();
+        if let Some(e) = ctx.error {
+            return Err(e);
+        }
+        match r {
+            0 => ctx.writer.flush(),
+            n => Err(std::io::Error::new(
+                std::io::Error::from_raw_os_error(n).kind(),
+                format!("`saq_bartleby_build_archive_to_writer` returned {n}"),
+            )),
+        }
+    }
+
+    /// Builds the final archive and writes it to a file descriptor.
+    ///
+    /// The file descriptor is neither rewound nor closed.
+    #[cfg(unix)]
+    pub fn write_archive_to_fd(mut self, fd: &impl std::os::fd::AsRawFd) -> Result<(), String> {
+        let r = unsafe { saq_bartleby_build_archive_to_fd(self.0, fd.as_raw_fd()) };
+        self.0 = std::ptr::null_mut();
+        match r {
+            0 => Ok(()),
+            n => Err(format!("`saq_bartleby_build_archive_to_fd` returned {n}")),
+        }
+    }
 }
@@ -12,6 +12,12 @@ def _bartleby_impl(ctx):
 
     args = ctx.actions.args()
 
+    # Arguments are passed through a parameter file, as required by
+    # persistent workers. The file is quoted as a shell would, which is what
+    # the tool expects, with or without a worker.
+    args.use_param_file("@%s", use_always = True)
+    args.set_param_file_format("shell")
+
     out_name = "lib{}_bartleby.a".format(ctx.label.name)
     out = ctx.actions.declare_file(out_name)
     args.add("-o", out)
@@ -19,14 +25,43 @@ def _bartleby_impl(ctx):
     if ctx.attr.prefix != None:
         args.add("--prefix", ctx.attr.prefix)
 
+    outputs = [out]
+    rename_map = None
+    if ctx.attr.hash_names:
+        rename_map = ctx.actions.declare_file(
+            "lib{}_bartleby.renames.txt".format(ctx.label.name),
+        )
+        args.add("--hash-names")
+        args.add("--rename-map-file", rename_map)
+        outputs.append(rename_map)
+
+    inputs = list(libs)
+    if ctx.file.rename_policy != None:
+        args.add("--rename-policy", ctx.file.rename_policy)
+        inputs.append(ctx.file.rename_policy)
+    if ctx.attr.roots:
+        args.add_joined("--roots", ctx.attr.roots, join_with = ",")
+    if ctx.file.exports_file != None:
+        args.add("--exports-file", ctx.file.exports_file)
+        inputs.append(ctx.file.exports_file)
+
+    if ctx.attr.duplicate_members != "keep":
+        args.add("--duplicate-members", ctx.attr.duplicate_members)
+
     for l in libs:
         args.add(l)
 
     ctx.actions.run(
-        outputs = [out],
-        inputs = libs,
+        outputs = outputs,
+        inputs = inputs,
         executable = ctx.executable._bartleby,
         arguments = [args],
+        mnemonic = "Bartleby",
+        progress_message = "Running bartleby on %{label}",
+        execution_requirements = {
+            "supports-workers": "1",
+            "requires-worker-protocol": "json",
+        },
     )
 
     user_link_flags = []
@@ -62,6 +97,7 @@ def _bartleby_impl(ctx):
 
     return [
         DefaultInfo(files = depset([out])),
+        OutputGroupInfo(rename_map = depset([rename_map] if rename_map else [])),
         cc_info,
     ]
 
@@ -69,11 +105,20 @@ def _bartleby_impl(ctx):
 bartleby = rule(
     doc = """Run Bartleby on a set of libraries.
 
-This outputs a target that provides a [`CcInfo`](https://bazel.build/rules/lib/CcInfo) provider.""",
+This outputs a target that provides a [`CcInfo`](https://bazel.build/rules/lib/CcInfo) provider.
+
+The action supports persistent workers, using the JSON worker protocol. Use
+`--strategy=Bartleby=worker` to keep bartleby processes alive across actions,
+so that libraries shared by several targets are only mapped and scanned once.""",
     implementation = _bartleby_impl,
     attrs = {
         "srcs": attr.label_list(mandatory = True, doc = "Libraries to give to bartleby. These targets have to provide a [`CcInfo`](https://bazel.build/rules/lib/CcInfo) provider."),
         "prefix": attr.string(mandatory = False, doc = "Prefix to apply to library's symbols"),
+        "hash_names": attr.bool(default = False, doc = "Rename symbols into `prefix` followed by a short hash of their name, instead of prefixing them. The map of the renamed symbols is available in the `rename_map` output group."),
+        "rename_policy": attr.label(mandatory = False, allow_single_file = True, doc = "Policy file selecting the symbols to prefix, made of keep/rename rules. Requires `prefix`."),
+        "roots": attr.string_list(mandatory = False, doc = "Symbols to keep the library members reachable from. Unreachable members are dropped."),
+        "exports_file": attr.label(mandatory = False, allow_single_file = True, doc = "File listing symbols to keep the library members reachable from, one per line. Unreachable members are dropped."),
+        "duplicate_members": attr.string(default = "keep", values = ["keep", "share", "collapse"], doc = "How library members identical to a previous one are handled: `keep` processes and emits every copy, `share` processes them once and emits every copy, `collapse` processes and emits them once."),
         "_bartleby": attr.label(
             doc = "bartleby tool",
             executable = True,